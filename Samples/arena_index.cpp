@@ -0,0 +1,122 @@
+//////////////////////////////////////////////////////////////////////
+// MMapper arena_index -- indexing a mapped file with std::pmr + KFS::Arena.
+// Author: Oliver "kfsone" Smith 2018 <oliver@kfs.org>
+// Redistribution and re-use fully permitted contingent on inclusion of these 3 lines in copied- or derived- works.
+//////////////////////////////////////////////////////////////////////
+// Usage:
+//
+//  arena_index <filename> [passes]
+//
+// Builds a line index (vector of string_views) and a word-count table
+// (unordered_map of string_view -> count) over a mapped text file,
+// 'passes' times, first with the default allocator and then with an
+// ArenaResource that is reset() between passes. The index entries point
+// into the mapping, so the only allocations are the containers' own.
+
+
+#include "mmapper.h"
+#include "arenaresource.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <memory_resource>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+
+template<typename... Args>
+void die(const char* reason, Args&&... args)
+{
+	std::cerr << "ERROR: " << reason;
+	((std::cerr << args), ...);
+	std::cerr << std::endl;
+	exit(1);
+}
+
+
+struct IndexStats
+{
+	size_t	lines{ 0 };
+	size_t	distinctWords{ 0 };
+};
+
+static IndexStats buildIndex(const KFS::MMappedFile& mf, std::pmr::memory_resource* resource)
+{
+	std::pmr::vector<std::string_view> lines(resource);
+	std::pmr::unordered_map<std::string_view, uint32_t> words(resource);
+
+	const char* const end = mf.end();
+	const char* lineStart = mf.begin();
+	const char* wordStart = nullptr;
+	for (const char* ptr = mf.begin(); ptr < end; ++ptr)
+	{
+		const char c = *ptr;
+		const bool isWord = (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_';
+		if (isWord && !wordStart)
+			wordStart = ptr;
+		else if (!isWord && wordStart)
+		{
+			++words[std::string_view(wordStart, size_t(ptr - wordStart))];
+			wordStart = nullptr;
+		}
+		if (c == '\n')
+		{
+			lines.emplace_back(lineStart, size_t(ptr - lineStart));
+			lineStart = ptr + 1;
+		}
+	}
+	if (wordStart)
+		++words[std::string_view(wordStart, size_t(end - wordStart))];
+	if (lineStart < end)
+		lines.emplace_back(lineStart, size_t(end - lineStart));
+
+	return IndexStats{ lines.size(), words.size() };
+}
+
+
+template<typename Fn>
+static double timePasses(int passes, Fn&& fn)
+{
+	const auto start = std::chrono::steady_clock::now();
+	for (int pass = 0; pass < passes; ++pass)
+		fn();
+	return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() / passes;
+}
+
+
+int main(int argc, const char* const argv[])
+{
+	if (argc < 2)
+		die("Usage: ", argv[0], " <filename> [passes]");
+	const int passes = argc > 2 ? std::max(atoi(argv[2]), 1) : 5;
+
+	KFS::MMappedFile mf(argv[1]);
+	if (!mf.isMapped())
+		die("Unable to map ", argv[1]);
+
+	IndexStats stats;
+	const double mallocMs = timePasses(passes, [&] {
+		stats = buildIndex(mf, std::pmr::new_delete_resource());
+	});
+
+	KFS::Arena arena;
+	if (!arena.isValid())
+		die("Unable to reserve an arena");
+	KFS::ArenaResource resource(arena);
+	size_t peak = 0;
+	const double arenaMs = timePasses(passes, [&] {
+		stats = buildIndex(mf, &resource);
+		peak = std::max(peak, arena.bytesUsed());
+		arena.reset();
+	});
+
+	std::cout << argv[1] << ": " << mf.size() << " bytes, " << stats.lines << " lines, " << stats.distinctWords << " distinct words\n"
+			  << "new/delete: " << mallocMs << " ms/pass\n"
+			  << "arena:      " << arenaMs << " ms/pass (" << peak / 1024 << "KB used, "
+			  << arena.bytesCommitted() / 1024 << "KB committed)\n";
+
+	return 0;
+}
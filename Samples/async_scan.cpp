@@ -0,0 +1,145 @@
+//////////////////////////////////////////////////////////////////////
+// MMapper async_scan -- synchronous mapped scan vs KFS::AsyncChunkStream.
+// Author: Oliver "kfsone" Smith 2018 <oliver@kfs.org>
+// Redistribution and re-use fully permitted contingent on inclusion of these 3 lines in copied- or derived- works.
+//////////////////////////////////////////////////////////////////////
+// C++20. Usage:
+//
+//  async_scan <sync|mmap|read> <file> [<passes> [<chunk MB> [<prefetch>]]]
+//
+// Evicts the file from the page cache, then hashes it 'passes' times
+// (default 1) per chunk - a stand-in for real per-chunk work - and
+// reports throughput and how long the consumer sat waiting for data:
+//
+//  sync: walk the mapping directly, faulting pages in as we go.
+//  mmap: an AsyncChunkStream over the mapping faults the next chunks in
+//        on I/O threads while this one is hashed.
+//  read: an AsyncChunkStream reads the next chunks into buffers.
+
+
+#include "asyncchunks.h"
+#include "filehandle.h"
+#include "mmapper.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+
+template<typename... Args>
+void die(const char* reason, Args&&... args)
+{
+	std::cerr << "ERROR: " << reason;
+	(std::cerr << ... << args);
+	std::cerr << std::endl;
+	exit(1);
+}
+
+
+using Clock = std::chrono::steady_clock;
+
+struct ScanResult
+{
+	uint64_t	hash{ 0 };
+	double		waited{ 0 };	// seconds the consumer spent waiting on next()
+};
+
+
+static uint64_t hashChunk(const char* from, const char* to, uint64_t hash, size_t passes)
+{
+	for (size_t pass = 0; pass < passes; ++pass)
+	{
+		const char* at = from;
+		for ( ; at + 8 <= to; at += 8)
+		{
+			uint64_t word;
+			memcpy(&word, at, 8);
+			hash = (hash ^ word) * 0x100000001b3ULL;
+		}
+		for ( ; at < to; ++at)
+			hash = (hash ^ uint8_t(*at)) * 0x100000001b3ULL;
+	}
+	return hash;
+}
+
+
+static KFS::AsyncTask<ScanResult> scan(KFS::AsyncChunkStream& stream, size_t passes)
+{
+	ScanResult result;
+	for (;;)
+	{
+		const auto asked = Clock::now();
+		const std::optional<KFS::Chunk> chunk = co_await stream.next();
+		result.waited += std::chrono::duration<double>(Clock::now() - asked).count();
+		if (!chunk)
+			break;
+		result.hash = hashChunk(chunk->begin, chunk->end, result.hash, passes);
+	}
+	co_return result;
+}
+
+
+int main(int argc, const char* const argv[])
+{
+	if (argc < 3)
+		die("Usage: ", argv[0], " <sync|mmap|read> <file> [<passes> [<chunk MB> [<prefetch>]]]");
+	const std::string mode = argv[1];
+	const char* const filename = argv[2];
+	if (mode != "sync" && mode != "mmap" && mode != "read")
+		die("Unknown mode: ", mode);
+	const size_t passes = argc > 3 ? size_t(atoll(argv[3])) : 1;
+	KFS::AsyncChunkOptions options;
+	if (argc > 4)
+		options.chunkSize = size_t(atoll(argv[4])) * 1024 * 1024;
+	if (argc > 5)
+		options.prefetch = size_t(atoll(argv[5]));
+
+	KFS::FileHandle handle(filename);
+	if (!handle.isValid())
+		die("Unable to open ", filename);
+	// Start cold, so every mode reads from disk.
+	handle.advise(0, 0, KFS::AccessPattern::DontNeed);
+
+	KFS::MMappedFile file(filename);
+	if (mode != "read" && !file.isMapped())
+		die("Unable to map ", filename);
+
+	ScanResult result;
+	const uint64_t size = handle.metadata().size;
+	const auto start = Clock::now();
+	if (mode == "sync")
+	{
+		// Same chunks as the streams, so the hashes agree.
+		for (const char* from = file.begin(); from < file.end(); )
+		{
+			const char* const to = from + std::min<size_t>(options.chunkSize, size_t(file.end() - from));
+			result.hash = hashChunk(from, to, result.hash, passes);
+			from = to;
+		}
+	}
+	else if (mode == "mmap")
+	{
+		KFS::AsyncChunkStream stream(file, options);
+		result = KFS::syncWait(scan(stream, passes));
+	}
+	else
+	{
+		KFS::AsyncChunkStream stream(handle, options);
+		result = KFS::syncWait(scan(stream, passes));
+		if (stream.error() != 0)
+			die("Read failed: ", strerror(stream.error()));
+	}
+	const std::chrono::duration<double> elapsed = Clock::now() - start;
+
+	constexpr double MB = 1024.0 * 1024.0;
+	std::cout << mode << ": hash " << std::hex << result.hash << std::dec << ", " << size / MB << " MB in "
+			  << elapsed.count() << "s (" << size / MB / elapsed.count() << " MB/s)";
+	if (mode != "sync")
+		std::cout << ", waited " << result.waited << "s for data";
+	std::cout << "\n";
+	return 0;
+}
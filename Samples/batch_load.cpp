@@ -0,0 +1,121 @@
+//////////////////////////////////////////////////////////////////////
+// MMapper batch_load -- KFS::BatchLoader against one-file-at-a-time loading.
+// Author: Oliver "kfsone" Smith 2018 <oliver@kfs.org>
+// Redistribution and re-use fully permitted contingent on inclusion of these 3 lines in copied- or derived- works.
+//////////////////////////////////////////////////////////////////////
+// Usage:
+//
+//  batch_load <directory> [<repeats>]
+//
+// Loads every regular file under 'directory' (recursively) 'repeats'
+// times with MMappedFile, with BatchLoader's thread pool and with
+// BatchLoader's io_uring pipeline (where available), checksumming the
+// contents, and reports files/second for each.
+
+
+#include "batchloader.h"
+#include "mmapper.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <filesystem>
+#include <iostream>
+#include <string>
+#include <vector>
+
+
+template<typename... Args>
+void die(const char* reason, Args&&... args)
+{
+	std::cerr << "ERROR: " << reason;
+	(std::cerr << ... << args);
+	std::cerr << std::endl;
+	exit(1);
+}
+
+
+static uint64_t checksum(const char* from, const char* to)
+{
+	uint64_t sum = 0;
+	for ( ; from < to; ++from)
+		sum += static_cast<unsigned char>(*from);
+	return sum;
+}
+
+
+template<typename Fn>
+static void timed(const char* label, size_t files, int repeats, Fn&& fn)
+{
+	const auto start = std::chrono::steady_clock::now();
+	uint64_t sum = 0;
+	size_t loaded = 0;
+	for (int repeat = 0; repeat < repeats; ++repeat)
+		fn(sum, loaded);
+	const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+	std::cout << label << double(files) * repeats / elapsed.count() << " files/s ("
+			  << loaded / repeats << " loaded), checksum " << sum << "\n";
+}
+
+
+int main(int argc, const char* const argv[])
+{
+	if (argc < 2)
+		die("Usage: ", argv[0], " <directory> [<repeats>]");
+	const int repeats = argc > 2 ? std::max(atoi(argv[2]), 1) : 3;
+
+	std::vector<std::string> files;
+	for (const auto& entry : std::filesystem::recursive_directory_iterator(argv[1], std::filesystem::directory_options::skip_permission_denied))
+	{
+		std::error_code ec;
+		if (entry.is_regular_file(ec))
+			files.push_back(entry.path().string());
+	}
+	if (files.empty())
+		die("No files under ", argv[1]);
+	std::cout << files.size() << " files\n";
+
+	timed("MMappedFile:         ", files.size(), repeats, [&](uint64_t& sum, size_t& loaded) {
+		for (const std::string& filename : files)
+		{
+			KFS::MMappedFile file;
+			if (file.mapFile(filename))
+			{
+				sum += checksum(file.begin(), file.end());
+				++loaded;
+			}
+			// Empty files can't be mapped, but they did load.
+			else if (std::filesystem::is_empty(filename))
+				++loaded;
+		}
+	});
+
+	KFS::BatchLoaderOptions options;
+	options.allowUring = false;
+	KFS::BatchLoader threads(options);
+	timed("BatchLoader threads: ", files.size(), repeats, [&](uint64_t& sum, size_t& loaded) {
+		std::atomic<uint64_t> total{ 0 };
+		loaded += threads.load(files, [&](const KFS::LoadedFile& file) {
+			if (file.data)
+				total += checksum(file.data, file.data + file.size);
+		});
+		sum += total;
+	});
+
+	KFS::BatchLoader uring;
+	if (!uring.usingUring())
+	{
+		std::cout << "io_uring is not available here\n";
+		return 0;
+	}
+	timed("BatchLoader io_uring:", files.size(), repeats, [&](uint64_t& sum, size_t& loaded) {
+		loaded += uring.load(files, [&](const KFS::LoadedFile& file) {
+			if (file.data)
+				sum += checksum(file.data, file.data + file.size);
+		});
+	});
+
+	return 0;
+}
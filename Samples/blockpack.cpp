@@ -0,0 +1,169 @@
+//////////////////////////////////////////////////////////////////////
+// MMapper blockpack -- convert files to/from block containers and
+// benchmark reading them against a plain mapping.
+// Author: Oliver "kfsone" Smith 2018 <oliver@kfs.org>
+// Redistribution and re-use fully permitted contingent on inclusion of these 3 lines in copied- or derived- works.
+//////////////////////////////////////////////////////////////////////
+// Command line only, usage:
+//
+//  blockpack pack <input> <output.kblk> [blockSizeKB]
+//  blockpack unpack <input.kblk> <output>
+//  blockpack bench <input> <input.kblk> [randomReads]
+//
+// 'bench' checksums the whole file through MMappedFile and through
+// BlockCompressedFile::span(), then performs the same set of random 4KB
+// reads through both, reporting throughput for each.
+
+
+#include "mmapper.h"
+#include "blockcontainer.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <vector>
+
+#include "../3rdParty/xxhash.hpp"
+
+
+template<typename... Args>
+void die(const char* reason, Args&&... args)
+{
+	std::cerr << "ERROR: " << reason;
+	((std::cerr << args), ...);
+	std::cerr << std::endl;
+	exit(1);
+}
+
+
+using Clock = std::chrono::steady_clock;
+
+static double secondsSince(Clock::time_point start)
+{
+	return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+static void report(const char* what, size_t bytes, double seconds, uint64_t checksum)
+{
+	std::cout << what << ": " << bytes << " bytes in " << seconds << "s, "
+			  << (seconds > 0 ? bytes / seconds / (1024 * 1024) : 0) << " MB/s, checksum "
+			  << std::hex << checksum << std::dec << "\n";
+}
+
+
+int main(int argc, const char* const argv[])
+{
+	if (argc < 4)
+		die("Usage: ", argv[0], " {pack <input> <output.kblk> [blockSizeKB] | unpack <input.kblk> <output> | bench <input> <input.kblk> [randomReads]}");
+
+	const char* const mode = argv[1];
+	if (strcmp(mode, "pack") == 0)
+	{
+		const uint32_t blockSize = argc > 4 ? uint32_t(atoi(argv[4])) * 1024 : KFS::c_defaultContainerBlockSize;
+		KFS::MMappedFile input(argv[2]);
+		if (!input.isMapped())
+			die("Failed to map ", argv[2]);
+
+		const auto start = Clock::now();
+		if (!KFS::writeBlockContainer(argv[3], input, blockSize))
+			die("Failed to write ", argv[3]);
+		const double seconds = secondsSince(start);
+
+		KFS::BlockCompressedFile packed(argv[3]);
+		std::cout << argv[3] << ": " << input.size() << " -> " << packed.storedSize() << " bytes ("
+				  << double(input.size()) / packed.storedSize() << "x) in " << seconds << "s\n";
+	}
+	else if (strcmp(mode, "unpack") == 0)
+	{
+		KFS::BlockCompressedFile packed(argv[2]);
+		if (!packed.isOpen())
+			die("Not a block container: ", argv[2]);
+
+		std::ofstream out(argv[3], std::ios::binary | std::ios::trunc);
+		for (size_t blockNo = 0; blockNo < packed.blockCount(); ++blockNo)
+		{
+			size_t size;
+			const char* data = packed.block(blockNo, size);
+			if (!data)
+				die("Corrupt block ", blockNo);
+			out.write(data, size);
+		}
+		if (!out)
+			die("Failed writing ", argv[3]);
+	}
+	else if (strcmp(mode, "bench") == 0)
+	{
+		const size_t randomReads = argc > 4 ? size_t(atoll(argv[4])) : 100000;
+
+		KFS::MMappedFile raw(argv[2]);
+		KFS::BlockCompressedFile packed(argv[3]);
+		if (!raw.isMapped() || !packed.isOpen())
+			die("Failed to open inputs");
+		if (raw.size() != packed.size())
+			die("Container doesn't match the raw file size");
+
+		std::cout << "raw " << raw.size() << " bytes, container " << packed.storedSize() << " bytes in "
+				  << packed.blockCount() << " blocks of " << packed.blockSize() << "\n";
+
+		// Sequential scans.
+		{
+			const auto start = Clock::now();
+			const uint64_t digest = xxh::xxhash<64>(raw.begin(), raw.size());
+			report("sequential mmap     ", raw.size(), secondsSince(start), digest);
+		}
+		{
+			const auto start = Clock::now();
+			xxh::hash_state_t<64> state;
+			for (size_t offset = 0, available; offset < packed.size(); offset += available)
+			{
+				const char* data = packed.span(offset, available);
+				if (!data)
+					die("Corrupt block at offset ", offset, " of ", argv[3]);
+				state.update(data, available);
+			}
+			report("sequential container", packed.size(), secondsSince(start), state.digest());
+		}
+
+		// Random 4KB reads, same offsets for both.
+		constexpr size_t readSize = 4096;
+		if (raw.size() > readSize)
+		{
+			std::mt19937_64 rng{ 42 };
+			std::uniform_int_distribution<size_t> pick(0, raw.size() - readSize);
+			std::vector<size_t> offsets(randomReads);
+			for (size_t& offset : offsets)
+				offset = pick(rng);
+
+			std::vector<char> buffer(readSize);
+			{
+				uint64_t sum = 0;
+				const auto start = Clock::now();
+				for (size_t offset : offsets)
+				{
+					memcpy(buffer.data(), raw.begin() + offset, readSize);
+					sum += uint8_t(buffer[offset % readSize]);
+				}
+				report("random 4K mmap      ", randomReads * readSize, secondsSince(start), sum);
+			}
+			{
+				uint64_t sum = 0;
+				const auto start = Clock::now();
+				for (size_t offset : offsets)
+				{
+					packed.read(buffer.data(), readSize, offset);
+					sum += uint8_t(buffer[offset % readSize]);
+				}
+				report("random 4K container ", randomReads * readSize, secondsSince(start), sum);
+			}
+		}
+	}
+	else
+	{
+		die("Unknown mode: ", mode, ". Expecting 'pack', 'unpack' or 'bench'");
+	}
+
+	return 0;
+}
@@ -0,0 +1,114 @@
+//////////////////////////////////////////////////////////////////////
+// MMapper cdc_delta -- chunk-level delta between two files with KFS::CdcChunker.
+// Author: Oliver "kfsone" Smith 2018 <oliver@kfs.org>
+// Redistribution and re-use fully permitted contingent on inclusion of these 3 lines in copied- or derived- works.
+//////////////////////////////////////////////////////////////////////
+// Command line only, usage:
+//
+//  cdc_delta <old file> <new file> [<average chunk KB>]
+//
+// Works out what would have to be sent to turn 'old' into 'new' when
+// both sides hold chunk digests: new chunks whose digest 'old' already
+// has are references, the rest are sent. Does it with content-defined
+// chunks and, for comparison, with fixed-size blocks of the average
+// chunk size, which an insertion near the start throws out of step for
+// the rest of the file.
+
+
+#include "mmapper.h"
+#include "cdcchunker.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <unordered_set>
+#include <vector>
+
+#include "../3rdParty/xxhash.hpp"
+
+
+template<typename... Args>
+void die(const char* reason, Args&&... args)
+{
+	std::cerr << "ERROR: " << reason;
+	(std::cerr << ... << args);
+	std::cerr << std::endl;
+	exit(1);
+}
+
+
+using Clock = std::chrono::steady_clock;
+constexpr double MB = 1024.0 * 1024.0;
+
+
+static std::vector<KFS::CdcChunk> fixedBlocks(const KFS::MMappedFile& file, uint64_t blockSize)
+{
+	std::vector<KFS::CdcChunk> blocks;
+	for (uint64_t offset = 0; offset < file.size(); offset += blockSize)
+	{
+		const uint64_t size = std::min<uint64_t>(blockSize, file.size() - offset);
+		blocks.push_back(KFS::CdcChunk{ offset, size, xxh::xxhash<64>(file.begin() + offset, size_t(size)) });
+	}
+	return blocks;
+}
+
+
+static void report(const char* method, const std::vector<KFS::CdcChunk>& oldChunks, const std::vector<KFS::CdcChunk>& newChunks)
+{
+	std::unordered_set<uint64_t> have;
+	have.reserve(oldChunks.size());
+	for (const KFS::CdcChunk& chunk : oldChunks)
+		have.insert(chunk.digest);
+
+	uint64_t sendBytes = 0, newBytes = 0;
+	size_t sendChunks = 0;
+	for (const KFS::CdcChunk& chunk : newChunks)
+	{
+		newBytes += chunk.size;
+		if (have.count(chunk.digest) == 0)
+		{
+			sendBytes += chunk.size;
+			++sendChunks;
+		}
+	}
+	std::cout << method << ": " << newChunks.size() << " chunks, " << sendChunks << " to send: "
+			  << sendBytes / MB << " of " << newBytes / MB << " MB ("
+			  << (newBytes ? 100.0 * sendBytes / newBytes : 0.0) << "%)\n";
+}
+
+
+int main(int argc, const char* const argv[])
+{
+	if (argc < 3)
+		die("Usage: ", argv[0], " <old file> <new file> [<average chunk KB>]");
+
+	KFS::MMappedFile oldFile(argv[1]);
+	if (!oldFile.isMapped())
+		die("Could not map ", argv[1]);
+	KFS::MMappedFile newFile(argv[2]);
+	if (!newFile.isMapped())
+		die("Could not map ", argv[2]);
+
+	KFS::CdcOptions options;
+	if (argc > 3)
+	{
+		options.avgSize = size_t(atoll(argv[3])) * 1024;
+		options.minSize = options.avgSize / 4;
+		options.maxSize = options.avgSize * 4;
+	}
+	const KFS::CdcChunker chunker(options);
+
+	const auto start = Clock::now();
+	const std::vector<KFS::CdcChunk> oldChunks = chunker.chunk(oldFile);
+	const std::vector<KFS::CdcChunk> newChunks = chunker.chunk(newFile);
+	const std::chrono::duration<double> elapsed = Clock::now() - start;
+	std::cout << "Chunked " << (oldFile.size() + newFile.size()) / MB << " MB in " << elapsed.count() << "s ("
+			  << (oldFile.size() + newFile.size()) / MB / elapsed.count() << " MB/s), average chunk "
+			  << chunker.options().avgSize / 1024 << " KB\n";
+
+	report("content-defined", oldChunks, newChunks);
+	const uint64_t blockSize = chunker.options().avgSize;
+	report("fixed blocks", fixedBlocks(oldFile, blockSize), fixedBlocks(newFile, blockSize));
+	return 0;
+}
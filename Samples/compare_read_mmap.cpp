@@ -2,11 +2,21 @@
 //
 // This is a linux-only demonstration/test of mmap vs read.
 // It takes two arguments:
-//  mmaptest {read | mmap} <filename>
+//  mmaptest {read | pread | mmap | mmap-prefetch | pmmap} <filename> [cold]
 //
 // It will then open the file and create a "checksum" of all the
 // bytes in the file using either the normal read() method (with
-// a small, 256 byte buffer) or using the mmap() alternative.
+// a small, 256 byte buffer), a tuned read path (FileHandle::readAt
+// with large buffers and sequential readahead), using the mmap()
+// alternative, mmap() with a KFS::Prefetcher faulting pages in ahead
+// of the hash, or mmap() with the hashing split across threads.
+//
+// 'cold' drops the file from the page cache first, so the mode has to
+// read it from disk; that's where mmap-prefetch pulls ahead of mmap.
+//
+// pmmap can't feed one hash stream from several threads, so its
+// checksum chains the hashes of each 8MB of the file, and won't
+// match the other modes'.
 //
 // Recommend you do something like time mmaptest read file; time mmaptest mmapfile
 // But give it a BIG file.
@@ -14,16 +24,20 @@
 // Don't need Microsoft warnings about ISO names for this demonstration.
 #define _CRT_SECURE_NO_WARNINGS
 
+#include <algorithm>
 #include <cstdint>
 #include <cstdio>
 #include <cstring>
 #include <iostream>
 #include <iomanip>
+#include <vector>
 
 #include <fcntl.h>
 
 #include "mmapper.h"
 #include "filehandle.h"
+#include "parallelchunks.h"
+#include "prefetcher.h"
 
 
 #if defined(WIN32) && defined(_MSC_VER)
@@ -66,25 +80,64 @@ void die(const char* reason, Args&&... args)
 
 int main(int argc, const char* const argv[])
 {
-	if ( argc != 3 )
-		die("Usage: ", argv[0], " {read | mmap} <filename>");
+	if ( argc != 3 && !(argc == 4 && strcmp(argv[3], "cold") == 0) )
+		die("Usage: ", argv[0], " {read | pread | mmap | mmap-prefetch | pmmap} <filename> [cold]");
 
 	const char* mode = argv[1];
-	bool useMmap;
+	bool useMmap = false, usePread = false, useParallel = false, usePrefetch = false;
 	if ( strcmp(mode, "read") == 0 )
 		useMmap = false;
+	else if ( strcmp(mode, "pread") == 0 )
+		usePread = true;
 	else if ( strcmp(mode, "mmap") == 0 )
 		useMmap = true;
+	else if ( strcmp(mode, "mmap-prefetch") == 0 )
+		useMmap = usePrefetch = true;
+	else if ( strcmp(mode, "pmmap") == 0 )
+		useMmap = useParallel = true;
 	else
-		die("Unknown mode: ", argv[1], ". Expecting 'read' or 'mmap'");
+		die("Unknown mode: ", argv[1], ". Expecting 'read', 'pread', 'mmap', 'mmap-prefetch' or 'pmmap'");
 
 	// We calculate a checksum either way.
 	const char* filename = argv[2];
+	if (argc == 4)
+	{
+		KFS::FileHandle fh(filename);
+		if (!fh.isValid() || !fh.advise(0, 0, KFS::AccessPattern::DontNeed))
+			die("Could not drop ", filename, " from the page cache");
+	}
 	uint64_t checksum{ 0 };
 	uint64_t size{0};
 
 	xxh::hash_state_t<64> hash_stream;
-	if (!useMmap)  // I put this there to show you what the normal pattern is first.
+	if (usePread)
+	{
+		////////// Tuned READ Code //////////
+		// What read() looks like done properly: big buffers (a
+		// multiple of the file system's preferred block size), and
+		// telling the OS we'll read sequentially so it reads ahead
+		// further.
+		KFS::FileHandle fh(filename);
+		if (!fh.isValid())
+			die("Could not open file", filename);
+		const KFS::FileMetadata& meta = fh.metadata();
+		size = meta.size;
+		if (size <= 0)
+			die("File is 0 bytes long.");
+		fh.advise(0, 0, KFS::AccessPattern::Sequential);
+
+		const size_t blockSize = std::max<size_t>(meta.blockSize, 4096);
+		std::vector<char> buffer(std::max<size_t>(blockSize, 1024 * 1024) / blockSize * blockSize);
+		for (uint64_t offset = 0; offset < size; )
+		{
+			const ptrdiff_t bytesRead = fh.readAt(buffer.data(), buffer.size(), offset);
+			if ( bytesRead <= 0 )
+				break;
+			hash_stream.update(buffer.data(), size_t(bytesRead));
+			offset += uint64_t(bytesRead);
+		}
+	}
+	else if (!useMmap)  // I put this there to show you what the normal pattern is first.
 	{
 		////////// READ Code //////////
 		// The right buffer size can make a huge difference to the
@@ -150,18 +203,49 @@ int main(int argc, const char* const argv[])
 		if (!mf.isMapped())
 			die("Failed to map file");
 
-		// That's it. We can pass the entire file to the function
-		// and the OS will worry about paging/loading the file as
-		// required.
-		//
-		// The OS may even be able to make memory-management
-		// decisions for us based on our usage patterns.
-		hash_stream.update(mf.begin(), mf.size());
+		if (useParallel)
+		{
+			// Hash fixed-size chunks (so the result doesn't depend on
+			// the number of cores) on every core, then chain the chunk
+			// hashes in file order.
+			KFS::ChunkOptions options;
+			options.chunkSize = 8 * 1024 * 1024;
+			checksum = KFS::parallelReduceChunks(mf,
+				[](const KFS::Chunk& chunk) { return xxh::xxhash<64>(chunk.begin, chunk.size()); },
+				uint64_t{ 0 },
+				[](uint64_t sofar, xxh::hash_t<64> chunkHash) { return xxh::xxhash<64>(reinterpret_cast<const char*>(&chunkHash), sizeof(chunkHash), sofar); },
+				options);
+		}
+		else if (usePrefetch)
+		{
+			// A fast hash outruns the kernel's readahead and ends up
+			// waiting on page faults. Tell a prefetcher how far we've
+			// got as we go, and it faults the pages ahead of us in from
+			// another thread.
+			KFS::Prefetcher prefetcher(mf);
+			static const size_t Step = 1024 * 1024;
+			for (size_t offset = 0; offset < mf.size(); offset += Step)
+			{
+				const size_t length = std::min(Step, mf.size() - offset);
+				hash_stream.update(mf.begin() + offset, length);
+				prefetcher.publish(offset + length);
+			}
+		}
+		else
+		{
+			// That's it. We can pass the entire file to the function
+			// and the OS will worry about paging/loading the file as
+			// required.
+			//
+			// The OS may even be able to make memory-management
+			// decisions for us based on our usage patterns.
+			hash_stream.update(mf.begin(), mf.size());
+		}
 
 		size = mf.size();
 	}
 
 	// Try both versions and compare the checksums and the timing.
-	std::cout << filename << ":" << mode << ": size " << size << " bytes, checksum " << std::hex << hash_stream.digest() << "\n";
+	std::cout << filename << ":" << mode << ": size " << size << " bytes, checksum " << std::hex << (useParallel ? checksum : hash_stream.digest()) << "\n";
 }
 
@@ -0,0 +1,125 @@
+//////////////////////////////////////////////////////////////////////
+// MMapper csv_bench -- KFS::CsvTokenizer against a byte-at-a-time parser.
+// Author: Oliver "kfsone" Smith 2018 <oliver@kfs.org>
+// Redistribution and re-use fully permitted contingent on inclusion of these 3 lines in copied- or derived- works.
+//////////////////////////////////////////////////////////////////////
+// Usage:
+//
+//  csv_bench <filename> [tsv] [<threads>]
+//
+// Maps the file and counts its records and fields with a conventional
+// one-byte-at-a-time state machine, with CsvTokenizer at each SIMD level
+// the CPU supports, and with parallelTokenize(), reporting MB/s for each.
+
+
+#include "csvtokenizer.h"
+#include "mmapper.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+
+template<typename... Args>
+void die(const char* reason, Args&&... args)
+{
+	std::cerr << "ERROR: " << reason;
+	(std::cerr << ... << args);
+	std::cerr << std::endl;
+	exit(1);
+}
+
+
+template<typename Fn>
+static void timed(const char* label, size_t bytes, Fn&& fn)
+{
+	// Best of three.
+	double best = 0;
+	size_t records = 0, fields = 0;
+	for (int run = 0; run < 3; ++run)
+	{
+		const auto start = std::chrono::steady_clock::now();
+		records = fields = 0;
+		fn(records, fields);
+		const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+		best = std::max(best, bytes / elapsed.count() / (1024 * 1024));
+	}
+	std::cout << label << best << " MB/s (" << records << " records, " << fields << " fields)\n";
+}
+
+
+// What a hand-written parser usually looks like.
+static void naive(const char* p, const char* end, char delimiter, size_t& records, size_t& fields)
+{
+	bool quoted = false, inRecord = false;
+	for ( ; p < end; ++p)
+	{
+		const char c = *p;
+		if (c == '"')
+			quoted = !quoted;
+		else if (quoted)
+			;
+		else if (c == delimiter)
+			++fields;
+		else if (c == '\n')
+		{
+			++fields;
+			++records;
+			inRecord = false;
+			continue;
+		}
+		inRecord = true;
+	}
+	if (inRecord)
+		++fields, ++records;
+}
+
+
+int main(int argc, const char* const argv[])
+{
+	if (argc < 2)
+		die("Usage: ", argv[0], " <filename> [tsv] [<threads>]");
+	int argNo = 2;
+	const bool tsv = argc > argNo && strcmp(argv[argNo], "tsv") == 0;
+	argNo += tsv;
+	const size_t threads = argc > argNo ? static_cast<size_t>(atoi(argv[argNo])) : 0;
+
+	KFS::MMappedFile file(argv[1]);
+	if (!file.isMapped())
+		die("Couldn't map ", argv[1]);
+	const char delimiter = tsv ? '\t' : ',';
+	// Fault it all in, so we time parsing rather than I/O.
+	{
+		volatile char sink = 0;
+		for (const char* p = file.begin(); p < file.end(); p += 4096)
+			sink = sink + *p;
+	}
+
+	timed("byte-at-a-time:   ", file.size(), [&](size_t& records, size_t& fields) {
+		naive(file.begin(), file.end(), delimiter, records, fields);
+	});
+
+	static const char* const c_names[] = { "scalar masks:     ", "SSE2:             ", "AVX2:             " };
+	KFS::CsvOptions options;
+	options.delimiter = delimiter;
+	for (int simd = 0; simd <= static_cast<int>(KFS::CsvTokenizer::supportedSimd()); ++simd)
+	{
+		options.simd = static_cast<KFS::CsvSimd>(simd);
+		const KFS::CsvTokenizer csv(options);
+		timed(c_names[simd], file.size(), [&](size_t& records, size_t& fields) {
+			records = csv.tokenize(file, [&](const KFS::CsvField*, size_t count) { fields += count; });
+		});
+	}
+
+	const KFS::CsvTokenizer csv(KFS::CsvOptions{ delimiter });
+	timed("parallel:         ", file.size(), [&](size_t& records, size_t& fields) {
+		std::atomic<size_t> total{ 0 };
+		records = csv.parallelTokenize(file, threads, [&](size_t, const KFS::CsvField*, size_t count) { total.fetch_add(count, std::memory_order_relaxed); });
+		fields = total;
+	});
+
+	return 0;
+}
@@ -0,0 +1,113 @@
+//////////////////////////////////////////////////////////////////////
+// MMapper guarded_scan -- surviving a file truncated under a mapping.
+// Author: Oliver "kfsone" Smith 2018 <oliver@kfs.org>
+// Redistribution and re-use fully permitted contingent on inclusion of these 3 lines in copied- or derived- works.
+//////////////////////////////////////////////////////////////////////
+// POSIX only. Usage:
+//
+//  guarded_scan <scratch file> [<MB>]
+//
+// Writes a scratch file, maps it, and sums its bytes inside
+// KFS::GuardedAccess::run() while another thread truncates it to half;
+// the scan reports where it was cut short instead of dying of SIGBUS.
+// Then times guarded and unguarded small reads to show the fast path.
+
+
+#include "guardedaccess.h"
+#include "mmapper.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <unistd.h>
+
+
+template<typename... Args>
+void die(const char* reason, Args&&... args)
+{
+	std::cerr << "ERROR: " << reason;
+	(std::cerr << ... << args);
+	std::cerr << std::endl;
+	exit(1);
+}
+
+
+int main(int argc, const char* const argv[])
+{
+	if (argc < 2)
+		die("Usage: ", argv[0], " <scratch file> [<MB>]");
+	const char* const filename = argv[1];
+	const size_t size = (argc > 2 ? size_t(atoll(argv[2])) : 256) * 1024 * 1024;
+
+	{
+		std::ofstream out(filename, std::ios::binary | std::ios::trunc);
+		const std::vector<char> block(1024 * 1024, 1);
+		for (size_t written = 0; written < size; written += block.size())
+			out.write(block.data(), std::streamsize(block.size()));
+		if (!out)
+			die("Unable to write ", filename);
+	}
+
+	KFS::MMappedFile file(filename);
+	if (!file.isMapped())
+		die("Unable to map ", filename);
+
+	// Truncate once the scan is a quarter of the way in.
+	std::atomic<size_t> progress{ 0 };
+	std::thread truncator([&] {
+		while (progress.load(std::memory_order_relaxed) < size / 4)
+			std::this_thread::yield();
+		if (truncate(filename, off_t(size / 2)) != 0)
+			die("Unable to truncate ", filename);
+		progress.store(size, std::memory_order_relaxed);
+	});
+
+	size_t sum = 0;
+	KFS::GuardedFault fault;
+	const bool completed = KFS::GuardedAccess::run(file, [&] {
+		const char* const begin = file.begin();
+		for (size_t offset = 0; offset < size; ++offset)
+		{
+			sum += size_t(begin[offset]);
+			// Give the truncator a chance, then wait for it.
+			if (offset == size / 4)
+			{
+				progress.store(offset, std::memory_order_relaxed);
+				while (progress.load(std::memory_order_relaxed) != size)
+					std::this_thread::yield();
+			}
+		}
+	}, &fault);
+	truncator.join();
+
+	if (completed)
+		std::cout << "scan completed (no fault?), sum " << sum << "\n";
+	else
+		std::cout << "scan stopped by signal " << fault.code << " at offset "
+				  << static_cast<const char*>(fault.address) - file.begin() << " of " << size << ", sum so far " << sum << "\n";
+
+	// Fast path cost.
+	constexpr size_t calls = 10 * 1000 * 1000;
+	const char* const begin = file.begin();
+	size_t checksum = 0;
+	auto start = std::chrono::steady_clock::now();
+	for (size_t call = 0; call < calls; ++call)
+		checksum += size_t(begin[(call * 4096) % (size / 2)]);
+	const std::chrono::duration<double, std::nano> plain = std::chrono::steady_clock::now() - start;
+	start = std::chrono::steady_clock::now();
+	for (size_t call = 0; call < calls; ++call)
+		KFS::GuardedAccess::run(file, [&] { checksum += size_t(begin[(call * 4096) % (size / 2)]); });
+	const std::chrono::duration<double, std::nano> guarded = std::chrono::steady_clock::now() - start;
+
+	std::cout << "single-byte reads: " << plain.count() / calls << "ns plain, " << guarded.count() / calls << "ns guarded"
+			  << " (checksum " << checksum << ")\n";
+
+	unlink(filename);
+	return 0;
+}
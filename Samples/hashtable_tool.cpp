@@ -0,0 +1,123 @@
+//////////////////////////////////////////////////////////////////////
+// MMapper hash table tool -- build and query KFS::MappedHashTable files.
+// Author: Oliver "kfsone" Smith 2018 <oliver@kfs.org>
+// Redistribution and re-use fully permitted contingent on inclusion of these 3 lines in copied- or derived- works.
+//////////////////////////////////////////////////////////////////////
+// Command line only, usage:
+//
+//  hashtable_tool build <input.tsv> <output.kht>
+//  hashtable_tool get <table.kht> <key1> [... <keyN>]
+//  hashtable_tool bench <table.kht> <input.tsv>
+//
+// The input is one "key<TAB>value" pair per line; lines without a tab
+// are ignored. 'bench' times opening the table and then looks up every
+// key in the input file.
+
+
+#include "mmapper.h"
+#include "mappedhashtable.h"
+
+#include <chrono>
+#include <cstring>
+#include <iostream>
+
+
+template<typename... Args>
+void die(const char* reason, Args&&... args)
+{
+	std::cerr << "ERROR: " << reason;
+	(std::cerr << ... << args);
+	std::cerr << std::endl;
+	exit(1);
+}
+
+
+//////////////////////////////////////////////////////////////////////
+// Call fn(key, keyLen, value, valueLen) for each line of a tsv file.
+
+template<typename Fn>
+size_t forEachPair(const char* filename, Fn&& fn)
+{
+	KFS::MMappedFile mf(filename);
+	if (!mf.isMapped())
+		die("Could not map ", filename);
+
+	size_t pairs = 0;
+	for (const char* line = mf.begin(); line < mf.end(); )
+	{
+		const char* eol = static_cast<const char*>(memchr(line, '\n', mf.end() - line));
+		if (!eol)
+			eol = mf.end();
+		const char* tab = static_cast<const char*>(memchr(line, '\t', eol - line));
+		if (tab)
+		{
+			const char* valueEnd = (eol > tab + 1 && eol[-1] == '\r') ? eol - 1 : eol;
+			fn(line, size_t(tab - line), tab + 1, size_t(valueEnd - tab - 1));
+			++pairs;
+		}
+		line = eol + 1;
+	}
+	return pairs;
+}
+
+
+int main(int argc, const char* const argv[])
+{
+	using clock = std::chrono::steady_clock;
+
+	if (argc < 4)
+		die("Usage: ", argv[0], " {build <input.tsv> <output.kht> | get <table.kht> <key>... | bench <table.kht> <input.tsv>}");
+
+	const char* const mode = argv[1];
+	if (strcmp(mode, "build") == 0)
+	{
+		KFS::MappedHashTableBuilder builder;
+		const size_t pairs = forEachPair(argv[2], [&](const char* key, size_t keyLen, const char* value, size_t valueLen) {
+			builder.add(key, keyLen, value, valueLen);
+		});
+		if (!builder.write(argv[3]))
+			die("Failed to write ", argv[3]);
+		std::cout << argv[3] << ": " << pairs << " pairs\n";
+	}
+	else if (strcmp(mode, "get") == 0)
+	{
+		KFS::MappedHashTable table(argv[2]);
+		if (!table.isOpen())
+			die("Not a usable hash table: ", argv[2]);
+		for (int argNo = 3; argNo < argc; ++argNo)
+		{
+			const KFS::HashTableValue value = table.find(argv[argNo], strlen(argv[argNo]));
+			if (value)
+				std::cout << argv[argNo] << "\t" << std::string(value.data, value.size) << "\n";
+			else
+				std::cout << argv[argNo] << ": not found\n";
+		}
+	}
+	else if (strcmp(mode, "bench") == 0)
+	{
+		const auto openStart = clock::now();
+		KFS::MappedHashTable table(argv[2]);
+		const auto openEnd = clock::now();
+		if (!table.isOpen())
+			die("Not a usable hash table: ", argv[2]);
+
+		size_t found = 0;
+		const auto lookupStart = clock::now();
+		const size_t pairs = forEachPair(argv[3], [&](const char* key, size_t keyLen, const char*, size_t) {
+			found += table.contains(key, keyLen) ? 1 : 0;
+		});
+		const auto lookupEnd = clock::now();
+
+		const double openUs = std::chrono::duration<double, std::micro>(openEnd - openStart).count();
+		const double lookupSecs = std::chrono::duration<double>(lookupEnd - lookupStart).count();
+		std::cout << argv[2] << ": " << table.size() << " keys, opened in " << openUs << "us\n"
+				  << "looked up " << pairs << " keys (" << found << " found) in " << lookupSecs << "s, "
+				  << (lookupSecs > 0 ? pairs / lookupSecs : 0) << " lookups/s\n";
+	}
+	else
+	{
+		die("Unknown mode: ", mode, ". Expecting 'build', 'get' or 'bench'");
+	}
+
+	return 0;
+}
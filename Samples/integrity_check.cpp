@@ -0,0 +1,119 @@
+//////////////////////////////////////////////////////////////////////
+// MMapper integrity_check -- build and use KFS::IntegritySidecar files.
+// Author: Oliver "kfsone" Smith 2018 <oliver@kfs.org>
+// Redistribution and re-use fully permitted contingent on inclusion of these 3 lines in copied- or derived- works.
+//////////////////////////////////////////////////////////////////////
+// Command line only, usage:
+//
+//  integrity_check build <file> [<block KB>]
+//  integrity_check verify <file>
+//  integrity_check lazy <file> [<reads>]
+//
+// The sidecar is <file>.xxb. 'build' hashes the file a block at a time
+// (1MB by default) and writes it. 'verify' checks every block and lists
+// the bad ones. 'lazy' shows what it costs to start using a verified
+// view: it opens one, makes 'reads' (default 1000) random 4KB reads
+// through it while a low-priority sweep checks the rest, and reports
+// how long the reads took and how much of the file they verified.
+
+
+#include "mmapper.h"
+#include "integrity.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+
+
+template<typename... Args>
+void die(const char* reason, Args&&... args)
+{
+	std::cerr << "ERROR: " << reason;
+	(std::cerr << ... << args);
+	std::cerr << std::endl;
+	exit(1);
+}
+
+
+using Clock = std::chrono::steady_clock;
+
+static double secondsSince(Clock::time_point start)
+{
+	return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+
+int main(int argc, const char* const argv[])
+{
+	if (argc < 3)
+		die("Usage: ", argv[0], " {build <file> [<block KB>] | verify <file> | lazy <file> [<reads>]}");
+	const std::string mode = argv[1];
+	const char* const filename = argv[2];
+	const std::string sidecarName = std::string(filename) + ".xxb";
+
+	KFS::MMappedFile data(filename);
+	if (!data.isMapped())
+		die("Could not map ", filename);
+
+	const auto start = Clock::now();
+	if (mode == "build")
+	{
+		const uint64_t blockSize = argc > 3 ? uint64_t(atoll(argv[3])) * 1024 : KFS::IntegritySidecar::c_defaultBlockSize;
+		if (!KFS::IntegritySidecar::write(data, sidecarName, blockSize))
+			die("Could not write ", sidecarName);
+		std::cout << "Wrote " << sidecarName << " in " << secondsSince(start) << "s\n";
+		return 0;
+	}
+
+	KFS::IntegritySidecar sidecar(sidecarName);
+	if (!sidecar.isOpen())
+		die("Could not open ", sidecarName);
+	KFS::VerifiedView view(data, sidecar);
+	if (!view.isValid())
+		die(filename, " is not the size ", sidecarName, " describes");
+
+	if (mode == "verify")
+	{
+		for (size_t blockNo = 0; blockNo < view.blockCount(); ++blockNo)
+			view.verifyBlock(blockNo);
+		for (size_t blockNo : view.corruptBlocks())
+			std::cout << "Block " << blockNo << " (offset " << blockNo * sidecar.blockSize() << ") is corrupt\n";
+		std::cout << view.verifiedCount() << " blocks good, " << view.corruptCount() << " corrupt, in "
+				  << secondsSince(start) << "s\n";
+		return view.corruptCount() == 0 ? 0 : 2;
+	}
+
+	if (mode != "lazy")
+		die("Unknown mode: ", mode);
+
+	const size_t reads = argc > 3 ? size_t(atoll(argv[3])) : 1000;
+	const size_t readSize = std::min<size_t>(4096, view.size());
+	std::mt19937_64 random(42);
+	std::uniform_int_distribution<size_t> offsets(0, view.size() - readSize);
+
+	view.sweep();
+	size_t failed = 0;
+	uint64_t sum = 0;
+	for (size_t read = 0; read < reads; ++read)
+	{
+		const char* const record = view.access(offsets(random), readSize);
+		if (!record)
+		{
+			++failed;
+			continue;
+		}
+		sum += uint8_t(record[0]);
+	}
+	const double readTime = secondsSince(start);
+	std::cout << reads << " reads (" << failed << " hit corrupt blocks, checksum " << sum << ") in " << readTime << "s; "
+			  << view.verifiedCount() << "/" << view.blockCount() << " blocks verified so far\n";
+
+	while (!view.sweepDone() && view.verifiedCount() + view.corruptCount() < view.blockCount())
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	std::cout << "Sweep finished after " << secondsSince(start) << "s: " << view.corruptCount() << " corrupt blocks\n";
+	return view.corruptCount() == 0 ? 0 : 2;
+}
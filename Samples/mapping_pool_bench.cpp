@@ -0,0 +1,126 @@
+//////////////////////////////////////////////////////////////////////
+// MMapper mapping_pool_bench -- MMappedFile vs MappingPool for many short-lived mappings.
+// Author: Oliver "kfsone" Smith 2018 <oliver@kfs.org>
+// Redistribution and re-use fully permitted contingent on inclusion of these 3 lines in copied- or derived- works.
+//////////////////////////////////////////////////////////////////////
+// Usage:
+//
+//  mapping_pool_bench <scratch dir> [max threads [seconds per run [files]]]
+//
+// Writes 'files' small files (1KB..256KB) into the scratch directory,
+// then for 1, 2, 4 ... 'max threads' threads repeatedly maps a file,
+// touches each of its pages and unmaps it - once with MMappedFile and
+// once with a shared MappingPool - and reports mappings per second.
+// The files are removed afterwards.
+
+
+#include "mmapper.h"
+#include "mappingpool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+template<typename... Args>
+void die(const char* reason, Args&&... args)
+{
+	std::cerr << "ERROR: " << reason;
+	(std::cerr << ... << args);
+	std::cerr << std::endl;
+	exit(1);
+}
+
+
+// Touch one byte per page so the mapping is really used.
+template<typename Mapping>
+static uint64_t touchPages(const Mapping& mapping)
+{
+	uint64_t sum = 0;
+	for (const char* ptr = mapping.begin(); ptr < mapping.end(); ptr += 4096)
+		sum += static_cast<unsigned char>(*ptr);
+	return sum;
+}
+
+
+template<typename MapOne>
+static double run(unsigned threads, double seconds, size_t files, MapOne&& mapOne)
+{
+	std::atomic<bool> stop{ false };
+	std::atomic<uint64_t> total{ 0 };
+	static std::atomic<uint64_t> s_sink{ 0 };	// keeps the page touches alive
+	std::vector<std::thread> workers;
+	for (unsigned threadNo = 0; threadNo < threads; ++threadNo)
+	{
+		workers.emplace_back([&, threadNo] {
+			uint64_t count = 0, sum = 0;
+			for (size_t fileNo = threadNo; !stop.load(std::memory_order_relaxed); fileNo = (fileNo + 7) % files, ++count)
+				sum += mapOne(fileNo);
+			total += count;
+			s_sink ^= sum;
+		});
+	}
+	std::this_thread::sleep_for(std::chrono::duration<double>(seconds));
+	stop = true;
+	for (auto& worker : workers)
+		worker.join();
+	return static_cast<double>(total.load()) / seconds;
+}
+
+
+int main(int argc, const char* const argv[])
+{
+	if (argc < 2)
+		die("Usage: ", argv[0], " <scratch dir> [max threads [seconds per run [files]]]");
+	const std::string dir = argv[1];
+	const unsigned maxThreads = argc > 2 ? std::max(atoi(argv[2]), 1) : std::max(std::thread::hardware_concurrency(), 1u);
+	const double seconds = argc > 3 ? atof(argv[3]) : 1.0;
+	const size_t fileCount = argc > 4 ? std::max<size_t>(size_t(atoll(argv[4])), 1) : 256;
+
+	std::vector<std::string> files;
+	for (size_t fileNo = 0; fileNo < fileCount; ++fileNo)
+	{
+		files.push_back(dir + "/mpbench." + std::to_string(fileNo));
+		const size_t size = size_t(1024) << (fileNo % 9);
+		FILE* fp = fopen(files.back().c_str(), "wb");
+		if (!fp)
+			die("Unable to create ", files.back());
+		std::string contents(size, char('a' + fileNo % 26));
+		fwrite(contents.data(), 1, contents.size(), fp);
+		fclose(fp);
+	}
+
+	KFS::MappingPool pool;
+
+	std::cout << std::setw(8) << "threads" << std::setw(16) << "MMappedFile/s" << std::setw(16) << "MappingPool/s" << std::setw(10) << "ratio" << "\n";
+	std::vector<unsigned> threadCounts;
+	for (unsigned threads = 1; threads < maxThreads; threads *= 2)
+		threadCounts.push_back(threads);
+	threadCounts.push_back(maxThreads);
+
+	for (unsigned threads : threadCounts)
+	{
+		const double plain = run(threads, seconds, fileCount, [&](size_t fileNo) {
+			KFS::MMappedFile mf(files[fileNo]);
+			return mf.isMapped() ? touchPages(mf) : 0;
+		});
+		const double pooled = run(threads, seconds, fileCount, [&](size_t fileNo) {
+			KFS::PooledMapping mapping;
+			return pool.map(files[fileNo], mapping) ? touchPages(mapping) : 0;
+		});
+		std::cout << std::setw(8) << threads << std::setw(16) << std::fixed << std::setprecision(0) << plain
+				  << std::setw(16) << pooled << std::setw(10) << std::setprecision(2) << pooled / plain << "\n";
+	}
+
+	pool.flush();
+	for (const auto& file : files)
+		remove(file.c_str());
+	return 0;
+}
@@ -0,0 +1,432 @@
+//////////////////////////////////////////////////////////////////////
+// MMapper mmap_cmp -- parallel, vectorized byte-by-byte file compare.
+// Author: Oliver "kfsone" Smith 2018 <oliver@kfs.org>
+// Redistribution and re-use fully permitted contingent on inclusion of these 3 lines in copied- or derived- works.
+//////////////////////////////////////////////////////////////////////
+// Command line only, usage:
+//
+//  mmap_cmp [-n <ranges>] [-s] [-i scalar|sse2|avx2] <file1> <file2>
+//
+// Maps both files and compares them on every core, 64 bytes at a time
+// with SSE2 or AVX2 compares (the best the CPU has, or no better than
+// -i). Lists the first 'ranges' (default 10) runs of differing bytes
+// with their offsets; without -s it also counts every differing byte,
+// with -s it stops once it has the ranges it needs to list. If one file
+// is shorter, the rest of the longer one counts as a differing range.
+//
+// Exits 0 if the files are identical, 1 if they differ, 2 on error.
+
+
+#include "mmapper.h"
+#include "filehandle.h"
+#include "parallelchunks.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <string>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+# define CMP_X86 1
+# include <immintrin.h>
+#endif
+
+#if defined(_MSC_VER) && !defined(__clang__)
+# include <intrin.h>
+# define CMP_ISA(isa_)
+# define CMP_KERNEL(isa_)
+#else
+# define CMP_ISA(isa_)		__attribute__((target(isa_)))
+# define CMP_KERNEL(isa_)	__attribute__((target(isa_), flatten))
+#endif
+
+
+template<typename... Args>
+void die(const char* reason, Args&&... args)
+{
+	std::cerr << "ERROR: " << reason;
+	(std::cerr << ... << args);
+	std::cerr << std::endl;
+	exit(2);
+}
+
+
+enum class Isa { Scalar, SSE2, AVX2 };
+
+static Isa supportedIsa()
+{
+#if defined(CMP_X86) && defined(_MSC_VER) && !defined(__clang__)
+# if defined(__AVX2__)
+	return Isa::AVX2;
+# elif defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+	return Isa::SSE2;
+# else
+	return Isa::Scalar;
+# endif
+#elif defined(CMP_X86)
+	if (__builtin_cpu_supports("avx2"))
+		return Isa::AVX2;
+	if (__builtin_cpu_supports("sse2"))
+		return Isa::SSE2;
+	return Isa::Scalar;
+#else
+	return Isa::Scalar;
+#endif
+}
+
+
+static inline unsigned lowestBit(uint64_t bits) noexcept
+{
+#if defined(_MSC_VER) && !defined(__clang__) && defined(_M_X64)
+	unsigned long index;
+	_BitScanForward64(&index, bits);
+	return unsigned(index);
+#elif defined(_MSC_VER) && !defined(__clang__)
+	unsigned long index;
+	if (_BitScanForward(&index, static_cast<unsigned long>(bits)))
+		return unsigned(index);
+	_BitScanForward(&index, static_cast<unsigned long>(bits >> 32));
+	return unsigned(index) + 32;
+#else
+	return unsigned(__builtin_ctzll(bits));
+#endif
+}
+
+
+//////////////////////////////////////////////////////////////////////
+// Block compares. same256() is the fast path: are four 64-byte blocks
+// identical? diff64() says which bytes of one block differ (bit n for
+// byte n).
+
+struct ScalarOps
+{
+	static bool same256(const char* a, const char* b) noexcept
+	{
+		return memcmp(a, b, 256) == 0;
+	}
+
+	static uint64_t diff64(const char* a, const char* b) noexcept
+	{
+		uint64_t bits = 0;
+		for (unsigned byte = 0; byte < 64; ++byte)
+			bits |= uint64_t(a[byte] != b[byte]) << byte;
+		return bits;
+	}
+};
+
+#if defined(CMP_X86)
+struct Sse2Ops
+{
+	CMP_ISA("sse2")
+	static bool same256(const char* a, const char* b) noexcept
+	{
+		__m128i any = _mm_setzero_si128();
+		for (unsigned lane = 0; lane < 16; ++lane)
+		{
+			const __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + lane * 16));
+			const __m128i y = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + lane * 16));
+			any = _mm_or_si128(any, _mm_xor_si128(x, y));
+		}
+		return _mm_movemask_epi8(_mm_cmpeq_epi8(any, _mm_setzero_si128())) == 0xffff;
+	}
+
+	CMP_ISA("sse2")
+	static uint64_t diff64(const char* a, const char* b) noexcept
+	{
+		uint64_t same = 0;
+		for (unsigned lane = 0; lane < 4; ++lane)
+		{
+			const __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + lane * 16));
+			const __m128i y = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + lane * 16));
+			same |= uint64_t(static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(x, y)))) << (lane * 16);
+		}
+		return ~same;
+	}
+};
+
+struct Avx2Ops
+{
+	CMP_ISA("avx2")
+	static bool same256(const char* a, const char* b) noexcept
+	{
+		__m256i any = _mm256_setzero_si256();
+		for (unsigned lane = 0; lane < 8; ++lane)
+		{
+			const __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + lane * 32));
+			const __m256i y = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + lane * 32));
+			any = _mm256_or_si256(any, _mm256_xor_si256(x, y));
+		}
+		return _mm256_testz_si256(any, any) != 0;
+	}
+
+	CMP_ISA("avx2")
+	static uint64_t diff64(const char* a, const char* b) noexcept
+	{
+		const __m256i lo = _mm256_cmpeq_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(a)),
+											 _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b)));
+		const __m256i hi = _mm256_cmpeq_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + 32)),
+											 _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + 32)));
+		return ~(uint64_t(static_cast<uint32_t>(_mm256_movemask_epi8(lo)))
+				 | uint64_t(static_cast<uint32_t>(_mm256_movemask_epi8(hi))) << 32);
+	}
+};
+#endif
+
+
+//////////////////////////////////////////////////////////////////////
+// What one chunk found.
+
+struct Range
+{
+	uint64_t	begin;
+	uint64_t	end;
+};
+
+struct ChunkDiffs
+{
+	std::vector<Range>	ranges;
+	uint64_t			bytes{ 0 };			// differing bytes seen
+	bool				partial{ false };	// stopped before the end of the chunk
+};
+
+struct ScanState
+{
+	//! Ranges a chunk keeps: one more than we list, as its first may
+	//! merge with the previous chunk's last.
+	size_t				keep;
+	bool				stopEarly;
+	//! With stopEarly, the lowest chunk that filled its ranges: chunks
+	//! after it can't change the list.
+	std::atomic<size_t>	cutoff{ std::numeric_limits<size_t>::max() };
+};
+
+
+template<typename Ops>
+static void scanChunk(const char* a, const char* b, uint64_t base, size_t size, size_t chunkNo, ScanState& state, ChunkDiffs& out)
+{
+	// Note the differing bytes [begin, end); false once we can stop.
+	auto add = [&](uint64_t begin, uint64_t end) {
+		out.bytes += end - begin;
+		if (!out.ranges.empty() && out.ranges.back().end == begin)
+		{
+			out.ranges.back().end = end;
+		}
+		else if (out.ranges.size() < state.keep)
+		{
+			out.ranges.push_back(Range{ begin, end });
+			// Full: later chunks can't add to the list. This one carries
+			// on to where its last range ends.
+			if (state.stopEarly && out.ranges.size() == state.keep)
+			{
+				size_t cutoff = state.cutoff.load(std::memory_order_relaxed);
+				while (chunkNo < cutoff && !state.cutoff.compare_exchange_weak(cutoff, chunkNo))
+				{
+				}
+			}
+		}
+		else
+		{
+			return !state.stopEarly;
+		}
+		return true;
+	};
+	// Split a block's bits into runs.
+	auto addBlock = [&](uint64_t at, uint64_t bits) {
+		while (bits)
+		{
+			const unsigned first = lowestBit(bits);
+			const uint64_t rest = ~bits >> first;
+			const unsigned length = rest ? lowestBit(rest) : 64 - first;
+			if (!add(at + first, at + first + length))
+				return false;
+			bits = first + length >= 64 ? 0 : bits & (~uint64_t(0) << (first + length));
+		}
+		return true;
+	};
+
+	for (size_t at = 0; at < size; )
+	{
+		// Every MB, see whether an earlier chunk already has all the
+		// ranges we'll list.
+		if (state.stopEarly && (at & ((1 << 20) - 1)) == 0 && state.cutoff.load(std::memory_order_relaxed) < chunkNo)
+		{
+			out.partial = true;
+			return;
+		}
+		if (at + 256 <= size && Ops::same256(a + at, b + at))
+		{
+			at += 256;
+			continue;
+		}
+		for (const size_t end = std::min(size, at + 256); at < end; at += 64)
+		{
+			uint64_t bits = 0;
+			if (at + 64 <= size)
+			{
+				bits = Ops::diff64(a + at, b + at);
+			}
+			else
+			{
+				for (size_t byte = at; byte < size; ++byte)
+					bits |= uint64_t(a[byte] != b[byte]) << (byte - at);
+			}
+			if (bits && !addBlock(base + at, bits))
+			{
+				out.partial = true;
+				return;
+			}
+		}
+	}
+}
+
+// One copy of the loop per instruction set, each built for it.
+using ScanFn = void (*)(const char*, const char*, uint64_t, size_t, size_t, ScanState&, ChunkDiffs&);
+
+static void scanScalar(const char* a, const char* b, uint64_t base, size_t size, size_t chunkNo, ScanState& state, ChunkDiffs& out)
+{
+	scanChunk<ScalarOps>(a, b, base, size, chunkNo, state, out);
+}
+
+#if defined(CMP_X86)
+CMP_KERNEL("sse2")
+static void scanSse2(const char* a, const char* b, uint64_t base, size_t size, size_t chunkNo, ScanState& state, ChunkDiffs& out)
+{
+	scanChunk<Sse2Ops>(a, b, base, size, chunkNo, state, out);
+}
+
+CMP_KERNEL("avx2")
+static void scanAvx2(const char* a, const char* b, uint64_t base, size_t size, size_t chunkNo, ScanState& state, ChunkDiffs& out)
+{
+	scanChunk<Avx2Ops>(a, b, base, size, chunkNo, state, out);
+}
+#endif
+
+
+int main(int argc, const char* const argv[])
+{
+	size_t listRanges = 10;
+	bool stopEarly = false;
+	Isa isa = supportedIsa();
+	std::vector<const char*> filenames;
+	for (int argNo = 1; argNo < argc; ++argNo)
+	{
+		const std::string arg = argv[argNo];
+		if (arg == "-n" && argNo + 1 < argc)
+			listRanges = size_t(atoll(argv[++argNo]));
+		else if (arg == "-s")
+			stopEarly = true;
+		else if (arg == "-i" && argNo + 1 < argc)
+		{
+			const std::string name = argv[++argNo];
+			const Isa wanted = name == "avx2" ? Isa::AVX2 : name == "sse2" ? Isa::SSE2 : Isa::Scalar;
+			isa = std::min(isa, wanted);
+		}
+		else
+			filenames.push_back(argv[argNo]);
+	}
+	if (filenames.size() != 2)
+		die("Usage: ", argv[0], " [-n <ranges>] [-s] [-i scalar|sse2|avx2] <file1> <file2>");
+	listRanges = std::max<size_t>(listRanges, 1);
+
+	// A failed map and an empty file look the same, so open each first:
+	// only a file that opens, and says it's empty, is empty.
+	KFS::MMappedFile files[2];
+	for (size_t fileNo = 0; fileNo < 2; ++fileNo)
+	{
+		const KFS::FileHandle handle(filenames[fileNo]);
+		if (!handle.isValid())
+			die("Could not open ", filenames[fileNo]);
+		if (handle.uncachedFileSize() > 0 && !files[fileNo].mapFile(filenames[fileNo]))
+			die("Could not map ", filenames[fileNo]);
+	}
+	const KFS::MMappedFile& first = files[0];
+	const KFS::MMappedFile& second = files[1];
+	const size_t common = std::min(first.size(), second.size());
+
+	ScanFn scan = scanScalar;
+#if defined(CMP_X86)
+	if (isa == Isa::AVX2)
+		scan = scanAvx2;
+	else if (isa == Isa::SSE2)
+		scan = scanSse2;
+#endif
+
+	// Chunks small enough for every core to get several, and for later
+	// ones to be skipped once the ranges to list are found.
+	ScanState state;
+	state.keep = listRanges + 1;
+	state.stopEarly = stopEarly;
+	KFS::ChunkOptions options;
+	options.chunkSize = 8 * 1024 * 1024;
+
+	const auto start = std::chrono::steady_clock::now();
+	ChunkDiffs diffs = KFS::parallelReduceChunks(first.begin(), first.begin() + common,
+		[&](const KFS::Chunk& chunk) {
+			ChunkDiffs found;
+			const uint64_t base = uint64_t(chunk.begin - first.begin());
+			scan(chunk.begin, second.begin() + base, base, chunk.size(), chunk.index, state, found);
+			return found;
+		},
+		ChunkDiffs{},
+		[&](ChunkDiffs sofar, ChunkDiffs chunk) {
+			if (sofar.partial)
+				return sofar;
+			sofar.bytes += chunk.bytes;
+			for (const Range& range : chunk.ranges)
+			{
+				if (!sofar.ranges.empty() && sofar.ranges.back().end == range.begin)
+					sofar.ranges.back().end = range.end;
+				else if (sofar.ranges.size() < listRanges)
+					sofar.ranges.push_back(range);
+				else
+					sofar.partial = stopEarly;
+			}
+			sofar.partial = sofar.partial || chunk.partial;
+			return sofar;
+		},
+		options);
+	const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+	// A longer file's tail differs from the nothing in the shorter one.
+	const size_t longest = std::max(first.size(), second.size());
+	if (longest > common)
+	{
+		std::cout << "EOF on " << (first.size() < second.size() ? filenames[0] : filenames[1]) << " after " << common << " bytes\n";
+		if (!diffs.partial)
+		{
+			diffs.bytes += longest - common;
+			if (!diffs.ranges.empty() && diffs.ranges.back().end == common)
+				diffs.ranges.back().end = longest;
+			else if (diffs.ranges.size() < listRanges)
+				diffs.ranges.push_back(Range{ common, longest });
+			else
+				diffs.partial = stopEarly;
+		}
+	}
+
+	for (const Range& range : diffs.ranges)
+		std::cout << "differ: bytes " << range.begin << "-" << range.end - 1 << " (" << range.end - range.begin << ")\n";
+
+	constexpr double MB = 1024.0 * 1024.0;
+	const char* const isaName = isa == Isa::AVX2 ? "AVX2" : isa == Isa::SSE2 ? "SSE2" : "scalar";
+	if (diffs.partial)
+	{
+		std::cout << "stopped after " << diffs.ranges.size() << " differing ranges, in " << elapsed.count() << "s (" << isaName << ")\n";
+	}
+	else
+	{
+		if (diffs.ranges.empty())
+			std::cout << "identical";
+		else
+			std::cout << diffs.bytes << " differing bytes";
+		std::cout << "; compared " << common / MB << " MB in " << elapsed.count() << "s (" << common / MB / elapsed.count()
+				  << " MB/s, " << isaName << ")\n";
+	}
+	return diffs.ranges.empty() ? 0 : 1;
+}
@@ -0,0 +1,56 @@
+//////////////////////////////////////////////////////////////////////
+// MMapper mmap_metrics -- dump KFS::Metrics after some mapping work.
+// Author: Oliver "kfsone" Smith 2018 <oliver@kfs.org>
+// Redistribution and re-use fully permitted contingent on inclusion of these 3 lines in copied- or derived- works.
+//////////////////////////////////////////////////////////////////////
+// Usage:
+//
+//  mmap_metrics <repeats> <filename1> [... <filenameN>]
+//
+// Maps and unmaps each file 'repeats' times (missing or empty files
+// show up as failures) and prints the metrics snapshot as JSON.
+// Configure with -DMMAPPER_ENABLE_METRICS=ON, otherwise there's nothing
+// to show.
+
+
+#include "metrics.h"
+#include "mmapper.h"
+
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+
+template<typename... Args>
+void die(const char* reason, Args&&... args)
+{
+	std::cerr << "ERROR: " << reason;
+	(std::cerr << ... << args);
+	std::cerr << std::endl;
+	exit(1);
+}
+
+
+int main(int argc, const char* const argv[])
+{
+	if (argc < 3)
+		die("Usage: ", argv[0], " <repeats> <filename1> [... <filenameN>]");
+	const long repeats = atol(argv[1]);
+	if (!KFS::Metrics::c_enabled)
+		std::cerr << "Metrics are disabled; rebuild with -DMMAPPER_ENABLE_METRICS=ON\n";
+
+	for (long repeat = 0; repeat < repeats; ++repeat)
+	{
+		// Hold them all at once, so peak_bytes_mapped means something.
+		std::vector<KFS::MMappedFile> files;
+		for (int argNo = 2; argNo < argc; ++argNo)
+		{
+			KFS::MMappedFile file;
+			if (file.mapFile(argv[argNo]))
+				files.push_back(std::move(file));
+		}
+	}
+
+	std::cout << KFS::Metrics::snapshot().toJson() << "\n";
+	return 0;
+}
@@ -9,13 +9,25 @@
 //
 //  common_demo <word> <filename1> [... <filenameN>]
 //
-// Case-sensitive search for 'word' in the listed files.
+// Case-sensitive search for 'word' in the listed files, reporting the
+// line of the first match. Each file is searched in parallel.
 
 
 #include "mmapper.h"			// For KFS::MMappedFile
+#include "parallelchunks.h"		// For KFS::parallelReduceChunks
+#include <algorithm>			// For std::count, std::search.
 #include <iostream>				// For std::cout, cerr, endl, etc.
 #include <stdexcept>			// For std::exception types.
-#include <cstring>				// For strstr.
+#include <cstring>				// For strlen.
+
+
+// What searching one chunk of a file tells us.
+struct ChunkScan
+{
+	size_t	lines;			// newlines in the chunk
+	size_t	firstMatch;		// line (within the chunk) of the first match, or noMatch
+};
+static const size_t noMatch = ~size_t(0);
 
 
 int	main(int argc, const char* const argv[])
@@ -35,6 +47,8 @@ int	main(int argc, const char* const argv[])
 		return 2;
 	}
 
+	const size_t needleLength = strlen(needle);
+
 	for (size_t fileNo = 2; fileNo < static_cast<size_t>(argc); ++fileNo)
 	{
 		const char* const filename = argv[fileNo];
@@ -42,13 +56,28 @@ int	main(int argc, const char* const argv[])
 		{
 			KFS::MMappedFile mf(argv[fileNo]);
 
-			// We can use good-old strstr because MappedFile ensures a
-			// terminating \0 at the end of the allocation.
-			const char* begin = mf.begin();
-			const char* const location = strstr(begin, needle);
-			if (location != NULL && *location != 0)
+			// Split the file between threads on line boundaries, so no
+			// match that fits on one line is cut in two. Each chunk says
+			// how many lines it has and where its first match is; folding
+			// those in file order gives the line of the first match.
+			const ChunkScan scan = KFS::parallelReduceChunks(mf, '\n',
+				[&](const KFS::Chunk& chunk) {
+					const char* const location = std::search(chunk.begin, chunk.end, needle, needle + needleLength);
+					const size_t lines = static_cast<size_t>(std::count(chunk.begin, chunk.end, '\n'));
+					if (location == chunk.end)
+						return ChunkScan{ lines, noMatch };
+					return ChunkScan{ lines, static_cast<size_t>(std::count(chunk.begin, location, '\n')) };
+				},
+				ChunkScan{ 0, noMatch },
+				[](ChunkScan sofar, ChunkScan chunk) {
+					if (sofar.firstMatch == noMatch && chunk.firstMatch != noMatch)
+						sofar.firstMatch = sofar.lines + chunk.firstMatch;
+					sofar.lines += chunk.lines;
+					return sofar;
+				});
+			if (scan.firstMatch != noMatch)
 			{
-				std::cout << filename << " matches." << std::endl;
+				std::cout << filename << " matches at line " << scan.firstMatch + 1 << "." << std::endl;
 			}
 		}
 		catch (std::exception& e)
@@ -0,0 +1,77 @@
+//////////////////////////////////////////////////////////////////////
+// MMapper mmap_tail -- follow a growing log via KFS::FollowedFile.
+// Author: Oliver "kfsone" Smith 2018 <oliver@kfs.org>
+// Redistribution and re-use fully permitted contingent on inclusion of these 3 lines in copied- or derived- works.
+//////////////////////////////////////////////////////////////////////
+// POSIX only. Usage:
+//
+//  mmap_tail [-e] <file> [<word> [<idle seconds>]]
+//
+// Prints each complete line containing 'word' (every line if omitted) as
+// it's appended, reading straight from the mapping. -e starts at the
+// current end of the file, like tail -f. Stops after 'idle seconds'
+// without growth (default: never) and reports lines and throughput.
+
+
+#include "followfile.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+
+template<typename... Args>
+void die(const char* reason, Args&&... args)
+{
+	std::cerr << "ERROR: " << reason;
+	(std::cerr << ... << args);
+	std::cerr << std::endl;
+	exit(1);
+}
+
+
+int main(int argc, const char* const argv[])
+{
+	int argNo = 1;
+	const bool fromEnd = argc > argNo && strcmp(argv[argNo], "-e") == 0;
+	if (fromEnd)
+		++argNo;
+	if (argc <= argNo)
+		die("Usage: ", argv[0], " [-e] <file> [<word> [<idle seconds>]]");
+	const char* const filename = argv[argNo++];
+	const std::string word = argc > argNo ? argv[argNo++] : "";
+	const int idleMs = argc > argNo ? atoi(argv[argNo++]) * 1000 : -1;
+
+	KFS::FollowedFile follower;
+	if (!follower.open(filename))
+		die("Unable to follow ", filename);
+	if (fromEnd)
+		follower.skipToEnd();
+
+	size_t lines = 0, matches = 0;
+	const auto start = std::chrono::steady_clock::now();
+	const size_t bytes = follower.follow([&](const char* from, const char* to) -> size_t {
+		// Only whole lines; a partial one is offered again when it grows.
+		const char* line = from;
+		for (const char* eol; (eol = static_cast<const char*>(memchr(line, '\n', size_t(to - line)))) != nullptr; line = eol + 1)
+		{
+			++lines;
+			if (word.empty() || std::search(line, eol, word.begin(), word.end()) != eol)
+			{
+				std::cout.write(line, std::streamsize(eol + 1 - line));
+				++matches;
+			}
+		}
+		return size_t(line - from);
+	}, idleMs);
+	const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+	std::cout << std::flush;
+	std::cerr << lines << " lines, " << matches << " matches, " << bytes << " bytes in " << elapsed.count() << "s ("
+			  << (elapsed.count() > 0 ? double(bytes) / (1024 * 1024) / elapsed.count() : 0.0) << " MB/s), "
+			  << follower.truncations() << " truncations\n";
+	return 0;
+}
@@ -0,0 +1,68 @@
+//////////////////////////////////////////////////////////////////////
+// MMapper policy_wc -- KFS::BasicMappedFile with different policies side by side.
+// Author: Oliver "kfsone" Smith 2018 <oliver@kfs.org>
+// Redistribution and re-use fully permitted contingent on inclusion of these 3 lines in copied- or derived- works.
+//////////////////////////////////////////////////////////////////////
+// Usage:
+//
+//  policy_wc <filename1> [... <filenameN>]
+//
+// Counts lines and words in each file through a sequential, throwing
+// view, then upper-cases the first word of a copy-on-write view and
+// shows the file itself is untouched.
+
+
+#include "basicmappedfile.h"
+#include "mmapper.h"
+
+#include <cctype>
+#include <iostream>
+#include <string>
+
+
+using ScanView = KFS::BasicMappedFile<KFS::MapPolicy::Throw, KFS::MapPolicy::Sequential>;
+using ScratchView = KFS::BasicMappedFile<KFS::MapPolicy::CopyOnWrite, KFS::MapPolicy::Exact>;
+
+
+int main(int argc, const char* const argv[])
+{
+	if (argc < 2)
+	{
+		std::cerr << "Usage: " << argv[0] << " <filename1> [... <filenameN>]" << std::endl;
+		return 1;
+	}
+
+	std::cout << "sizeof(MMappedFile) " << sizeof(KFS::MMappedFile) << ", sizeof(ScanView) " << sizeof(ScanView) << "\n";
+
+	for (int argNo = 1; argNo < argc; ++argNo)
+	{
+		try
+		{
+			ScanView view(argv[argNo]);
+			size_t lines = 0, words = 0;
+			bool inWord = false;
+			for (const char* p = view.begin(); p != view.end(); ++p)
+			{
+				lines += *p == '\n';
+				const bool isSpace = std::isspace(static_cast<unsigned char>(*p)) != 0;
+				words += !isSpace && !inWord;
+				inWord = !isSpace;
+			}
+			std::cout << argv[argNo] << ": " << lines << " lines, " << words << " words\n";
+
+			ScratchView scratch(argv[argNo]);
+			if (!scratch.isMapped())
+				continue;
+			for (char* p = scratch.begin(); p != scratch.end() && !std::isspace(static_cast<unsigned char>(*p)); ++p)
+				*p = static_cast<char>(std::toupper(static_cast<unsigned char>(*p)));
+			std::cout << "  private copy starts '" << std::string(scratch.begin(), std::min<size_t>(scratch.size(), 16))
+					  << "', file still starts '" << std::string(view.begin(), std::min<size_t>(view.size(), 16)) << "'\n";
+		}
+		catch (const std::system_error& e)
+		{
+			std::cerr << "ERROR:" << argv[argNo] << ": " << e.what() << " (" << e.code().value() << ")" << std::endl;
+		}
+	}
+
+	return 0;
+}
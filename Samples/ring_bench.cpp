@@ -0,0 +1,173 @@
+//////////////////////////////////////////////////////////////////////
+// MMapper ring_bench -- cross-process throughput/latency of KFS::SharedRing.
+// Author: Oliver "kfsone" Smith 2018 <oliver@kfs.org>
+// Redistribution and re-use fully permitted contingent on inclusion of these 3 lines in copied- or derived- works.
+//////////////////////////////////////////////////////////////////////
+// POSIX only. Usage:
+//
+//  ring_bench [producers [messages [payloadBytes [batch [ringKB]]]]]
+//
+// Creates a SharedMemory region holding a SharedRing, forks 'producers'
+// worker processes and hands each of them the region's descriptor over
+// a UNIX socket (SCM_RIGHTS). Each worker attaches, then publishes
+// 'messages' records of 'payloadBytes' in batches of 'batch'. The parent
+// consumes, sleeping on the ring's futex when idle, and reports the
+// throughput and the distribution of publish->consume latency.
+
+
+#include "sharedmemory.h"
+#include "sharedring.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+
+template<typename... Args>
+void die(const char* reason, Args&&... args)
+{
+	std::cerr << "ERROR: " << reason;
+	((std::cerr << args), ...);
+	std::cerr << std::endl;
+	exit(1);
+}
+
+
+// What each record starts with; the rest is filler.
+struct Message
+{
+	uint32_t	producer;
+	uint32_t	sequence;
+	int64_t		sentNs;
+};
+
+static int64_t nowNs()
+{
+	// steady_clock is CLOCK_MONOTONIC on Linux: comparable across processes.
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+
+static void runProducer(int sock, uint32_t producerNo, size_t messages, size_t payload, size_t batch)
+{
+	KFS::SharedMemory shm;
+	if (!shm.attach(KFS::SharedMemory::receiveHandle(sock), KFS::SharedMemory::Access::ReadWrite))
+		die("producer ", producerNo, " failed to attach");
+	KFS::SharedRing ring;
+	if (!ring.attach(shm.data(), shm.size()))
+		die("producer ", producerNo, " found no ring");
+
+	std::vector<std::vector<char>> buffers(batch, std::vector<char>(payload, 'x'));
+	std::vector<KFS::SharedRing::Buffer> records(batch);
+	for (size_t sent = 0; sent < messages; )
+	{
+		const size_t count = std::min(batch, messages - sent);
+		for (size_t i = 0; i < count; ++i)
+		{
+			Message msg{ producerNo, uint32_t(sent + i), nowNs() };
+			memcpy(buffers[i].data(), &msg, sizeof(msg));
+			records[i] = { buffers[i].data(), payload };
+		}
+
+		if (count == 1)
+			ring.publish(records[0].data, records[0].size);
+		else
+			while (!ring.tryPublishBatch(records.data(), count))
+				sched_yield();
+		sent += count;
+	}
+}
+
+
+int main(int argc, const char* const argv[])
+{
+	const uint32_t producers = argc > 1 ? uint32_t(atoi(argv[1])) : 1;
+	const size_t messages = argc > 2 ? size_t(atoll(argv[2])) : 1000000;
+	const size_t payload = argc > 3 ? std::max<size_t>(size_t(atoll(argv[3])), sizeof(Message)) : 64;
+	const size_t batch = argc > 4 ? std::max<size_t>(size_t(atoll(argv[4])), 1) : 1;
+	const size_t ringBytes = (argc > 5 ? size_t(atoll(argv[5])) : 1024) * 1024;
+	if (producers == 0)
+		die("Usage: ", argv[0], " [producers [messages [payloadBytes [batch [ringKB]]]]]");
+
+	KFS::SharedMemory shm;
+	if (!shm.create(KFS::SharedRing::regionSize(ringBytes), "ring_bench"))
+		die("Unable to create shared memory");
+	KFS::SharedRing ring;
+	if (!ring.initialize(shm.data(), shm.size(), producers > 1 ? KFS::SharedRing::Producers::Multiple : KFS::SharedRing::Producers::Single))
+		die("Unable to initialize ring");
+	if (payload > ring.maxRecordSize() || payload * batch > ring.capacity() / 2)
+		die("Records/batches too large for a ", ringBytes / 1024, "KB ring");
+
+	std::vector<pid_t> children;
+	for (uint32_t producerNo = 0; producerNo < producers; ++producerNo)
+	{
+		int sockets[2];
+		if (socketpair(AF_UNIX, SOCK_STREAM, 0, sockets) != 0)
+			die("socketpair failed");
+
+		const pid_t pid = fork();
+		if (pid < 0)
+			die("fork failed");
+		if (pid == 0)
+		{
+			close(sockets[0]);
+			runProducer(sockets[1], producerNo, messages, payload, batch);
+			_exit(0);
+		}
+		close(sockets[1]);
+		if (!KFS::SharedMemory::sendHandle(sockets[0], shm.handle()))
+			die("Unable to send the ring to producer ", producerNo);
+		close(sockets[0]);
+		children.push_back(pid);
+	}
+
+	// Consume everything, sampling latency.
+	const size_t expected = size_t(producers) * messages;
+	std::vector<uint32_t> nextSequence(producers, 0);
+	std::vector<int64_t> latencies;
+	latencies.reserve(std::min<size_t>(expected, 1u << 20));
+	size_t received = 0, outOfOrder = 0, sleeps = 0;
+
+	const auto start = std::chrono::steady_clock::now();
+	while (received < expected)
+	{
+		const size_t got = ring.consume([&](const char* data, size_t) {
+			Message msg;
+			memcpy(&msg, data, sizeof(msg));
+			if (msg.sequence != nextSequence[msg.producer]++)
+				++outOfOrder;
+			if (latencies.size() < latencies.capacity())
+				latencies.push_back(nowNs() - msg.sentNs);
+		});
+		received += got;
+		if (got == 0)
+		{
+			++sleeps;
+			ring.waitForData(100);
+		}
+	}
+	const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	for (pid_t pid : children)
+		waitpid(pid, nullptr, 0);
+
+	std::sort(latencies.begin(), latencies.end());
+	auto percentile = [&](double p) { return latencies.empty() ? 0 : latencies[size_t(p * (latencies.size() - 1))]; };
+
+	std::cout << producers << " producer(s), " << received << " records of " << payload << " bytes, batch " << batch
+			  << ", ring " << ring.capacity() / 1024 << "KB\n"
+			  << "throughput: " << received / seconds << " records/s, " << received * payload / seconds / (1024 * 1024) << " MB/s\n"
+			  << "latency ns: p50 " << percentile(0.50) << ", p99 " << percentile(0.99) << ", p99.9 " << percentile(0.999)
+			  << ", max " << percentile(1.0) << "\n"
+			  << "consumer sleeps: " << sleeps << ", out of order: " << outOfOrder << "\n";
+
+	return outOfOrder == 0 ? 0 : 1;
+}
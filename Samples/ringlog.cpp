@@ -0,0 +1,95 @@
+//////////////////////////////////////////////////////////////////////
+// MMapper ringlog -- circular journal files via KFS::RingMappedFile.
+// Author: Oliver "kfsone" Smith 2018 <oliver@kfs.org>
+// Redistribution and re-use fully permitted contingent on inclusion of these 3 lines in copied- or derived- works.
+//////////////////////////////////////////////////////////////////////
+// Usage:
+//
+//  ringlog create <journal> <capacity KB>
+//  ringlog append <journal> <message> [... <message>]
+//  ringlog fill <journal> <count>          (numbered records of varying size)
+//  ringlog dump <journal>
+//
+// Records that wrap around the end of the ring are read in place - the
+// double mapping makes them contiguous.
+
+
+#include "ringmapping.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+
+template<typename... Args>
+void die(const char* reason, Args&&... args)
+{
+	std::cerr << "ERROR: " << reason;
+	(std::cerr << ... << args);
+	std::cerr << std::endl;
+	exit(1);
+}
+
+
+int main(int argc, const char* const argv[])
+{
+	if (argc < 3)
+		die("Usage: ", argv[0], " {create <journal> <KB> | append <journal> <message>... | fill <journal> <count> | dump <journal>}");
+	const std::string mode = argv[1];
+	const char* const filename = argv[2];
+
+	if (mode == "create")
+	{
+		const size_t kb = argc > 3 ? size_t(atoll(argv[3])) : 64;
+		if (!KFS::RingMappedFile::create(filename, kb * 1024))
+			die("Unable to create ", filename);
+		return 0;
+	}
+
+	if (mode == "append" || mode == "fill")
+	{
+		KFS::RingMappedFile ring(filename, KFS::FileAccess::ReadWrite);
+		if (!ring.isMapped())
+			die("Unable to open ", filename);
+		if (mode == "append")
+		{
+			for (int argNo = 3; argNo < argc; ++argNo)
+				if (!ring.append(argv[argNo], strlen(argv[argNo])))
+					die("Record too large: ", argv[argNo]);
+		}
+		else
+		{
+			const long count = argc > 3 ? atol(argv[3]) : 1000;
+			for (long recordNo = 0; recordNo < count; ++recordNo)
+			{
+				const std::string record = "record " + std::to_string(recordNo) + " " + std::string(size_t(recordNo % 97), '.');
+				ring.append(record.data(), record.size());
+			}
+		}
+		std::cout << "head " << ring.head() << ", tail " << ring.tail() << ", capacity " << ring.capacity() << "\n";
+		return 0;
+	}
+
+	if (mode == "dump")
+	{
+		KFS::RingMappedFile ring(filename);
+		if (!ring.isMapped())
+			die("Unable to open ", filename);
+
+		auto cursor = ring.oldest();
+		const char* data;
+		size_t size, records = 0, wrapped = 0;
+		while (cursor.next(data, size))
+		{
+			std::cout.write(data, std::streamsize(size)) << "\n";
+			++records;
+			if (data + size > ring.span(0) + ring.capacity())
+				++wrapped;
+		}
+		std::cout << records << " records (" << wrapped << " wrapped), " << cursor.lostBytes() << " bytes lost\n";
+		return 0;
+	}
+
+	die("Unknown mode: ", mode);
+}
@@ -0,0 +1,74 @@
+//////////////////////////////////////////////////////////////////////
+// MMapper shard_scan -- one scan over many shard files via KFS::MultiMappedFile.
+// Author: Oliver "kfsone" Smith 2018 <oliver@kfs.org>
+// Redistribution and re-use fully permitted contingent on inclusion of these 3 lines in copied- or derived- works.
+//////////////////////////////////////////////////////////////////////
+// POSIX only. Usage:
+//
+//  shard_scan <word> <shard1> [... <shardN>]
+//
+// Maps the shards back to back, separated by newlines, and walks the
+// whole range as one block of lines: counts them, and reports each line
+// containing 'word' as shard:line-offset via locate().
+
+
+#include "multimapping.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+
+template<typename... Args>
+void die(const char* reason, Args&&... args)
+{
+	std::cerr << "ERROR: " << reason;
+	((std::cerr << args), ...);
+	std::cerr << std::endl;
+	exit(1);
+}
+
+
+int main(int argc, const char* const argv[])
+{
+	if (argc < 3)
+		die("Usage: ", argv[0], " <word> <shard1> [... <shardN>]");
+	const char* const word = argv[1];
+	const size_t wordLen = strlen(word);
+
+	std::vector<KFS::filename_str_t> shards(argv + 2, argv + argc);
+	KFS::MultiMappedFile::PaddingPolicy padding;
+	padding.fill = '\n';			// a shard's last line can't run into the next shard
+	padding.alwaysSeparate = true;
+
+	KFS::MultiMappedFile view;
+	if (!view.map(shards, padding))
+		die("Unable to map the shards");
+
+	size_t lines = 0, matches = 0;
+	for (const char* line = view.begin(); line < view.end(); )
+	{
+		const char* eol = static_cast<const char*>(memchr(line, '\n', size_t(view.end() - line)));
+		if (!eol)
+			eol = view.end();
+		if (eol > line)
+		{
+			++lines;
+			const char* hit = std::search(line, eol, word, word + wordLen);
+			if (hit != eol)
+			{
+				const auto where = view.locate(line);
+				std::cout << view.shards()[where.shard].filename << ":" << where.offset << ": "
+						  << std::string(line, size_t(eol - line)) << "\n";
+				++matches;
+			}
+		}
+		line = eol + 1;
+	}
+
+	std::cout << shards.size() << " shards, " << view.size() << " bytes in view, "
+			  << lines << " non-empty lines, " << matches << " matches\n";
+	return 0;
+}
@@ -0,0 +1,103 @@
+//////////////////////////////////////////////////////////////////////
+// MMapper small_files -- MMappedFile vs KFS::AdaptiveLoader on many small files.
+// Author: Oliver "kfsone" Smith 2018 <oliver@kfs.org>
+// Redistribution and re-use fully permitted contingent on inclusion of these 3 lines in copied- or derived- works.
+//////////////////////////////////////////////////////////////////////
+// Usage:
+//
+//  small_files <directory> [<repeats>]
+//
+// Loads every regular file under 'directory' (recursively) 'repeats'
+// times each way, checksumming the contents, and reports files/second
+// and the calibrated read/map threshold.
+
+
+#include "adaptiveloader.h"
+#include "mmapper.h"
+
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <filesystem>
+#include <iostream>
+#include <string>
+#include <vector>
+
+
+template<typename... Args>
+void die(const char* reason, Args&&... args)
+{
+	std::cerr << "ERROR: " << reason;
+	(std::cerr << ... << args);
+	std::cerr << std::endl;
+	exit(1);
+}
+
+
+static uint64_t checksum(const char* from, const char* to)
+{
+	uint64_t sum = 0;
+	for ( ; from < to; ++from)
+		sum += static_cast<unsigned char>(*from);
+	return sum;
+}
+
+
+int main(int argc, const char* const argv[])
+{
+	if (argc < 2)
+		die("Usage: ", argv[0], " <directory> [<repeats>]");
+	const int repeats = argc > 2 ? atoi(argv[2]) : 3;
+
+	std::vector<std::string> files;
+	uint64_t totalBytes = 0;
+	for (const auto& entry : std::filesystem::recursive_directory_iterator(argv[1], std::filesystem::directory_options::skip_permission_denied))
+	{
+		std::error_code ec;
+		if (entry.is_regular_file(ec) && entry.file_size(ec) > 0)
+		{
+			files.push_back(entry.path().string());
+			totalBytes += entry.file_size(ec);
+		}
+	}
+	if (files.empty())
+		die("No files under ", argv[1]);
+
+	const auto calibrateStart = std::chrono::steady_clock::now();
+	const size_t threshold = KFS::AdaptiveLoader::threshold();
+	const std::chrono::duration<double, std::milli> calibration = std::chrono::steady_clock::now() - calibrateStart;
+	std::cout << files.size() << " files, " << totalBytes / files.size() << " bytes average; threshold "
+			  << threshold << " bytes (calibrated in " << calibration.count() << "ms)\n";
+
+	for (int pass = 0; pass < 2; ++pass)
+	{
+		const bool adaptive = pass == 1;
+		uint64_t sum = 0;
+		size_t buffered = 0;
+		const auto start = std::chrono::steady_clock::now();
+		for (int repeat = 0; repeat < repeats; ++repeat)
+		{
+			for (const std::string& filename : files)
+			{
+				if (adaptive)
+				{
+					const KFS::FileContents contents = KFS::AdaptiveLoader::load(filename);
+					sum += checksum(contents.begin(), contents.end());
+					buffered += contents.source() == KFS::FileContents::Source::Buffer;
+				}
+				else
+				{
+					KFS::MMappedFile file;
+					if (file.mapFile(filename))
+						sum += checksum(file.begin(), file.end());
+				}
+			}
+		}
+		const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+		std::cout << (adaptive ? "AdaptiveLoader: " : "MMappedFile:    ") << double(files.size()) * repeats / elapsed.count() << " files/s";
+		if (adaptive)
+			std::cout << " (" << buffered / repeats << " read, " << files.size() - buffered / repeats << " mapped)";
+		std::cout << ", checksum " << sum << "\n";
+	}
+	return 0;
+}
@@ -0,0 +1,125 @@
+//////////////////////////////////////////////////////////////////////
+// MMapper stream_scan -- plain mapped scan vs KFS::StreamScan.
+// Author: Oliver "kfsone" Smith 2018 <oliver@kfs.org>
+// Redistribution and re-use fully permitted contingent on inclusion of these 3 lines in copied- or derived- works.
+//////////////////////////////////////////////////////////////////////
+// POSIX only. Usage:
+//
+//  stream_scan <plain|stream> <file> [<window MB>]
+//
+// Evicts the file from the page cache, counts its lines through a
+// mapping, and reports throughput, the process' peak RSS and how much of
+// the file is still cached afterwards. Run each mode as its own process:
+// peak RSS only ever goes up.
+
+
+#include "mmapper.h"
+#include "streamscan.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+template<typename... Args>
+void die(const char* reason, Args&&... args)
+{
+	std::cerr << "ERROR: " << reason;
+	(std::cerr << ... << args);
+	std::cerr << std::endl;
+	exit(1);
+}
+
+
+static size_t countLines(const char* from, const char* to)
+{
+	size_t lines = 0;
+	while ((from = static_cast<const char*>(memchr(from, '\n', size_t(to - from)))) != nullptr)
+	{
+		++lines;
+		++from;
+	}
+	return lines;
+}
+
+
+//! Bytes of 'filename' in the page cache, via mincore on a fresh mapping.
+static size_t cachedBytes(const char* filename)
+{
+	const int fd = open(filename, O_RDONLY);
+	struct stat stats;
+	if (fd < 0 || fstat(fd, &stats) != 0 || stats.st_size == 0)
+		return 0;
+	const size_t size = size_t(stats.st_size);
+	const size_t page = size_t(sysconf(_SC_PAGESIZE));
+	void* const map = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return 0;
+	std::vector<unsigned char> resident((size + page - 1) / page);
+	size_t cached = 0;
+	if (mincore(map, size, resident.data()) == 0)
+	{
+		for (unsigned char flag : resident)
+			cached += (flag & 1) ? page : 0;
+	}
+	munmap(map, size);
+	return cached;
+}
+
+
+int main(int argc, const char* const argv[])
+{
+	if (argc < 3)
+		die("Usage: ", argv[0], " <plain|stream> <file> [<window MB>]");
+	const std::string mode = argv[1];
+	const char* const filename = argv[2];
+	if (mode != "plain" && mode != "stream")
+		die("Unknown mode: ", mode);
+
+	// Start cold, so both modes read from disk.
+	{
+		const int fd = open(filename, O_RDONLY);
+		if (fd < 0)
+			die("Unable to open ", filename);
+		posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+		close(fd);
+	}
+
+	KFS::MMappedFile file(filename);
+	if (!file.isMapped())
+		die("Unable to map ", filename);
+
+	size_t lines = 0;
+	const auto start = std::chrono::steady_clock::now();
+	if (mode == "plain")
+	{
+		lines = countLines(file.begin(), file.end());
+	}
+	else
+	{
+		KFS::StreamScanOptions options;
+		if (argc > 3)
+			options.window = size_t(atoll(argv[3])) * 1024 * 1024;
+		KFS::StreamScan scan(file, options);
+		scan.scan([&](const char* from, const char* to) { lines += countLines(from, to); return true; });
+	}
+	const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	constexpr double MB = 1024.0 * 1024.0;
+	std::cout << mode << ": " << lines << " lines, " << file.size() / MB << " MB in " << elapsed.count() << "s ("
+			  << file.size() / MB / elapsed.count() << " MB/s), peak RSS " << usage.ru_maxrss / 1024.0 << " MB, "
+			  << cachedBytes(filename) / MB << " MB of the file still cached\n";
+	return 0;
+}
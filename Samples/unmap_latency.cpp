@@ -0,0 +1,81 @@
+//////////////////////////////////////////////////////////////////////
+// MMapper unmap_latency -- inline vs deferred (Reclaimer) release of big mappings.
+// Author: Oliver "kfsone" Smith 2018 <oliver@kfs.org>
+// Redistribution and re-use fully permitted contingent on inclusion of these 3 lines in copied- or derived- works.
+//////////////////////////////////////////////////////////////////////
+// Usage:
+//
+//  unmap_latency <big file> [iterations]
+//
+// Maps the file, touches every page so the page tables are fully
+// populated, then times how long releasing the mapping blocks the
+// calling thread: first unmapping inline, then with deferRelease()
+// handing it to a Reclaimer.
+
+
+#include "mmapper.h"
+#include "reclaimer.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+
+template<typename... Args>
+void die(const char* reason, Args&&... args)
+{
+	std::cerr << "ERROR: " << reason;
+	(std::cerr << ... << args);
+	std::cerr << std::endl;
+	exit(1);
+}
+
+
+static std::vector<double> measure(const char* filename, int iterations, KFS::Reclaimer* reclaimer)
+{
+	std::vector<double> releaseUs;
+	uint64_t sum = 0;
+	for (int iteration = 0; iteration < iterations; ++iteration)
+	{
+		KFS::MMappedFile mf(filename);
+		if (!mf.isMapped())
+			die("Unable to map ", filename);
+		mf.deferRelease(reclaimer);
+		for (const char* ptr = mf.begin(); ptr < mf.end(); ptr += 4096)
+			sum += static_cast<unsigned char>(*ptr);
+
+		const auto start = std::chrono::steady_clock::now();
+		mf.unmapFile();
+		releaseUs.push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count());
+	}
+	if (reclaimer)
+		reclaimer->drain();
+	std::sort(releaseUs.begin(), releaseUs.end());
+	return sum != 1 ? releaseUs : std::vector<double>{};		// 'sum' keeps the touches alive
+}
+
+
+int main(int argc, const char* const argv[])
+{
+	if (argc < 2)
+		die("Usage: ", argv[0], " <big file> [iterations]");
+	const int iterations = argc > 2 ? std::max(atoi(argv[2]), 1) : 10;
+
+	KFS::Reclaimer reclaimer;
+	const auto inlineUs = measure(argv[1], iterations, nullptr);
+	const auto deferredUs = measure(argv[1], iterations, &reclaimer);
+
+	auto report = [](const char* label, const std::vector<double>& us) {
+		std::cout << label << "p50 " << us[us.size() / 2] << "us, max " << us.back() << "us\n";
+	};
+	report("inline unmap:   ", inlineUs);
+	report("deferred unmap: ", deferredUs);
+
+	const auto stats = reclaimer.stats();
+	std::cout << "reclaimer: " << stats.deferred << " deferred, " << stats.synchronous << " synchronous, "
+			  << stats.unmapCalls << " munmap calls\n";
+	return 0;
+}
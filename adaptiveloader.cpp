@@ -0,0 +1,230 @@
+// MMapper -> AdaptiveLoader -- Read small files into pooled buffers, map big ones.
+// Author: Oliver "kfsone" Smith 2018 <oliver@kfs.org>
+// Redistribution and re-use fully permitted contingent on inclusion of these 3 lines in copied- or derived- works.
+
+#include "adaptiveloader.h"
+#include "addressspace.h"
+#include "basicmappedfile.h"
+#include "filehandle.h"
+#include "internal_includes.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <mutex>
+#include <string>
+#include <vector>
+
+
+namespace KFS
+{
+
+	constexpr size_t AdaptiveLoader::c_defaultThreshold;
+	constexpr size_t AdaptiveLoader::c_pooledBuffers;
+
+	// How mapped files are mapped: as MMappedFile does.
+	static constexpr MappingCore::Request c_mapRequest{ false, false, true, MapPolicy::Advice::Normal, false, false };
+
+
+	//////////////////////////////////////////////////////////////////////
+	// Buffer pool. Each buffer carries its capacity in a header in front
+	// of the data, so any thread can pool or free it.
+
+	namespace
+	{
+		struct alignas(16) BufferHeader
+		{
+			size_t	capacity;
+		};
+
+		struct BufferPool
+		{
+			BufferHeader*	buffers[AdaptiveLoader::c_pooledBuffers];
+			size_t			count{ 0 };
+
+			~BufferPool()
+			{
+				while (count)
+					std::free(buffers[--count]);
+			}
+		};
+
+		thread_local BufferPool t_pool;
+
+		std::atomic<size_t> s_threshold{ 0 };
+		std::once_flag s_calibrateOnce;
+	}
+
+	static char* _acquireBuffer(size_t bytes_) noexcept
+	{
+		BufferPool& pool = t_pool;
+		for (size_t bufferNo = 0; bufferNo < pool.count; ++bufferNo)
+		{
+			BufferHeader* const header = pool.buffers[bufferNo];
+			if (header->capacity >= bytes_)
+			{
+				pool.buffers[bufferNo] = pool.buffers[--pool.count];
+				return reinterpret_cast<char*>(header + 1);
+			}
+		}
+
+		// Round up so a buffer can be reused for similar sizes.
+		const size_t capacity = (std::max<size_t>(bytes_, 4096) + 4095) & ~size_t(4095);
+		BufferHeader* const header = static_cast<BufferHeader*>(std::malloc(sizeof(BufferHeader) + capacity));
+		if (!header)
+			return nullptr;
+		header->capacity = capacity;
+		return reinterpret_cast<char*>(header + 1);
+	}
+
+	static void _releaseBuffer(const char* buffer_) noexcept
+	{
+		BufferHeader* const header = reinterpret_cast<BufferHeader*>(const_cast<char*>(buffer_)) - 1;
+		BufferPool& pool = t_pool;
+		if (pool.count < AdaptiveLoader::c_pooledBuffers)
+			pool.buffers[pool.count++] = header;
+		else
+			std::free(header);
+	}
+
+
+	//////////////////////////////////////////////////////////////////////
+	// FileContents.
+
+	void FileContents::release() noexcept
+	{
+		switch (m_source)
+		{
+			case Source::None:		break;
+			case Source::Buffer:	_releaseBuffer(m_data); break;
+			case Source::Mapping:	MappingCore::unmap(const_cast<char*>(m_data), m_size, true); break;
+		}
+		m_data = nullptr;
+		m_size = 0;
+		m_source = Source::None;
+	}
+
+
+	//////////////////////////////////////////////////////////////////////
+	// Loading.
+
+	FileContents AdaptiveLoader::load(const filename_str_t& filename_) MMAPPER_MAYBE_NOEXCEPT
+	{
+		FileHandle fh{ filename_ };
+		if (!fh.isValid())
+			return FileContents{};
+		const size_t size = static_cast<size_t>(fh.metadata().size);
+
+		if (size <= threshold())
+		{
+			char* const buffer = _acquireBuffer(size + 1);
+			if (!buffer)
+				return FileContents{};
+			// Owns the buffer from here, in case the read throws.
+			FileContents contents(buffer, 0, FileContents::Source::Buffer);
+			const ptrdiff_t got = fh.readAt(buffer, size, 0);
+			if (got < 0)
+				return FileContents{};
+			// It may have shrunk since we asked.
+			buffer[got] = '\0';
+			contents.m_size = static_cast<size_t>(got);
+			return contents;
+		}
+
+		const char* reason = nullptr;
+		long error = 0;
+		void* const base = MappingCore::map(fh, size, c_mapRequest, reason, error);
+		if (!base)
+			return FileContents{};
+		return FileContents(static_cast<const char*>(base), size, FileContents::Source::Mapping);
+	}
+
+
+	//////////////////////////////////////////////////////////////////////
+	// Threshold.
+
+	size_t AdaptiveLoader::threshold() noexcept
+	{
+		const size_t threshold = s_threshold.load(std::memory_order_relaxed);
+		if (threshold)
+			return threshold;
+		std::call_once(s_calibrateOnce, [] {
+			const size_t measured = calibrate();
+			size_t unset = 0;
+			s_threshold.compare_exchange_strong(unset, measured ? measured : c_defaultThreshold);
+		});
+		return s_threshold.load(std::memory_order_relaxed);
+	}
+
+	void AdaptiveLoader::setThreshold(size_t bytes_) noexcept
+	{
+		// 0 would mean "not calibrated yet".
+		s_threshold.store(std::max<size_t>(bytes_, 1), std::memory_order_relaxed);
+	}
+
+	size_t AdaptiveLoader::calibrate() noexcept
+	{
+#if MMAPPER_API == MMAPPER_WIN32
+		return 0;
+#else
+		constexpr size_t c_largestProbe = 1024 * 1024;
+		constexpr int c_iterations = 32;
+
+		const char* const tmpdir = std::getenv("TMPDIR");
+		const std::string filename = std::string(tmpdir && *tmpdir ? tmpdir : "/tmp") + "/.mmapper-calibrate-" + std::to_string(getpid());
+		FileHandle fh{ filename, FileAccess::CreateReadWrite };
+		if (!fh.isValid())
+			return 0;
+		// The descriptor keeps it alive for as long as we need it.
+		unlink(filename.c_str());
+
+		std::vector<char> buffer(c_largestProbe + 1, 'x');
+		if (pwrite(fh, buffer.data(), c_largestProbe, 0) != static_cast<ssize_t>(c_largestProbe))
+			return 0;
+
+		using clock = std::chrono::steady_clock;
+		const size_t page = AddressRange::pageSize();
+		volatile char sink = 0;
+		size_t crossover = 0;
+		for (size_t size = page; size <= c_largestProbe; size *= 2)
+		{
+			// Best of three, to shrug off the odd interruption.
+			clock::duration readTime = clock::duration::max(), mapTime = clock::duration::max();
+			for (int round = 0; round < 3; ++round)
+			{
+				auto start = clock::now();
+				for (int iteration = 0; iteration < c_iterations; ++iteration)
+				{
+					if (fh.readAt(buffer.data(), size, 0) != static_cast<ptrdiff_t>(size))
+						return 0;
+					for (size_t offset = 0; offset < size; offset += page)
+						sink = sink + buffer[offset];
+				}
+				readTime = std::min(readTime, clock::now() - start);
+
+				start = clock::now();
+				for (int iteration = 0; iteration < c_iterations; ++iteration)
+				{
+					const char* reason = nullptr;
+					long error = 0;
+					const char* const base = static_cast<const char*>(MappingCore::map(fh, size, c_mapRequest, reason, error));
+					if (!base)
+						return 0;
+					for (size_t offset = 0; offset < size; offset += page)
+						sink = sink + base[offset];
+					MappingCore::unmap(const_cast<char*>(base), size, true);
+				}
+				mapTime = std::min(mapTime, clock::now() - start);
+			}
+
+			if (readTime >= mapTime)
+				break;
+			crossover = size;
+		}
+		// Even a page is quicker to map: only empty files get read.
+		return crossover ? crossover : 1;
+#endif
+	}
+
+}
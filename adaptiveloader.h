@@ -0,0 +1,116 @@
+#pragma once
+
+// MMapper -> AdaptiveLoader -- Read small files into pooled buffers, map big ones.
+// Author: Oliver "kfsone" Smith 2018 <oliver@kfs.org>
+// Redistribution and re-use fully permitted contingent on inclusion of these 3 lines in copied- or derived- works.
+
+#include "mmapper_platform.h"
+
+#include <cstddef>
+#include <utility>
+
+
+namespace KFS
+{
+
+	//////////////////////////////////////////////////////////////////////
+	//! @class FileContents
+	//! @brief The bytes of a file loaded by AdaptiveLoader, however they
+	//! got there.
+	//!
+	//! @detail A read-only span over either a pooled buffer or a mapping;
+	//! either way the byte at end() is '\0'. Move-only; the buffer goes
+	//! back to the destroying thread's pool, or the mapping is released.
+	//
+	class FileContents
+	{
+	public:
+		enum class Source { None, Buffer, Mapping };
+
+	private:
+		const char*		m_data{ nullptr };
+		size_t			m_size{ 0 };
+		Source			m_source{ Source::None };
+
+		friend class AdaptiveLoader;
+		FileContents(const char* data_, size_t size_, Source source_) noexcept : m_data(data_), m_size(size_), m_source(source_) {}
+
+	public:
+		FileContents() noexcept = default;
+		~FileContents() noexcept { release(); }
+
+		FileContents(const FileContents&) = delete;
+		FileContents& operator=(const FileContents&) = delete;
+
+		FileContents(FileContents&& rhs_) noexcept
+			: m_data(std::exchange(rhs_.m_data, nullptr))
+			, m_size(std::exchange(rhs_.m_size, 0))
+			, m_source(std::exchange(rhs_.m_source, Source::None))
+		{
+		}
+
+		FileContents& operator=(FileContents&& rhs_) noexcept
+		{
+			if (this != &rhs_)
+			{
+				release();
+				m_data = std::exchange(rhs_.m_data, nullptr);
+				m_size = std::exchange(rhs_.m_size, 0);
+				m_source = std::exchange(rhs_.m_source, Source::None);
+			}
+			return *this;
+		}
+
+		//! Give up the contents.
+		void release() noexcept;
+
+		//! False if the load failed. An empty file loads successfully.
+		bool isLoaded() const noexcept { return m_source != Source::None; }
+		Source source() const noexcept { return m_source; }
+
+		const char* data() const noexcept { return m_data; }
+		const char* begin() const noexcept { return m_data; }
+		const char* end() const noexcept { return m_data + m_size; }
+		size_t size() const noexcept { return m_size; }
+		bool empty() const noexcept { return m_size == 0; }
+	};
+
+
+	//////////////////////////////////////////////////////////////////////
+	//! @class AdaptiveLoader
+	//! @brief Load a whole file the cheapest way for its size.
+	//!
+	//! @detail For a file of a few KB, mmap() + page faults + munmap()
+	//! cost more than one read() into a buffer we already have. Files up
+	//! to threshold() bytes are read into a buffer from a small
+	//! thread-local pool; bigger ones are mapped.
+	//!
+	//! The threshold is measured the first time it's needed: a short
+	//! microbenchmark reads and maps a scratch file in the temp directory
+	//! at a range of sizes and picks the largest size at which reading
+	//! still wins. setThreshold() overrides it (e.g. from configuration,
+	//! or to skip the benchmark).
+	//
+	class AdaptiveLoader
+	{
+	public:
+		//! Used when the benchmark can't run (no writable temp directory;
+		//! always on Windows).
+		static constexpr size_t c_defaultThreshold{ 64 * 1024 };
+
+		//! Buffers each thread keeps for reuse.
+		static constexpr size_t c_pooledBuffers{ 8 };
+
+		//! Load 'filename_'; check isLoaded().
+		static FileContents load(const filename_str_t& filename_) MMAPPER_MAYBE_NOEXCEPT;
+
+		//! Largest file that gets read rather than mapped.
+		static size_t threshold() noexcept;
+		static void setThreshold(size_t bytes_) noexcept;
+
+		//! Run the microbenchmark now.
+		//! @return the crossover size it found, or 0 if it couldn't run.
+		static size_t calibrate() noexcept;
+	};
+
+}
@@ -0,0 +1,262 @@
+// MMapper -> AddressRange -- Reserve virtual address space and commit it piecemeal.
+// Author: Oliver "kfsone" Smith 2018 <oliver@kfs.org>
+// Redistribution and re-use fully permitted contingent on inclusion of these 3 lines in copied- or derived- works.
+
+#include "addressspace.h"
+#include "internal_includes.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <stdexcept>
+#include <utility>
+
+
+namespace KFS
+{
+
+	static inline bool _fail(const char* reason_) MMAPPER_MAYBE_NOEXCEPT
+	{
+#ifndef MMAPPER_NO_THROW
+		throw std::runtime_error(reason_);
+#endif
+		(void)reason_;
+		return false;
+	}
+
+	static inline size_t _roundUp(size_t value_, size_t granule_) noexcept
+	{
+		return (value_ + granule_ - 1) & ~(granule_ - 1);
+	}
+
+
+	//////////////////////////////////////////////////////////////////////
+	// Page sizes.
+
+	size_t AddressRange::pageSize() noexcept
+	{
+		static const size_t s_pageSize = [] {
+#if MMAPPER_API == MMAPPER_WIN32
+			SYSTEM_INFO info;
+			GetSystemInfo(&info);
+			return static_cast<size_t>(info.dwPageSize);
+#else
+			const long size = sysconf(_SC_PAGESIZE);
+			return size > 0 ? static_cast<size_t>(size) : size_t(4096);
+#endif
+		}();
+		return s_pageSize;
+	}
+
+	size_t AddressRange::hugePageSize() noexcept
+	{
+		static const size_t s_hugePageSize = [] {
+#if MMAPPER_API == MMAPPER_WIN32
+			return static_cast<size_t>(GetLargePageMinimum());
+#elif defined(__linux__) && defined(MADV_HUGEPAGE)
+			size_t size = 0;
+			if (FILE* fp = fopen("/sys/kernel/mm/transparent_hugepage/hpage_pmd_size", "r"))
+			{
+				unsigned long long value = 0;
+				if (fscanf(fp, "%llu", &value) == 1)
+					size = static_cast<size_t>(value);
+				fclose(fp);
+			}
+			return size;
+#else
+			return size_t(0);
+#endif
+		}();
+		return s_hugePageSize;
+	}
+
+
+	//////////////////////////////////////////////////////////////////////
+	// Populating mapped pages.
+
+	void AddressRange::populate(const void* begin_, size_t size_) noexcept
+	{
+		if (size_ == 0)
+			return;
+		const size_t page = pageSize();
+		const char* const begin = static_cast<const char*>(begin_);
+#if MMAPPER_API != MMAPPER_WIN32
+		const uintptr_t start = reinterpret_cast<uintptr_t>(begin) & ~uintptr_t(page - 1);
+		const size_t length = static_cast<size_t>(reinterpret_cast<uintptr_t>(begin + size_) - start);
+# if defined(MADV_POPULATE_READ)
+		if (madvise(reinterpret_cast<void*>(start), length, MADV_POPULATE_READ) == 0)
+			return;
+# endif
+		madvise(reinterpret_cast<void*>(start), length, MADV_WILLNEED);
+#endif
+		const volatile char* const base = begin;
+		for (size_t offset = 0; offset < size_; offset += page)
+			(void)base[offset];
+		(void)base[size_ - 1];
+	}
+
+
+	//////////////////////////////////////////////////////////////////////
+	// Lifetime.
+
+	AddressRange::~AddressRange() noexcept
+	{
+		release();
+	}
+
+	AddressRange::AddressRange(AddressRange&& rhs_) noexcept
+		: m_base(std::exchange(rhs_.m_base, nullptr))
+		, m_size(std::exchange(rhs_.m_size, 0))
+	{
+	}
+
+	AddressRange& AddressRange::operator=(AddressRange&& rhs_) noexcept
+	{
+		if (this != &rhs_)
+		{
+			release();
+			m_base = std::exchange(rhs_.m_base, nullptr);
+			m_size = std::exchange(rhs_.m_size, 0);
+		}
+		return *this;
+	}
+
+	void AddressRange::release() noexcept
+	{
+		if (!m_base)
+			return;
+#if MMAPPER_API == MMAPPER_WIN32
+		VirtualFree(m_base, 0, MEM_RELEASE);
+#else
+		munmap(m_base, m_size);
+#endif
+		m_base = nullptr;
+		m_size = 0;
+	}
+
+
+	//////////////////////////////////////////////////////////////////////
+	// Reserve.
+
+	bool AddressRange::reserve(size_t size_, size_t alignment_) MMAPPER_MAYBE_NOEXCEPT
+	{
+		release();
+
+		if (size_ == 0)
+			return _fail("trying to reserve an empty address range");
+		const size_t size = _roundUp(size_, pageSize());
+		if (alignment_ < pageSize())
+			alignment_ = 0;
+		if (alignment_ & (alignment_ - 1))
+			return _fail("address range alignment must be a power of two");
+
+#if MMAPPER_API == MMAPPER_WIN32
+		// Reserve enough to find an aligned start, then give it back and
+		// try to take just the aligned part. Another thread can steal the
+		// addresses in between, hence the retries.
+		for (int attempt = 0; attempt < 8; ++attempt)
+		{
+			char* const probe = static_cast<char*>(VirtualAlloc(NULL, size + alignment_, MEM_RESERVE, PAGE_NOACCESS));
+			if (!probe)
+				break;
+			if (!alignment_)
+			{
+				m_base = probe;
+				m_size = size;
+				return true;
+			}
+			VirtualFree(probe, 0, MEM_RELEASE);
+			char* const aligned = reinterpret_cast<char*>(_roundUp(reinterpret_cast<uintptr_t>(probe), alignment_));
+			m_base = static_cast<char*>(VirtualAlloc(aligned, size, MEM_RESERVE, PAGE_NOACCESS));
+			if (m_base)
+			{
+				m_size = size;
+				return true;
+			}
+		}
+		return _fail("VirtualAlloc could not reserve address space");
+#else
+		// MAP_NORESERVE: don't charge the reservation against overcommit.
+		const size_t span = size + alignment_;
+		char* const probe = static_cast<char*>(mmap(NULL, span, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0));
+		if (probe == MAP_FAILED)
+			return _fail("unable to reserve address space");
+
+		// Trim the misaligned head and the unused tail.
+		char* const aligned = alignment_ ? reinterpret_cast<char*>(_roundUp(reinterpret_cast<uintptr_t>(probe), alignment_)) : probe;
+		if (aligned != probe)
+			munmap(probe, static_cast<size_t>(aligned - probe));
+		if (probe + span != aligned + size)
+			munmap(aligned + size, static_cast<size_t>(probe + span - (aligned + size)));
+
+		m_base = aligned;
+		m_size = size;
+		return true;
+#endif
+	}
+
+
+	//////////////////////////////////////////////////////////////////////
+	// Commit / decommit.
+
+	bool AddressRange::commit(size_t offset_, size_t length_) MMAPPER_MAYBE_NOEXCEPT
+	{
+		if (!m_base || offset_ > m_size || length_ > m_size - offset_)
+			return _fail("commit outside of the reserved range");
+		if (length_ == 0)
+			return true;
+
+		const size_t start = offset_ & ~(pageSize() - 1);
+		const size_t length = _roundUp(offset_ + length_, pageSize()) - start;
+#if MMAPPER_API == MMAPPER_WIN32
+		if (!VirtualAlloc(m_base + start, length, MEM_COMMIT, PAGE_READWRITE))
+			return _fail("VirtualAlloc could not commit memory");
+#else
+		if (mprotect(m_base + start, length, PROT_READ | PROT_WRITE) != 0)
+			return _fail("unable to commit reserved memory");
+#endif
+		return true;
+	}
+
+	bool AddressRange::decommit(size_t offset_, size_t length_) MMAPPER_MAYBE_NOEXCEPT
+	{
+		if (!m_base || offset_ > m_size || length_ > m_size - offset_)
+			return _fail("decommit outside of the reserved range");
+
+		// Only pages entirely inside the range.
+		const size_t start = _roundUp(offset_, pageSize());
+		const size_t end = (offset_ + length_) & ~(pageSize() - 1);
+		if (end <= start)
+			return true;
+
+#if MMAPPER_API == MMAPPER_WIN32
+		if (!VirtualFree(m_base + start, end - start, MEM_DECOMMIT))
+			return _fail("VirtualFree could not decommit memory");
+#else
+		// Replacing the pages with a fresh PROT_NONE mapping both frees
+		// them and drops the commit charge that mprotect(RW) took.
+		void* const ptr = mmap(m_base + start, end - start, PROT_NONE,
+							   MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED, -1, 0);
+		if (ptr == MAP_FAILED)
+			return _fail("unable to decommit memory");
+#endif
+		return true;
+	}
+
+	bool AddressRange::adviseHugePages(size_t offset_, size_t length_) noexcept
+	{
+#if MMAPPER_API == MMAPPER_POSIX && defined(MADV_HUGEPAGE)
+		if (!m_base || offset_ > m_size || length_ > m_size - offset_ || hugePageSize() == 0)
+			return false;
+		const size_t start = offset_ & ~(pageSize() - 1);
+		const size_t length = _roundUp(offset_ + length_, pageSize()) - start;
+		return madvise(m_base + start, length, MADV_HUGEPAGE) == 0;
+#else
+		// Windows large pages must be locked and committed up front with
+		// SeLockMemoryPrivilege; that doesn't fit lazy commit.
+		(void)offset_;
+		(void)length_;
+		return false;
+#endif
+	}
+
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+// MMapper -> AddressRange -- Reserve virtual address space and commit it piecemeal.
+// Author: Oliver "kfsone" Smith 2018 <oliver@kfs.org>
+// Redistribution and re-use fully permitted contingent on inclusion of these 3 lines in copied- or derived- works.
+
+#include "mmapper_platform.h"
+
+#include <cstddef>
+
+
+namespace KFS
+{
+
+	//////////////////////////////////////////////////////////////////////
+	//! @class AddressRange
+	//! @brief RAII reservation of a block of virtual address space.
+	//!
+	//! @detail reserve() claims addresses without backing them: the range
+	//! is inaccessible and costs no memory. commit() makes pages
+	//! read/write (they are still only populated when first touched),
+	//! decommit() returns their memory to the OS while keeping the
+	//! addresses reserved.
+	//!
+	//! POSIX: PROT_NONE anonymous mapping, mprotect() to commit, and a
+	//! fresh PROT_NONE mapping over the pages to decommit.
+	//! Windows: VirtualAlloc(MEM_RESERVE / MEM_COMMIT), VirtualFree(MEM_DECOMMIT).
+	//
+	class AddressRange
+	{
+		char*	m_base{ nullptr };
+		size_t	m_size{ 0 };
+
+	public:
+		AddressRange() noexcept = default;
+		~AddressRange() noexcept;
+
+		// Copying not allowed.
+		AddressRange(const AddressRange&) = delete;
+		AddressRange& operator=(const AddressRange&) = delete;
+
+		// Move allowed; the source is left empty.
+		AddressRange(AddressRange&& rhs_) noexcept;
+		AddressRange& operator=(AddressRange&& rhs_) noexcept;
+
+		//! Reserve 'size_' bytes (rounded up to whole pages), optionally
+		//! starting on an 'alignment_' boundary (a power of two, e.g. the
+		//! huge page size).
+		//! @return true on success.
+		bool reserve(size_t size_, size_t alignment_ = 0) MMAPPER_MAYBE_NOEXCEPT;
+
+		//! Make [offset_, offset_ + length_) readable and writable. The
+		//! range is widened to page boundaries.
+		//! @return true on success.
+		bool commit(size_t offset_, size_t length_) MMAPPER_MAYBE_NOEXCEPT;
+
+		//! Discard the contents of [offset_, offset_ + length_) and make it
+		//! inaccessible again; the addresses stay reserved. Only whole
+		//! pages inside the range are affected.
+		//! @return true on success.
+		bool decommit(size_t offset_, size_t length_) MMAPPER_MAYBE_NOEXCEPT;
+
+		//! Ask for transparent huge pages over the range. Advisory: false
+		//! means the platform doesn't offer them, not that anything broke.
+		bool adviseHugePages(size_t offset_, size_t length_) noexcept;
+
+		//! Give the addresses back.
+		void release() noexcept;
+
+		bool isReserved() const noexcept { return m_base != nullptr; }
+		char* data() const noexcept { return m_base; }
+		size_t size() const noexcept { return m_size; }
+
+		//! The OS page size (commit granularity).
+		static size_t pageSize() noexcept;
+
+		//! The transparent/large page size, or 0 if unavailable.
+		static size_t hugePageSize() noexcept;
+
+		//! Fault [begin_, begin_ + size_) of an existing mapping in now and
+		//! return once it's resident: MADV_POPULATE_READ where the kernel
+		//! has it, else MADV_WILLNEED to queue the I/O and a read of each
+		//! page to wait for it.
+		static void populate(const void* begin_, size_t size_) noexcept;
+	};
+
+}
@@ -0,0 +1,121 @@
+// MMapper -> Arena -- Bump allocator over a lazily committed address range.
+// Author: Oliver "kfsone" Smith 2018 <oliver@kfs.org>
+// Redistribution and re-use fully permitted contingent on inclusion of these 3 lines in copied- or derived- works.
+
+#include "arena.h"
+
+#include <algorithm>
+
+
+namespace KFS
+{
+
+	constexpr size_t Arena::c_defaultReserve;
+
+	// Commit in steps of at least this much, so the slow path is rare.
+	static constexpr size_t c_minCommitChunk{ 256 * 1024 };
+
+
+	//////////////////////////////////////////////////////////////////////
+	// Construction.
+
+	Arena::Arena(size_t reserveBytes_, bool hugePages_) MMAPPER_MAYBE_NOEXCEPT
+	{
+		// Align the range and the commit steps to the huge page size so
+		// that every committed chunk can be backed by whole huge pages.
+		const size_t hugePage = hugePages_ ? AddressRange::hugePageSize() : 0;
+		m_hugePages = hugePage != 0;
+		m_commitChunk = std::max(c_minCommitChunk, hugePage);
+
+		if (!m_range.reserve(reserveBytes_, hugePage))
+			return;
+		m_cursor = m_committed = m_range.data();
+	}
+
+
+	//////////////////////////////////////////////////////////////////////
+	// Ran out of committed space: commit more, if the reservation allows.
+
+	void* Arena::allocateSlow(size_t bytes_, size_t alignment_) noexcept
+	{
+		if (!isValid() || alignment_ == 0 || (alignment_ & (alignment_ - 1)) != 0)
+			return nullptr;
+
+		char* const base = m_range.data();
+		const size_t reserved = m_range.size();
+		const size_t cursor = static_cast<size_t>(m_cursor - base);
+		const size_t start = (cursor + alignment_ - 1) & ~(alignment_ - 1);
+		if (start < cursor || start > reserved || bytes_ > reserved - start)
+			return nullptr;
+
+		const size_t committed = bytesCommitted();
+		const size_t need = start + bytes_;
+		if (need > committed)
+		{
+			size_t target = (need + m_commitChunk - 1) / m_commitChunk * m_commitChunk;
+			target = std::min(target, reserved);
+#ifndef MMAPPER_NO_THROW
+			try
+			{
+#endif
+				if (!m_range.commit(committed, target - committed))
+					return nullptr;
+#ifndef MMAPPER_NO_THROW
+			}
+			catch (...)
+			{
+				return nullptr;
+			}
+#endif
+			if (m_hugePages)
+				m_range.adviseHugePages(committed, target - committed);
+			m_committed = base + target;
+		}
+
+		m_last = base + start;
+		m_cursor = m_last + bytes_;
+		return m_last;
+	}
+
+
+	//////////////////////////////////////////////////////////////////////
+	// Return unused committed memory.
+
+	void Arena::trim(size_t keepBytes_) noexcept
+	{
+		if (!isValid())
+			return;
+
+		const size_t keep = std::max(bytesUsed(), std::min(keepBytes_, bytesCommitted()));
+		size_t from = (keep + m_commitChunk - 1) / m_commitChunk * m_commitChunk;
+		from = std::min(from, bytesCommitted());
+		if (from == bytesCommitted())
+			return;
+
+#ifndef MMAPPER_NO_THROW
+		try
+		{
+#endif
+			if (!m_range.decommit(from, bytesCommitted() - from))
+				return;
+#ifndef MMAPPER_NO_THROW
+		}
+		catch (...)
+		{
+			return;
+		}
+#endif
+		m_committed = m_range.data() + from;
+	}
+
+
+	//////////////////////////////////////////////////////////////////////
+	// Per-thread arena.
+
+	Arena& Arena::threadLocal() noexcept
+	{
+		thread_local Arena s_arena;
+		return s_arena;
+	}
+
+}
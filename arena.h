@@ -0,0 +1,118 @@
+#pragma once
+
+// MMapper -> Arena -- Bump allocator over a lazily committed address range.
+// Author: Oliver "kfsone" Smith 2018 <oliver@kfs.org>
+// Redistribution and re-use fully permitted contingent on inclusion of these 3 lines in copied- or derived- works.
+
+#include "addressspace.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+
+
+namespace KFS
+{
+
+	//////////////////////////////////////////////////////////////////////
+	//! @class Arena
+	//! @brief Allocate-only memory for lots of small, short-lived objects -
+	//! e.g. the index a parser builds over an MMappedFile.
+	//!
+	//! @detail The arena reserves one large range of address space up
+	//! front and commits it in chunks as the cursor reaches them, advising
+	//! transparent huge pages for each chunk where available. Allocating is
+	//! a pointer bump; individual frees are no-ops (except for the most
+	//! recent allocation, which is rolled back so that a growing vector
+	//! can reuse its space). reset() throws everything away at once in
+	//! O(1) while keeping the committed pages for reuse; trim() returns
+	//! them to the OS.
+	//!
+	//! An Arena is not thread safe: use one per thread, e.g. threadLocal().
+	//! For std::pmr containers, wrap it in an ArenaResource (arenaresource.h).
+	//
+	class Arena
+	{
+		AddressRange	m_range;
+		char*			m_cursor{ nullptr };
+		char*			m_committed{ nullptr };		// end of committed space
+		char*			m_last{ nullptr };			// start of the most recent allocation
+		size_t			m_commitChunk{ 0 };
+		bool			m_hugePages{ false };
+
+	public:
+		//! Default reservation: address space is cheap on 64-bit systems.
+		static constexpr size_t c_defaultReserve{ sizeof(void*) >= 8 ? (size_t(1) << 36) : (size_t(1) << 28) };
+
+		//! Reserve 'reserveBytes_' of address space. Check isValid() in
+		//! no-throw builds.
+		//! @param[in] reserveBytes_ the most the arena can ever hand out.
+		//! @param[in] hugePages_ request transparent huge pages.
+		explicit Arena(size_t reserveBytes_ = c_defaultReserve, bool hugePages_ = true) MMAPPER_MAYBE_NOEXCEPT;
+
+		// Copying not allowed; moving would invalidate outstanding pointers
+		// held by memory resources, so that's out too.
+		Arena(const Arena&) = delete;
+		Arena& operator=(const Arena&) = delete;
+
+		bool isValid() const noexcept { return m_range.isReserved(); }
+
+		//! Get 'bytes_' of memory aligned to 'alignment_' (a power of two).
+		//! @return the memory, or nullptr if the reservation is exhausted.
+		void* allocate(size_t bytes_, size_t alignment_ = alignof(std::max_align_t)) noexcept
+		{
+			char* const start = reinterpret_cast<char*>((reinterpret_cast<uintptr_t>(m_cursor) + alignment_ - 1) & ~uintptr_t(alignment_ - 1));
+			if (start < m_cursor || start > m_committed || bytes_ > static_cast<size_t>(m_committed - start))
+				return allocateSlow(bytes_, alignment_);
+			m_cursor = start + bytes_;
+			m_last = start;
+			return start;
+		}
+
+		//! Give memory back. Only reclaims anything if it was the most
+		//! recent allocation.
+		void deallocate(void* ptr_, size_t bytes_) noexcept
+		{
+			if (ptr_ == m_last && static_cast<char*>(ptr_) + bytes_ == m_cursor)
+				m_cursor = m_last;
+		}
+
+		//! Construct a T in the arena. Its destructor will never be run.
+		template<typename T, typename... Args>
+		T* make(Args&&... args_)
+		{
+			void* const ptr = allocate(sizeof(T), alignof(T));
+			return ptr ? new (ptr) T(static_cast<Args&&>(args_)...) : nullptr;
+		}
+
+		//! Position to rewind() to, discarding everything allocated since.
+		using Marker = char*;
+		Marker mark() const noexcept { return m_cursor; }
+		void rewind(Marker marker_) noexcept { m_cursor = marker_; m_last = nullptr; }
+
+		//! Discard every allocation. O(1): committed pages are kept.
+		void reset() noexcept { rewind(m_range.data()); }
+
+		//! Decommit everything past the first 'keepBytes_' of committed
+		//! space that isn't in use, returning it to the OS.
+		void trim(size_t keepBytes_ = 0) noexcept;
+
+		size_t bytesUsed() const noexcept { return static_cast<size_t>(m_cursor - m_range.data()); }
+		size_t bytesCommitted() const noexcept { return static_cast<size_t>(m_committed - m_range.data()); }
+		size_t bytesReserved() const noexcept { return m_range.size(); }
+
+		//! Contains this pointer?
+		bool owns(const void* ptr_) const noexcept
+		{
+			return ptr_ >= m_range.data() && ptr_ < m_range.data() + m_range.size();
+		}
+
+		//! This thread's arena, created on first use with the default
+		//! reservation and released when the thread exits.
+		static Arena& threadLocal() noexcept;
+
+	private:
+		void* allocateSlow(size_t bytes_, size_t alignment_) noexcept;
+	};
+
+}
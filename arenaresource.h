@@ -0,0 +1,68 @@
+#pragma once
+
+// MMapper -> ArenaResource -- std::pmr::memory_resource over a KFS::Arena (C++17).
+// Author: Oliver "kfsone" Smith 2018 <oliver@kfs.org>
+// Redistribution and re-use fully permitted contingent on inclusion of these 3 lines in copied- or derived- works.
+
+#include "arena.h"
+
+#include <memory_resource>
+#include <new>
+
+
+namespace KFS
+{
+
+	//////////////////////////////////////////////////////////////////////
+	//! @class ArenaResource
+	//! @brief Lets std::pmr containers allocate from an Arena.
+	//!
+	//! @code
+	//!   KFS::Arena arena;
+	//!   KFS::ArenaResource resource(arena);
+	//!   std::pmr::vector<std::string_view> lines(&resource);
+	//!   ... index a mapped file ...
+	//!   arena.reset();	// after the containers are gone
+	//! @endcode
+	//!
+	//! Throws std::bad_alloc when the arena's reservation is exhausted.
+	//! Like the arena, a resource must only be used by one thread.
+	//
+	class ArenaResource final : public std::pmr::memory_resource
+	{
+		Arena&	m_arena;
+
+	public:
+		explicit ArenaResource(Arena& arena_) noexcept : m_arena(arena_) {}
+
+		Arena& arena() const noexcept { return m_arena; }
+
+		//! A resource over Arena::threadLocal().
+		static ArenaResource& threadLocal() noexcept
+		{
+			thread_local ArenaResource s_resource(Arena::threadLocal());
+			return s_resource;
+		}
+
+	protected:
+		void* do_allocate(size_t bytes_, size_t alignment_) override
+		{
+			void* const ptr = m_arena.allocate(bytes_, alignment_);
+			if (!ptr)
+				throw std::bad_alloc();
+			return ptr;
+		}
+
+		void do_deallocate(void* ptr_, size_t bytes_, size_t) override
+		{
+			m_arena.deallocate(ptr_, bytes_);
+		}
+
+		bool do_is_equal(const std::pmr::memory_resource& rhs_) const noexcept override
+		{
+			const ArenaResource* const other = dynamic_cast<const ArenaResource*>(&rhs_);
+			return other && &other->m_arena == &m_arena;
+		}
+	};
+
+}
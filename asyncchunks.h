@@ -0,0 +1,528 @@
+#pragma once
+
+// MMapper -> AsyncChunks -- Coroutine chunk streaming with the next chunks loading behind you (C++20).
+// Author: Oliver "kfsone" Smith 2018 <oliver@kfs.org>
+// Redistribution and re-use fully permitted contingent on inclusion of these 3 lines in copied- or derived- works.
+
+#include "mmapper_platform.h"
+#include "addressspace.h"
+#include "filehandle.h"
+#include "mmapper.h"
+#include "parallelchunks.h"		// For KFS::Chunk
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <condition_variable>
+#include <coroutine>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <utility>
+#include <vector>
+
+
+namespace KFS
+{
+
+	//////////////////////////////////////////////////////////////////////
+	//! @class IoExecutor
+	//! @brief A few threads that do nothing but blocking I/O - reads and
+	//! page faults - on behalf of the threads doing the work.
+	//
+	class IoExecutor
+	{
+		std::vector<std::thread>			m_threads;
+		std::mutex							m_lock;
+		std::condition_variable				m_wake;
+		std::deque<std::function<void()>>	m_jobs;
+		bool								m_stopping{ false };
+
+		void _worker() noexcept
+		{
+			std::unique_lock<std::mutex> lock(m_lock);
+			for (;;)
+			{
+				m_wake.wait(lock, [this] { return m_stopping || !m_jobs.empty(); });
+				if (m_jobs.empty())
+					return;
+				std::function<void()> job = std::move(m_jobs.front());
+				m_jobs.pop_front();
+				lock.unlock();
+				job();
+				lock.lock();
+			}
+		}
+
+	public:
+		//! I/O mostly waits on the device, so a couple of threads keep a
+		//! disk busy; more help with high-latency or parallel storage.
+		explicit IoExecutor(size_t threads_ = 2)
+		{
+			for (size_t i = 0; i < std::max<size_t>(threads_, 1); ++i)
+				m_threads.emplace_back([this] { _worker(); });
+		}
+
+		//! Finishes the jobs already posted.
+		~IoExecutor() noexcept
+		{
+			{
+				std::lock_guard<std::mutex> lock(m_lock);
+				m_stopping = true;
+			}
+			m_wake.notify_all();
+			for (std::thread& thread : m_threads)
+				thread.join();
+		}
+
+		IoExecutor(const IoExecutor&) = delete;
+		IoExecutor& operator=(const IoExecutor&) = delete;
+
+		//! A process-wide executor.
+		static IoExecutor& global()
+		{
+			static IoExecutor s_executor;
+			return s_executor;
+		}
+
+		//! Run 'job_' on one of the threads. Jobs mustn't throw.
+		void post(std::function<void()> job_)
+		{
+			{
+				std::lock_guard<std::mutex> lock(m_lock);
+				m_jobs.push_back(std::move(job_));
+			}
+			m_wake.notify_one();
+		}
+	};
+
+
+	namespace Async
+	{
+		//! Where syncWait() resumes coroutines that other threads woke, so
+		//! consumer code stays on the thread that started it.
+		class ResumeLoop
+		{
+			std::mutex							m_lock;
+			std::condition_variable				m_wake;
+			std::deque<std::coroutine_handle<>>	m_ready;
+
+		public:
+			void post(std::coroutine_handle<> handle_)
+			{
+				{
+					std::lock_guard<std::mutex> lock(m_lock);
+					m_ready.push_back(handle_);
+				}
+				m_wake.notify_one();
+			}
+
+			//! Wait for one coroutine to be posted and resume it.
+			void runOne()
+			{
+				std::unique_lock<std::mutex> lock(m_lock);
+				m_wake.wait(lock, [this] { return !m_ready.empty(); });
+				const std::coroutine_handle<> handle = m_ready.front();
+				m_ready.pop_front();
+				lock.unlock();
+				handle.resume();
+			}
+
+			//! The loop syncWait() is running on this thread, if any.
+			static ResumeLoop*& current() noexcept
+			{
+				thread_local ResumeLoop* t_current{ nullptr };
+				return t_current;
+			}
+		};
+
+		//! Resume 'handle_' on 'loop_', or right here without one.
+		inline void resumeOn(ResumeLoop* loop_, std::coroutine_handle<> handle_)
+		{
+			if (loop_)
+				loop_->post(handle_);
+			else
+				handle_.resume();
+		}
+
+		template<typename T>
+		struct TaskResult
+		{
+			std::optional<T>	m_value;
+			template<typename U>
+			void return_value(U&& value_) { m_value.emplace(std::forward<U>(value_)); }
+			T take() { return std::move(*m_value); }
+		};
+
+		template<>
+		struct TaskResult<void>
+		{
+			void return_void() noexcept {}
+			void take() noexcept {}
+		};
+	}
+
+
+	//////////////////////////////////////////////////////////////////////
+	//! @class AsyncTask
+	//! @brief A coroutine that starts when awaited (or handed to
+	//! syncWait()) and hands back a T.
+	//
+	template<typename T = void>
+	class AsyncTask
+	{
+	public:
+		struct promise_type : Async::TaskResult<T>
+		{
+			std::coroutine_handle<>	m_continuation{ std::noop_coroutine() };
+			std::exception_ptr		m_exception;
+
+			AsyncTask get_return_object() noexcept { return AsyncTask(std::coroutine_handle<promise_type>::from_promise(*this)); }
+			std::suspend_always initial_suspend() noexcept { return {}; }
+			void unhandled_exception() noexcept { m_exception = std::current_exception(); }
+
+			struct FinalAwaiter
+			{
+				bool await_ready() noexcept { return false; }
+				std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> handle_) noexcept { return handle_.promise().m_continuation; }
+				void await_resume() noexcept {}
+			};
+			FinalAwaiter final_suspend() noexcept { return {}; }
+		};
+
+	private:
+		std::coroutine_handle<promise_type>	m_handle;
+
+		explicit AsyncTask(std::coroutine_handle<promise_type> handle_) noexcept : m_handle(handle_) {}
+
+		T _result()
+		{
+			promise_type& promise = m_handle.promise();
+			if (promise.m_exception)
+				std::rethrow_exception(promise.m_exception);
+			return promise.take();
+		}
+
+		template<typename U>
+		friend U syncWait(AsyncTask<U>&& task_);
+
+	public:
+		AsyncTask(AsyncTask&& rhs_) noexcept : m_handle(std::exchange(rhs_.m_handle, nullptr)) {}
+		AsyncTask& operator=(AsyncTask&& rhs_) noexcept
+		{
+			if (this != &rhs_)
+			{
+				if (m_handle)
+					m_handle.destroy();
+				m_handle = std::exchange(rhs_.m_handle, nullptr);
+			}
+			return *this;
+		}
+		~AsyncTask() noexcept
+		{
+			if (m_handle)
+				m_handle.destroy();
+		}
+
+		//! co_await a task to run it to completion and take its result.
+		auto operator co_await() && noexcept
+		{
+			struct Awaiter
+			{
+				AsyncTask&	m_task;
+				bool await_ready() noexcept { return false; }
+				std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting_) noexcept
+				{
+					m_task.m_handle.promise().m_continuation = awaiting_;
+					return m_task.m_handle;
+				}
+				T await_resume() { return m_task._result(); }
+			};
+			return Awaiter{ *this };
+		}
+	};
+
+	//! Run 'task_' to completion on this thread and return its result.
+	//! Coroutines it awaits that are woken from other threads (an
+	//! AsyncChunkStream's loads) are resumed back here.
+	template<typename T>
+	T syncWait(AsyncTask<T>&& task_)
+	{
+		Async::ResumeLoop loop;
+		Async::ResumeLoop* const outer = std::exchange(Async::ResumeLoop::current(), &loop);
+		task_.m_handle.resume();
+		while (!task_.m_handle.done())
+			loop.runOne();
+		Async::ResumeLoop::current() = outer;
+		return task_._result();
+	}
+
+
+	//! How AsyncChunkStream cuts up and reads ahead of its input.
+	struct AsyncChunkOptions
+	{
+		//! Bytes per chunk; mapped streams round it up to whole pages.
+		size_t		chunkSize{ 4 * 1024 * 1024 };
+		//! Chunks to load ahead of the one being processed.
+		size_t		prefetch{ 4 };
+		//! Defaults to IoExecutor::global().
+		IoExecutor*	executor{ nullptr };
+	};
+
+
+	//////////////////////////////////////////////////////////////////////
+	//! @class AsyncChunkStream
+	//! @brief An async generator of a file's chunks: `co_await next()`
+	//! for each in turn while the next few load on an IoExecutor.
+	//!
+	//! @detail Walking a cold mapping synchronously, the consumer takes a
+	//! page fault every few KB and sits idle while the disk catches up;
+	//! the disk sits idle while the consumer computes. Here, while the
+	//! consumer is on chunk n, chunks n+1 to n+prefetch are being loaded:
+	//!
+	//!  - over memory (a mapping): an I/O thread faults the chunk's pages
+	//!    in (MADV_POPULATE_READ where available, else WILLNEED and a
+	//!    touch per page), so they're resident when the consumer gets there;
+	//!  - over a FileHandle: an I/O thread reads the chunk into one of
+	//!    prefetch+1 buffers, for files that can't or shouldn't be mapped.
+	//!
+	//! If the chunk asked for is still loading, the consumer suspends and
+	//! is resumed when it lands; under syncWait() that's back on the
+	//! consumer's own thread.
+	//!
+	//! @code
+	//!   KFS::AsyncTask<uint64_t> countLines(KFS::AsyncChunkStream& stream) {
+	//!       uint64_t lines = 0;
+	//!       while (auto chunk = co_await stream.next())
+	//!           lines += std::count(chunk->begin, chunk->end, '\n');
+	//!       co_return lines;
+	//!   }
+	//!   KFS::MMappedFile file("big.log");
+	//!   KFS::AsyncChunkStream stream(file);
+	//!   uint64_t lines = KFS::syncWait(countLines(stream));
+	//! @endcode
+	//!
+	//! Chunks are cut every chunkSize bytes, not on record boundaries. A
+	//! chunk is only valid until the next call to next(): its buffer (or
+	//! its place in the window) is reused. One consumer per stream, one
+	//! next() outstanding at a time, and the stream must outlive it.
+	//
+	class AsyncChunkStream
+	{
+		enum : int { Loading, Ready, Waiting };
+
+		struct Slot
+		{
+			std::atomic<int>		m_state{ Ready };
+			std::coroutine_handle<>	m_waiter;
+			Async::ResumeLoop*		m_loop{ nullptr };
+			Chunk					m_chunk{};
+			int						m_error{ 0 };
+			bool					m_short{ false };	// read hit EOF early
+			std::unique_ptr<char[]>	m_buffer;
+		};
+
+		const char*					m_begin{ nullptr };		// memory streams
+		const FileHandle*			m_file{ nullptr };		// read-backed streams
+		uint64_t					m_size{ 0 };
+		size_t						m_chunkSize{ 0 };
+		size_t						m_chunkCount{ 0 };
+		size_t						m_slotCount{ 0 };
+		std::unique_ptr<Slot[]>		m_slots;
+		IoExecutor*					m_executor{ nullptr };
+		size_t						m_next{ 0 };
+		int							m_error{ 0 };
+
+		std::mutex					m_lock;
+		std::condition_variable		m_idle;
+		size_t						m_outstanding{ 0 };
+
+		void _start(const AsyncChunkOptions& options_)
+		{
+			m_executor = options_.executor ? options_.executor : &IoExecutor::global();
+			if (m_chunkSize == 0)
+				m_chunkSize = AsyncChunkOptions{}.chunkSize;
+			m_chunkCount = static_cast<size_t>((m_size + m_chunkSize - 1) / m_chunkSize);
+			m_slotCount = options_.prefetch + 1;
+			m_slots.reset(new Slot[m_slotCount]);
+			for (size_t chunkNo = 0; chunkNo < std::min(m_slotCount, m_chunkCount); ++chunkNo)
+				_load(chunkNo);
+		}
+
+		void _load(size_t chunkNo_)
+		{
+			Slot& slot = m_slots[chunkNo_ % m_slotCount];
+			slot.m_state.store(Loading, std::memory_order_relaxed);
+			slot.m_error = 0;
+			slot.m_short = false;
+			{
+				std::lock_guard<std::mutex> lock(m_lock);
+				++m_outstanding;
+			}
+			m_executor->post([this, &slot, chunkNo_] { _loadJob(slot, chunkNo_); });
+		}
+
+		void _loadJob(Slot& slot_, size_t chunkNo_) noexcept
+		{
+			const uint64_t offset = static_cast<uint64_t>(chunkNo_) * m_chunkSize;
+			const size_t size = static_cast<size_t>(std::min<uint64_t>(m_chunkSize, m_size - offset));
+			if (m_file)
+				_read(slot_, chunkNo_, offset, size);
+			else
+				_fault(slot_, chunkNo_, m_begin + offset, size);
+
+			std::coroutine_handle<> waiter;
+			Async::ResumeLoop* loop = nullptr;
+			if (slot_.m_state.exchange(Ready, std::memory_order_acq_rel) == Waiting)
+			{
+				waiter = slot_.m_waiter;
+				loop = slot_.m_loop;
+			}
+			{
+				// Once this is down the stream may be destroyed under us.
+				std::lock_guard<std::mutex> lock(m_lock);
+				--m_outstanding;
+				m_idle.notify_all();
+			}
+			if (waiter)
+				Async::resumeOn(loop, waiter);
+		}
+
+		void _read(Slot& slot_, size_t chunkNo_, uint64_t offset_, size_t size_) noexcept
+		{
+			if (!slot_.m_buffer)
+				slot_.m_buffer.reset(new (std::nothrow) char[m_chunkSize]);
+			ptrdiff_t got = -1;
+			errno = 0;
+			if (slot_.m_buffer)
+			{
+				try
+				{
+					got = m_file->readAt(slot_.m_buffer.get(), size_, offset_);
+				}
+				catch (...)
+				{
+				}
+			}
+			else
+			{
+				errno = ENOMEM;
+			}
+			if (got < 0)
+			{
+				slot_.m_error = errno ? errno : EIO;
+				return;
+			}
+			// A file that shrank under us ends early: next() stops after
+			// this chunk.
+			slot_.m_chunk = Chunk{ chunkNo_, slot_.m_buffer.get(), slot_.m_buffer.get() + got };
+			slot_.m_short = static_cast<size_t>(got) < size_;
+		}
+
+		static void _fault(Slot& slot_, size_t chunkNo_, const char* begin_, size_t size_) noexcept
+		{
+			slot_.m_chunk = Chunk{ chunkNo_, begin_, begin_ + size_ };
+			AddressRange::populate(begin_, size_);
+		}
+
+	public:
+		//! Stream [begin_, end_) of memory that's already mapped.
+		AsyncChunkStream(const char* begin_, const char* end_, const AsyncChunkOptions& options_ = AsyncChunkOptions{})
+			: m_begin(begin_)
+			, m_size(static_cast<uint64_t>(end_ - begin_))
+		{
+			const size_t pageSize = AddressRange::pageSize();
+			m_chunkSize = (options_.chunkSize + pageSize - 1) / pageSize * pageSize;
+			_start(options_);
+		}
+
+		explicit AsyncChunkStream(const MMappedFile& file_, const AsyncChunkOptions& options_ = AsyncChunkOptions{})
+			: AsyncChunkStream(file_.begin(), file_.end(), options_)
+		{
+		}
+
+		//! Stream a file through read buffers. 'file_' must outlive the
+		//! stream; its size is taken now.
+		explicit AsyncChunkStream(const FileHandle& file_, const AsyncChunkOptions& options_ = AsyncChunkOptions{})
+			: m_file(&file_)
+			, m_size(file_.metadata().size)
+			, m_chunkSize(options_.chunkSize)
+		{
+			_start(options_);
+		}
+
+		//! Waits for loads in flight.
+		~AsyncChunkStream() noexcept
+		{
+			std::unique_lock<std::mutex> lock(m_lock);
+			m_idle.wait(lock, [this] { return m_outstanding == 0; });
+		}
+
+		AsyncChunkStream(const AsyncChunkStream&) = delete;
+		AsyncChunkStream& operator=(const AsyncChunkStream&) = delete;
+
+		size_t chunkCount() const noexcept { return m_chunkCount; }
+
+		//! Why the stream ended early (an errno value), or 0.
+		int error() const noexcept { return m_error; }
+
+		//! `co_await next()` gives the next chunk, or nullopt once the
+		//! input (or a read) runs out.
+		auto next()
+		{
+			struct Awaiter
+			{
+				AsyncChunkStream*	m_stream;
+				Slot*				m_slot;
+
+				bool await_ready() const noexcept
+				{
+					return !m_slot || m_slot->m_state.load(std::memory_order_acquire) == Ready;
+				}
+
+				bool await_suspend(std::coroutine_handle<> waiter_) noexcept
+				{
+					m_slot->m_waiter = waiter_;
+					m_slot->m_loop = Async::ResumeLoop::current();
+					int expected = Loading;
+					// Losing the race means it landed meanwhile: carry on.
+					return m_slot->m_state.compare_exchange_strong(expected, Waiting, std::memory_order_acq_rel);
+				}
+
+				std::optional<Chunk> await_resume() noexcept
+				{
+					if (!m_slot)
+						return std::nullopt;
+					if (m_slot->m_error != 0)
+					{
+						m_stream->m_error = m_slot->m_error;
+						m_stream->m_next = m_stream->m_chunkCount;
+						return std::nullopt;
+					}
+					if (m_slot->m_short)
+					{
+						m_stream->m_next = m_stream->m_chunkCount;
+						if (m_slot->m_chunk.size() == 0)
+							return std::nullopt;
+					}
+					return m_slot->m_chunk;
+				}
+			};
+
+			if (m_next >= m_chunkCount)
+				return Awaiter{ this, nullptr };
+			// The previous chunk is finished with: its slot takes the
+			// chunk at the far end of the window.
+			if (m_next > 0 && m_next - 1 + m_slotCount < m_chunkCount)
+				_load(m_next - 1 + m_slotCount);
+			return Awaiter{ this, &m_slots[m_next++ % m_slotCount] };
+		}
+	};
+
+}
@@ -0,0 +1,172 @@
+// MMapper -> BasicMappedFile -- File mapping with its behaviour chosen by compile-time policies.
+// Author: Oliver "kfsone" Smith 2018 <oliver@kfs.org>
+// Redistribution and re-use fully permitted contingent on inclusion of these 3 lines in copied- or derived- works.
+
+#include "basicmappedfile.h"
+#include "addressspace.h"
+#include "filehandle.h"
+#include "internal_includes.h"
+
+
+namespace KFS
+{
+
+	static inline long _lastError() noexcept
+	{
+#if MMAPPER_API == MMAPPER_WIN32
+		return static_cast<long>(GetLastError());
+#else
+		return errno;
+#endif
+	}
+
+	static inline void* _fail(const char* reason_, long error_, const char*& reasonOut_, long& errorOut_) noexcept
+	{
+		reasonOut_ = reason_;
+		errorOut_ = error_;
+		return nullptr;
+	}
+
+	//! Bytes of address space a mapping of 'size_' bytes occupies.
+	static inline size_t _mappedLength(size_t size_, bool terminate_) noexcept
+	{
+		const size_t page = AddressRange::pageSize();
+		return ((terminate_ ? size_ + 1 : size_) + page - 1) & ~(page - 1);
+	}
+
+
+	//////////////////////////////////////////////////////////////////////
+	// Map.
+
+	void* MappingCore::map(const filename_str_t& filename_, const Request& request_, size_t& size_,
+						   const char*& reason_, long& error_) noexcept
+	{
+		const bool writeThrough = request_.writable && !request_.privateCopy;
+		FileHandle fh{ filename_, writeThrough ? FileAccess::ReadWrite : FileAccess::ReadOnly };
+		if (!fh.isValid())
+			return _fail("unable to open file", _lastError(), reason_, error_);
+
+		const size_t size = static_cast<size_t>(fh.metadata().size);
+		void* const base = map(fh, size, request_, reason_, error_);
+		if (base)
+			size_ = size;
+		return base;
+	}
+
+	void* MappingCore::map(const FileHandle& file_, size_t size_, const Request& request_,
+						   const char*& reason_, long& error_) noexcept
+	{
+		if (!size_)
+			return _fail("trying to map zero-sized file", 0, reason_, error_);
+
+#if MMAPPER_API == MMAPPER_WIN32
+		const DWORD protect = !request_.writable ? PAGE_READONLY : request_.privateCopy ? PAGE_WRITECOPY : PAGE_READWRITE;
+		const DWORD access = !request_.writable ? FILE_MAP_READ : request_.privateCopy ? FILE_MAP_COPY : FILE_MAP_WRITE;
+		FileHandle mapFh{ CreateFileMapping(file_, NULL, protect, 0, 0, NULL) };
+		if (!mapFh.isValid())
+			return _fail("failed to create file mapping", _lastError(), reason_, error_);
+		char* const base = static_cast<char*>(MapViewOfFileEx(mapFh, access, 0, 0, 0, NULL));
+		if (!base)
+			return _fail("mapping failed", _lastError(), reason_, error_);
+
+		if (request_.lock && !VirtualLock(base, size_))
+		{
+			const long error = _lastError();
+			UnmapViewOfFile(base);
+			return _fail("unable to lock mapping", error, reason_, error_);
+		}
+		if (request_.prefault)
+		{
+			// Touch a byte per page.
+			volatile char sink = 0;
+			const size_t page = AddressRange::pageSize();
+			for (size_t offset = 0; offset < size_; offset += page)
+				sink = sink + base[offset];
+		}
+#else
+		const int prot = request_.writable ? (PROT_READ | PROT_WRITE) : PROT_READ;
+		int flags = request_.privateCopy ? MAP_PRIVATE : MAP_SHARED;
+# if defined(MAP_POPULATE)
+		if (request_.prefault)
+			flags |= MAP_POPULATE;
+# endif
+
+		const size_t page = AddressRange::pageSize();
+		const size_t length = _mappedLength(size_, request_.terminate);
+		char* base;
+		if (request_.terminate && size_ % page == 0)
+		{
+			// Mapping past EOF would fault rather than read '\0', so put a
+			// zero page after the file.
+			base = static_cast<char*>(mmap(NULL, length, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+			if (base == MAP_FAILED)
+				return _fail("unable to reserve address space", _lastError(), reason_, error_);
+			if (mmap(base, size_, prot, flags | MAP_FIXED, file_, 0) == MAP_FAILED)
+			{
+				const long error = _lastError();
+				munmap(base, length);
+				return _fail("mapping failed", error, reason_, error_);
+			}
+		}
+		else
+		{
+			base = static_cast<char*>(mmap(NULL, length, prot, flags, file_, 0));
+			if (base == MAP_FAILED)
+				return _fail("mapping failed", _lastError(), reason_, error_);
+		}
+
+# if !defined(MAP_POPULATE)
+		if (request_.prefault)
+		{
+			volatile char sink = 0;
+			for (size_t offset = 0; offset < size_; offset += page)
+				sink = sink + base[offset];
+		}
+# endif
+
+		switch (request_.advice)
+		{
+			case MapPolicy::Advice::Normal:		break;
+			case MapPolicy::Advice::Sequential:	madvise(base, length, MADV_SEQUENTIAL); break;
+			case MapPolicy::Advice::Random:		madvise(base, length, MADV_RANDOM); break;
+			case MapPolicy::Advice::WillNeed:	madvise(base, length, MADV_WILLNEED); break;
+		}
+
+		if (request_.lock && mlock(base, length) != 0)
+		{
+			const long error = _lastError();
+			munmap(base, length);
+			return _fail("unable to lock mapping", error, reason_, error_);
+		}
+#endif
+
+		return base;
+	}
+
+
+	//////////////////////////////////////////////////////////////////////
+	// Unmap and sync.
+
+	void MappingCore::unmap(void* base_, size_t size_, bool terminate_) noexcept
+	{
+#if MMAPPER_API == MMAPPER_WIN32
+		(void)size_;
+		(void)terminate_;
+		UnmapViewOfFile(base_);
+#else
+		// Also drops any lock.
+		munmap(base_, _mappedLength(size_, terminate_));
+#endif
+	}
+
+	bool MappingCore::sync(void* base_, size_t size_, bool wait_) noexcept
+	{
+#if MMAPPER_API == MMAPPER_WIN32
+		(void)wait_;
+		return FlushViewOfFile(base_, size_) != 0;
+#else
+		return msync(base_, size_, wait_ ? MS_SYNC : MS_ASYNC) == 0;
+#endif
+	}
+
+}
@@ -0,0 +1,308 @@
+#pragma once
+
+// MMapper -> BasicMappedFile -- File mapping with its behaviour chosen by compile-time policies.
+// Author: Oliver "kfsone" Smith 2018 <oliver@kfs.org>
+// Redistribution and re-use fully permitted contingent on inclusion of these 3 lines in copied- or derived- works.
+
+#include "mmapper_platform.h"
+
+#include <cstddef>
+#include <system_error>
+#include <type_traits>
+#include <utility>
+
+
+namespace KFS
+{
+
+	class FileHandle;
+
+	//////////////////////////////////////////////////////////////////////
+	// Policies for BasicMappedFile. Pass any of them, in any order; each
+	// category you leave out gets its default (marked *).
+
+	namespace MapPolicy
+	{
+		struct ErrorTag {};
+		struct AccessTag {};
+		struct PaddingTag {};
+		struct AdviceTag {};
+		struct PrefaultTag {};
+		struct LockTag {};
+
+		// Error handling.
+
+		//! * Report failure by returning false; the constructor leaves the
+		//! object unmapped.
+		struct ReturnFalse
+		{
+			using category = ErrorTag;
+			static constexpr bool c_noexcept{ true };
+			static bool fail(const char*, long) noexcept { return false; }
+		};
+
+		//! Throw std::system_error, carrying the errno/GetLastError() code.
+		struct Throw
+		{
+			using category = ErrorTag;
+			static constexpr bool c_noexcept{ false };
+			[[noreturn]] static bool fail(const char* reason_, long error_)
+			{
+				throw std::system_error(static_cast<int>(error_), std::system_category(), reason_);
+			}
+		};
+
+		// Access.
+
+		//! * Read-only, shared with other mappers of the file.
+		struct ReadOnly
+		{
+			using category = AccessTag;
+			using value_type = const char;
+			static constexpr bool c_writable{ false };
+			static constexpr bool c_private{ false };
+		};
+
+		//! Writes go to the file.
+		struct ReadWrite
+		{
+			using category = AccessTag;
+			using value_type = char;
+			static constexpr bool c_writable{ true };
+			static constexpr bool c_private{ false };
+		};
+
+		//! Writable, but writes stay in our private copy of the pages.
+		struct CopyOnWrite
+		{
+			using category = AccessTag;
+			using value_type = char;
+			static constexpr bool c_writable{ true };
+			static constexpr bool c_private{ true };
+		};
+
+		// Padding after the data.
+
+		//! * The byte at end() reads as '\0' (as MMappedFile), even when
+		//! the file fills its last page (POSIX; on Windows only when it
+		//! doesn't).
+		struct NullTerminated { using category = PaddingTag; static constexpr bool c_terminate{ true }; };
+		//! Map exactly the file; nothing past end() may be read.
+		struct Exact { using category = PaddingTag; static constexpr bool c_terminate{ false }; };
+
+		// Access pattern advice.
+
+		enum class Advice { Normal, Sequential, Random, WillNeed };
+		//! * No advice.
+		struct NormalAdvice { using category = AdviceTag; static constexpr Advice c_advice{ Advice::Normal }; };
+		struct Sequential { using category = AdviceTag; static constexpr Advice c_advice{ Advice::Sequential }; };
+		struct Random { using category = AdviceTag; static constexpr Advice c_advice{ Advice::Random }; };
+		struct WillNeed { using category = AdviceTag; static constexpr Advice c_advice{ Advice::WillNeed }; };
+
+		// Prefaulting.
+
+		//! * Pages are read in as they're touched.
+		struct Lazy { using category = PrefaultTag; static constexpr bool c_prefault{ false }; };
+		//! Read the whole file in while mapping it (MAP_POPULATE).
+		struct Prefault { using category = PrefaultTag; static constexpr bool c_prefault{ true }; };
+
+		// Locking.
+
+		//! * Pages can be evicted.
+		struct Unlocked { using category = LockTag; static constexpr bool c_lock{ false }; };
+		//! mlock()/VirtualLock() the mapping; mapping fails if we can't.
+		struct Locked { using category = LockTag; static constexpr bool c_lock{ true }; };
+
+
+		//! The first of Policies in Category, else Default.
+		template<typename Category, typename Default, typename... Policies>
+		struct Select { using type = Default; };
+
+		template<typename Category, typename Default, typename First, typename... Rest>
+		struct Select<Category, Default, First, Rest...>
+		{
+			using type = typename std::conditional<std::is_same<typename First::category, Category>::value,
+												   First, typename Select<Category, Default, Rest...>::type>::type;
+		};
+
+		//! How many of Policies are in Category.
+		template<typename Category, typename... Policies>
+		struct Count : std::integral_constant<size_t, 0> {};
+
+		template<typename Category, typename First, typename... Rest>
+		struct Count<Category, First, Rest...>
+			: std::integral_constant<size_t, (std::is_same<typename First::category, Category>::value ? 1 : 0) + Count<Category, Rest...>::value> {};
+	}
+
+
+	//////////////////////////////////////////////////////////////////////
+	//! @class MappingCore
+	//! @brief The platform work behind BasicMappedFile, compiled once
+	//! rather than per policy combination.
+	//
+	class MappingCore
+	{
+	public:
+		struct Request
+		{
+			bool				writable;
+			bool				privateCopy;
+			bool				terminate;
+			MapPolicy::Advice	advice;
+			bool				prefault;
+			bool				lock;
+		};
+
+		//! Map 'filename_' as 'request_' says.
+		//! @return the base address and sets size_, or returns nullptr and
+		//! sets reason_ and error_.
+		static void* map(const filename_str_t& filename_, const Request& request_, size_t& size_,
+						 const char*& reason_, long& error_) noexcept;
+
+		//! As map(), for a file already open (with write access if the
+		//! request needs it) whose size the caller knows.
+		static void* map(const FileHandle& file_, size_t size_, const Request& request_,
+						 const char*& reason_, long& error_) noexcept;
+
+		//! Undo map() for a file of 'size_' bytes.
+		static void unmap(void* base_, size_t size_, bool terminate_) noexcept;
+
+		//! Write dirty pages of a shared, writable mapping back to the file.
+		static bool sync(void* base_, size_t size_, bool wait_) noexcept;
+	};
+
+
+	//////////////////////////////////////////////////////////////////////
+	//! @class BasicMappedFile
+	//! @brief An RAII file mapping whose behaviour is fixed at compile
+	//! time by policies rather than by MMAPPER_NO_THROW.
+	//!
+	//! @detail
+	//!   using LogView = BasicMappedFile<MapPolicy::Throw, MapPolicy::Sequential>;
+	//!   using Table   = BasicMappedFile<MapPolicy::ReadWrite, MapPolicy::Locked>;
+	//!
+	//! Components can use different combinations in one binary. There are
+	//! no virtual functions and the object is just a pointer and a size,
+	//! so begin()/end()/size() inline to a load. The platform code lives
+	//! in the non-template MappingCore.
+	//!
+	//! BasicMappedFile<> behaves like MMappedFile: read-only, '\0' after
+	//! end(), failures reported by returning false.
+	//
+	template<typename... Policies>
+	class BasicMappedFile
+	{
+	public:
+		using ErrorPolicy = typename MapPolicy::Select<MapPolicy::ErrorTag, MapPolicy::ReturnFalse, Policies...>::type;
+		using AccessPolicy = typename MapPolicy::Select<MapPolicy::AccessTag, MapPolicy::ReadOnly, Policies...>::type;
+		using PaddingPolicy = typename MapPolicy::Select<MapPolicy::PaddingTag, MapPolicy::NullTerminated, Policies...>::type;
+		using AdvicePolicy = typename MapPolicy::Select<MapPolicy::AdviceTag, MapPolicy::NormalAdvice, Policies...>::type;
+		using PrefaultPolicy = typename MapPolicy::Select<MapPolicy::PrefaultTag, MapPolicy::Lazy, Policies...>::type;
+		using LockPolicy = typename MapPolicy::Select<MapPolicy::LockTag, MapPolicy::Unlocked, Policies...>::type;
+
+		static_assert(MapPolicy::Count<MapPolicy::ErrorTag, Policies...>::value <= 1
+					  && MapPolicy::Count<MapPolicy::AccessTag, Policies...>::value <= 1
+					  && MapPolicy::Count<MapPolicy::PaddingTag, Policies...>::value <= 1
+					  && MapPolicy::Count<MapPolicy::AdviceTag, Policies...>::value <= 1
+					  && MapPolicy::Count<MapPolicy::PrefaultTag, Policies...>::value <= 1
+					  && MapPolicy::Count<MapPolicy::LockTag, Policies...>::value <= 1,
+					  "at most one policy per category");
+
+		using value_type = typename AccessPolicy::value_type;
+		static constexpr bool c_noexcept = ErrorPolicy::c_noexcept;
+
+	private:
+		value_type*		m_base{ nullptr };
+		size_t			m_size{ 0 };
+
+		static constexpr MappingCore::Request c_request{
+			AccessPolicy::c_writable, AccessPolicy::c_private, PaddingPolicy::c_terminate,
+			AdvicePolicy::c_advice, PrefaultPolicy::c_prefault, LockPolicy::c_lock
+		};
+
+	public:
+		BasicMappedFile() noexcept = default;
+
+		explicit BasicMappedFile(const filename_str_t& filename_) noexcept(c_noexcept)
+		{
+			map(filename_);
+		}
+
+		~BasicMappedFile() noexcept { unmap(); }
+
+		// Copying not allowed.
+		BasicMappedFile(const BasicMappedFile&) = delete;
+		BasicMappedFile& operator=(const BasicMappedFile&) = delete;
+
+		// Move allowed; the source is left unmapped.
+		BasicMappedFile(BasicMappedFile&& rhs_) noexcept
+			: m_base(std::exchange(rhs_.m_base, nullptr))
+			, m_size(std::exchange(rhs_.m_size, 0))
+		{
+		}
+
+		BasicMappedFile& operator=(BasicMappedFile&& rhs_) noexcept
+		{
+			if (this != &rhs_)
+			{
+				unmap();
+				m_base = std::exchange(rhs_.m_base, nullptr);
+				m_size = std::exchange(rhs_.m_size, 0);
+			}
+			return *this;
+		}
+
+		//! Map 'filename_', replacing any current mapping.
+		//! @return true on success; failures go to the ErrorPolicy.
+		bool map(const filename_str_t& filename_) noexcept(c_noexcept)
+		{
+			unmap();
+			const char* reason = nullptr;
+			long error = 0;
+			size_t size = 0;
+			void* const base = MappingCore::map(filename_, c_request, size, reason, error);
+			if (!base)
+				return ErrorPolicy::fail(reason, error);
+			m_base = static_cast<value_type*>(base);
+			m_size = size;
+			return true;
+		}
+
+		void unmap() noexcept
+		{
+			if (!m_base)
+				return;
+			MappingCore::unmap(const_cast<char*>(m_base), m_size, PaddingPolicy::c_terminate);
+			m_base = nullptr;
+			m_size = 0;
+		}
+
+		//! Flush writes to the file (ReadWrite only); 'wait_' blocks until
+		//! they're on disk.
+		bool sync(bool wait_ = true) noexcept
+		{
+			static_assert(AccessPolicy::c_writable && !AccessPolicy::c_private, "sync() needs a ReadWrite mapping");
+			return m_base && MappingCore::sync(m_base, m_size, wait_);
+		}
+
+		//////////////////////////////////////////////////////////////////////
+		// Accessors.
+
+		bool isMapped() const noexcept { return m_base != nullptr; }
+
+		template<typename T=char>
+		auto begin() const noexcept { return reinterpret_cast<typename std::conditional<AccessPolicy::c_writable, T, const T>::type*>(m_base); }
+
+		template<typename T=char>
+		auto end() const noexcept { return reinterpret_cast<typename std::conditional<AccessPolicy::c_writable, T, const T>::type*>(m_base + m_size); }
+
+		value_type* data() const noexcept { return m_base; }
+		size_t size() const noexcept { return m_size; }
+
+		value_type& operator[](size_t offset_) const noexcept { return m_base[offset_]; }
+	};
+
+	template<typename... Policies>
+	constexpr MappingCore::Request BasicMappedFile<Policies...>::c_request;
+
+}
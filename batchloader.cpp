@@ -0,0 +1,447 @@
+// MMapper -> BatchLoader -- Load many small files with a few system calls.
+// Author: Oliver "kfsone" Smith 2018 <oliver@kfs.org>
+// Redistribution and re-use fully permitted contingent on inclusion of these 3 lines in copied- or derived- works.
+
+#include "batchloader.h"
+#include "filehandle.h"
+#include "internal_includes.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <thread>
+
+#if defined(__linux__) && defined(__has_include)
+# if __has_include(<linux/io_uring.h>)
+#  include <linux/io_uring.h>
+#  include <sys/syscall.h>
+#  include <sys/uio.h>
+// Direct (registered-slot) opens need the 5.15+ definitions.
+#  if defined(IORING_FILE_INDEX_ALLOC) && defined(__NR_io_uring_setup)
+#   define MMAPPER_BATCH_URING 1
+#  endif
+# endif
+#endif
+
+
+namespace KFS
+{
+
+	static inline long _lastError() noexcept
+	{
+#if MMAPPER_API == MMAPPER_WIN32
+		return static_cast<long>(GetLastError());
+#else
+		return errno;
+#endif
+	}
+
+	//! Read all of 'filename_' into 'buffer_' with a '\0' after it.
+	//! @return the size, or -1 having set error_.
+	static ptrdiff_t _readWhole(const filename_str_t& filename_, std::vector<char>& buffer_, long& error_) noexcept
+	{
+		try
+		{
+			FileHandle fh{ filename_ };
+			if (!fh.isValid())
+			{
+				error_ = _lastError();
+				return -1;
+			}
+			const size_t size = static_cast<size_t>(fh.metadata().size);
+			if (buffer_.size() < size + 1)
+				buffer_.resize(size + 1);
+			const ptrdiff_t got = fh.readAt(buffer_.data(), size, 0);
+			if (got < 0)
+			{
+				error_ = _lastError();
+				return -1;
+			}
+			buffer_[static_cast<size_t>(got)] = '\0';
+			return got;
+		}
+		catch (...)
+		{
+			// Throwing builds: open/read failures, or no memory.
+			error_ = EIO;
+			return -1;
+		}
+	}
+
+
+	//////////////////////////////////////////////////////////////////////
+	// The ring.
+
+#if defined(MMAPPER_BATCH_URING)
+
+	struct BatchLoader::Ring
+	{
+		enum Step : unsigned { Open, Read, Close, c_steps };
+
+		struct Slot
+		{
+			size_t			index;
+			int				results[c_steps];
+			unsigned		pending;
+		};
+
+		int					fd{ -1 };
+		void*				sqRing{ MAP_FAILED };
+		size_t				sqRingSize{ 0 };
+		void*				cqRing{ MAP_FAILED };
+		size_t				cqRingSize{ 0 };
+		io_uring_sqe*		sqes{ static_cast<io_uring_sqe*>(MAP_FAILED) };
+		size_t				sqesSize{ 0 };
+
+		unsigned*			sqTail{ nullptr };
+		unsigned			sqMask{ 0 };
+		unsigned			queuedTail{ 0 };	// published by enter()
+		unsigned*			cqHead{ nullptr };
+		unsigned*			cqTail{ nullptr };
+		unsigned			cqMask{ 0 };
+		io_uring_cqe*		cqes{ nullptr };
+
+		char*				buffers{ static_cast<char*>(MAP_FAILED) };
+		size_t				bufferStride{ 0 };
+		size_t				bufferSize{ 0 };
+		std::vector<Slot>	slots;
+		unsigned			unsubmitted{ 0 };
+
+		~Ring() noexcept
+		{
+			// Closing the ring waits out anything still in flight.
+			if (fd >= 0)
+				close(fd);
+			if (buffers != MAP_FAILED)
+				munmap(buffers, bufferStride * slots.size());
+			if (sqes != MAP_FAILED)
+				munmap(sqes, sqesSize);
+			if (cqRing != MAP_FAILED && cqRing != sqRing)
+				munmap(cqRing, cqRingSize);
+			if (sqRing != MAP_FAILED)
+				munmap(sqRing, sqRingSize);
+		}
+
+		bool setup(size_t slots_, size_t bufferSize_) noexcept
+		{
+			io_uring_params params;
+			std::memset(&params, 0, sizeof(params));
+			// Three requests per file; the kernel rounds up to a power of 2.
+			fd = static_cast<int>(syscall(__NR_io_uring_setup, static_cast<unsigned>(slots_ * c_steps), &params));
+			if (fd < 0)
+				return false;
+
+			sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+			cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+			if (params.features & IORING_FEAT_SINGLE_MMAP)
+				sqRingSize = cqRingSize = std::max(sqRingSize, cqRingSize);
+			sqRing = mmap(NULL, sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+			if (sqRing == MAP_FAILED)
+				return false;
+			cqRing = (params.features & IORING_FEAT_SINGLE_MMAP) ? sqRing
+					: mmap(NULL, cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+			if (cqRing == MAP_FAILED)
+				return false;
+			sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+			sqes = static_cast<io_uring_sqe*>(mmap(NULL, sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES));
+			if (sqes == MAP_FAILED)
+				return false;
+
+			char* const sq = static_cast<char*>(sqRing);
+			sqTail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+			queuedTail = *sqTail;
+			sqMask = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+			// Slot n of the submission array always names sqe n.
+			unsigned* const array = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+			for (unsigned entry = 0; entry < params.sq_entries; ++entry)
+				array[entry] = entry;
+			char* const cq = static_cast<char*>(cqRing);
+			cqHead = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+			cqTail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+			cqMask = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+			cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+
+			// One registered buffer and one registered file slot per file
+			// in flight.
+			slots.resize(slots_);
+			bufferSize = bufferSize_;
+			const size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+			bufferStride = (bufferSize_ + 1 + page - 1) & ~(page - 1);
+			buffers = static_cast<char*>(mmap(NULL, bufferStride * slots_, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+			if (buffers == MAP_FAILED)
+				return false;
+			std::vector<iovec> iovecs(slots_);
+			for (size_t slotNo = 0; slotNo < slots_; ++slotNo)
+				iovecs[slotNo] = iovec{ buffers + slotNo * bufferStride, bufferSize_ };
+			if (syscall(__NR_io_uring_register, fd, IORING_REGISTER_BUFFERS, iovecs.data(), static_cast<unsigned>(slots_)) != 0)
+				return false;
+			const std::vector<int> empty(slots_, -1);
+			if (syscall(__NR_io_uring_register, fd, IORING_REGISTER_FILES, empty.data(), static_cast<unsigned>(slots_)) != 0)
+				return false;
+
+			return selfTest();
+		}
+
+		//! Kernels before 5.15 reject opening into a registered slot;
+		//! find out now rather than fail every file.
+		bool selfTest() noexcept
+		{
+			io_uring_sqe* sqe = prepare(Open, 0);
+			sqe->opcode = IORING_OP_OPENAT;
+			sqe->fd = AT_FDCWD;
+			sqe->addr = reinterpret_cast<uintptr_t>("/");
+			sqe->open_flags = O_RDONLY | O_DIRECTORY;
+			sqe->file_index = 1;
+			sqe->flags = IOSQE_IO_HARDLINK;
+			sqe = prepare(Close, 0);
+			sqe->opcode = IORING_OP_CLOSE;
+			sqe->file_index = 1;
+
+			slots[0].pending = 2;
+			slots[0].results[Open] = slots[0].results[Close] = -1;
+			while (slots[0].pending)
+			{
+				if (!enter())
+					return false;
+				reap([](Slot&) {});
+			}
+			return slots[0].results[Open] == 0 && slots[0].results[Close] == 0;
+		}
+
+		io_uring_sqe* prepare(Step step_, size_t slotNo_) noexcept
+		{
+			io_uring_sqe* const sqe = &sqes[queuedTail++ & sqMask];
+			std::memset(sqe, 0, sizeof(*sqe));
+			sqe->user_data = slotNo_ * c_steps + step_;
+			++unsubmitted;
+			return sqe;
+		}
+
+		//! Queue the chain that loads 'filename_' into 'slotNo_'. Each link
+		//! is hard, so a failed open still runs (and fails) the rest and
+		//! every step completes exactly once.
+		void queue(size_t slotNo_, size_t index_, const filename_str_t& filename_) noexcept
+		{
+			Slot& slot = slots[slotNo_];
+			slot.index = index_;
+			slot.pending = c_steps;
+			const unsigned fileSlot = static_cast<unsigned>(slotNo_);
+
+			io_uring_sqe* sqe = prepare(Open, slotNo_);
+			sqe->opcode = IORING_OP_OPENAT;
+			sqe->fd = AT_FDCWD;
+			sqe->addr = reinterpret_cast<uintptr_t>(filename_.c_str());
+			sqe->open_flags = O_RDONLY;	// O_CLOEXEC is refused for slots.
+			sqe->file_index = fileSlot + 1;
+			sqe->flags = IOSQE_IO_HARDLINK;
+
+			sqe = prepare(Read, slotNo_);
+			sqe->opcode = IORING_OP_READ_FIXED;
+			sqe->fd = static_cast<int>(fileSlot);
+			sqe->addr = reinterpret_cast<uintptr_t>(buffers + slotNo_ * bufferStride);
+			sqe->len = static_cast<unsigned>(bufferSize);
+			sqe->buf_index = static_cast<uint16_t>(fileSlot);
+			sqe->flags = IOSQE_FIXED_FILE | IOSQE_IO_HARDLINK;
+
+			sqe = prepare(Close, slotNo_);
+			sqe->opcode = IORING_OP_CLOSE;
+			sqe->file_index = fileSlot + 1;
+		}
+
+		//! Submit what's queued and wait for at least one completion.
+		bool enter() noexcept
+		{
+			__atomic_store_n(sqTail, queuedTail, __ATOMIC_RELEASE);
+			for ( ; ; )
+			{
+				const long submitted = syscall(__NR_io_uring_enter, fd, unsubmitted, 1u, IORING_ENTER_GETEVENTS, NULL, 0);
+				if (submitted >= 0)
+				{
+					unsubmitted -= static_cast<unsigned>(submitted);
+					return true;
+				}
+				// Completions to reap first, or short of memory: go round.
+				if (errno == EAGAIN || errno == EBUSY || errno == ENOMEM)
+					return true;
+				if (errno != EINTR)
+					return false;
+			}
+		}
+
+		//! Record completions, calling finished_(slot) as each slot's
+		//! last step lands.
+		template<typename Finished>
+		void reap(Finished&& finished_) noexcept
+		{
+			unsigned head = *cqHead;
+			const unsigned tail = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+			for ( ; head != tail; ++head)
+			{
+				const io_uring_cqe& cqe = cqes[head & cqMask];
+				Slot& slot = slots[cqe.user_data / c_steps];
+				slot.results[cqe.user_data % c_steps] = cqe.res;
+				if (--slot.pending == 0)
+					finished_(slot);
+			}
+			__atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+		}
+	};
+
+#else
+
+	struct BatchLoader::Ring {};
+
+#endif
+
+
+	//////////////////////////////////////////////////////////////////////
+	// Lifetime.
+
+	BatchLoader::BatchLoader(BatchLoaderOptions options_) noexcept
+		: m_options(options_)
+	{
+		// More than this many registered files runs into RLIMIT_NOFILE.
+		m_options.inFlight = std::min<size_t>(std::max<size_t>(m_options.inFlight, 1), 1024);
+		m_options.bufferSize = std::min<size_t>(std::max<size_t>(m_options.bufferSize, 1), 1u << 30);
+#if defined(MMAPPER_BATCH_URING)
+		if (m_options.allowUring)
+		{
+			Ring* const ring = new (std::nothrow) Ring;
+			if (ring && ring->setup(m_options.inFlight, m_options.bufferSize))
+				m_ring = ring;
+			else
+				delete ring;
+		}
+#endif
+	}
+
+	BatchLoader::~BatchLoader() noexcept
+	{
+		delete m_ring;
+	}
+
+
+	//////////////////////////////////////////////////////////////////////
+	// Loading.
+
+	size_t BatchLoader::_load(const std::vector<filename_str_t>& files_, Thunk thunk_, void* context_) noexcept
+	{
+		if (files_.empty())
+			return 0;
+		return m_ring ? _loadWithRing(files_, thunk_, context_) : _loadWithThreads(files_, thunk_, context_);
+	}
+
+	size_t BatchLoader::_loadWithRing(const std::vector<filename_str_t>& files_, Thunk thunk_, void* context_) noexcept
+	{
+#if defined(MMAPPER_BATCH_URING)
+		Ring& ring = *m_ring;
+		std::vector<size_t> freeSlots(ring.slots.size());
+		for (size_t slotNo = 0; slotNo < freeSlots.size(); ++slotNo)
+			freeSlots[slotNo] = freeSlots.size() - 1 - slotNo;
+		std::vector<char> spill;
+		size_t next = 0, loaded = 0;
+
+		auto finished = [&](Ring::Slot& slot_) {
+			const size_t slotNo = static_cast<size_t>(&slot_ - ring.slots.data());
+			LoadedFile file{ slot_.index, nullptr, 0, 0 };
+			const int* const results = slot_.results;
+			const int failed = results[Ring::Open] < 0 ? results[Ring::Open]
+							 : results[Ring::Read] < 0 ? results[Ring::Read] : 0;
+			if (failed)
+				file.error = -failed;
+			else if (static_cast<size_t>(results[Ring::Read]) == ring.bufferSize)
+			{
+				// Filled the buffer, so there may be more: start again the
+				// ordinary way.
+				const ptrdiff_t size = _readWhole(files_[slot_.index], spill, file.error);
+				if (size >= 0)
+				{
+					file.data = spill.data();
+					file.size = static_cast<size_t>(size);
+				}
+			}
+			else
+			{
+				char* const buffer = ring.buffers + slotNo * ring.bufferStride;
+				file.size = static_cast<size_t>(results[Ring::Read]);
+				buffer[file.size] = '\0';
+				file.data = buffer;
+			}
+			loaded += file.data != nullptr;
+			thunk_(context_, file);
+			freeSlots.push_back(slotNo);
+		};
+
+		while (next < files_.size() || freeSlots.size() < ring.slots.size())
+		{
+			for ( ; next < files_.size() && !freeSlots.empty(); ++next)
+			{
+				ring.queue(freeSlots.back(), next, files_[next]);
+				freeSlots.pop_back();
+			}
+			if (!ring.enter())
+			{
+				// The ring itself is broken. Files in flight fail with it;
+				// the rest go to the threads. The ring is deliberately
+				// leaked: the kernel may yet write into its slots.
+				const long error = _lastError();
+				for (const Ring::Slot& slot : ring.slots)
+				{
+					if (slot.pending)
+						thunk_(context_, LoadedFile{ slot.index, nullptr, 0, error });
+				}
+				m_ring = nullptr;
+				const std::vector<filename_str_t> rest(files_.begin() + static_cast<ptrdiff_t>(next), files_.end());
+				const size_t offset = next;
+				auto shifted = [thunk_, context_, offset](const LoadedFile& file_) {
+					thunk_(context_, LoadedFile{ file_.index + offset, file_.data, file_.size, file_.error });
+				};
+				return loaded + (rest.empty() ? 0 : load(rest, shifted));
+			}
+			ring.reap(finished);
+		}
+		return loaded;
+#else
+		return _loadWithThreads(files_, thunk_, context_);
+#endif
+	}
+
+	size_t BatchLoader::_loadWithThreads(const std::vector<filename_str_t>& files_, Thunk thunk_, void* context_) noexcept
+	{
+		std::atomic<size_t> next{ 0 }, loaded{ 0 };
+		auto worker = [&]() noexcept {
+			std::vector<char> buffer;
+			for (size_t index = next++; index < files_.size(); index = next++)
+			{
+				LoadedFile file{ index, nullptr, 0, 0 };
+				const ptrdiff_t size = _readWhole(files_[index], buffer, file.error);
+				if (size >= 0)
+				{
+					file.data = buffer.data();
+					file.size = static_cast<size_t>(size);
+					loaded.fetch_add(1, std::memory_order_relaxed);
+				}
+				thunk_(context_, file);
+			}
+		};
+
+		size_t threadCount = m_options.threads ? m_options.threads : std::max(std::thread::hardware_concurrency(), 1u);
+		threadCount = std::min(threadCount, files_.size());
+		std::vector<std::thread> threads;
+		try
+		{
+			threads.reserve(threadCount - 1);
+			while (threads.size() + 1 < threadCount)
+				threads.emplace_back(worker);
+		}
+		catch (...)
+		{
+			// Carry on with however many we got, plus this one.
+		}
+		worker();
+		for (std::thread& thread : threads)
+			thread.join();
+		return loaded.load();
+	}
+
+}
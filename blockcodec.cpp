@@ -0,0 +1,223 @@
+// MMapper -> BlockCodec -- Small, fast LZ77 block codec (LZ4 block format).
+// Author: Oliver "kfsone" Smith 2018 <oliver@kfs.org>
+// Redistribution and re-use fully permitted contingent on inclusion of these 3 lines in copied- or derived- works.
+
+#include "blockcodec.h"
+
+#include <cstdint>
+#include <cstring>
+
+
+namespace KFS
+{
+
+	//////////////////////////////////////////////////////////////////////
+	// Format constants, as defined by the LZ4 block format description.
+
+	static constexpr size_t c_minMatch = 4;
+	static constexpr size_t c_lastLiterals = 5;		// The last 5 bytes are always literals.
+	static constexpr size_t c_matchFindLimit = 12;	// No match may start in the last 12 bytes.
+	static constexpr size_t c_maxOffset = 65535;
+	static constexpr unsigned c_hashLog = 14;
+
+
+	static inline uint32_t _read32(const uint8_t* ptr_) noexcept
+	{
+		uint32_t value;
+		std::memcpy(&value, ptr_, sizeof(value));
+		return value;
+	}
+
+	static inline uint32_t _hash(uint32_t sequence_) noexcept
+	{
+		return (sequence_ * 2654435761U) >> (32 - c_hashLog);
+	}
+
+	// Write a length continuation (the part that didn't fit in the token).
+	static inline uint8_t* _writeLength(uint8_t* op_, size_t length_) noexcept
+	{
+		for ( ; length_ >= 255; length_ -= 255)
+			*op_++ = 255;
+		*op_++ = static_cast<uint8_t>(length_);
+		return op_;
+	}
+
+
+	//////////////////////////////////////////////////////////////////////
+	// Compression.
+
+	size_t lz4CompressBlock(const void* src_, size_t srcSize_, void* dst_, size_t dstCapacity_) noexcept
+	{
+		const uint8_t* const src = static_cast<const uint8_t*>(src_);
+		uint8_t* const dst = static_cast<uint8_t*>(dst_);
+		uint8_t* op = dst;
+		uint8_t* const oend = dst + dstCapacity_;
+
+		// Conservative room check for a sequence, so the writers below
+		// don't need to check every byte.
+		auto fits = [&](size_t literals_, size_t extra_) {
+			return size_t(oend - op) >= 1 + literals_ / 255 + 1 + literals_ + extra_;
+		};
+
+		size_t anchor = 0;
+		if (srcSize_ > c_matchFindLimit)
+		{
+			uint32_t table[1u << c_hashLog];
+			std::memset(table, 0, sizeof(table));
+
+			const size_t mfLimit = srcSize_ - c_matchFindLimit;
+			const size_t matchLimit = srcSize_ - c_lastLiterals;
+
+			size_t ip = 0;
+			while (ip < mfLimit)
+			{
+				const uint32_t sequence = _read32(src + ip);
+				const uint32_t h = _hash(sequence);
+				size_t ref = table[h];
+				table[h] = static_cast<uint32_t>(ip);
+
+				if (ref >= ip || ip - ref > c_maxOffset || _read32(src + ref) != sequence)
+				{
+					// Skip faster through data that isn't compressing.
+					ip += 1 + ((ip - anchor) >> 6);
+					continue;
+				}
+
+				// Extend the match backwards over pending literals, then forwards.
+				while (ip > anchor && ref > 0 && src[ip - 1] == src[ref - 1])
+				{
+					--ip;
+					--ref;
+				}
+				size_t matchLen = c_minMatch;
+				while (ip + matchLen < matchLimit && src[ip + matchLen] == src[ref + matchLen])
+					++matchLen;
+
+				const size_t literals = ip - anchor;
+				if (!fits(literals, 2 + 1 + (matchLen - c_minMatch) / 255))
+					return 0;
+
+				const size_t tokenMatch = matchLen - c_minMatch;
+				*op++ = static_cast<uint8_t>(((literals < 15 ? literals : 15) << 4) | (tokenMatch < 15 ? tokenMatch : 15));
+				if (literals >= 15)
+					op = _writeLength(op, literals - 15);
+				std::memcpy(op, src + anchor, literals);
+				op += literals;
+
+				const size_t offset = ip - ref;
+				*op++ = static_cast<uint8_t>(offset);
+				*op++ = static_cast<uint8_t>(offset >> 8);
+				if (tokenMatch >= 15)
+					op = _writeLength(op, tokenMatch - 15);
+
+				ip += matchLen;
+				anchor = ip;
+
+				// Seed the table with a position inside the match to help
+				// the next search.
+				if (ip - 2 < mfLimit)
+					table[_hash(_read32(src + ip - 2))] = static_cast<uint32_t>(ip - 2);
+			}
+		}
+
+		// Whatever remains goes out as literals.
+		const size_t literals = srcSize_ - anchor;
+		if (!fits(literals, 0))
+			return 0;
+		*op++ = static_cast<uint8_t>((literals < 15 ? literals : 15) << 4);
+		if (literals >= 15)
+			op = _writeLength(op, literals - 15);
+		std::memcpy(op, src + anchor, literals);
+		op += literals;
+
+		return static_cast<size_t>(op - dst);
+	}
+
+
+	//////////////////////////////////////////////////////////////////////
+	// Decompression.
+
+	bool lz4DecompressBlock(const void* src_, size_t srcSize_, void* dst_, size_t dstSize_) noexcept
+	{
+		const uint8_t* ip = static_cast<const uint8_t*>(src_);
+		const uint8_t* const iend = ip + srcSize_;
+		uint8_t* const dst = static_cast<uint8_t*>(dst_);
+		uint8_t* op = dst;
+		uint8_t* const oend = dst + dstSize_;
+
+		// Read a length continuation; returns false on truncated input.
+		auto readLength = [&](size_t& length_) {
+			uint8_t b;
+			do
+			{
+				if (ip >= iend)
+					return false;
+				b = *ip++;
+				length_ += b;
+			} while (b == 255);
+			return true;
+		};
+
+		for ( ; ; )
+		{
+			if (ip >= iend)
+				return false;
+			const uint8_t token = *ip++;
+
+			size_t literals = token >> 4;
+			if (literals == 15 && !readLength(literals))
+				return false;
+			if (literals > size_t(iend - ip) || literals > size_t(oend - op))
+				return false;
+			// Short runs are the common case: a fixed-size copy is much
+			// cheaper than a variable one when there's room to overshoot.
+			if (literals <= 16 && iend - ip >= 16 && oend - op >= 16)
+				std::memcpy(op, ip, 16);
+			else
+				std::memcpy(op, ip, literals);
+			op += literals;
+			ip += literals;
+
+			// The last sequence has literals only.
+			if (ip == iend)
+				return op == oend;
+
+			if (iend - ip < 2)
+				return false;
+			const size_t offset = size_t(ip[0]) | (size_t(ip[1]) << 8);
+			ip += 2;
+			if (offset == 0 || offset > size_t(op - dst))
+				return false;
+
+			size_t matchLen = token & 15;
+			if (matchLen == 15 && !readLength(matchLen))
+				return false;
+			matchLen += c_minMatch;
+			if (matchLen > size_t(oend - op))
+				return false;
+
+			const uint8_t* match = op - offset;
+			uint8_t* const end = op + matchLen;
+			if (offset >= 8 && size_t(oend - end) >= 8)
+			{
+				// 8-byte steps never read bytes the same step writes, so this
+				// is also correct for overlapping matches; it may write up to
+				// 7 bytes past the match, which later sequences overwrite.
+				do
+				{
+					std::memcpy(op, match, 8);
+					op += 8;
+					match += 8;
+				} while (op < end);
+				op = end;
+			}
+			else
+			{
+				// Near the end of the block, or a short repeating pattern.
+				while (op < end)
+					*op++ = *match++;
+			}
+		}
+	}
+
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+// MMapper -> BlockCodec -- Small, fast LZ77 block codec (LZ4 block format).
+// Author: Oliver "kfsone" Smith 2018 <oliver@kfs.org>
+// Redistribution and re-use fully permitted contingent on inclusion of these 3 lines in copied- or derived- works.
+
+#include <cstddef>
+
+
+namespace KFS
+{
+
+	//////////////////////////////////////////////////////////////////////
+	// A self-contained compressor/decompressor producing the LZ4 *block*
+	// format (no frame headers or checksums), so blocks can also be read
+	// with the reference LZ4_decompress_safe(). It favours speed over
+	// ratio: greedy matching, one 16K-entry hash table, 64KB window.
+	//
+	// Both functions work on whole blocks held in memory; callers are
+	// expected to split their data into independent blocks.
+
+	//! Worst-case compressed size of 'srcSize_' bytes.
+	constexpr size_t lz4CompressBound(size_t srcSize_) noexcept { return srcSize_ + srcSize_ / 255 + 16; }
+
+	//! Compress a block.
+	//! @return number of bytes written to dst_, or 0 if it didn't fit in dstCapacity_.
+	size_t lz4CompressBlock(const void* src_, size_t srcSize_, void* dst_, size_t dstCapacity_) noexcept;
+
+	//! Decompress a block that must expand to exactly dstSize_ bytes.
+	//! Malformed input is detected; it never reads or writes out of bounds.
+	//! @return true on success.
+	bool lz4DecompressBlock(const void* src_, size_t srcSize_, void* dst_, size_t dstSize_) noexcept;
+
+}
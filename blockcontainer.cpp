@@ -0,0 +1,276 @@
+// MMapper -> BlockContainer -- Seekable block-compressed files read through a mapping.
+// Author: Oliver "kfsone" Smith 2018 <oliver@kfs.org>
+// Redistribution and re-use fully permitted contingent on inclusion of these 3 lines in copied- or derived- works.
+
+#include "blockcontainer.h"
+#include "blockcodec.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+
+namespace KFS
+{
+
+	constexpr char BlockContainerHeader::c_magic[8];
+	constexpr uint32_t BlockContainerHeader::c_version;
+	constexpr uint32_t BlockContainerHeader::c_byteOrderMark;
+
+
+	static inline bool _fail(const char* reason_) MMAPPER_MAYBE_NOEXCEPT
+	{
+#ifndef MMAPPER_NO_THROW
+		throw std::runtime_error(reason_);
+#endif
+		(void)reason_;
+		return false;
+	}
+
+
+	//////////////////////////////////////////////////////////////////////
+	// Writer.
+
+	bool writeBlockContainer(const filename_str_t& output_, const void* data_, size_t size_, uint32_t blockSize_) MMAPPER_MAYBE_NOEXCEPT
+	{
+		if (blockSize_ == 0)
+			return _fail("block size must be non-zero");
+
+		std::ofstream out(output_, std::ios::binary | std::ios::trunc);
+		if (!out)
+			return _fail("unable to create block container");
+
+		const uint64_t blockCount = (size_ + blockSize_ - 1) / blockSize_;
+
+		BlockContainerHeader header{};
+		std::memcpy(header.magic, BlockContainerHeader::c_magic, sizeof(header.magic));
+		header.version = BlockContainerHeader::c_version;
+		header.byteOrder = BlockContainerHeader::c_byteOrderMark;
+		header.blockSize = blockSize_;
+		header.codec = BlockCodec::LZ4;
+		header.rawSize = size_;
+		header.blockCount = blockCount;
+
+		// Placeholder header; rewritten once the index offset is known.
+		out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+		std::vector<uint64_t> index;
+		index.reserve(static_cast<size_t>(blockCount) + 1);
+		std::unique_ptr<char[]> scratch(new char[lz4CompressBound(blockSize_)]);
+
+		uint64_t position = sizeof(header);
+		const char* const data = static_cast<const char*>(data_);
+		for (uint64_t blockNo = 0; blockNo < blockCount; ++blockNo)
+		{
+			const size_t offset = static_cast<size_t>(blockNo * blockSize_);
+			const size_t rawLen = std::min<size_t>(blockSize_, size_ - offset);
+
+			// Only keep the compressed form if it's actually smaller; the
+			// reader recognizes stored blocks by their length.
+			size_t packedLen = lz4CompressBlock(data + offset, rawLen, scratch.get(), rawLen - 1);
+			index.push_back(position);
+			if (packedLen != 0)
+				out.write(scratch.get(), packedLen);
+			else
+			{
+				packedLen = rawLen;
+				out.write(data + offset, rawLen);
+			}
+			position += packedLen;
+		}
+		index.push_back(position);
+
+		// Keep the index 8-byte aligned so it can be used in place.
+		static const char padding[8]{};
+		const size_t padLen = static_cast<size_t>((8 - position % 8) % 8);
+		out.write(padding, padLen);
+		header.indexOffset = position + padLen;
+		out.write(reinterpret_cast<const char*>(index.data()), index.size() * sizeof(uint64_t));
+
+		out.seekp(0);
+		out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		out.close();
+		if (!out)
+			return _fail("failed writing block container");
+
+		return true;
+	}
+
+
+	//////////////////////////////////////////////////////////////////////
+	// Reader.
+
+	bool BlockCompressedFile::open(filename_str_t filename_, size_t cacheBlocks_) MMAPPER_MAYBE_NOEXCEPT
+	{
+		close();
+
+		if (!m_file.mapFile(std::move(filename_)))
+			return false;
+
+		const BlockContainerHeader* header = m_file.begin<BlockContainerHeader>();
+		if (m_file.size() < sizeof(BlockContainerHeader)
+			|| std::memcmp(header->magic, BlockContainerHeader::c_magic, sizeof(header->magic)) != 0
+			|| header->version != BlockContainerHeader::c_version)
+		{
+			close();
+			return _fail("not a block container");
+		}
+		if (header->byteOrder != BlockContainerHeader::c_byteOrderMark)
+		{
+			close();
+			return _fail("block container was written with a different byte order");
+		}
+		if (header->codec != BlockCodec::LZ4 || header->blockSize == 0
+			|| header->blockCount != (header->rawSize + header->blockSize - 1) / header->blockSize)
+		{
+			close();
+			return _fail("block container header is corrupt");
+		}
+
+		m_index = MappedArray<uint64_t>(m_file, static_cast<size_t>(header->indexOffset), static_cast<size_t>(header->blockCount + 1));
+		if (!m_index.isValid())
+		{
+			close();
+			return false;
+		}
+
+		// Check the index once here so block() can trust it.
+		for (size_t i = 0; i < m_index.size(); ++i)
+		{
+			const uint64_t start = m_index[i];
+			if (start < sizeof(BlockContainerHeader) || start > header->indexOffset || (i > 0 && start < m_index[i - 1]))
+			{
+				close();
+				return _fail("block container index is corrupt");
+			}
+		}
+
+		m_header = header;
+		m_cache.resize(std::max<size_t>(cacheBlocks_, 1));
+		return true;
+	}
+
+
+	void BlockCompressedFile::close() noexcept
+	{
+		m_header = nullptr;
+		m_index = MappedArray<uint64_t>{};
+		m_cache.clear();
+		m_useCounter = 0;
+		m_lastBlock = ~uint64_t(0);
+		m_lastData = nullptr;
+		m_lastSize = 0;
+		if (m_file.isMapped())
+			m_file.unmapFile();
+	}
+
+
+	const char* BlockCompressedFile::block(size_t blockNo_, size_t& size_) MMAPPER_MAYBE_NOEXCEPT
+	{
+		if (blockNo_ == m_lastBlock)
+		{
+			size_ = m_lastSize;
+			return m_lastData;
+		}
+		if (!m_header || blockNo_ >= m_header->blockCount)
+		{
+			size_ = 0;
+			_fail("block number out of range");
+			return nullptr;
+		}
+
+		const char* data = decompress(blockNo_, size_);
+		if (data)
+		{
+			m_lastBlock = blockNo_;
+			m_lastData = data;
+			m_lastSize = size_;
+		}
+		return data;
+	}
+
+
+	const char* BlockCompressedFile::decompress(size_t blockNo_, size_t& size_) MMAPPER_MAYBE_NOEXCEPT
+	{
+		const uint64_t blockSize = m_header->blockSize;
+		const size_t rawLen = static_cast<size_t>(std::min<uint64_t>(blockSize, m_header->rawSize - blockNo_ * blockSize));
+		const char* const stored = m_file.begin() + m_index[blockNo_];
+		const size_t storedLen = static_cast<size_t>(m_index[blockNo_ + 1] - m_index[blockNo_]);
+
+		size_ = rawLen;
+
+		// Incompressible blocks come straight from the mapping.
+		if (storedLen == rawLen)
+			return stored;
+
+		// Find the block in the cache, or the least recently used slot.
+		CacheSlot* victim = &m_cache.front();
+		for (CacheSlot& slot : m_cache)
+		{
+			if (slot.block == blockNo_)
+			{
+				slot.lastUse = ++m_useCounter;
+				return slot.buffer.get();
+			}
+			if (slot.lastUse < victim->lastUse)
+				victim = &slot;
+		}
+
+		if (!victim->buffer)
+			victim->buffer.reset(new char[static_cast<size_t>(blockSize)]);
+
+		// The slot is being reused; forget what it held before trying to decode.
+		if (victim->block == m_lastBlock)
+			m_lastBlock = ~uint64_t(0);
+		victim->block = ~uint64_t(0);
+
+		if (!lz4DecompressBlock(stored, storedLen, victim->buffer.get(), rawLen))
+		{
+			size_ = 0;
+			_fail("block container data is corrupt");
+			return nullptr;
+		}
+
+		victim->block = blockNo_;
+		victim->lastUse = ++m_useCounter;
+		return victim->buffer.get();
+	}
+
+
+	const char* BlockCompressedFile::span(size_t offset_, size_t& available_) MMAPPER_MAYBE_NOEXCEPT
+	{
+		available_ = 0;
+		if (!m_header || offset_ >= m_header->rawSize)
+			return nullptr;
+
+		const size_t blockNo = static_cast<size_t>(offset_ / m_header->blockSize);
+		const size_t within = static_cast<size_t>(offset_ - uint64_t(blockNo) * m_header->blockSize);
+		size_t size;
+		const char* data = block(blockNo, size);
+		if (!data)
+			return nullptr;
+
+		available_ = size - within;
+		return data + within;
+	}
+
+
+	size_t BlockCompressedFile::read(void* dst_, size_t length_, size_t offset_) MMAPPER_MAYBE_NOEXCEPT
+	{
+		char* dst = static_cast<char*>(dst_);
+		size_t copied = 0;
+		while (copied < length_)
+		{
+			size_t available;
+			const char* src = span(offset_ + copied, available);
+			if (!src)
+				break;
+			const size_t n = std::min(available, length_ - copied);
+			std::memcpy(dst + copied, src, n);
+			copied += n;
+		}
+		return copied;
+	}
+
+}
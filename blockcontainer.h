@@ -0,0 +1,247 @@
+#pragma once
+
+// MMapper -> BlockContainer -- Seekable block-compressed files read through a mapping.
+// Author: Oliver "kfsone" Smith 2018 <oliver@kfs.org>
+// Redistribution and re-use fully permitted contingent on inclusion of these 3 lines in copied- or derived- works.
+
+#include "mmapper.h"
+#include "mappedarray.h"
+
+#include <cstdint>
+#include <iterator>
+#include <memory>
+#include <utility>
+#include <vector>
+
+
+namespace KFS
+{
+
+	//////////////////////////////////////////////////////////////////////
+	// On-disk format.
+	//
+	// [BlockContainerHeader][block 0]...[block N-1][pad to 8][index]
+	//
+	// The raw data is cut into fixed-size blocks (the last may be short)
+	// which are compressed independently. The index holds blockCount + 1
+	// file offsets, so block i occupies [index[i], index[i+1]). A block
+	// whose stored size equals its raw size was incompressible and is
+	// stored as-is; readers use those straight from the mapping.
+
+	enum class BlockCodec : uint32_t
+	{
+		Stored = 0,		// No compression.
+		LZ4 = 1,		// LZ4 block format, see blockcodec.h
+	};
+
+	struct BlockContainerHeader
+	{
+		static constexpr char c_magic[8]{ 'K', 'F', 'S', 'B', 'L', 'K', '0', '1' };
+		static constexpr uint32_t c_version{ 1 };
+		static constexpr uint32_t c_byteOrderMark{ 0x01020304 };
+
+		char		magic[8];
+		uint32_t	version;
+		uint32_t	byteOrder;
+		uint32_t	blockSize;
+		BlockCodec	codec;
+		uint64_t	rawSize;
+		uint64_t	blockCount;
+		uint64_t	indexOffset;
+		uint64_t	reserved[2];
+	};
+	static_assert(sizeof(BlockContainerHeader) == 64, "BlockContainerHeader layout changed");
+
+	//! Default block size: large enough to amortize per-block overhead,
+	//! small enough that a random read doesn't decompress much waste.
+	constexpr uint32_t c_defaultContainerBlockSize{ 64 * 1024 };
+
+
+	//////////////////////////////////////////////////////////////////////
+	//! Compress a buffer into a block container file.
+	//!
+	//! @param[in] output_ the container file to create.
+	//! @param[in] data_, size_ the raw bytes.
+	//! @param[in] blockSize_ [optional] uncompressed size of each block.
+	//! @return true on success, false (or throw) on failure.
+	bool writeBlockContainer(const filename_str_t& output_, const void* data_, size_t size_,
+							 uint32_t blockSize_ = c_defaultContainerBlockSize) MMAPPER_MAYBE_NOEXCEPT;
+
+	//! Compress a mapped file into a block container file.
+	inline bool writeBlockContainer(const filename_str_t& output_, const MMappedFile& input_,
+									uint32_t blockSize_ = c_defaultContainerBlockSize) MMAPPER_MAYBE_NOEXCEPT
+	{
+		return writeBlockContainer(output_, input_.begin(), input_.size(), blockSize_);
+	}
+
+
+	//////////////////////////////////////////////////////////////////////
+	//! @class BlockCompressedFile
+	//! @brief Random access to the uncompressed contents of a block
+	//! container, decompressing blocks on demand.
+	//!
+	//! @detail The container is mapped with MMappedFile; decompressed
+	//! blocks are kept in a small LRU cache whose buffers are allocated
+	//! once and reused, so steady-state reads don't allocate.
+	//!
+	//! Pointers returned by block()/span() remain valid until the block
+	//! is evicted, i.e. until 'cacheBlocks' other blocks have been
+	//! touched. The cache makes instances single-threaded: give each
+	//! thread its own BlockCompressedFile (they share the page cache).
+	//
+	class BlockCompressedFile
+	{
+		struct CacheSlot
+		{
+			uint64_t					block{ ~uint64_t(0) };
+			uint64_t					lastUse{ 0 };
+			std::unique_ptr<char[]>		buffer{};
+		};
+
+		MMappedFile					m_file{};
+		const BlockContainerHeader*	m_header{ nullptr };
+		MappedArray<uint64_t>		m_index{};
+		std::vector<CacheSlot>		m_cache{};
+		uint64_t					m_useCounter{ 0 };
+
+		// Fast path for sequential access: the block we returned last.
+		uint64_t					m_lastBlock{ ~uint64_t(0) };
+		const char*					m_lastData{ nullptr };
+		size_t						m_lastSize{ 0 };
+
+	public:
+		BlockCompressedFile() noexcept = default;
+		explicit BlockCompressedFile(filename_str_t filename_, size_t cacheBlocks_ = 16) MMAPPER_MAYBE_NOEXCEPT
+		{
+			open(std::move(filename_), cacheBlocks_);
+		}
+
+		// Pointers into the cache make copies dangerous.
+		BlockCompressedFile(const BlockCompressedFile&) = delete;
+		BlockCompressedFile& operator=(const BlockCompressedFile&) = delete;
+
+		// Move allowed; the cache buffers move with it, and the source is
+		// left closed.
+		BlockCompressedFile(BlockCompressedFile&& rhs_) noexcept
+			: m_file(std::move(rhs_.m_file))
+			, m_header(std::exchange(rhs_.m_header, nullptr))
+			, m_index(std::exchange(rhs_.m_index, MappedArray<uint64_t>{}))
+			, m_cache(std::move(rhs_.m_cache))
+			, m_useCounter(std::exchange(rhs_.m_useCounter, 0))
+			, m_lastBlock(std::exchange(rhs_.m_lastBlock, ~uint64_t(0)))
+			, m_lastData(std::exchange(rhs_.m_lastData, nullptr))
+			, m_lastSize(std::exchange(rhs_.m_lastSize, 0))
+		{
+			rhs_.m_cache.clear();
+		}
+
+		BlockCompressedFile& operator=(BlockCompressedFile&& rhs_) noexcept
+		{
+			if (this != &rhs_)
+			{
+				close();
+				m_file = std::move(rhs_.m_file);
+				m_header = std::exchange(rhs_.m_header, nullptr);
+				m_index = std::exchange(rhs_.m_index, MappedArray<uint64_t>{});
+				m_cache = std::move(rhs_.m_cache);
+				rhs_.m_cache.clear();
+				m_useCounter = std::exchange(rhs_.m_useCounter, 0);
+				m_lastBlock = std::exchange(rhs_.m_lastBlock, ~uint64_t(0));
+				m_lastData = std::exchange(rhs_.m_lastData, nullptr);
+				m_lastSize = std::exchange(rhs_.m_lastSize, 0);
+			}
+			return *this;
+		}
+
+		//! Map and validate a container.
+		//! @param[in] cacheBlocks_ number of decompressed blocks to keep.
+		bool open(filename_str_t filename_, size_t cacheBlocks_ = 16) MMAPPER_MAYBE_NOEXCEPT;
+		void close() noexcept;
+
+		bool isOpen() const noexcept { return m_header != nullptr; }
+		const filename_str_t& filename() const noexcept { return m_file.filename(); }
+
+		//! Uncompressed size of the contents.
+		size_t size() const noexcept { return m_header ? static_cast<size_t>(m_header->rawSize) : 0; }
+		size_t blockSize() const noexcept { return m_header ? m_header->blockSize : 0; }
+		size_t blockCount() const noexcept { return m_header ? static_cast<size_t>(m_header->blockCount) : 0; }
+		//! Bytes the container occupies on disk.
+		size_t storedSize() const noexcept { return m_file.size(); }
+
+		//! Get the decompressed contents of a block.
+		//! @param[out] size_ the block's size (blockSize() except for the last).
+		//! @return pointer to the data, or nullptr if the block is corrupt.
+		const char* block(size_t blockNo_, size_t& size_) MMAPPER_MAYBE_NOEXCEPT;
+
+		//! Get contiguous bytes starting at an offset, without copying.
+		//! @param[out] available_ how many bytes are readable from the pointer
+		//!   (up to the end of the containing block).
+		const char* span(size_t offset_, size_t& available_) MMAPPER_MAYBE_NOEXCEPT;
+
+		//! Copy bytes out of the container, like pread().
+		//! @return number of bytes copied; short only at the end of the data.
+		size_t read(void* dst_, size_t length_, size_t offset_) MMAPPER_MAYBE_NOEXCEPT;
+
+		//! Single byte access; offset_ must be < size().
+		//! A corrupt block reads as zeros in no-throw mode.
+		char operator[](size_t offset_) MMAPPER_MAYBE_NOEXCEPT
+		{
+			const uint64_t blockNo = offset_ / m_header->blockSize;
+			size_t size;
+			if (blockNo != m_lastBlock && !block(static_cast<size_t>(blockNo), size))
+				return '\0';
+			return m_lastData[offset_ - blockNo * m_header->blockSize];
+		}
+
+		//////////////////////////////////////////////////////////////////////
+		//! Random-access iterator over the uncompressed bytes, so code written
+		//! against a plain mapping's begin()/end() can run on a container.
+		class const_iterator
+		{
+			BlockCompressedFile*	m_owner{ nullptr };
+			size_t					m_offset{ 0 };
+
+		public:
+			using iterator_category = std::random_access_iterator_tag;
+			using value_type = char;
+			using difference_type = ptrdiff_t;
+			using pointer = void;
+			using reference = char;
+
+			const_iterator() noexcept = default;
+			const_iterator(BlockCompressedFile* owner_, size_t offset_) noexcept : m_owner(owner_), m_offset(offset_) {}
+
+			char operator*() const { return (*m_owner)[m_offset]; }
+			char operator[](difference_type n_) const { return (*m_owner)[m_offset + n_]; }
+
+			const_iterator& operator++() noexcept { ++m_offset; return *this; }
+			const_iterator operator++(int) noexcept { const_iterator t{ *this }; ++m_offset; return t; }
+			const_iterator& operator--() noexcept { --m_offset; return *this; }
+			const_iterator operator--(int) noexcept { const_iterator t{ *this }; --m_offset; return t; }
+			const_iterator& operator+=(difference_type n_) noexcept { m_offset += n_; return *this; }
+			const_iterator& operator-=(difference_type n_) noexcept { m_offset -= n_; return *this; }
+			friend const_iterator operator+(const_iterator it_, difference_type n_) noexcept { return it_ += n_; }
+			friend const_iterator operator+(difference_type n_, const_iterator it_) noexcept { return it_ += n_; }
+			friend const_iterator operator-(const_iterator it_, difference_type n_) noexcept { return it_ -= n_; }
+			friend difference_type operator-(const_iterator lhs_, const_iterator rhs_) noexcept
+			{
+				return difference_type(lhs_.m_offset) - difference_type(rhs_.m_offset);
+			}
+			friend bool operator==(const_iterator lhs_, const_iterator rhs_) noexcept { return lhs_.m_offset == rhs_.m_offset; }
+			friend bool operator!=(const_iterator lhs_, const_iterator rhs_) noexcept { return lhs_.m_offset != rhs_.m_offset; }
+			friend bool operator<(const_iterator lhs_, const_iterator rhs_) noexcept { return lhs_.m_offset < rhs_.m_offset; }
+			friend bool operator>(const_iterator lhs_, const_iterator rhs_) noexcept { return lhs_.m_offset > rhs_.m_offset; }
+			friend bool operator<=(const_iterator lhs_, const_iterator rhs_) noexcept { return lhs_.m_offset <= rhs_.m_offset; }
+			friend bool operator>=(const_iterator lhs_, const_iterator rhs_) noexcept { return lhs_.m_offset >= rhs_.m_offset; }
+
+			size_t offset() const noexcept { return m_offset; }
+		};
+
+		const_iterator begin() noexcept { return const_iterator(this, 0); }
+		const_iterator end() noexcept { return const_iterator(this, size()); }
+
+	private:
+		const char* decompress(size_t blockNo_, size_t& size_) MMAPPER_MAYBE_NOEXCEPT;
+	};
+
+}
@@ -0,0 +1,220 @@
+// MMapper -> CdcChunker -- FastCDC content-defined chunking of a mapping, with chunk digests.
+// Author: Oliver "kfsone" Smith 2018 <oliver@kfs.org>
+// Redistribution and re-use fully permitted contingent on inclusion of these 3 lines in copied- or derived- works.
+
+#include "cdcchunker.h"
+#include "parallelchunks.h"
+
+#include <algorithm>
+
+#include "3rdParty/xxhash.hpp"
+
+
+namespace KFS
+{
+
+	//////////////////////////////////////////////////////////////////////
+	// Gear tables: 256 random 64-bit values (splitmix64), and the same
+	// shifted left one, for rolling two bytes at once.
+
+	struct GearTables
+	{
+		uint64_t	gear[256]{};
+		uint64_t	gearLS[256]{};
+
+		constexpr GearTables() noexcept
+		{
+			uint64_t state = 0x4b46534344433031ULL;	// "KFSCDC01"
+			for (size_t i = 0; i < 256; ++i)
+			{
+				uint64_t z = (state += 0x9e3779b97f4a7c15ULL);
+				z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+				z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+				gear[i] = z ^ (z >> 31);
+				gearLS[i] = gear[i] << 1;
+			}
+		}
+	};
+	static constexpr GearTables s_tables{};
+
+	// Chunks' digests are hashed in groups of this many per task.
+	static constexpr size_t c_digestGroup = 256;
+
+
+	//! 'bits' one bits just below the top bit: the top bits of a Gear hash
+	//! depend on the most bytes, and leaving bit 63 out lets the two-byte
+	//! step test a shifted hash against a shifted mask exactly.
+	static uint64_t _mask(unsigned bits_) noexcept
+	{
+		bits_ = std::min(std::max(bits_, 1u), 62u);
+		return ((uint64_t(1) << bits_) - 1) << (63 - bits_);
+	}
+
+
+	CdcChunker::CdcChunker(CdcOptions options_) noexcept
+		: m_options(options_)
+	{
+		unsigned bits = 1;
+		while (bits < 62 && (size_t(1) << bits) < m_options.avgSize)
+			++bits;
+		m_options.avgSize = size_t(1) << bits;
+		m_options.minSize = std::min(std::max<size_t>(m_options.minSize, 64), m_options.avgSize);
+		m_options.maxSize = std::max(m_options.maxSize, m_options.avgSize);
+		m_options.normalization = std::min(m_options.normalization, 3u);
+		if (m_options.segmentSize != 0)
+			m_options.segmentSize = std::max(m_options.segmentSize, m_options.maxSize * 4);
+		m_maskS = _mask(bits + m_options.normalization);
+		m_maskL = _mask(bits > m_options.normalization ? bits - m_options.normalization : 1);
+	}
+
+
+	//////////////////////////////////////////////////////////////////////
+	// One cut.
+
+	size_t CdcChunker::cut(const char* begin_, const char* end_) const noexcept
+	{
+		const size_t size = static_cast<size_t>(end_ - begin_);
+		if (size <= m_options.minSize)
+			return size;
+
+		const uint8_t* const data = reinterpret_cast<const uint8_t*>(begin_);
+		const size_t normal = std::min(m_options.avgSize, size);
+		const size_t limit = std::min(m_options.maxSize, size);
+		const uint64_t* const gear = s_tables.gear;
+		const uint64_t* const gearLS = s_tables.gearLS;
+		uint64_t hash = 0;
+		size_t at = m_options.minSize;
+
+		// Two bytes per step: hash << 2 plus the first byte's gear << 1 is
+		// the hash after that byte, shifted left one, so it's tested
+		// against the mask shifted too; the second byte makes it the true
+		// hash again.
+		const uint64_t maskSLS = m_maskS << 1;
+		for ( ; at + 2 <= normal; at += 2)
+		{
+			hash = (hash << 2) + gearLS[data[at]];
+			if ((hash & maskSLS) == 0)
+				return at + 1;
+			hash += gear[data[at + 1]];
+			if ((hash & m_maskS) == 0)
+				return at + 2;
+		}
+		if (at < normal)
+		{
+			hash = (hash << 1) + gear[data[at++]];
+			if ((hash & m_maskS) == 0)
+				return at;
+		}
+
+		const uint64_t maskLLS = m_maskL << 1;
+		for ( ; at + 2 <= limit; at += 2)
+		{
+			hash = (hash << 2) + gearLS[data[at]];
+			if ((hash & maskLLS) == 0)
+				return at + 1;
+			hash += gear[data[at + 1]];
+			if ((hash & m_maskL) == 0)
+				return at + 2;
+		}
+		if (at < limit)
+		{
+			hash = (hash << 1) + gear[data[at++]];
+			if ((hash & m_maskL) == 0)
+				return at;
+		}
+		return limit;
+	}
+
+
+	//////////////////////////////////////////////////////////////////////
+	// Cut [from_, size_) of begin_, stopping at the first cut at or past
+	// stopAfter_. Returns the end of each chunk.
+
+	std::vector<uint64_t> CdcChunker::_cuts(const char* begin_, size_t from_, size_t stopAfter_, size_t size_) const
+	{
+		std::vector<uint64_t> cuts;
+		cuts.reserve((stopAfter_ - from_) / m_options.avgSize + 2);
+		for (size_t at = from_; at < size_ && (cuts.empty() || cuts.back() < stopAfter_); )
+		{
+			at += cut(begin_ + at, begin_ + size_);
+			cuts.push_back(at);
+		}
+		return cuts;
+	}
+
+
+	std::vector<CdcChunk> CdcChunker::chunk(const char* begin_, const char* end_) const
+	{
+		const size_t size = static_cast<size_t>(end_ - begin_);
+		std::vector<uint64_t> cuts;
+		if (m_options.segmentSize == 0 || size <= m_options.segmentSize)
+		{
+			cuts = _cuts(begin_, 0, size, size);
+		}
+		else
+		{
+			// Each segment's cuts, from its own start to just past its end.
+			const size_t segmentSize = m_options.segmentSize;
+			const size_t segments = (size + segmentSize - 1) / segmentSize;
+			std::vector<std::vector<uint64_t>> segmentCuts(segments);
+			ChunkOptions options;
+			options.chunkSize = segmentSize;
+			parallelForChunks(begin_, end_, [&](const Chunk& segment_) {
+				const size_t from = static_cast<size_t>(segment_.begin - begin_);
+				segmentCuts[segment_.index] = _cuts(begin_, from, static_cast<size_t>(segment_.end - begin_), size);
+			}, options);
+
+			// Stitch them: from the last true cut, follow the chain into
+			// the next segment until it meets one of that segment's cuts.
+			cuts.reserve(size / m_options.avgSize + segments);
+			uint64_t at = 0;
+			for (size_t segmentNo = 0; segmentNo < segments; ++segmentNo)
+			{
+				const std::vector<uint64_t>& candidates = segmentCuts[segmentNo];
+				const uint64_t segmentEnd = std::min<uint64_t>((segmentNo + 1) * uint64_t(segmentSize), size);
+				if (at >= segmentEnd)
+					continue;
+				auto adopt = [&](std::vector<uint64_t>::const_iterator from_) {
+					cuts.insert(cuts.end(), from_, candidates.end());
+					at = candidates.back();
+				};
+				if (at == segmentNo * uint64_t(segmentSize))
+				{
+					adopt(candidates.begin());
+					continue;
+				}
+				for (;;)
+				{
+					auto match = std::lower_bound(candidates.begin(), candidates.end(), at);
+					if (match != candidates.end() && *match == at)
+					{
+						adopt(match + 1);
+						break;
+					}
+					if (at >= segmentEnd)
+						break;
+					at += cut(begin_ + at, end_);
+					cuts.push_back(at);
+				}
+			}
+		}
+
+		std::vector<CdcChunk> chunks(cuts.size());
+		uint64_t from = 0;
+		for (size_t chunkNo = 0; chunkNo < cuts.size(); ++chunkNo)
+		{
+			chunks[chunkNo] = CdcChunk{ from, cuts[chunkNo] - from, 0 };
+			from = cuts[chunkNo];
+		}
+		WorkStealingPool::global().run((chunks.size() + c_digestGroup - 1) / c_digestGroup, [&](size_t groupNo_) {
+			const size_t last = std::min(chunks.size(), (groupNo_ + 1) * c_digestGroup);
+			for (size_t chunkNo = groupNo_ * c_digestGroup; chunkNo < last; ++chunkNo)
+			{
+				CdcChunk& chunk = chunks[chunkNo];
+				chunk.digest = xxh::xxhash<64>(begin_ + chunk.offset, static_cast<size_t>(chunk.size));
+			}
+		});
+		return chunks;
+	}
+
+}
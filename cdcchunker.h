@@ -0,0 +1,82 @@
+#pragma once
+
+// MMapper -> CdcChunker -- FastCDC content-defined chunking of a mapping, with chunk digests.
+// Author: Oliver "kfsone" Smith 2018 <oliver@kfs.org>
+// Redistribution and re-use fully permitted contingent on inclusion of these 3 lines in copied- or derived- works.
+
+#include "mmapper.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+
+namespace KFS
+{
+
+	//! Chunk size limits for CdcChunker.
+	struct CdcOptions
+	{
+		//! No chunk is shorter than minSize (bar the last) or longer than
+		//! maxSize. avgSize is rounded to a power of two.
+		size_t		minSize{ 16 * 1024 };
+		size_t		avgSize{ 64 * 1024 };
+		size_t		maxSize{ 256 * 1024 };
+		//! How hard chunk sizes are pulled towards avgSize: the mask has
+		//! this many more bits before avgSize and fewer after (0 to 3).
+		unsigned	normalization{ 2 };
+		//! Bytes of input per parallel task; 0 chunks on one thread.
+		size_t		segmentSize{ 16 * 1024 * 1024 };
+	};
+
+	//! One chunk of the input and its xxhash64.
+	struct CdcChunk
+	{
+		uint64_t	offset;
+		uint64_t	size;
+		uint64_t	digest;
+	};
+
+
+	//////////////////////////////////////////////////////////////////////
+	//! @class CdcChunker
+	//! @brief Cut data into chunks where its content says to, so an
+	//! insertion or deletion only changes the chunks around it.
+	//!
+	//! @detail FastCDC: a Gear rolling hash, (hash << 1) + gear[byte],
+	//! cuts where the hash's top bits are all zero. Nothing is hashed for
+	//! the first minSize bytes of a chunk; up to avgSize a mask with extra
+	//! bits makes a cut less likely, after it one with fewer bits makes it
+	//! more likely, which keeps sizes close to the average. The loop rolls
+	//! two bytes per iteration.
+	//!
+	//! Where a chunk ends depends only on the bytes since it began, so the
+	//! input is split into segments chunked in parallel, each from its own
+	//! start. Their first few cuts are wrong, but once one lands on a cut
+	//! the segment before it also made, the rest agree; the merge walks
+	//! from each true cut into the next segment until that happens. The
+	//! result is identical to chunking on one thread. Digests are then
+	//! computed in parallel too.
+	//
+	class CdcChunker
+	{
+		CdcOptions	m_options;
+		uint64_t	m_maskS{ 0 };		// before avgSize
+		uint64_t	m_maskL{ 0 };		// after
+
+		std::vector<uint64_t> _cuts(const char* begin_, size_t from_, size_t stopAfter_, size_t size_) const;
+
+	public:
+		explicit CdcChunker(CdcOptions options_ = CdcOptions{}) noexcept;
+
+		const CdcOptions& options() const noexcept { return m_options; }
+
+		//! Length of the first chunk of [begin_, end_).
+		size_t cut(const char* begin_, const char* end_) const noexcept;
+
+		//! Chunk all of [begin_, end_).
+		std::vector<CdcChunk> chunk(const char* begin_, const char* end_) const;
+		std::vector<CdcChunk> chunk(const MMappedFile& file_) const { return chunk(file_.begin(), file_.end()); }
+	};
+
+}
@@ -0,0 +1,455 @@
+// MMapper -> CsvTokenizer -- SIMD field splitting for CSV/TSV in a mapping.
+// Author: Oliver "kfsone" Smith 2018 <oliver@kfs.org>
+// Redistribution and re-use fully permitted contingent on inclusion of these 3 lines in copied- or derived- works.
+
+#include "csvtokenizer.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+# define MMAPPER_CSV_X86 1
+# include <immintrin.h>
+#endif
+
+#if defined(_MSC_VER) && !defined(__clang__)
+# include <intrin.h>
+// MSVC emits any intrinsic without being told the target, but can't
+// check the CPU from here: AVX2 only if the whole build allows it.
+# define MMAPPER_CSV_ISA(isa_)
+# define MMAPPER_CSV_KERNEL(isa_)
+#else
+// Just these functions are built for 'isa_'; the kernels flatten them
+// in so the whole loop runs with the wider registers.
+# define MMAPPER_CSV_ISA(isa_)		__attribute__((target(isa_)))
+# define MMAPPER_CSV_KERNEL(isa_)	__attribute__((target(isa_), flatten))
+#endif
+
+
+namespace KFS
+{
+
+	//////////////////////////////////////////////////////////////////////
+	// Block masks.
+
+	namespace
+	{
+		//! Bit n is set where byte n of a 64-byte block is that character.
+		struct Masks
+		{
+			uint64_t	delimiter;
+			uint64_t	newline;
+			uint64_t	quote;
+		};
+
+		struct ScalarLoader
+		{
+			static Masks load(const char* block_, char delimiter_, char quote_) noexcept
+			{
+				Masks masks{ 0, 0, 0 };
+				for (unsigned byte = 0; byte < 64; ++byte)
+				{
+					const uint64_t bit = uint64_t(1) << byte;
+					masks.delimiter |= block_[byte] == delimiter_ ? bit : 0;
+					masks.newline |= block_[byte] == '\n' ? bit : 0;
+					masks.quote |= block_[byte] == quote_ ? bit : 0;
+				}
+				return masks;
+			}
+		};
+
+#if defined(MMAPPER_CSV_X86)
+		struct Sse2Loader
+		{
+			MMAPPER_CSV_ISA("sse2")
+			static Masks load(const char* block_, char delimiter_, char quote_) noexcept
+			{
+				const __m128i delimiters = _mm_set1_epi8(delimiter_);
+				const __m128i newlines = _mm_set1_epi8('\n');
+				const __m128i quotes = _mm_set1_epi8(quote_);
+				Masks masks{ 0, 0, 0 };
+				for (unsigned lane = 0; lane < 4; ++lane)
+				{
+					const __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(block_ + lane * 16));
+					const unsigned shift = lane * 16;
+					masks.delimiter |= uint64_t(static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, delimiters)))) << shift;
+					masks.newline |= uint64_t(static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, newlines)))) << shift;
+					masks.quote |= uint64_t(static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, quotes)))) << shift;
+				}
+				return masks;
+			}
+		};
+
+		struct Avx2Loader
+		{
+			MMAPPER_CSV_ISA("avx2")
+			static uint64_t match(__m256i lo_, __m256i hi_, __m256i match_) noexcept
+			{
+				return uint64_t(static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(lo_, match_))))
+					 | uint64_t(static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(hi_, match_)))) << 32;
+			}
+
+			MMAPPER_CSV_ISA("avx2")
+			static Masks load(const char* block_, char delimiter_, char quote_) noexcept
+			{
+				const __m256i lo = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(block_));
+				const __m256i hi = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(block_ + 32));
+				return Masks{ match(lo, hi, _mm256_set1_epi8(delimiter_)), match(lo, hi, _mm256_set1_epi8('\n')), match(lo, hi, _mm256_set1_epi8(quote_)) };
+			}
+		};
+#endif
+	}
+
+	//! Bit n of the result is the XOR of bits 0..n: set for the bytes
+	//! between an opening quote and its closing quote.
+	static inline uint64_t _prefixXor(uint64_t bits_) noexcept
+	{
+		bits_ ^= bits_ << 1;
+		bits_ ^= bits_ << 2;
+		bits_ ^= bits_ << 4;
+		bits_ ^= bits_ << 8;
+		bits_ ^= bits_ << 16;
+		bits_ ^= bits_ << 32;
+		return bits_;
+	}
+
+	static inline unsigned _lowestBit(uint64_t bits_) noexcept
+	{
+#if defined(_MSC_VER) && !defined(__clang__) && defined(_M_X64)
+		unsigned long index;
+		_BitScanForward64(&index, bits_);
+		return static_cast<unsigned>(index);
+#elif defined(_MSC_VER) && !defined(__clang__)
+		unsigned long index;
+		if (_BitScanForward(&index, static_cast<unsigned long>(bits_)))
+			return static_cast<unsigned>(index);
+		_BitScanForward(&index, static_cast<unsigned long>(bits_ >> 32));
+		return static_cast<unsigned>(index) + 32;
+#else
+		return static_cast<unsigned>(__builtin_ctzll(bits_));
+#endif
+	}
+
+
+	//////////////////////////////////////////////////////////////////////
+	// Kernels.
+
+	//! Marks offsets in _indexBlocks()'s output that are newlines.
+	static constexpr uint32_t c_newlineFlag = 0x80000000u;
+
+	//! Write the offset of every delimiter and newline outside quotes in
+	//! [data_, data_ + size_) to 'out_', newlines with c_newlineFlag set.
+	//! 'inQuote_' is all ones if data_ starts inside a quoted field, and
+	//! is left as it is at the end.
+	//! @return how many offsets were written.
+	template<typename Loader>
+	static inline size_t _indexBlocks(const char* data_, size_t size_, char delimiter_, char quote_, uint64_t& inQuote_, uint32_t* out_) noexcept
+	{
+		const uint64_t quoteEnable = quote_ ? ~uint64_t(0) : 0;
+		uint64_t inQuote = inQuote_;
+		size_t count = 0;
+		auto block = [&](const Masks& masks_, uint32_t offset_) {
+			const uint64_t quoted = _prefixXor(masks_.quote & quoteEnable) ^ inQuote;
+			inQuote = static_cast<uint64_t>(static_cast<int64_t>(quoted) >> 63);
+			const uint64_t newlines = masks_.newline & ~quoted;
+			for (uint64_t structural = (masks_.delimiter & ~quoted) | newlines; structural; structural &= structural - 1)
+			{
+				const unsigned bit = _lowestBit(structural);
+				out_[count++] = (offset_ + bit) | static_cast<uint32_t>((newlines >> bit) & 1) << 31;
+			}
+		};
+
+		size_t offset = 0;
+		for ( ; offset + 64 <= size_; offset += 64)
+			block(Loader::load(data_ + offset, delimiter_, quote_), static_cast<uint32_t>(offset));
+		if (offset < size_)
+		{
+			// Pad the tail with bytes that match nothing.
+			alignas(64) char tail[64];
+			std::memset(tail, delimiter_ == ' ' || quote_ == ' ' ? '\0' : ' ', sizeof(tail));
+			std::memcpy(tail, data_ + offset, size_ - offset);
+			block(Loader::load(tail, delimiter_, quote_), static_cast<uint32_t>(offset));
+		}
+
+		inQuote_ = inQuote;
+		return count;
+	}
+
+	//! 1 if [data_, data_ + size_) holds an odd number of quotes.
+	template<typename Loader>
+	static inline uint64_t _quoteParity(const char* data_, size_t size_, char quote_) noexcept
+	{
+		uint64_t folded = 0;
+		size_t offset = 0;
+		for ( ; offset + 64 <= size_; offset += 64)
+			folded ^= Loader::load(data_ + offset, '\0', quote_).quote;
+		for ( ; offset < size_; ++offset)
+			folded ^= data_[offset] == quote_ ? 1 : 0;
+		folded ^= folded >> 32;
+		folded ^= folded >> 16;
+		folded ^= folded >> 8;
+		folded ^= folded >> 4;
+		folded ^= folded >> 2;
+		folded ^= folded >> 1;
+		return folded & 1;
+	}
+
+	using IndexFn = size_t (*)(const char*, size_t, char, char, uint64_t&, uint32_t*);
+	using ParityFn = uint64_t (*)(const char*, size_t, char);
+
+	static size_t _indexScalar(const char* data_, size_t size_, char delimiter_, char quote_, uint64_t& inQuote_, uint32_t* out_) noexcept
+	{
+		return _indexBlocks<ScalarLoader>(data_, size_, delimiter_, quote_, inQuote_, out_);
+	}
+
+	static uint64_t _parityScalar(const char* data_, size_t size_, char quote_) noexcept
+	{
+		return _quoteParity<ScalarLoader>(data_, size_, quote_);
+	}
+
+#if defined(MMAPPER_CSV_X86)
+	MMAPPER_CSV_KERNEL("sse2")
+	static size_t _indexSse2(const char* data_, size_t size_, char delimiter_, char quote_, uint64_t& inQuote_, uint32_t* out_) noexcept
+	{
+		return _indexBlocks<Sse2Loader>(data_, size_, delimiter_, quote_, inQuote_, out_);
+	}
+
+	MMAPPER_CSV_KERNEL("sse2")
+	static uint64_t _paritySse2(const char* data_, size_t size_, char quote_) noexcept
+	{
+		return _quoteParity<Sse2Loader>(data_, size_, quote_);
+	}
+
+	MMAPPER_CSV_KERNEL("avx2,bmi")
+	static size_t _indexAvx2(const char* data_, size_t size_, char delimiter_, char quote_, uint64_t& inQuote_, uint32_t* out_) noexcept
+	{
+		return _indexBlocks<Avx2Loader>(data_, size_, delimiter_, quote_, inQuote_, out_);
+	}
+
+	MMAPPER_CSV_KERNEL("avx2")
+	static uint64_t _parityAvx2(const char* data_, size_t size_, char quote_) noexcept
+	{
+		return _quoteParity<Avx2Loader>(data_, size_, quote_);
+	}
+#endif
+
+	static IndexFn _indexKernel(CsvSimd simd_) noexcept
+	{
+		switch (simd_)
+		{
+#if defined(MMAPPER_CSV_X86)
+			case CsvSimd::AVX2:		return _indexAvx2;
+			case CsvSimd::SSE2:		return _indexSse2;
+#endif
+			default:				return _indexScalar;
+		}
+	}
+
+	static ParityFn _parityKernel(CsvSimd simd_) noexcept
+	{
+		switch (simd_)
+		{
+#if defined(MMAPPER_CSV_X86)
+			case CsvSimd::AVX2:		return _parityAvx2;
+			case CsvSimd::SSE2:		return _paritySse2;
+#endif
+			default:				return _parityScalar;
+		}
+	}
+
+
+	//////////////////////////////////////////////////////////////////////
+	// Setup.
+
+	CsvTokenizer::CsvTokenizer(CsvOptions options_) noexcept
+		: m_options(options_)
+	{
+		m_options.simd = std::min(m_options.simd, supportedSimd());
+	}
+
+	CsvSimd CsvTokenizer::supportedSimd() noexcept
+	{
+#if defined(MMAPPER_CSV_X86) && defined(_MSC_VER) && !defined(__clang__)
+# if defined(__AVX2__)
+		return CsvSimd::AVX2;
+# elif defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+		return CsvSimd::SSE2;
+# else
+		return CsvSimd::Scalar;
+# endif
+#elif defined(MMAPPER_CSV_X86)
+		if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("bmi"))
+			return CsvSimd::AVX2;
+		if (__builtin_cpu_supports("sse2"))
+			return CsvSimd::SSE2;
+		return CsvSimd::Scalar;
+#else
+		return CsvSimd::Scalar;
+#endif
+	}
+
+
+	//////////////////////////////////////////////////////////////////////
+	// Tokenizing.
+
+	size_t CsvTokenizer::_tokenize(const char* begin_, const char* end_, size_t chunk_, Thunk thunk_, void* context_) const noexcept
+	{
+		// Indexed a segment at a time, so the offsets stay small and hot.
+		constexpr size_t c_segment = 128 * 1024;
+
+		const IndexFn index = _indexKernel(m_options.simd);
+		const char delimiter = m_options.delimiter;
+		const char quote = m_options.quote;
+
+		std::vector<uint32_t> offsets(std::min<size_t>(c_segment, static_cast<size_t>(end_ - begin_)));
+		std::vector<CsvField> fields(64);
+		size_t fieldCount = 0;
+		size_t records = 0;
+
+		auto endField = [&](const char* from_, const char* to_) -> CsvField& {
+			if (fieldCount == fields.size())
+				fields.resize(fields.size() * 2);
+			CsvField& field = fields[fieldCount++];
+			const bool quoted = quote && to_ - from_ >= 2 && *from_ == quote && to_[-1] == quote;
+			field.begin = from_ + quoted;
+			field.end = to_ - quoted;
+			field.quoted = quoted;
+			return field;
+		};
+		auto endRecord = [&](const char* from_, const char* to_) {
+			if (to_ > from_ && to_[-1] == '\r')
+				--to_;
+			const CsvField& last = endField(from_, to_);
+			// A blank line is one empty, unquoted field.
+			if (fieldCount > 1 || last.begin != last.end || last.quoted)
+			{
+				thunk_(context_, chunk_, fields.data(), fieldCount);
+				++records;
+			}
+			fieldCount = 0;
+		};
+
+		uint64_t inQuote = 0;
+		const char* fieldStart = begin_;
+		for (const char* segment = begin_; segment < end_; segment += c_segment)
+		{
+			const size_t length = std::min<size_t>(c_segment, static_cast<size_t>(end_ - segment));
+			const size_t count = index(segment, length, delimiter, quote, inQuote, offsets.data());
+			for (size_t offsetNo = 0; offsetNo < count; ++offsetNo)
+			{
+				const uint32_t offset = offsets[offsetNo];
+				const char* const boundary = segment + (offset & ~c_newlineFlag);
+				if (offset & c_newlineFlag)
+					endRecord(fieldStart, boundary);
+				else
+					endField(fieldStart, boundary);
+				fieldStart = boundary + 1;
+			}
+		}
+		// A last record with no newline.
+		if (fieldStart < end_ || fieldCount)
+			endRecord(fieldStart, end_);
+
+		return records;
+	}
+
+	size_t CsvTokenizer::_parallelTokenize(const char* begin_, const char* end_, size_t threads_, Thunk thunk_, void* context_) const noexcept
+	{
+		// Below this, threads cost more than they save.
+		constexpr size_t c_minChunk = 1024 * 1024;
+
+		const size_t size = static_cast<size_t>(end_ - begin_);
+		size_t chunks = threads_ ? threads_ : std::max(std::thread::hardware_concurrency(), 1u);
+		chunks = std::min(chunks, std::max<size_t>(size / c_minChunk, 1));
+		if (chunks == 1)
+			return _tokenize(begin_, end_, 0, thunk_, context_);
+
+		std::vector<const char*> splits(chunks + 1);
+		for (size_t chunkNo = 0; chunkNo <= chunks; ++chunkNo)
+			splits[chunkNo] = begin_ + size / chunks * chunkNo;
+		splits[chunks] = end_;
+
+		// Run fn_(chunkNo) for every chunk, one thread each.
+		auto parallel = [chunks](auto&& fn_) {
+			std::vector<std::thread> threads;
+			size_t chunkNo = 1;
+			try
+			{
+				for ( ; chunkNo < chunks; ++chunkNo)
+					threads.emplace_back(fn_, chunkNo);
+			}
+			catch (...)
+			{
+				// Out of threads: do the rest here.
+			}
+			for (size_t rest = chunkNo; rest < chunks; ++rest)
+				fn_(rest);
+			fn_(0);
+			for (std::thread& thread : threads)
+				thread.join();
+		};
+
+		// Pass 1: each chunk's quote parity, so we know whether each split
+		// point is inside quotes.
+		std::vector<uint64_t> inQuote(chunks, 0);
+		if (m_options.quote)
+		{
+			const ParityFn parity = _parityKernel(m_options.simd);
+			std::vector<uint64_t> parities(chunks);
+			parallel([&](size_t chunkNo_) {
+				parities[chunkNo_] = parity(splits[chunkNo_], static_cast<size_t>(splits[chunkNo_ + 1] - splits[chunkNo_]), m_options.quote);
+			});
+			for (size_t chunkNo = 1; chunkNo < chunks; ++chunkNo)
+				inQuote[chunkNo] = inQuote[chunkNo - 1] ^ parities[chunkNo - 1];
+		}
+
+		// The first record that starts at or after each split.
+		auto recordStart = [&](size_t chunkNo_) {
+			if (chunkNo_ == 0)
+				return begin_;
+			if (chunkNo_ == chunks)
+				return end_;
+			bool quoted = inQuote[chunkNo_] != 0;
+			for (const char* p = splits[chunkNo_]; p < end_; ++p)
+			{
+				if (*p == m_options.quote && m_options.quote)
+					quoted = !quoted;
+				else if (*p == '\n' && !quoted)
+					return p + 1;
+			}
+			return end_;
+		};
+
+		// Pass 2: tokenize whole records.
+		std::atomic<size_t> records{ 0 };
+		parallel([&](size_t chunkNo_) {
+			const char* const from = recordStart(chunkNo_);
+			const char* const to = recordStart(chunkNo_ + 1);
+			if (from < to)
+				records += _tokenize(from, to, chunkNo_, thunk_, context_);
+		});
+		return records.load();
+	}
+
+	std::string CsvTokenizer::unescape(const CsvField& field_) const
+	{
+		std::string text(field_.begin, field_.end);
+		if (!field_.quoted)
+			return text;
+		const char quote = m_options.quote;
+		size_t out = 0;
+		for (size_t in = 0; in < text.size(); ++in)
+		{
+			text[out++] = text[in];
+			if (text[in] == quote && in + 1 < text.size() && text[in + 1] == quote)
+				++in;
+		}
+		text.resize(out);
+		return text;
+	}
+
+}
@@ -6,8 +6,14 @@
 #include "filehandle.h"
 #include "internal_includes.h"
 
+#include <algorithm>
+#include <stdexcept>
 #include <utility>
 
+#if MMAPPER_API == MMAPPER_POSIX
+# include <sys/uio.h>
+#endif
+
 #ifndef O_BINARY
 #define O_BINARY 0
 #endif
@@ -15,16 +21,44 @@
 namespace KFS
 {
 
+	// Largest single read we ask for; Linux caps reads just under 2GB anyway.
+	static constexpr size_t c_maxReadChunk{ size_t(1) << 30 };
+
+	static inline bool _fail(const char* reason_) MMAPPER_MAYBE_NOEXCEPT
+	{
+#ifndef MMAPPER_NO_THROW
+		throw std::runtime_error(reason_);
+#endif
+		(void)reason_;
+		return false;
+	}
+
+	static inline ptrdiff_t _ioError(const char* reason_) MMAPPER_MAYBE_NOEXCEPT
+	{
+		_fail(reason_);
+		return -1;
+	}
+
+
 	//////////////////////////////////////////////////////////////////////////
 	// Constructor
 
-	FileHandle::FileHandle(const filename_str_t& filename_) MMAPPER_MAYBE_NOEXCEPT
+	FileHandle::FileHandle(const filename_str_t& filename_, FileAccess access_) MMAPPER_MAYBE_NOEXCEPT
 	{
 #if MMAPPER_API == MMAPPER_WIN32
 		// Windows implementation.
-		m_fd = CreateFile(filename_.c_str(), FILE_GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, 0, NULL);
+		if (access_ == FileAccess::ReadOnly)
+			m_fd = CreateFile(filename_.c_str(), FILE_GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, 0, NULL);
+		else
+			m_fd = CreateFile(filename_.c_str(), FILE_GENERIC_READ | FILE_GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL,
+							  access_ == FileAccess::CreateReadWrite ? OPEN_ALWAYS : OPEN_EXISTING, 0, NULL);
 #else
-		m_fd = open(filename_.c_str(), O_RDONLY | O_BINARY);
+		switch (access_)
+		{
+			case FileAccess::ReadOnly:			m_fd = open(filename_.c_str(), O_RDONLY | O_BINARY); break;
+			case FileAccess::ReadWrite:			m_fd = open(filename_.c_str(), O_RDWR | O_BINARY); break;
+			case FileAccess::CreateReadWrite:	m_fd = open(filename_.c_str(), O_RDWR | O_CREAT | O_BINARY, 0644); break;
+		}
 #endif
 	}
 
@@ -41,6 +75,30 @@ namespace KFS
 	}
 
 
+	//////////////////////////////////////////////////////////////////////////
+	// Move: transfer ownership, so only one of us closes the handle.
+
+	FileHandle::FileHandle(FileHandle&& rhs_) noexcept
+		: m_fd(std::exchange(rhs_.m_fd, INVALID_HANDLE_VALUE))
+		, m_metadata(rhs_.m_metadata)
+		, m_haveMetadata(std::exchange(rhs_.m_haveMetadata, false))
+	{
+	}
+
+	FileHandle& FileHandle::operator=(FileHandle&& rhs_) noexcept
+	{
+		if (this != &rhs_)
+		{
+			if (isValid())
+				close();
+			m_fd = std::exchange(rhs_.m_fd, INVALID_HANDLE_VALUE);
+			m_metadata = rhs_.m_metadata;
+			m_haveMetadata = std::exchange(rhs_.m_haveMetadata, false);
+		}
+		return *this;
+	}
+
+
 	//////////////////////////////////////////////////////////////////////////
 	// Destructor, guarantee any open file is closed.
 
@@ -69,16 +127,27 @@ namespace KFS
 
 		// Invalidate the handle but keep the value so we can close it.
 		file_handle_t fd = std::exchange(m_fd, INVALID_HANDLE_VALUE);
+		forgetMetadata();
 
 		// Close the descriptor we had.
 #if MMAPPER_API == MMAPPER_WIN32
-		CloseHandle(m_fd);
+		CloseHandle(fd);
 #else
-		::close(m_fd);
+		::close(fd);
 #endif
 	}
 
 
+	//////////////////////////////////////////////////////////////////////////
+	// Hand the descriptor over to the caller.
+
+	file_handle_t FileHandle::release() noexcept
+	{
+		forgetMetadata();
+		return std::exchange(m_fd, INVALID_HANDLE_VALUE);
+	}
+
+
 	//////////////////////////////////////////////////////////////////////////
 	// Retrieve the file size if the file is open, but don't cache it.
 
@@ -127,5 +196,288 @@ namespace KFS
 
 		return size;
 	}
-};
 
+	//////////////////////////////////////////////////////////////////////////
+	// Size, block size and identity, fetched once.
+
+	FileMetadata FileHandle::metadata(bool refresh_) const MMAPPER_MAYBE_NOEXCEPT
+	{
+		if (!refresh_)
+		{
+			std::lock_guard<std::mutex> lock(m_metadataLock);
+			if (m_haveMetadata)
+				return m_metadata;
+		}
+
+		// Fetched outside the lock: a racing fetch just does the same work.
+		FileMetadata metadata{};
+		if (fetchMetadata(metadata))
+		{
+			std::lock_guard<std::mutex> lock(m_metadataLock);
+			m_metadata = metadata;
+			m_haveMetadata = true;
+		}
+		return metadata;
+	}
+
+	void FileHandle::forgetMetadata() const noexcept
+	{
+		std::lock_guard<std::mutex> lock(m_metadataLock);
+		m_haveMetadata = false;
+	}
+
+	bool FileHandle::fetchMetadata(FileMetadata& metadata_) const MMAPPER_MAYBE_NOEXCEPT
+	{
+		if (!isValid())
+		{
+#ifndef MMAPPER_NO_THROW
+			throw std::logic_error("Tried to get metadata of unopened handle");
+#endif
+			return false;
+		}
+
+#if MMAPPER_API == MMAPPER_WIN32
+		BY_HANDLE_FILE_INFORMATION info;
+		if (!GetFileInformationByHandle(m_fd, &info))
+			return _fail("GetFileInformationByHandle failed");
+		metadata_.size = (uint64_t(info.nFileSizeHigh) << 32) | info.nFileSizeLow;
+		metadata_.blockSize = 4096;
+		metadata_.inode = (uint64_t(info.nFileIndexHigh) << 32) | info.nFileIndexLow;
+		metadata_.device = info.dwVolumeSerialNumber;
+#else
+	# if defined(__linux__) && defined(STATX_BASIC_STATS)
+		// statx only fetches what we ask for; fall back if the kernel
+		// doesn't have it.
+		struct statx stx;
+		if (statx(m_fd, "", AT_EMPTY_PATH, STATX_SIZE | STATX_INO, &stx) == 0)
+		{
+			metadata_.size = stx.stx_size;
+			metadata_.blockSize = stx.stx_blksize;
+			metadata_.inode = stx.stx_ino;
+			metadata_.device = (uint64_t(stx.stx_dev_major) << 32) | stx.stx_dev_minor;
+			return true;
+		}
+	# endif
+		struct stat stats;
+		if (fstat(m_fd, &stats) < 0)
+			return _fail("fstat failed");
+		metadata_.size = static_cast<uint64_t>(stats.st_size);
+		metadata_.blockSize = static_cast<uint32_t>(stats.st_blksize);
+		metadata_.inode = static_cast<uint64_t>(stats.st_ino);
+		metadata_.device = static_cast<uint64_t>(stats.st_dev);
+#endif
+		return true;
+	}
+
+
+	//////////////////////////////////////////////////////////////////////////
+	// Positional read, retrying until full or EOF.
+
+	ptrdiff_t FileHandle::readAt(void* buffer_, size_t size_, uint64_t offset_) const MMAPPER_MAYBE_NOEXCEPT
+	{
+		if (!isValid())
+			return _ioError("Tried to read from unopened handle");
+
+		char* const into = static_cast<char*>(buffer_);
+		size_t total = 0;
+		while (total < size_)
+		{
+			const size_t chunk = std::min(size_ - total, c_maxReadChunk);
+			const uint64_t position = offset_ + total;
+#if MMAPPER_API == MMAPPER_WIN32
+			// A synchronous handle honours the OVERLAPPED offset.
+			OVERLAPPED overlapped{};
+			overlapped.Offset = static_cast<DWORD>(position);
+			overlapped.OffsetHigh = static_cast<DWORD>(position >> 32);
+			DWORD got = 0;
+			if (!ReadFile(m_fd, into + total, static_cast<DWORD>(chunk), &got, &overlapped))
+			{
+				if (GetLastError() == ERROR_HANDLE_EOF)
+					break;
+				return _ioError("ReadFile failed");
+			}
+#else
+			const ssize_t got = pread(m_fd, into + total, chunk, static_cast<off_t>(position));
+			if (got < 0)
+			{
+				if (errno == EINTR)
+					continue;
+				return _ioError("pread failed");
+			}
+#endif
+			if (got == 0)
+				break;
+			total += static_cast<size_t>(got);
+		}
+		return static_cast<ptrdiff_t>(total);
+	}
+
+
+	//////////////////////////////////////////////////////////////////////////
+	// Scatter read.
+
+	ptrdiff_t FileHandle::readAtV(const IoSpan* spans_, size_t count_, uint64_t offset_) const MMAPPER_MAYBE_NOEXCEPT
+	{
+		if (!isValid())
+			return _ioError("Tried to read from unopened handle");
+
+		size_t total = 0;
+		size_t spanNo = 0, skip = 0;	// where the next byte goes
+		for ( ; ; )
+		{
+			while (spanNo < count_ && skip == spans_[spanNo].size)
+			{
+				++spanNo;
+				skip = 0;
+			}
+			if (spanNo >= count_)
+				break;
+
+#if MMAPPER_API == MMAPPER_POSIX && (defined(__linux__) || defined(__FreeBSD__))
+			// Up to 64 spans per call; more than enough to amortize it.
+			constexpr size_t c_maxIov = 64;
+			struct iovec iov[c_maxIov];
+			size_t iovCount = 0;
+			for (size_t next = spanNo; next < count_ && iovCount < c_maxIov; ++next, ++iovCount)
+			{
+				const size_t from = next == spanNo ? skip : 0;
+				iov[iovCount].iov_base = static_cast<char*>(spans_[next].data) + from;
+				iov[iovCount].iov_len = spans_[next].size - from;
+			}
+			const ssize_t got = preadv(m_fd, iov, static_cast<int>(iovCount), static_cast<off_t>(offset_ + total));
+			if (got < 0)
+			{
+				if (errno == EINTR)
+					continue;
+				return _ioError("preadv failed");
+			}
+#else
+			const ptrdiff_t got = readAt(static_cast<char*>(spans_[spanNo].data) + skip, spans_[spanNo].size - skip, offset_ + total);
+			if (got < 0)
+				return -1;
+#endif
+			if (got == 0)
+				break;
+			total += static_cast<size_t>(got);
+
+			// Step over what was filled.
+			for (size_t left = static_cast<size_t>(got); left > 0; )
+			{
+				const size_t room = spans_[spanNo].size - skip;
+				if (left < room)
+				{
+					skip += left;
+					break;
+				}
+				left -= room;
+				++spanNo;
+				skip = 0;
+			}
+		}
+		return static_cast<ptrdiff_t>(total);
+	}
+
+
+	//////////////////////////////////////////////////////////////////////////
+	// Page cache hints.
+
+	bool FileHandle::advise(uint64_t offset_, uint64_t length_, AccessPattern pattern_) const noexcept
+	{
+#if MMAPPER_API == MMAPPER_POSIX && defined(POSIX_FADV_NORMAL)
+		if (!isValid())
+			return false;
+		int advice = POSIX_FADV_NORMAL;
+		switch (pattern_)
+		{
+			case AccessPattern::Normal:		advice = POSIX_FADV_NORMAL; break;
+			case AccessPattern::Sequential:	advice = POSIX_FADV_SEQUENTIAL; break;
+			case AccessPattern::Random:		advice = POSIX_FADV_RANDOM; break;
+			case AccessPattern::WillNeed:	advice = POSIX_FADV_WILLNEED; break;
+			case AccessPattern::DontNeed:	advice = POSIX_FADV_DONTNEED; break;
+		}
+		return posix_fadvise(m_fd, static_cast<off_t>(offset_), static_cast<off_t>(length_), advice) == 0;
+#else
+		(void)offset_;
+		(void)length_;
+		(void)pattern_;
+		return false;
+#endif
+	}
+
+	bool FileHandle::readahead(uint64_t offset_, uint64_t length_) const noexcept
+	{
+#if defined(__linux__)
+		if (!isValid())
+			return false;
+		return ::readahead(m_fd, static_cast<off64_t>(offset_), static_cast<size_t>(length_)) == 0;
+#else
+		return advise(offset_, length_, AccessPattern::WillNeed);
+#endif
+	}
+
+
+	//////////////////////////////////////////////////////////////////////////
+	// Preallocate disk space.
+
+	bool FileHandle::allocate(uint64_t offset_, uint64_t length_) MMAPPER_MAYBE_NOEXCEPT
+	{
+		if (!isValid())
+			return _fail("Tried to allocate space for unopened handle");
+		forgetMetadata();
+
+#if MMAPPER_API == MMAPPER_WIN32
+		// Reserve the clusters, then move EOF if we're growing the file.
+		const uint64_t end = offset_ + length_;
+		LARGE_INTEGER size{ 0 };
+		if (!GetFileSizeEx(m_fd, &size))
+			return _fail("GetFileSizeEx failed");
+		if (end > static_cast<uint64_t>(size.QuadPart))
+		{
+			FILE_ALLOCATION_INFO allocation;
+			allocation.AllocationSize.QuadPart = static_cast<LONGLONG>(end);
+			FILE_END_OF_FILE_INFO endOfFile;
+			endOfFile.EndOfFile.QuadPart = static_cast<LONGLONG>(end);
+			if (!SetFileInformationByHandle(m_fd, FileAllocationInfo, &allocation, sizeof(allocation))
+				|| !SetFileInformationByHandle(m_fd, FileEndOfFileInfo, &endOfFile, sizeof(endOfFile)))
+			{
+				return _fail("unable to allocate file space");
+			}
+		}
+		return true;
+#elif defined(__linux__)
+		for ( ; ; )
+		{
+			if (fallocate(m_fd, 0, static_cast<off_t>(offset_), static_cast<off_t>(length_)) == 0)
+				return true;
+			if (errno != EINTR)
+				break;
+		}
+		// Not every file system can; posix_fallocate() writes zeros instead.
+		if (errno == EOPNOTSUPP && posix_fallocate(m_fd, static_cast<off_t>(offset_), static_cast<off_t>(length_)) == 0)
+			return true;
+		return _fail("fallocate failed");
+#elif defined(__APPLE__)
+		// F_PREALLOCATE reserves space at EOF; ftruncate moves EOF over it.
+		struct stat stats;
+		if (fstat(m_fd, &stats) < 0)
+			return _fail("fstat failed");
+		const uint64_t end = offset_ + length_;
+		if (end <= static_cast<uint64_t>(stats.st_size))
+			return true;
+		fstore_t store{ F_ALLOCATECONTIG, F_PEOFPOSMODE, 0, static_cast<off_t>(end - stats.st_size), 0 };
+		if (fcntl(m_fd, F_PREALLOCATE, &store) < 0)
+		{
+			store.fst_flags = F_ALLOCATEALL;
+			if (fcntl(m_fd, F_PREALLOCATE, &store) < 0)
+				return _fail("F_PREALLOCATE failed");
+		}
+		if (ftruncate(m_fd, static_cast<off_t>(end)) < 0)
+			return _fail("ftruncate failed");
+		return true;
+#else
+		if (posix_fallocate(m_fd, static_cast<off_t>(offset_), static_cast<off_t>(length_)) != 0)
+			return _fail("posix_fallocate failed");
+		return true;
+#endif
+	}
+};
@@ -6,10 +6,55 @@
 
 #include "mmapper_platform.h"
 
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+
 
 namespace KFS
 {
 
+	//! How FileHandle opens a file.
+	enum class FileAccess
+	{
+		ReadOnly,		//!< existing file, read only
+		ReadWrite,		//!< existing file, read/write
+		CreateReadWrite	//!< read/write, created if missing
+	};
+
+
+	//! One buffer of a vectored read.
+	struct IoSpan
+	{
+		void*	data;
+		size_t	size;
+	};
+
+
+	//! Hints for FileHandle::advise().
+	enum class AccessPattern
+	{
+		Normal,
+		Sequential,		//!< read ahead aggressively
+		Random,			//!< don't read ahead
+		WillNeed,		//!< start reading the range in now
+		DontNeed		//!< drop the range from the page cache
+	};
+
+
+	//! What FileHandle::metadata() reports.
+	struct FileMetadata
+	{
+		uint64_t	size{ 0 };
+		//! Preferred I/O size.
+		uint32_t	blockSize{ 0 };
+		//! Inode (file index on Windows) and device (volume serial):
+		//! together, the file's identity.
+		uint64_t	inode{ 0 };
+		uint64_t	device{ 0 };
+	};
+
+
 	//////////////////////////////////////////////////////////////////////
 	// Helper that tracks a file handle and ensures it closes if we
 	// have to bail.
@@ -18,9 +63,18 @@ namespace KFS
 		// The all-important file handle type.
 		file_handle_t	m_fd{ INVALID_HANDLE_VALUE };
 
+		// Cached by metadata(); m_metadataLock lets threads sharing the
+		// handle fill and read it.
+		mutable std::mutex		m_metadataLock;
+		mutable FileMetadata	m_metadata{};
+		mutable bool			m_haveMetadata{ false };
+
+		bool fetchMetadata(FileMetadata& metadata_) const MMAPPER_MAYBE_NOEXCEPT;
+		void forgetMetadata() const noexcept;
+
 	public:
 		//! Filename ctor: Open the named file and track the file handle.
-		FileHandle(const filename_str_t& filename_) MMAPPER_MAYBE_NOEXCEPT;
+		FileHandle(const filename_str_t& filename_, FileAccess access_ = FileAccess::ReadOnly) MMAPPER_MAYBE_NOEXCEPT;
 
 		//! Handle ctor: Track an already open file handle.
 		//! Passing the invalid handle will raise an exception unless MMAPPER_NO_THROW is defined.
@@ -31,9 +85,9 @@ namespace KFS
 		FileHandle(const FileHandle&) = delete;
 		FileHandle& operator=(const FileHandle&) = delete;
 
-		// Move allowed.
-		FileHandle(FileHandle&&) noexcept = default;
-		FileHandle& operator=(FileHandle&&) noexcept = default;
+		// Move allowed; the source is left invalid.
+		FileHandle(FileHandle&& rhs_) noexcept;
+		FileHandle& operator=(FileHandle&& rhs_) noexcept;
 
 		// Destructor: close the file.
 		~FileHandle() noexcept;
@@ -42,16 +96,65 @@ namespace KFS
 
 		//! Boolean check whether this filehandle represents an open file.
 		//! @return true if we have an open file, else false.
-		bool isValid() const noexcept { return m_fd; }
+#if MMAPPER_API == MMAPPER_WIN32
+		// Some APIs (CreateFileMapping) report failure as NULL rather than INVALID_HANDLE_VALUE.
+		bool isValid() const noexcept { return m_fd != INVALID_HANDLE_VALUE && m_fd != NULL; }
+#else
+		bool isValid() const noexcept { return m_fd != INVALID_HANDLE_VALUE; }
+#endif
 
 		operator file_handle_t () const noexcept { return m_fd; }
 
+		//! Stop tracking the handle without closing it.
+		//! @return the handle, which the caller now owns.
+		file_handle_t release() noexcept;
+
 		//! Perform a stat-type operation to retrieve the size of an open file.
 		//! No attempt is made to cache the value, so repeated calls may result
 		//! in multiple system calls.
 		//!
 		//! @return size of the file or 0ULL if an error occurred in no throw mode.
 		size_t uncachedFileSize() const MMAPPER_MAYBE_NOEXCEPT;
+
+		//! Size, block size and identity in one system call (statx where
+		//! available), cached after the first call. Safe to call from
+		//! several threads sharing the handle.
+		//! @param[in] refresh_ re-fetch, and re-cache, rather than use the
+		//! cached copy.
+		//! @return a copy of the metadata; all zeros if it couldn't be
+		//! fetched in no throw mode.
+		FileMetadata metadata(bool refresh_ = false) const MMAPPER_MAYBE_NOEXCEPT;
+
+		//////////////////////////////////////////////////////////////////////
+		// Positional I/O. Each call says where to read, so several threads
+		// can share the handle.
+
+		//! Read up to 'size_' bytes at 'offset_', retrying interrupted and
+		//! short reads until the buffer is full or we hit EOF.
+		//! @return bytes read (fewer than size_ only at EOF), or -1 on
+		//! error in no throw mode.
+		ptrdiff_t readAt(void* buffer_, size_t size_, uint64_t offset_) const MMAPPER_MAYBE_NOEXCEPT;
+
+		//! Scatter-read consecutive bytes from 'offset_' into 'spans_'
+		//! (preadv), with the same retry rules as readAt().
+		//! @return total bytes read, or -1 on error in no throw mode.
+		ptrdiff_t readAtV(const IoSpan* spans_, size_t count_, uint64_t offset_) const MMAPPER_MAYBE_NOEXCEPT;
+
+		//! Tell the OS how [offset_, offset_ + length_) will be read; a
+		//! length of 0 means "to the end of the file". Advisory.
+		//! @return false if the platform doesn't support the hint.
+		bool advise(uint64_t offset_, uint64_t length_, AccessPattern pattern_) const noexcept;
+
+		//! Start reading [offset_, offset_ + length_) into the page cache
+		//! without waiting for it (readahead(2), else WILLNEED).
+		//! @return false if the platform doesn't support it.
+		bool readahead(uint64_t offset_, uint64_t length_) const noexcept;
+
+		//! Reserve disk space for [offset_, offset_ + length_), growing the
+		//! file if that's past the end, so later writes can't fail for
+		//! lack of space and the file is laid out contiguously.
+		//! @return true on success.
+		bool allocate(uint64_t offset_, uint64_t length_) MMAPPER_MAYBE_NOEXCEPT;
 	};
 
 }
\ No newline at end of file
@@ -0,0 +1,202 @@
+// MMapper -> FollowedFile -- Map a file that is still being written and follow its growth.
+// Author: Oliver "kfsone" Smith 2018 <oliver@kfs.org>
+// Redistribution and re-use fully permitted contingent on inclusion of these 3 lines in copied- or derived- works.
+
+#include "followfile.h"
+#include "internal_includes.h"
+
+#include <chrono>
+#include <stdexcept>
+#include <thread>
+
+#if defined(__linux__)
+# include <poll.h>
+# include <sys/inotify.h>
+#endif
+
+
+namespace KFS
+{
+
+	constexpr size_t FollowedFile::c_defaultReserve;
+	constexpr int FollowedFile::c_maxPollInterval;
+
+	//! Grow the mapping in steps of this much, so a file being appended
+	//! to a line at a time doesn't cost an mmap() per page. Pages past
+	//! EOF are mapped but never handed out.
+	static constexpr size_t c_mapStep{ 1024 * 1024 };
+
+
+	static inline bool _fail(const char* reason_) MMAPPER_MAYBE_NOEXCEPT
+	{
+#ifndef MMAPPER_NO_THROW
+		throw std::runtime_error(reason_);
+#endif
+		(void)reason_;
+		return false;
+	}
+
+
+	FollowedFile::FollowedFile(const filename_str_t& filename_, size_t reserve_) MMAPPER_MAYBE_NOEXCEPT
+	{
+		open(filename_, reserve_);
+	}
+
+
+	//////////////////////////////////////////////////////////////////////
+	// Open: reserve, watch, map what's there.
+
+	bool FollowedFile::open(const filename_str_t& filename_, size_t reserve_) MMAPPER_MAYBE_NOEXCEPT
+	{
+		close();
+
+#if MMAPPER_API == MMAPPER_WIN32
+		(void)filename_;
+		(void)reserve_;
+		return _fail("following files is not supported on Windows");
+#else
+		m_fd = ::open(filename_.c_str(), O_RDONLY | O_CLOEXEC);
+		if (m_fd == INVALID_HANDLE_VALUE)
+			return _fail("unable to open file to follow");
+		if (!m_range.reserve(reserve_))
+		{
+			close();
+			return _fail("unable to reserve address space to follow file");
+		}
+
+# if defined(__linux__)
+		// Optional: without it we just poll.
+		m_notify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+		if (m_notify >= 0 && inotify_add_watch(m_notify, filename_.c_str(), IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE) < 0)
+		{
+			::close(m_notify);
+			m_notify = -1;
+		}
+# endif
+
+		m_filename = filename_;
+		m_stop.store(false, std::memory_order_relaxed);
+		if (!refresh())
+		{
+			close();
+			return false;
+		}
+		return true;
+#endif
+	}
+
+	void FollowedFile::close() noexcept
+	{
+		m_range.release();
+#if MMAPPER_API != MMAPPER_WIN32
+		if (m_notify >= 0)
+			::close(m_notify);
+		if (m_fd != INVALID_HANDLE_VALUE)
+			::close(m_fd);
+#endif
+		m_notify = -1;
+		m_fd = INVALID_HANDLE_VALUE;
+		m_filename.clear();
+		m_mapped = 0;
+		m_size = 0;
+		m_consumed = 0;
+		m_truncations = 0;
+	}
+
+
+	//////////////////////////////////////////////////////////////////////
+	// Pick up growth (or truncation).
+
+	bool FollowedFile::refresh() MMAPPER_MAYBE_NOEXCEPT
+	{
+		if (!isOpen())
+			return false;
+
+#if MMAPPER_API == MMAPPER_WIN32
+		return false;
+#else
+		struct stat stats;
+		if (fstat(m_fd, &stats) != 0)
+			return _fail("unable to check size of followed file");
+		const size_t size = static_cast<size_t>(stats.st_size);
+
+		if (size < m_size)
+		{
+			// Truncated: whatever is there now is new.
+			++m_truncations;
+			m_consumed = 0;
+		}
+
+		if (size > m_mapped)
+		{
+			if (size > m_range.size())
+				return _fail("followed file has outgrown its reservation");
+			const size_t want = std::min((size + c_mapStep - 1) / c_mapStep * c_mapStep, m_range.size());
+			// m_mapped is page aligned, so it's also a valid file offset.
+			if (mmap(m_range.data() + m_mapped, want - m_mapped, PROT_READ, MAP_SHARED | MAP_FIXED, m_fd, static_cast<off_t>(m_mapped)) == MAP_FAILED)
+				return _fail("unable to extend mapping of followed file");
+			m_mapped = want;
+		}
+
+		m_size = size;
+		return true;
+#endif
+	}
+
+
+	//////////////////////////////////////////////////////////////////////
+	// Wait for the size to change.
+
+	bool FollowedFile::waitForChange(int timeoutMs_) noexcept
+	{
+		if (!isOpen())
+			return false;
+
+#if MMAPPER_API == MMAPPER_WIN32
+		(void)timeoutMs_;
+		return false;
+#else
+		using clock = std::chrono::steady_clock;
+		const auto deadline = clock::now() + std::chrono::milliseconds(timeoutMs_ < 0 ? 0 : timeoutMs_);
+		int interval = 1;
+
+		for ( ; ; )
+		{
+			if (stopping())
+				return true;
+
+			struct stat stats;
+			if (fstat(m_fd, &stats) != 0 || static_cast<size_t>(stats.st_size) != m_size)
+				return true;	// refresh() will report any error
+
+			int slice = m_notify >= 0 ? c_maxPollInterval : interval;
+			if (timeoutMs_ >= 0)
+			{
+				const auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - clock::now()).count();
+				if (remaining <= 0)
+					return false;
+				slice = static_cast<int>(std::min<decltype(remaining)>(slice, remaining));
+			}
+
+# if defined(__linux__)
+			if (m_notify >= 0)
+			{
+				pollfd pfd{ m_notify, POLLIN, 0 };
+				if (poll(&pfd, 1, slice) > 0)
+				{
+					// We only care that something happened.
+					char events[4096];
+					while (read(m_notify, events, sizeof(events)) > 0)
+						;
+				}
+				continue;
+			}
+# endif
+
+			std::this_thread::sleep_for(std::chrono::milliseconds(slice));
+			interval = std::min(interval * 2, c_maxPollInterval);
+		}
+#endif
+	}
+
+}
@@ -0,0 +1,149 @@
+#pragma once
+
+// MMapper -> FollowedFile -- Map a file that is still being written and follow its growth.
+// Author: Oliver "kfsone" Smith 2018 <oliver@kfs.org>
+// Redistribution and re-use fully permitted contingent on inclusion of these 3 lines in copied- or derived- works.
+
+#include "mmapper_platform.h"
+#include "addressspace.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+
+
+namespace KFS
+{
+
+	//////////////////////////////////////////////////////////////////////
+	//! @class FollowedFile
+	//! @brief A read-only mapping of a growing file ("tail -f" without
+	//! the copies).
+	//!
+	//! @detail MMappedFile sizes its mapping when the file is opened, so
+	//! anything appended later is invisible until you remap. FollowedFile
+	//! reserves a large address range up front and maps the file at the
+	//! start of it; when the file grows, the new pages are mapped in place
+	//! with MAP_FIXED. begin() never moves, and data already handed out
+	//! stays valid. (mremap could grow the mapping instead, but may move
+	//! it.)
+	//!
+	//! Growth is detected with inotify where available, otherwise by
+	//! polling fstat with a backoff from 1ms to c_maxPollInterval; even
+	//! with inotify, the size is re-checked at that interval, for file
+	//! systems that don't send events.
+	//!
+	//! follow() hands each newly appended stretch to a consumer, which
+	//! returns how much of it it used; the rest (e.g. a partial line) is
+	//! offered again, extended, once more data arrives.
+	//!
+	//! Follows the open file, like tail -f: a rotated log keeps being read
+	//! from its old inode. If the file shrinks it's treated as truncated
+	//! and reading restarts from offset 0. Unlike MMappedFile there's no
+	//! '\0' after end().
+	//!
+	//! POSIX only. Not copyable or movable: stop() may be called from
+	//! another thread.
+	//
+	class FollowedFile
+	{
+		AddressRange			m_range;
+		file_handle_t			m_fd{ INVALID_HANDLE_VALUE };
+		int						m_notify{ -1 };		// inotify descriptor, or -1
+		filename_str_t			m_filename{};
+		size_t					m_mapped{ 0 };		// bytes of the file mapped (whole pages)
+		size_t					m_size{ 0 };		// file size when last checked
+		size_t					m_consumed{ 0 };	// bytes follow() has delivered
+		size_t					m_truncations{ 0 };
+		std::atomic<bool>		m_stop{ false };
+
+	public:
+		//! Address space reserved for the file to grow into.
+		static constexpr size_t c_defaultReserve{ sizeof(void*) >= 8 ? (size_t(1) << 40) : (size_t(1) << 30) };
+
+		//! Longest wait between size checks, in milliseconds.
+		static constexpr int c_maxPollInterval{ 100 };
+
+		FollowedFile() noexcept = default;
+
+		//! Open 'filename_' and map what's there so far; see open().
+		explicit FollowedFile(const filename_str_t& filename_, size_t reserve_ = c_defaultReserve) MMAPPER_MAYBE_NOEXCEPT;
+
+		~FollowedFile() noexcept { close(); }
+
+		FollowedFile(const FollowedFile&) = delete;
+		FollowedFile& operator=(const FollowedFile&) = delete;
+
+		//! Open a file to follow, closing any current one. The file can
+		//! grow to 'reserve_' bytes; beyond that, refresh() fails.
+		//! @return true on success.
+		bool open(const filename_str_t& filename_, size_t reserve_ = c_defaultReserve) MMAPPER_MAYBE_NOEXCEPT;
+
+		void close() noexcept;
+
+		//! Re-check the file size and map any new pages.
+		//! @return false if the file can't be checked or has outgrown the
+		//! reservation.
+		bool refresh() MMAPPER_MAYBE_NOEXCEPT;
+
+		//! Block until the file size changes, stop() is called or
+		//! 'timeoutMs_' passes (-1: no timeout). Doesn't refresh().
+		//! @return true unless it timed out.
+		bool waitForChange(int timeoutMs_ = -1) noexcept;
+
+		//! Make follow() (and waitForChange()) return; safe from any
+		//! thread. Sticky until the next open().
+		void stop() noexcept { m_stop.store(true, std::memory_order_relaxed); }
+
+		bool stopping() const noexcept { return m_stop.load(std::memory_order_relaxed); }
+
+		//! Deliver data to 'consumer_' as it's appended, starting from
+		//! consumed(). consumer_(const char* from, const char* to) returns
+		//! the number of bytes it used. Runs until stop(), an error, or no
+		//! change for 'idleTimeoutMs_' (-1: forever).
+		//! @return bytes consumed by this call.
+		template<typename Consumer>
+		size_t follow(Consumer&& consumer_, int idleTimeoutMs_ = -1)
+		{
+			size_t delivered = 0;
+			while (!stopping() && refresh())
+			{
+				if (m_size > m_consumed)
+				{
+					const size_t used = std::min<size_t>(consumer_(begin() + m_consumed, end()), m_size - m_consumed);
+					m_consumed += used;
+					delivered += used;
+					if (used)
+						continue;
+				}
+				if (!waitForChange(idleTimeoutMs_))
+					break;
+			}
+			return delivered;
+		}
+
+		//////////////////////////////////////////////////////////////////////
+		// Accessors.
+
+		bool isOpen() const noexcept { return m_fd != INVALID_HANDLE_VALUE; }
+		const filename_str_t& filename() const noexcept { return m_filename; }
+
+		//! Start of the mapping; stable for as long as the file is open.
+		template<typename T=char>
+		const T* begin() const noexcept { return reinterpret_cast<const T*>(m_range.data()); }
+
+		//! End of the data as of the last refresh().
+		template<typename T=char>
+		const T* end() const noexcept { return reinterpret_cast<const T*>(m_range.data() + m_size); }
+
+		size_t size() const noexcept { return m_size; }
+
+		//! Where follow() resumes; skipToEnd() to only see new data.
+		size_t consumed() const noexcept { return m_consumed; }
+		void skipToEnd() noexcept { m_consumed = m_size; }
+
+		//! How many times the file has been seen to shrink.
+		size_t truncations() const noexcept { return m_truncations; }
+	};
+
+}
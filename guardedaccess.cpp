@@ -0,0 +1,185 @@
+// MMapper -> GuardedAccess -- Turn faults on truncated mappings into errors.
+// Author: Oliver "kfsone" Smith 2018 <oliver@kfs.org>
+// Redistribution and re-use fully permitted contingent on inclusion of these 3 lines in copied- or derived- works.
+
+#include "guardedaccess.h"
+#include "internal_includes.h"
+
+#include <atomic>
+#include <mutex>
+
+#if MMAPPER_API != MMAPPER_WIN32
+# include <csetjmp>
+# include <csignal>
+#endif
+
+
+namespace KFS
+{
+
+#if MMAPPER_API == MMAPPER_WIN32
+
+	bool GuardedAccess::install() noexcept
+	{
+		// SEH needs no global state.
+		return true;
+	}
+
+# if defined(_MSC_VER)
+	static int _filter(const EXCEPTION_POINTERS* info_, const char* begin_, size_t size_, GuardedFault* fault_) noexcept
+	{
+		const EXCEPTION_RECORD* record = info_->ExceptionRecord;
+		if (record->ExceptionCode != EXCEPTION_IN_PAGE_ERROR || record->NumberParameters < 2)
+			return EXCEPTION_CONTINUE_SEARCH;
+		const char* const address = reinterpret_cast<const char*>(record->ExceptionInformation[1]);
+		if (address < begin_ || address >= begin_ + size_)
+			return EXCEPTION_CONTINUE_SEARCH;
+		if (fault_)
+		{
+			fault_->address = address;
+			fault_->code = static_cast<long>(record->ExceptionCode);
+		}
+		return EXCEPTION_EXECUTE_HANDLER;
+	}
+# endif
+
+	bool GuardedAccess::_run(const void* begin_, size_t size_, Thunk thunk_, void* context_, GuardedFault* fault_)
+	{
+# if defined(_MSC_VER)
+		__try
+		{
+			thunk_(context_);
+		}
+		__except (_filter(GetExceptionInformation(), static_cast<const char*>(begin_), size_, fault_))
+		{
+			return false;
+		}
+# else
+		(void)begin_;
+		(void)size_;
+		(void)fault_;
+		thunk_(context_);
+# endif
+		return true;
+	}
+
+#else
+
+	//////////////////////////////////////////////////////////////////////
+	// One per active run() on a thread, innermost first.
+
+	namespace
+	{
+		struct GuardFrame
+		{
+			sigjmp_buf		env;
+			const char*		begin;
+			const char*		end;
+			GuardFrame*		outer;
+			// Written by the handler, read after the jump.
+			const void* volatile	faultAddress;
+			volatile int			signal;
+		};
+
+		thread_local GuardFrame* t_innermost{ nullptr };
+
+		struct sigaction s_previous;
+		std::once_flag s_installOnce;
+		std::atomic<bool> s_installed{ false };
+	}
+
+
+	//////////////////////////////////////////////////////////////////////
+	// The handler: only async-signal-safe operations from here on.
+
+	static void _onFault(int signal_, siginfo_t* info_, void* context_)
+	{
+		const char* const address = static_cast<const char*>(info_->si_addr);
+		for (GuardFrame* frame = t_innermost; frame; frame = frame->outer)
+		{
+			if (address >= frame->begin && address < frame->end)
+			{
+				frame->faultAddress = address;
+				frame->signal = signal_;
+				siglongjmp(frame->env, 1);
+			}
+		}
+
+		// Not ours: hand it on.
+		if (s_previous.sa_flags & SA_SIGINFO)
+		{
+			s_previous.sa_sigaction(signal_, info_, context_);
+			return;
+		}
+		if (s_previous.sa_handler != SIG_DFL && s_previous.sa_handler != SIG_IGN)
+		{
+			s_previous.sa_handler(signal_);
+			return;
+		}
+		// Restore the default action; returning re-runs the faulting
+		// access, which then terminates the process as it would have.
+		signal(signal_, SIG_DFL);
+	}
+
+	bool GuardedAccess::install() noexcept
+	{
+		if (s_installed.load(std::memory_order_acquire))
+			return true;
+		std::call_once(s_installOnce, [] {
+			struct sigaction action {};
+			action.sa_sigaction = _onFault;
+			// NODEFER: we don't save the mask in sigsetjmp, so SIGBUS must
+			// not be left blocked when we jump out of the handler.
+			action.sa_flags = SA_SIGINFO | SA_NODEFER | SA_ONSTACK;
+			sigemptyset(&action.sa_mask);
+			s_installed.store(sigaction(SIGBUS, &action, &s_previous) == 0, std::memory_order_release);
+		});
+		return s_installed.load(std::memory_order_acquire);
+	}
+
+
+	//////////////////////////////////////////////////////////////////////
+	// The guarded call.
+
+	bool GuardedAccess::_run(const void* begin_, size_t size_, Thunk thunk_, void* context_, GuardedFault* fault_)
+	{
+		if (!install())
+		{
+			thunk_(context_);
+			return true;
+		}
+
+		GuardFrame frame;
+		frame.begin = static_cast<const char*>(begin_);
+		frame.end = frame.begin + size_;
+		frame.outer = t_innermost;
+		frame.faultAddress = nullptr;
+		frame.signal = 0;
+
+		// Pops the frame however we leave: normally, via an exception, or
+		// after a jump back from the handler (which skips any inner
+		// frames' pops - restoring our outer frame covers those too).
+		struct Pop
+		{
+			GuardFrame* outer;
+			~Pop() { t_innermost = outer; }
+		} pop{ frame.outer };
+
+		if (sigsetjmp(frame.env, 0) != 0)
+		{
+			if (fault_)
+			{
+				fault_->address = frame.faultAddress;
+				fault_->code = frame.signal;
+			}
+			return false;
+		}
+
+		t_innermost = &frame;
+		thunk_(context_);
+		return true;
+	}
+
+#endif
+
+}
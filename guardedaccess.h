@@ -0,0 +1,91 @@
+#pragma once
+
+// MMapper -> GuardedAccess -- Turn faults on truncated mappings into errors.
+// Author: Oliver "kfsone" Smith 2018 <oliver@kfs.org>
+// Redistribution and re-use fully permitted contingent on inclusion of these 3 lines in copied- or derived- works.
+
+#include "mmapper_platform.h"
+#include "addressspace.h"
+#include "mmapper.h"
+
+#include <cstddef>
+#include <type_traits>
+#include <utility>
+
+
+namespace KFS
+{
+
+	//! What interrupted a guarded call.
+	struct GuardedFault
+	{
+		const void*	address{ nullptr };
+		//! SIGBUS, or EXCEPTION_IN_PAGE_ERROR on Windows.
+		long		code{ 0 };
+	};
+
+
+	//////////////////////////////////////////////////////////////////////
+	//! @class GuardedAccess
+	//! @brief Run code that reads a mapping so that the file being
+	//! truncated underneath it is an error, not a crash.
+	//!
+	//! @detail Touching a page of a mapping that is now past the end of
+	//! its file raises SIGBUS, which by default kills the process.
+	//!
+	//!   GuardedFault fault;
+	//!   if (!GuardedAccess::run(file, [&] { total = sum(file.begin(), file.end()); }, &fault))
+	//!       ... the file shrank; fault.address is where ...
+	//!
+	//! run() registers the range for the duration of the call, on the
+	//! calling thread only, and sets a sigsetjmp() point. A process-wide
+	//! SIGBUS handler (installed on first use, SA_SIGINFO | SA_NODEFER)
+	//! siglongjmp()s back to the innermost call on the faulting thread
+	//! whose range holds the fault address; any other fault is passed to
+	//! whatever handler was installed before us, or gets the default
+	//! action. The fast path is a sigsetjmp() that doesn't save the signal
+	//! mask - no system calls.
+	//!
+	//! On a fault, the callback is abandoned mid-flight: objects it
+	//! created are not destroyed and locks it took are not released, so
+	//! keep it to reading. Exceptions pass through normally.
+	//!
+	//! Windows: structured exception handling (EXCEPTION_IN_PAGE_ERROR)
+	//! with MSVC; elsewhere on Windows the callback runs unguarded.
+	//
+	class GuardedAccess
+	{
+		using Thunk = void (*)(void*);
+
+		static bool _run(const void* begin_, size_t size_, Thunk thunk_, void* context_, GuardedFault* fault_);
+
+	public:
+		//! Install the fault handler now rather than on first use, e.g.
+		//! before another library installs its own (which should then
+		//! chain to ours). Thread safe.
+		//! @return false if the handler couldn't be installed.
+		static bool install() noexcept;
+
+		//! Call 'fn_()', treating a fault in [begin_, begin_ + size_) as
+		//! an error.
+		//! @return true if fn_ completed, false if a fault cut it short
+		//! (described in *fault_ if given).
+		template<typename Fn>
+		static bool run(const void* begin_, size_t size_, Fn&& fn_, GuardedFault* fault_ = nullptr)
+		{
+			using FnType = typename std::remove_reference<Fn>::type;
+			return _run(begin_, size_, [](void* context_) { (*static_cast<FnType*>(context_))(); },
+						const_cast<void*>(static_cast<const void*>(&fn_)), fault_);
+		}
+
+		//! Guard the whole of 'file_''s mapping, including the page(s)
+		//! holding the '\0' after end().
+		template<typename Fn>
+		static bool run(const MMappedFile& file_, Fn&& fn_, GuardedFault* fault_ = nullptr)
+		{
+			const size_t page = AddressRange::pageSize();
+			return run(file_.begin(), (file_.size() + page) & ~(page - 1), std::forward<Fn>(fn_), fault_);
+		}
+	};
+
+}
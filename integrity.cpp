@@ -0,0 +1,297 @@
+// MMapper -> Integrity -- Per-block hash sidecars and a view that verifies blocks on first touch.
+// Author: Oliver "kfsone" Smith 2018 <oliver@kfs.org>
+// Redistribution and re-use fully permitted contingent on inclusion of these 3 lines in copied- or derived- works.
+
+#include "integrity.h"
+#include "parallelchunks.h"
+#include "internal_includes.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+#if defined(__linux__)
+# include <sys/resource.h>
+# include <sys/syscall.h>
+#endif
+
+#include "3rdParty/xxhash.hpp"
+
+
+namespace KFS
+{
+
+	constexpr char IntegrityHeader::c_magic[8];
+	constexpr uint32_t IntegrityHeader::c_version;
+	constexpr uint32_t IntegrityHeader::c_byteOrderMark;
+	constexpr uint64_t IntegritySidecar::c_defaultBlockSize;
+
+
+	static inline uint64_t _hashBlock(const char* data_, size_t size_, uint64_t seed_, size_t blockNo_) noexcept
+	{
+		return xxh::xxhash<64>(data_, size_, seed_ + blockNo_);
+	}
+
+	static inline bool _fail(const char* reason_) MMAPPER_MAYBE_NOEXCEPT
+	{
+#ifndef MMAPPER_NO_THROW
+		throw std::runtime_error(reason_);
+#endif
+		(void)reason_;
+		return false;
+	}
+
+
+	//////////////////////////////////////////////////////////////////////
+	// Sidecar.
+
+	bool IntegritySidecar::write(const MMappedFile& data_, const filename_str_t& filename_, uint64_t blockSize_, uint64_t seed_) MMAPPER_MAYBE_NOEXCEPT
+	{
+		if (blockSize_ == 0)
+			return _fail("integrity block size must be non-zero");
+
+		const uint64_t dataSize = data_.size();
+		std::vector<uint64_t> hashes(static_cast<size_t>((dataSize + blockSize_ - 1) / blockSize_));
+		// Chunks cut exactly every blockSize bytes, so chunk n is block n.
+		ChunkOptions options;
+		options.chunkSize = static_cast<size_t>(blockSize_);
+		parallelForChunks(data_.begin(), data_.end(), [&](const Chunk& chunk_) {
+			hashes[chunk_.index] = _hashBlock(chunk_.begin, chunk_.size(), seed_, chunk_.index);
+		}, options);
+
+		IntegrityHeader header{};
+		std::memcpy(header.magic, IntegrityHeader::c_magic, sizeof(header.magic));
+		header.version = IntegrityHeader::c_version;
+		header.byteOrder = IntegrityHeader::c_byteOrderMark;
+		header.seed = seed_;
+		header.blockSize = blockSize_;
+		header.dataSize = dataSize;
+		header.blockCount = hashes.size();
+		header.hashesOffset = sizeof(IntegrityHeader);
+
+		std::ofstream out(filename_, std::ios::binary | std::ios::trunc);
+		if (!out)
+			return _fail("unable to create integrity sidecar");
+		out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		out.write(reinterpret_cast<const char*>(hashes.data()), hashes.size() * sizeof(uint64_t));
+		out.close();
+		if (!out)
+			return _fail("failed writing integrity sidecar");
+
+		return true;
+	}
+
+
+	bool IntegritySidecar::open(filename_str_t filename_) MMAPPER_MAYBE_NOEXCEPT
+	{
+		close();
+
+		if (!m_file.mapFile(std::move(filename_)))
+			return false;
+
+		if (m_file.size() < sizeof(IntegrityHeader))
+		{
+			close();
+			return _fail("file is too small to be an integrity sidecar");
+		}
+
+		const IntegrityHeader* header = m_file.begin<IntegrityHeader>();
+		if (std::memcmp(header->magic, IntegrityHeader::c_magic, sizeof(header->magic)) != 0
+			|| header->version != IntegrityHeader::c_version)
+		{
+			close();
+			return _fail("not an integrity sidecar");
+		}
+		if (header->byteOrder != IntegrityHeader::c_byteOrderMark)
+		{
+			close();
+			return _fail("integrity sidecar was written with a different byte order");
+		}
+
+		const uint64_t fileSize = m_file.size();
+		if (header->blockSize == 0
+			|| header->blockCount != (header->dataSize + header->blockSize - 1) / header->blockSize
+			|| header->blockCount > fileSize / sizeof(uint64_t)
+			|| header->hashesOffset > fileSize - header->blockCount * sizeof(uint64_t))
+		{
+			close();
+			return _fail("integrity sidecar header is corrupt");
+		}
+
+		m_hashes = MappedArray<uint64_t>(m_file, static_cast<size_t>(header->hashesOffset), static_cast<size_t>(header->blockCount));
+		if (!m_hashes.isValid())
+		{
+			close();
+			return false;
+		}
+
+		m_header = header;
+		return true;
+	}
+
+
+	void IntegritySidecar::close() noexcept
+	{
+		m_header = nullptr;
+		m_hashes = MappedArray<uint64_t>{};
+		if (m_file.isMapped())
+			m_file.unmapFile();
+	}
+
+
+	bool IntegritySidecar::check(size_t blockNo_, const char* data_, size_t size_) const noexcept
+	{
+		if (!m_header || blockNo_ >= m_hashes.size())
+			return false;
+		return _hashBlock(data_, size_, m_header->seed, blockNo_) == m_hashes[blockNo_];
+	}
+
+
+	//////////////////////////////////////////////////////////////////////
+	// Verified view.
+
+	VerifiedView::VerifiedView(const MMappedFile& data_, const IntegritySidecar& sidecar_) MMAPPER_MAYBE_NOEXCEPT
+		: m_begin(data_.begin())
+		, m_size(data_.size())
+	{
+		if (!sidecar_.isOpen() || sidecar_.dataSize() != m_size)
+		{
+			_fail("data file doesn't match its integrity sidecar");
+			return;
+		}
+
+		m_blockSize = static_cast<size_t>(sidecar_.blockSize());
+		m_blockCount = sidecar_.blockCount();
+		const size_t words = (m_blockCount + 63) / 64;
+		m_verified.reset(new std::atomic<uint64_t>[words]);
+		m_corrupt.reset(new std::atomic<uint64_t>[words]);
+		for (size_t word = 0; word < words; ++word)
+		{
+			m_verified[word].store(0, std::memory_order_relaxed);
+			m_corrupt[word].store(0, std::memory_order_relaxed);
+		}
+		m_sidecar = &sidecar_;
+	}
+
+
+	bool VerifiedView::_verify(size_t blockNo_) noexcept
+	{
+		const size_t offset = blockNo_ * m_blockSize;
+		const size_t size = std::min(m_blockSize, m_size - offset);
+		const bool good = m_sidecar->check(blockNo_, m_begin + offset, size);
+
+		// Whoever sets the bit first does the counting.
+		const uint64_t bit = uint64_t(1) << (blockNo_ % 64);
+		std::atomic<uint64_t>& word = (good ? m_verified : m_corrupt)[blockNo_ / 64];
+		if ((word.fetch_or(bit, std::memory_order_acq_rel) & bit) == 0)
+			(good ? m_verifiedCount : m_corruptCount).fetch_add(1, std::memory_order_relaxed);
+		return good;
+	}
+
+
+	bool VerifiedView::verifyBlock(size_t blockNo_) noexcept
+	{
+		if (!m_sidecar || blockNo_ >= m_blockCount || isCorrupt(blockNo_))
+			return false;
+		return isVerified(blockNo_) || _verify(blockNo_);
+	}
+
+
+	const char* VerifiedView::access(size_t offset_, size_t length_) noexcept
+	{
+		if (!m_sidecar || offset_ > m_size || length_ > m_size - offset_)
+			return nullptr;
+		if (length_ == 0)
+			return m_begin + offset_;
+
+		const size_t last = (offset_ + length_ - 1) / m_blockSize;
+		for (size_t blockNo = offset_ / m_blockSize; blockNo <= last; ++blockNo)
+		{
+			if (!verifyBlock(blockNo))
+				return nullptr;
+		}
+		return m_begin + offset_;
+	}
+
+
+	std::vector<size_t> VerifiedView::corruptBlocks() const
+	{
+		std::vector<size_t> blocks;
+		for (size_t blockNo = 0; blockNo < m_blockCount; ++blockNo)
+		{
+			if (isCorrupt(blockNo))
+				blocks.push_back(blockNo);
+		}
+		return blocks;
+	}
+
+
+	//////////////////////////////////////////////////////////////////////
+	// Background sweep.
+
+	void VerifiedView::sweep(SweepOptions options_)
+	{
+		if (!m_sidecar || (m_sweeper.joinable() && !m_sweepDone.load(std::memory_order_acquire)))
+			return;
+		stopSweep();
+		m_stopSweep.store(false, std::memory_order_relaxed);
+		m_sweepDone.store(false, std::memory_order_relaxed);
+		m_sweeper = std::thread([this, options_] { _sweep(options_); });
+	}
+
+
+	void VerifiedView::stopSweep() noexcept
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_lock);
+			m_stopSweep.store(true, std::memory_order_relaxed);
+		}
+		m_wake.notify_all();
+		if (m_sweeper.joinable())
+			m_sweeper.join();
+	}
+
+
+	void VerifiedView::_sweep(SweepOptions options_) noexcept
+	{
+		if (options_.lowPriority)
+		{
+			// Only this thread: stay out of the way of the CPU and the
+			// disk while anyone else wants them.
+#if MMAPPER_API == MMAPPER_WIN32
+			SetThreadPriority(GetCurrentThread(), THREAD_MODE_BACKGROUND_BEGIN);
+#elif defined(__linux__)
+			const pid_t tid = static_cast<pid_t>(syscall(SYS_gettid));
+			setpriority(PRIO_PROCESS, static_cast<id_t>(tid), 19);
+# if defined(SYS_ioprio_set)
+			// IOPRIO_WHO_PROCESS, IOPRIO_CLASS_IDLE.
+			syscall(SYS_ioprio_set, 1, tid, 3 << 13);
+# endif
+#endif
+		}
+
+		using Clock = std::chrono::steady_clock;
+		const Clock::time_point start = Clock::now();
+		uint64_t hashed = 0;
+		for (size_t blockNo = 0; blockNo < m_blockCount; ++blockNo)
+		{
+			if (m_stopSweep.load(std::memory_order_relaxed))
+				return;
+			if (isVerified(blockNo) || isCorrupt(blockNo))
+				continue;
+			_verify(blockNo);
+			hashed += std::min(m_blockSize, m_size - blockNo * m_blockSize);
+
+			if (options_.rateLimit != 0)
+			{
+				const auto due = start + std::chrono::duration<double>(double(hashed) / double(options_.rateLimit));
+				std::unique_lock<std::mutex> lock(m_lock);
+				m_wake.wait_until(lock, std::chrono::time_point_cast<Clock::duration>(due), [this] { return m_stopSweep.load(std::memory_order_relaxed); });
+			}
+		}
+		m_sweepDone.store(true, std::memory_order_release);
+	}
+
+}
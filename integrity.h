@@ -0,0 +1,216 @@
+#pragma once
+
+// MMapper -> Integrity -- Per-block hash sidecars and a view that verifies blocks on first touch.
+// Author: Oliver "kfsone" Smith 2018 <oliver@kfs.org>
+// Redistribution and re-use fully permitted contingent on inclusion of these 3 lines in copied- or derived- works.
+
+#include "mmapper.h"
+#include "mappedarray.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+
+namespace KFS
+{
+
+	//////////////////////////////////////////////////////////////////////
+	// Sidecar format.
+	//
+	// [IntegrityHeader][uint64 hash * blockCount]
+	//
+	// Block n is bytes [n * blockSize, (n + 1) * blockSize) of the data
+	// file, the last one short. Its hash is xxhash64 of those bytes with
+	// seed + n as the seed, so a block that moved doesn't match either.
+	// Values are in the byte order of the machine that wrote the sidecar.
+
+	struct IntegrityHeader
+	{
+		static constexpr char c_magic[8]{ 'K', 'F', 'S', 'I', 'N', 'T', 'G', '1' };
+		static constexpr uint32_t c_version{ 1 };
+		static constexpr uint32_t c_byteOrderMark{ 0x01020304 };
+
+		char		magic[8];
+		uint32_t	version;
+		uint32_t	byteOrder;
+		uint64_t	seed;
+		uint64_t	blockSize;
+		uint64_t	dataSize;			// of the file the hashes describe
+		uint64_t	blockCount;
+		uint64_t	hashesOffset;		// from the start of the sidecar
+		uint64_t	reserved;
+	};
+	static_assert(sizeof(IntegrityHeader) == 64, "IntegrityHeader must be one cache line");
+
+
+	//////////////////////////////////////////////////////////////////////
+	//! @class IntegritySidecar
+	//! @brief The per-block hashes of a data file, mapped.
+	//
+	class IntegritySidecar
+	{
+		MMappedFile				m_file{};
+		const IntegrityHeader*	m_header{ nullptr };
+		MappedArray<uint64_t>	m_hashes{};
+
+	public:
+		static constexpr uint64_t c_defaultBlockSize{ 1024 * 1024 };
+
+		IntegritySidecar() noexcept = default;
+		explicit IntegritySidecar(filename_str_t filename_) MMAPPER_MAYBE_NOEXCEPT { open(std::move(filename_)); }
+
+		// Copying not allowed.
+		IntegritySidecar(const IntegritySidecar&) = delete;
+		IntegritySidecar& operator=(const IntegritySidecar&) = delete;
+
+		// Move allowed; the source is left closed.
+		IntegritySidecar(IntegritySidecar&& rhs_) noexcept
+			: m_file(std::move(rhs_.m_file))
+			, m_header(std::exchange(rhs_.m_header, nullptr))
+			, m_hashes(std::exchange(rhs_.m_hashes, MappedArray<uint64_t>{}))
+		{
+		}
+
+		IntegritySidecar& operator=(IntegritySidecar&& rhs_) noexcept
+		{
+			if (this != &rhs_)
+			{
+				close();
+				m_file = std::move(rhs_.m_file);
+				m_header = std::exchange(rhs_.m_header, nullptr);
+				m_hashes = std::exchange(rhs_.m_hashes, MappedArray<uint64_t>{});
+			}
+			return *this;
+		}
+
+		//! Hash 'data_' a block at a time, on every core, and write the
+		//! sidecar to 'filename_'.
+		//! @return true on success, false (or throw) on failure.
+		static bool write(const MMappedFile& data_, const filename_str_t& filename_,
+						  uint64_t blockSize_ = c_defaultBlockSize, uint64_t seed_ = 0) MMAPPER_MAYBE_NOEXCEPT;
+
+		//! Map and validate a sidecar.
+		bool open(filename_str_t filename_) MMAPPER_MAYBE_NOEXCEPT;
+		void close() noexcept;
+		bool isOpen() const noexcept { return m_header != nullptr; }
+
+		uint64_t blockSize() const noexcept { return m_header ? m_header->blockSize : 0; }
+		uint64_t dataSize() const noexcept { return m_header ? m_header->dataSize : 0; }
+		size_t blockCount() const noexcept { return m_hashes.size(); }
+
+		//! Does 'data_' (block 'blockNo_', blockSize bytes or the short
+		//! last block) hash to what the sidecar says?
+		bool check(size_t blockNo_, const char* data_, size_t size_) const noexcept;
+	};
+
+
+	//! How a VerifiedView's background sweep behaves.
+	struct SweepOptions
+	{
+		//! Run the sweep at idle CPU and I/O priority where the OS allows.
+		bool		lowPriority{ true };
+		//! Bytes per second to hash at most; 0 for no limit.
+		uint64_t	rateLimit{ 0 };
+	};
+
+
+	//////////////////////////////////////////////////////////////////////
+	//! @class VerifiedView
+	//! @brief A mapped data file whose blocks are checked against a
+	//! sidecar the first time they're accessed, not all up front.
+	//!
+	//! @detail Hashing a multi-GB file before using it takes minutes.
+	//! Here access() hashes only the blocks a range covers that haven't
+	//! been verified yet, so startup is free and each block costs one
+	//! hash, the first time. Verified and corrupt blocks are tracked in
+	//! atomic bitmaps: any number of threads can call access(); two
+	//! touching an unverified block at once may both hash it, which is
+	//! harmless.
+	//!
+	//! sweep() verifies the rest in the background, on a thread at idle
+	//! priority, so rot in blocks nobody happens to read is still found.
+	//!
+	//! @code
+	//!   KFS::MMappedFile data("big.dat");
+	//!   KFS::IntegritySidecar sidecar("big.dat.xxb");
+	//!   KFS::VerifiedView view(data, sidecar);
+	//!   view.sweep();
+	//!   if (const char* record = view.access(offset, length)) ...
+	//! @endcode
+	//!
+	//! The mapping and sidecar must outlive the view.
+	//
+	class VerifiedView
+	{
+		const char*								m_begin{ nullptr };
+		size_t									m_size{ 0 };
+		const IntegritySidecar*					m_sidecar{ nullptr };
+		size_t									m_blockSize{ 0 };
+		size_t									m_blockCount{ 0 };
+		std::unique_ptr<std::atomic<uint64_t>[]>	m_verified;
+		std::unique_ptr<std::atomic<uint64_t>[]>	m_corrupt;
+		std::atomic<size_t>						m_verifiedCount{ 0 };
+		std::atomic<size_t>						m_corruptCount{ 0 };
+
+		std::thread								m_sweeper;
+		std::atomic<bool>						m_stopSweep{ false };
+		std::atomic<bool>						m_sweepDone{ false };
+		std::mutex								m_lock;
+		std::condition_variable					m_wake;
+
+		bool _verify(size_t blockNo_) noexcept;
+		void _sweep(SweepOptions options_) noexcept;
+
+	public:
+		//! Check 'data_' against 'sidecar_'. If the sizes disagree the
+		//! view is invalid (or throws).
+		VerifiedView(const MMappedFile& data_, const IntegritySidecar& sidecar_) MMAPPER_MAYBE_NOEXCEPT;
+
+		VerifiedView(const VerifiedView&) = delete;
+		VerifiedView& operator=(const VerifiedView&) = delete;
+
+		//! Stops the sweep.
+		~VerifiedView() noexcept { stopSweep(); }
+
+		bool isValid() const noexcept { return m_sidecar != nullptr; }
+		size_t size() const noexcept { return m_size; }
+		size_t blockCount() const noexcept { return m_blockCount; }
+
+		//! [offset_, offset_ + length_) of the data, once every block it
+		//! touches has verified; nullptr if one is corrupt or the range is
+		//! out of bounds.
+		const char* access(size_t offset_, size_t length_) noexcept;
+
+		//! Verify a block now if it hasn't been.
+		//! @return false if it's corrupt.
+		bool verifyBlock(size_t blockNo_) noexcept;
+
+		bool isVerified(size_t blockNo_) const noexcept
+		{
+			return blockNo_ < m_blockCount && (m_verified[blockNo_ / 64].load(std::memory_order_acquire) >> (blockNo_ % 64)) & 1;
+		}
+		bool isCorrupt(size_t blockNo_) const noexcept
+		{
+			return blockNo_ < m_blockCount && (m_corrupt[blockNo_ / 64].load(std::memory_order_acquire) >> (blockNo_ % 64)) & 1;
+		}
+		size_t verifiedCount() const noexcept { return m_verifiedCount.load(std::memory_order_relaxed); }
+		size_t corruptCount() const noexcept { return m_corruptCount.load(std::memory_order_relaxed); }
+		std::vector<size_t> corruptBlocks() const;
+
+		//! Start verifying every block not yet checked on a background
+		//! thread. Does nothing if a sweep is already running.
+		void sweep(SweepOptions options_ = SweepOptions{});
+		//! Stop the sweep early (or wait for nothing if there isn't one).
+		void stopSweep() noexcept;
+		//! True once a sweep has checked every block.
+		bool sweepDone() const noexcept { return m_sweepDone.load(std::memory_order_acquire); }
+	};
+
+}
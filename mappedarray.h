@@ -0,0 +1,449 @@
+#pragma once
+
+// MMapper -> MappedArray -- Typed, zero-copy views over memory-mapped binary files.
+// Author: Oliver "kfsone" Smith 2018 <oliver@kfs.org>
+// Redistribution and re-use fully permitted contingent on inclusion of these 3 lines in copied- or derived- works.
+
+#include "mmapper.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+#include <limits>
+#include <stdexcept>
+#include <type_traits>
+
+
+namespace KFS
+{
+
+	//////////////////////////////////////////////////////////////////////
+	//! Byte order of the records in a file.
+	//
+	enum class Endian
+	{
+		Little,
+		Big,
+#if defined(__BYTE_ORDER__) && defined(__ORDER_BIG_ENDIAN__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+		Native = Big,
+#else
+		Native = Little,	// x86, x64, ARM as deployed by every platform we build for.
+#endif
+	};
+
+
+	//////////////////////////////////////////////////////////////////////
+	// Byte swapping.
+
+	namespace detail
+	{
+		inline uint16_t bswap(uint16_t v_) noexcept { return static_cast<uint16_t>((v_ << 8) | (v_ >> 8)); }
+		inline uint32_t bswap(uint32_t v_) noexcept
+		{
+#if defined(__GNUC__) || defined(__clang__)
+			return __builtin_bswap32(v_);
+#elif defined(_MSC_VER)
+			return _byteswap_ulong(v_);
+#else
+			return (v_ >> 24) | ((v_ >> 8) & 0xff00) | ((v_ << 8) & 0xff0000) | (v_ << 24);
+#endif
+		}
+		inline uint64_t bswap(uint64_t v_) noexcept
+		{
+#if defined(__GNUC__) || defined(__clang__)
+			return __builtin_bswap64(v_);
+#elif defined(_MSC_VER)
+			return _byteswap_uint64(v_);
+#else
+			return (uint64_t(bswap(uint32_t(v_))) << 32) | bswap(uint32_t(v_ >> 32));
+#endif
+		}
+
+		template<size_t Size> struct UIntOfSize;
+		template<> struct UIntOfSize<1> { using type = uint8_t; };
+		template<> struct UIntOfSize<2> { using type = uint16_t; };
+		template<> struct UIntOfSize<4> { using type = uint32_t; };
+		template<> struct UIntOfSize<8> { using type = uint64_t; };
+
+		inline uint8_t bswap(uint8_t v_) noexcept { return v_; }
+
+		//! Reverse the bytes of any 1, 2, 4 or 8 byte scalar (integers, floats, enums).
+		template<typename T>
+		T swapScalar(T value_) noexcept
+		{
+			using U = typename UIntOfSize<sizeof(T)>::type;
+			U bits;
+			std::memcpy(&bits, &value_, sizeof(bits));
+			bits = bswap(bits);
+			std::memcpy(&value_, &bits, sizeof(bits));
+			return value_;
+		}
+	}
+
+
+	//////////////////////////////////////////////////////////////////////
+	//! Customization point describing how to byte-swap a record.
+	//!
+	//! Scalars (integers, floating point and enums) are handled for you.
+	//! For your own structures, specialize this in the KFS namespace:
+	//!
+	//!   template<> struct RecordSwapper<MyRecord> {
+	//!       static void swap(MyRecord& r) noexcept {
+	//!           r.id = detail::swapScalar(r.id);
+	//!           r.score = detail::swapScalar(r.score);
+	//!       }
+	//!   };
+	//
+	template<typename T, typename Enable = void>
+	struct RecordSwapper;
+
+	template<typename T>
+	struct RecordSwapper<T, typename std::enable_if<std::is_arithmetic<T>::value || std::is_enum<T>::value>::type>
+	{
+		static void swap(T& value_) noexcept { value_ = detail::swapScalar(value_); }
+	};
+
+
+	//////////////////////////////////////////////////////////////////////
+	// Validation helpers shared by the views.
+
+	namespace detail
+	{
+		//! Report a view that can't be constructed.
+		//! @return false in no-throw mode, otherwise throws.
+		inline bool viewError(const char* reason_) MMAPPER_MAYBE_NOEXCEPT
+		{
+#ifndef MMAPPER_NO_THROW
+			throw std::runtime_error(reason_);
+#endif
+			(void)reason_;
+			return false;
+		}
+
+		//! Determine how many T's fit in [offset, offset+count) of the mapping and
+		//! check the result is well formed.
+		//!
+		//! @param[in] alignment_ required alignment of the first element, or 1 for none.
+		//! @param[in,out] count_ requested element count, or npos for "the rest of the file".
+		//! @return pointer to the first element, or nullptr if the layout is invalid.
+		inline const char* validateExtent(const MMappedFile& mf_, size_t offset_, size_t elementSize_,
+										  size_t alignment_, size_t& count_) MMAPPER_MAYBE_NOEXCEPT
+		{
+			if (!mf_.isMapped())
+			{
+				viewError("view over an unmapped file");
+				return nullptr;
+			}
+			if (offset_ > mf_.size())
+			{
+				viewError("view offset is past the end of the file");
+				return nullptr;
+			}
+
+			const char* const first = mf_.begin() + offset_;
+			if (reinterpret_cast<uintptr_t>(first) % alignment_ != 0)
+			{
+				viewError("view records are misaligned in the mapping");
+				return nullptr;
+			}
+
+			const size_t available = mf_.size() - offset_;
+			if (count_ == std::numeric_limits<size_t>::max())
+			{
+				// "The rest of the file" has to be an exact number of records,
+				// anything else means we're looking at the wrong file/format.
+				if (available % elementSize_ != 0)
+				{
+					viewError("file size is not a whole number of records");
+					return nullptr;
+				}
+				count_ = available / elementSize_;
+			}
+			else if (count_ > available / elementSize_)
+			{
+				viewError("record count exceeds the size of the file");
+				return nullptr;
+			}
+
+			return first;
+		}
+	}
+
+
+	//////////////////////////////////////////////////////////////////////
+	//! @class MappedArray
+	//! @brief A bounds- and alignment-checked array of T living directly
+	//! in a memory-mapped file.
+	//!
+	//! @detail Construction validates the layout once; after that element
+	//! access is a plain pointer dereference, and the iterators are raw
+	//! pointers so every standard algorithm works at full speed.
+	//!
+	//! The view does not own the mapping: the MMappedFile must outlive it.
+	//!
+	//! If the layout is invalid the view is empty (no-throw mode) or the
+	//! constructor throws.
+	//
+	template<typename T>
+	class MappedArray
+	{
+		static_assert(std::is_trivially_copyable<T>::value, "MappedArray records must be trivially copyable");
+		static_assert(std::is_standard_layout<T>::value, "MappedArray records must be standard layout");
+
+		const T*	m_begin{ nullptr };
+		size_t		m_count{ 0 };
+
+	public:
+		using value_type = T;
+		using size_type = size_t;
+		using difference_type = ptrdiff_t;
+		using const_reference = const T&;
+		using reference = const T&;
+		using const_pointer = const T*;
+		using const_iterator = const T*;
+		using iterator = const T*;
+		using const_reverse_iterator = std::reverse_iterator<const_iterator>;
+
+		//! Value passed as 'count' to take all the remaining records in the file.
+		static constexpr size_t npos = std::numeric_limits<size_t>::max();
+
+		MappedArray() noexcept = default;
+
+		//! View records in a mapped file.
+		//!
+		//! @param[in] mf_ the mapping to view.
+		//! @param[in] offset_ [optional] byte offset of the first record.
+		//! @param[in] count_ [optional] number of records, defaults to all remaining bytes.
+		explicit MappedArray(const MMappedFile& mf_, size_t offset_ = 0, size_t count_ = npos) MMAPPER_MAYBE_NOEXCEPT
+		{
+			size_t count = count_;
+			const char* first = detail::validateExtent(mf_, offset_, sizeof(T), alignof(T), count);
+			if (first)
+			{
+				m_begin = reinterpret_cast<const T*>(first);
+				m_count = count;
+			}
+		}
+
+		//! True if the view was constructed successfully (an empty array still counts).
+		bool isValid() const noexcept { return m_begin != nullptr; }
+
+		size_t size() const noexcept { return m_count; }
+		bool empty() const noexcept { return m_count == 0; }
+		size_t sizeBytes() const noexcept { return m_count * sizeof(T); }
+
+		const T* data() const noexcept { return m_begin; }
+		const_iterator begin() const noexcept { return m_begin; }
+		const_iterator end() const noexcept { return m_begin + m_count; }
+		const_iterator cbegin() const noexcept { return begin(); }
+		const_iterator cend() const noexcept { return end(); }
+		const_reverse_iterator rbegin() const noexcept { return const_reverse_iterator(end()); }
+		const_reverse_iterator rend() const noexcept { return const_reverse_iterator(begin()); }
+
+		const T& operator[](size_t index_) const noexcept { return m_begin[index_]; }
+		const T& front() const noexcept { return m_begin[0]; }
+		const T& back() const noexcept { return m_begin[m_count - 1]; }
+
+		//! Bounds-checked access; always throws std::out_of_range on a bad index.
+		const T& at(size_t index_) const
+		{
+			if (index_ >= m_count)
+				throw std::out_of_range("MappedArray::at");
+			return m_begin[index_];
+		}
+	};
+
+	template<typename T>
+	constexpr size_t MappedArray<T>::npos;
+
+
+	//////////////////////////////////////////////////////////////////////
+	//! @class MappedRecordView
+	//! @brief Random-access view over records stored in a fixed byte order.
+	//!
+	//! @detail Elements are returned by value: each access copies the record
+	//! out of the mapping (so no alignment requirement applies) and, when
+	//! the file's byte order differs from the host's, swaps it through
+	//! RecordSwapper<T>. Which of the two happens is decided at compile
+	//! time, so a native-order view costs one (usually elided) memcpy.
+	//!
+	//! Use MappedArray when the data is known to be in native order and
+	//! you want references; use this when the format is portable.
+	//
+	template<typename T, Endian E = Endian::Native>
+	class MappedRecordView
+	{
+		static_assert(std::is_trivially_copyable<T>::value, "MappedRecordView records must be trivially copyable");
+
+		const char*	m_begin{ nullptr };
+		size_t		m_count{ 0 };
+
+		static constexpr bool c_needsSwap = (E != Endian::Native);
+
+	public:
+		static constexpr size_t npos = std::numeric_limits<size_t>::max();
+
+		//! Read a single record from raw bytes in the view's byte order.
+		static T load(const char* ptr_) noexcept
+		{
+			T value;
+			std::memcpy(&value, ptr_, sizeof(T));
+			swapIf(value, std::integral_constant<bool, c_needsSwap>{});
+			return value;
+		}
+
+		//////////////////////////////////////////////////////////////////////
+		//! Random access iterator yielding records by value.
+		class const_iterator
+		{
+			const char*	m_ptr{ nullptr };
+
+		public:
+			using iterator_category = std::random_access_iterator_tag;
+			using value_type = T;
+			using difference_type = ptrdiff_t;
+			using pointer = void;
+			using reference = T;	// Records are materialized on access.
+
+			const_iterator() noexcept = default;
+			explicit const_iterator(const char* ptr_) noexcept : m_ptr(ptr_) {}
+
+			T operator*() const noexcept { return load(m_ptr); }
+			T operator[](difference_type n_) const noexcept { return load(m_ptr + n_ * difference_type(sizeof(T))); }
+
+			const_iterator& operator++() noexcept { m_ptr += sizeof(T); return *this; }
+			const_iterator operator++(int) noexcept { const_iterator t{ *this }; ++*this; return t; }
+			const_iterator& operator--() noexcept { m_ptr -= sizeof(T); return *this; }
+			const_iterator operator--(int) noexcept { const_iterator t{ *this }; --*this; return t; }
+			const_iterator& operator+=(difference_type n_) noexcept { m_ptr += n_ * difference_type(sizeof(T)); return *this; }
+			const_iterator& operator-=(difference_type n_) noexcept { m_ptr -= n_ * difference_type(sizeof(T)); return *this; }
+			friend const_iterator operator+(const_iterator it_, difference_type n_) noexcept { return it_ += n_; }
+			friend const_iterator operator+(difference_type n_, const_iterator it_) noexcept { return it_ += n_; }
+			friend const_iterator operator-(const_iterator it_, difference_type n_) noexcept { return it_ -= n_; }
+			friend difference_type operator-(const_iterator lhs_, const_iterator rhs_) noexcept
+			{
+				return (lhs_.m_ptr - rhs_.m_ptr) / difference_type(sizeof(T));
+			}
+
+			friend bool operator==(const_iterator lhs_, const_iterator rhs_) noexcept { return lhs_.m_ptr == rhs_.m_ptr; }
+			friend bool operator!=(const_iterator lhs_, const_iterator rhs_) noexcept { return lhs_.m_ptr != rhs_.m_ptr; }
+			friend bool operator<(const_iterator lhs_, const_iterator rhs_) noexcept { return lhs_.m_ptr < rhs_.m_ptr; }
+			friend bool operator>(const_iterator lhs_, const_iterator rhs_) noexcept { return lhs_.m_ptr > rhs_.m_ptr; }
+			friend bool operator<=(const_iterator lhs_, const_iterator rhs_) noexcept { return lhs_.m_ptr <= rhs_.m_ptr; }
+			friend bool operator>=(const_iterator lhs_, const_iterator rhs_) noexcept { return lhs_.m_ptr >= rhs_.m_ptr; }
+
+			//! Address of the underlying record in the mapping.
+			const char* raw() const noexcept { return m_ptr; }
+		};
+		using iterator = const_iterator;
+		using value_type = T;
+		using size_type = size_t;
+
+		MappedRecordView() noexcept = default;
+
+		//! View records in a mapped file.
+		//!
+		//! @param[in] mf_ the mapping to view.
+		//! @param[in] offset_ [optional] byte offset of the first record.
+		//! @param[in] count_ [optional] number of records, defaults to all remaining bytes.
+		explicit MappedRecordView(const MMappedFile& mf_, size_t offset_ = 0, size_t count_ = npos) MMAPPER_MAYBE_NOEXCEPT
+		{
+			size_t count = count_;
+			const char* first = detail::validateExtent(mf_, offset_, sizeof(T), 1, count);
+			if (first)
+			{
+				m_begin = first;
+				m_count = count;
+			}
+		}
+
+		bool isValid() const noexcept { return m_begin != nullptr; }
+		size_t size() const noexcept { return m_count; }
+		bool empty() const noexcept { return m_count == 0; }
+
+		const_iterator begin() const noexcept { return const_iterator(m_begin); }
+		const_iterator end() const noexcept { return const_iterator(m_begin + m_count * sizeof(T)); }
+
+		T operator[](size_t index_) const noexcept { return load(m_begin + index_ * sizeof(T)); }
+		T front() const noexcept { return (*this)[0]; }
+		T back() const noexcept { return (*this)[m_count - 1]; }
+
+		T at(size_t index_) const
+		{
+			if (index_ >= m_count)
+				throw std::out_of_range("MappedRecordView::at");
+			return (*this)[index_];
+		}
+
+		//! Raw bytes of the records, in file order.
+		const char* data() const noexcept { return m_begin; }
+
+	private:
+		static void swapIf(T&, std::false_type) noexcept {}
+		static void swapIf(T& value_, std::true_type) noexcept { RecordSwapper<T>::swap(value_); }
+	};
+
+	template<typename T, Endian E>
+	constexpr size_t MappedRecordView<T, E>::npos;
+
+
+	//////////////////////////////////////////////////////////////////////
+	//! @class MappedTable
+	//! @brief The common "fixed header followed by an array of records"
+	//! file layout.
+	//!
+	//! @detail The header is loaded (and byte-swapped if required) once at
+	//! construction, the records are a MappedRecordView starting at the
+	//! first suitably aligned offset after the header. The record count
+	//! is either the rest of the file or computed from the header:
+	//!
+	//!   KFS::MappedTable<Header, Entry, KFS::Endian::Little> table{
+	//!       mf, [](const Header& h) { return size_t(h.entryCount); } };
+	//!
+	//! Header is validated for size only; checking magic numbers and
+	//! versions is up to the caller.
+	//
+	template<typename Header, typename Record, Endian E = Endian::Native>
+	class MappedTable
+	{
+		static_assert(std::is_trivially_copyable<Header>::value, "MappedTable header must be trivially copyable");
+
+		Header							m_header{};
+		MappedRecordView<Record, E>		m_records{};
+		bool							m_valid{ false };
+
+	public:
+		//! Byte offset of the first record.
+		static constexpr size_t c_recordOffset = (sizeof(Header) + alignof(Record) - 1) / alignof(Record) * alignof(Record);
+
+		MappedTable() noexcept = default;
+
+		//! Header followed by records filling the rest of the file.
+		explicit MappedTable(const MMappedFile& mf_) MMAPPER_MAYBE_NOEXCEPT
+			: MappedTable(mf_, [](const Header&) { return MappedRecordView<Record, E>::npos; })
+		{}
+
+		//! Header followed by 'countFn_(header)' records.
+		template<typename CountFn>
+		MappedTable(const MMappedFile& mf_, CountFn&& countFn_) MMAPPER_MAYBE_NOEXCEPT
+		{
+			if (!mf_.isMapped() || mf_.size() < c_recordOffset)
+			{
+				detail::viewError("file is too small to contain the table header");
+				return;
+			}
+			m_header = MappedRecordView<Header, E>::load(mf_.begin());
+			m_records = MappedRecordView<Record, E>(mf_, c_recordOffset, static_cast<size_t>(countFn_(m_header)));
+			m_valid = m_records.isValid();
+		}
+
+		bool isValid() const noexcept { return m_valid; }
+		const Header& header() const noexcept { return m_header; }
+		const MappedRecordView<Record, E>& records() const noexcept { return m_records; }
+	};
+
+	template<typename Header, typename Record, Endian E>
+	constexpr size_t MappedTable<Header, Record, E>::c_recordOffset;
+
+}
@@ -0,0 +1,256 @@
+// MMapper -> MappedHashTable -- Read-only key/value tables used directly from a mapping.
+// Author: Oliver "kfsone" Smith 2018 <oliver@kfs.org>
+// Redistribution and re-use fully permitted contingent on inclusion of these 3 lines in copied- or derived- works.
+
+#include "mappedhashtable.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <stdexcept>
+
+#include "3rdParty/xxhash.hpp"
+
+
+namespace KFS
+{
+
+	constexpr char HashTableHeader::c_magic[8];
+	constexpr uint32_t HashTableHeader::c_version;
+	constexpr uint32_t HashTableHeader::c_byteOrderMark;
+	constexpr size_t HashBucket::c_slots;
+
+
+	//////////////////////////////////////////////////////////////////////
+	// Helpers shared by the builder and the reader.
+
+	static inline uint64_t _hashKey(const void* key_, size_t keyLen_, uint64_t seed_) noexcept
+	{
+		return xxh::xxhash<64>(static_cast<const char*>(key_), keyLen_, seed_);
+	}
+
+	// Fingerprints come from the bits the bucket index doesn't use, and
+	// zero is reserved to mean "empty slot".
+	static inline uint16_t _fingerprint(uint64_t hash_) noexcept
+	{
+		const uint16_t fp = static_cast<uint16_t>(hash_ >> 48);
+		return fp ? fp : 1;
+	}
+
+	static inline uint32_t _readU32(const char* ptr_) noexcept
+	{
+		uint32_t value;
+		std::memcpy(&value, ptr_, sizeof(value));
+		return value;
+	}
+
+	static inline bool _fail(const char* reason_) MMAPPER_MAYBE_NOEXCEPT
+	{
+#ifndef MMAPPER_NO_THROW
+		throw std::runtime_error(reason_);
+#endif
+		(void)reason_;
+		return false;
+	}
+
+
+	//////////////////////////////////////////////////////////////////////
+	// Builder.
+
+	bool MappedHashTableBuilder::add(const void* key_, size_t keyLen_, const void* value_, size_t valueLen_) MMAPPER_MAYBE_NOEXCEPT
+	{
+		constexpr size_t maxLen = std::numeric_limits<uint32_t>::max();
+		if (keyLen_ > maxLen || valueLen_ > maxLen)
+			return _fail("hash table key or value too large");
+
+		const uint64_t offset = m_heap.size();
+		const uint32_t lengths[2]{ static_cast<uint32_t>(keyLen_), static_cast<uint32_t>(valueLen_) };
+		const char* const lenBytes = reinterpret_cast<const char*>(lengths);
+		m_heap.insert(m_heap.end(), lenBytes, lenBytes + sizeof(lengths));
+		m_heap.insert(m_heap.end(), static_cast<const char*>(key_), static_cast<const char*>(key_) + keyLen_);
+		m_heap.insert(m_heap.end(), static_cast<const char*>(value_), static_cast<const char*>(value_) + valueLen_);
+
+		m_entries.push_back(Entry{ _hashKey(key_, keyLen_, m_seed), offset });
+		return true;
+	}
+
+
+	bool MappedHashTableBuilder::write(const filename_str_t& filename_) const MMAPPER_MAYBE_NOEXCEPT
+	{
+		// Size for a 75% slot load factor; the bucket count must be a
+		// power of two so the home bucket is just a mask of the hash.
+		const uint64_t wantSlots = m_entries.size() + m_entries.size() / 3 + 1;
+		uint64_t bucketCount = 1;
+		while (bucketCount * HashBucket::c_slots < wantSlots)
+			bucketCount <<= 1;
+		const uint64_t mask = bucketCount - 1;
+
+		std::vector<HashBucket> buckets(static_cast<size_t>(bucketCount));
+		std::memset(buckets.data(), 0, buckets.size() * sizeof(HashBucket));
+
+		auto sameKey = [this](uint64_t lhs_, uint64_t rhs_) {
+			const char* const l = m_heap.data() + lhs_;
+			const char* const r = m_heap.data() + rhs_;
+			const uint32_t len = _readU32(l);
+			return len == _readU32(r) && std::memcmp(l + 8, r + 8, len) == 0;
+		};
+
+		uint64_t entryCount = 0;
+		for (const Entry& entry : m_entries)
+		{
+			const uint16_t fp = _fingerprint(entry.hash);
+			for (uint64_t bucketNo = entry.hash & mask; ; bucketNo = (bucketNo + 1) & mask)
+			{
+				HashBucket& bucket = buckets[static_cast<size_t>(bucketNo)];
+				size_t slot = 0;
+				for ( ; slot < HashBucket::c_slots && bucket.fingerprints[slot] != 0; ++slot)
+				{
+					// Later additions of the same key replace earlier ones.
+					if (bucket.fingerprints[slot] == fp && sameKey(bucket.offsets[slot], entry.heapOffset))
+						break;
+				}
+				if (slot == HashBucket::c_slots)
+					continue;
+				if (bucket.fingerprints[slot] == 0)
+					++entryCount;
+				bucket.fingerprints[slot] = fp;
+				bucket.offsets[slot] = entry.heapOffset;
+				break;
+			}
+		}
+
+		HashTableHeader header{};
+		std::memcpy(header.magic, HashTableHeader::c_magic, sizeof(header.magic));
+		header.version = HashTableHeader::c_version;
+		header.byteOrder = HashTableHeader::c_byteOrderMark;
+		header.seed = m_seed;
+		header.entryCount = entryCount;
+		header.bucketCount = bucketCount;
+		header.bucketsOffset = sizeof(HashTableHeader);
+		header.heapOffset = header.bucketsOffset + bucketCount * sizeof(HashBucket);
+		header.heapSize = m_heap.size();
+
+		std::ofstream out(filename_, std::ios::binary | std::ios::trunc);
+		if (!out)
+			return _fail("unable to create hash table file");
+		out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		out.write(reinterpret_cast<const char*>(buckets.data()), buckets.size() * sizeof(HashBucket));
+		out.write(m_heap.data(), m_heap.size());
+		out.close();
+		if (!out)
+			return _fail("failed writing hash table file");
+
+		return true;
+	}
+
+
+	//////////////////////////////////////////////////////////////////////
+	// Reader.
+
+	bool MappedHashTable::open(filename_str_t filename_) MMAPPER_MAYBE_NOEXCEPT
+	{
+		close();
+
+		if (!m_file.mapFile(std::move(filename_)))
+			return false;
+
+		if (m_file.size() < sizeof(HashTableHeader))
+		{
+			close();
+			return _fail("file is too small to be a hash table");
+		}
+
+		// The mapping is page aligned, so the header can be used in place.
+		const HashTableHeader* header = m_file.begin<HashTableHeader>();
+		if (std::memcmp(header->magic, HashTableHeader::c_magic, sizeof(header->magic)) != 0
+			|| header->version != HashTableHeader::c_version)
+		{
+			close();
+			return _fail("not a hash table file");
+		}
+		if (header->byteOrder != HashTableHeader::c_byteOrderMark)
+		{
+			close();
+			return _fail("hash table was built with a different byte order");
+		}
+
+		const uint64_t fileSize = m_file.size();
+		const uint64_t bucketBytes = header->bucketCount * sizeof(HashBucket);
+		if (header->bucketCount == 0 || (header->bucketCount & (header->bucketCount - 1)) != 0
+			|| header->bucketCount > fileSize / sizeof(HashBucket)
+			|| header->bucketsOffset > fileSize - bucketBytes
+			|| header->heapOffset < header->bucketsOffset + bucketBytes
+			|| header->heapOffset > fileSize || header->heapSize > fileSize - header->heapOffset)
+		{
+			close();
+			return _fail("hash table header is corrupt");
+		}
+
+		m_buckets = MappedArray<HashBucket>(m_file, static_cast<size_t>(header->bucketsOffset), static_cast<size_t>(header->bucketCount));
+		if (!m_buckets.isValid())
+		{
+			close();
+			return false;
+		}
+
+		m_header = header;
+		m_heap = m_file.begin() + header->heapOffset;
+		m_heapSize = static_cast<size_t>(header->heapSize);
+		return true;
+	}
+
+
+	void MappedHashTable::close() noexcept
+	{
+		m_header = nullptr;
+		m_buckets = MappedArray<HashBucket>{};
+		m_heap = nullptr;
+		m_heapSize = 0;
+		if (m_file.isMapped())
+			m_file.unmapFile();
+	}
+
+
+	HashTableValue MappedHashTable::find(const void* key_, size_t keyLen_) const noexcept
+	{
+		if (!m_header)
+			return HashTableValue{};
+
+		const uint64_t hash = _hashKey(key_, keyLen_, m_header->seed);
+		const uint16_t fp = _fingerprint(hash);
+		const size_t mask = m_buckets.size() - 1;
+
+		// Every probe is bounded by the bucket count so a corrupt table
+		// with no empty slots can't loop forever.
+		size_t bucketNo = static_cast<size_t>(hash) & mask;
+		for (size_t probes = 0; probes < m_buckets.size(); ++probes, bucketNo = (bucketNo + 1) & mask)
+		{
+			const HashBucket& bucket = m_buckets[bucketNo];
+			for (size_t slot = 0; slot < HashBucket::c_slots; ++slot)
+			{
+				const uint16_t slotFp = bucket.fingerprints[slot];
+				if (slotFp == 0)
+					return HashTableValue{};	// Chain ends at the first hole.
+				if (slotFp != fp)
+					continue;
+
+				const uint64_t offset = bucket.offsets[slot];
+				if (offset > m_heapSize || m_heapSize - offset < 8)
+					continue;
+				const char* const entry = m_heap + offset;
+				const uint32_t keyLen = _readU32(entry);
+				const uint32_t valueLen = _readU32(entry + 4);
+				if (keyLen != keyLen_ || m_heapSize - offset - 8 < uint64_t(keyLen) + valueLen)
+					continue;
+				if (std::memcmp(entry + 8, key_, keyLen) != 0)
+					continue;
+
+				return HashTableValue{ entry + 8 + keyLen, valueLen };
+			}
+		}
+
+		return HashTableValue{};
+	}
+
+}
@@ -0,0 +1,182 @@
+#pragma once
+
+// MMapper -> MappedHashTable -- Read-only key/value tables used directly from a mapping.
+// Author: Oliver "kfsone" Smith 2018 <oliver@kfs.org>
+// Redistribution and re-use fully permitted contingent on inclusion of these 3 lines in copied- or derived- works.
+
+#include "mmapper.h"
+#include "mappedarray.h"
+
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+
+namespace KFS
+{
+
+	//////////////////////////////////////////////////////////////////////
+	// On-disk format.
+	//
+	// [HashTableHeader][padding to 64][HashBucket * bucketCount][heap]
+	//
+	// Keys are hashed with xxhash64. The low bits of the hash select the
+	// home bucket, the top 16 bits are the key's fingerprint. Buckets are
+	// one cache line each and are probed linearly, so a lookup normally
+	// touches the home bucket and then the heap entry it points at.
+	//
+	// Heap entries are [uint32 keyLen][uint32 valueLen][key][value] and
+	// are not aligned. All values are in the byte order of the machine
+	// that built the table; the reader refuses a table from a foreign one.
+
+	struct HashTableHeader
+	{
+		static constexpr char c_magic[8]{ 'K', 'F', 'S', 'H', 'T', 'A', 'B', '1' };
+		static constexpr uint32_t c_version{ 1 };
+		static constexpr uint32_t c_byteOrderMark{ 0x01020304 };
+
+		char		magic[8];
+		uint32_t	version;
+		uint32_t	byteOrder;
+		uint64_t	seed;
+		uint64_t	entryCount;
+		uint64_t	bucketCount;		// Always a power of two.
+		uint64_t	bucketsOffset;		// Multiple of 64 from the start of the file.
+		uint64_t	heapOffset;
+		uint64_t	heapSize;
+	};
+	static_assert(sizeof(HashTableHeader) == 64, "HashTableHeader must be one cache line");
+
+	struct alignas(64) HashBucket
+	{
+		static constexpr size_t c_slots{ 6 };
+
+		//! Fingerprint per slot; 0 marks an empty slot.
+		uint16_t	fingerprints[c_slots];
+		uint16_t	reserved[2];
+		//! Offset of each slot's entry relative to the start of the heap.
+		uint64_t	offsets[c_slots];
+	};
+	static_assert(sizeof(HashBucket) == 64, "HashBucket must be one cache line");
+
+
+	//////////////////////////////////////////////////////////////////////
+	//! A value located in a table; points into the mapping.
+	struct HashTableValue
+	{
+		const char*	data{ nullptr };
+		size_t		size{ 0 };
+
+		explicit operator bool() const noexcept { return data != nullptr; }
+	};
+
+
+	//////////////////////////////////////////////////////////////////////
+	//! @class MappedHashTableBuilder
+	//! @brief Collects key/value pairs in memory and writes them out in
+	//! the MappedHashTable format.
+	//!
+	//! @detail Adding a key that's already present replaces its value.
+	//
+	class MappedHashTableBuilder
+	{
+		struct Entry
+		{
+			uint64_t	hash;
+			uint64_t	heapOffset;
+		};
+
+		uint64_t			m_seed;
+		std::vector<char>	m_heap{};
+		std::vector<Entry>	m_entries{};
+
+	public:
+		explicit MappedHashTableBuilder(uint64_t seed_ = 0) noexcept : m_seed(seed_) {}
+
+		//! Queue a key/value pair for writing.
+		//! @return false if the key or value is too large for the format.
+		bool add(const void* key_, size_t keyLen_, const void* value_, size_t valueLen_) MMAPPER_MAYBE_NOEXCEPT;
+		bool add(const std::string& key_, const std::string& value_) MMAPPER_MAYBE_NOEXCEPT
+		{
+			return add(key_.data(), key_.size(), value_.data(), value_.size());
+		}
+
+		//! Number of pairs added so far (including replaced duplicates).
+		size_t size() const noexcept { return m_entries.size(); }
+
+		//! Lay out the table and write it to disk.
+		//! @return true on success, false (or throw) on I/O failure.
+		bool write(const filename_str_t& filename_) const MMAPPER_MAYBE_NOEXCEPT;
+	};
+
+
+	//////////////////////////////////////////////////////////////////////
+	//! @class MappedHashTable
+	//! @brief O(1) lookups into a table file without loading it.
+	//!
+	//! @detail Opening the table is a single mmap plus header validation;
+	//! pages are faulted in as lookups touch them. Lookups are const and
+	//! thread safe.
+	//
+	class MappedHashTable
+	{
+		MMappedFile				m_file{};
+		const HashTableHeader*	m_header{ nullptr };
+		MappedArray<HashBucket>	m_buckets{};
+		const char*				m_heap{ nullptr };
+		size_t					m_heapSize{ 0 };
+
+	public:
+		MappedHashTable() noexcept = default;
+		explicit MappedHashTable(filename_str_t filename_) MMAPPER_MAYBE_NOEXCEPT { open(std::move(filename_)); }
+
+		// Copying not allowed.
+		MappedHashTable(const MappedHashTable&) = delete;
+		MappedHashTable& operator=(const MappedHashTable&) = delete;
+
+		// Move allowed; the source is left closed.
+		MappedHashTable(MappedHashTable&& rhs_) noexcept
+			: m_file(std::move(rhs_.m_file))
+			, m_header(std::exchange(rhs_.m_header, nullptr))
+			, m_buckets(std::exchange(rhs_.m_buckets, MappedArray<HashBucket>{}))
+			, m_heap(std::exchange(rhs_.m_heap, nullptr))
+			, m_heapSize(std::exchange(rhs_.m_heapSize, 0))
+		{
+		}
+
+		MappedHashTable& operator=(MappedHashTable&& rhs_) noexcept
+		{
+			if (this != &rhs_)
+			{
+				close();
+				m_file = std::move(rhs_.m_file);
+				m_header = std::exchange(rhs_.m_header, nullptr);
+				m_buckets = std::exchange(rhs_.m_buckets, MappedArray<HashBucket>{});
+				m_heap = std::exchange(rhs_.m_heap, nullptr);
+				m_heapSize = std::exchange(rhs_.m_heapSize, 0);
+			}
+			return *this;
+		}
+
+		//! Map and validate a table file.
+		//! @return true if the file was mapped and is a usable table.
+		bool open(filename_str_t filename_) MMAPPER_MAYBE_NOEXCEPT;
+
+		//! Release the table.
+		void close() noexcept;
+
+		bool isOpen() const noexcept { return m_header != nullptr; }
+
+		//! Number of distinct keys in the table.
+		size_t size() const noexcept { return m_header ? static_cast<size_t>(m_header->entryCount) : 0; }
+
+		//! Look up a key.
+		//! @return the value, which evaluates false if the key isn't present.
+		HashTableValue find(const void* key_, size_t keyLen_) const noexcept;
+		HashTableValue find(const std::string& key_) const noexcept { return find(key_.data(), key_.size()); }
+
+		bool contains(const void* key_, size_t keyLen_) const noexcept { return static_cast<bool>(find(key_, keyLen_)); }
+	};
+
+}
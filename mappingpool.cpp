@@ -0,0 +1,384 @@
+// MMapper -> MappingPool -- Reuse reserved address ranges for short-lived file mappings.
+// Author: Oliver "kfsone" Smith 2018 <oliver@kfs.org>
+// Redistribution and re-use fully permitted contingent on inclusion of these 3 lines in copied- or derived- works.
+
+#include "mappingpool.h"
+#include "filehandle.h"
+#include "internal_includes.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <new>
+#include <stdexcept>
+#include <thread>
+#include <tuple>
+#include <utility>
+
+#if MMAPPER_API == MMAPPER_WIN32
+# include <malloc.h>
+#endif
+
+
+namespace KFS
+{
+
+	constexpr uint32_t PooledMapping::c_unpooled;
+
+	// Smallest slot, in pages.
+	static constexpr size_t c_minSlotPages{ 16 };
+
+	// Slots a thread takes from a slab at a time.
+	static constexpr size_t c_carveBatch{ 8 };
+
+	// Slabs are at least this big.
+	static constexpr size_t c_minSlabBytes{ 32 * 1024 * 1024 };
+
+
+	static inline bool _fail(const char* reason_) MMAPPER_MAYBE_NOEXCEPT
+	{
+#ifndef MMAPPER_NO_THROW
+		throw std::runtime_error(reason_);
+#endif
+		(void)reason_;
+		return false;
+	}
+
+#if MMAPPER_API == MMAPPER_POSIX
+	// Replace whatever is mapped over a range with an unbacked, read-only
+	// anonymous placeholder - without ever leaving a hole someone else's
+	// mmap() could land in. It reads as zeros, which is what provides the
+	// '\0' after files that end on a page boundary.
+	static inline void _placeholder(char* base_, size_t length_) noexcept
+	{
+		mmap(base_, length_, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED, -1, 0);
+	}
+#endif
+
+
+	//////////////////////////////////////////////////////////////////////
+	// PooledMapping.
+
+	PooledMapping::PooledMapping(PooledMapping&& rhs_) noexcept
+		: m_pool(std::exchange(rhs_.m_pool, nullptr))
+		, m_basePtr(std::exchange(rhs_.m_basePtr, nullptr))
+		, m_size(std::exchange(rhs_.m_size, 0))
+		, m_mappedBytes(std::exchange(rhs_.m_mappedBytes, 0))
+		, m_sizeClass(rhs_.m_sizeClass)
+	{
+	}
+
+	PooledMapping& PooledMapping::operator=(PooledMapping&& rhs_) noexcept
+	{
+		if (this != &rhs_)
+		{
+			release();
+			m_pool = std::exchange(rhs_.m_pool, nullptr);
+			m_basePtr = std::exchange(rhs_.m_basePtr, nullptr);
+			m_size = std::exchange(rhs_.m_size, 0);
+			m_mappedBytes = std::exchange(rhs_.m_mappedBytes, 0);
+			m_sizeClass = rhs_.m_sizeClass;
+		}
+		return *this;
+	}
+
+	void PooledMapping::release() noexcept
+	{
+		if (!m_pool)
+			return;
+		m_pool->giveBack(*this);
+		m_pool = nullptr;
+		m_basePtr = nullptr;
+		m_size = 0;
+		m_mappedBytes = 0;
+	}
+
+
+	//////////////////////////////////////////////////////////////////////
+	// Shards, each on its own cache lines.
+
+	std::unique_ptr<MappingPool::Shard[], MappingPool::ShardsDeleter> MappingPool::allocShards(uint32_t count_)
+	{
+		const size_t bytes = sizeof(Shard) * count_;
+#if MMAPPER_API == MMAPPER_WIN32
+		void* memory = _aligned_malloc(bytes, alignof(Shard));
+#else
+		void* memory = nullptr;
+		if (posix_memalign(&memory, alignof(Shard), bytes) != 0)
+			memory = nullptr;
+#endif
+		if (!memory)
+			throw std::bad_alloc();
+
+		Shard* const shards = static_cast<Shard*>(memory);
+		for (uint32_t shardNo = 0; shardNo < count_; ++shardNo)
+			new (shards + shardNo) Shard;
+		return std::unique_ptr<Shard[], ShardsDeleter>(shards, ShardsDeleter{ count_ });
+	}
+
+	void MappingPool::ShardsDeleter::operator()(Shard* shards_) const noexcept
+	{
+		for (uint32_t shardNo = 0; shardNo < count; ++shardNo)
+			shards_[shardNo].~Shard();
+#if MMAPPER_API == MMAPPER_WIN32
+		_aligned_free(shards_);
+#else
+		free(shards_);
+#endif
+	}
+
+
+	//////////////////////////////////////////////////////////////////////
+	// Pool lifetime.
+
+	MappingPool::MappingPool(size_t maxPooledBytes_, size_t retireBatch_)
+		: m_minSlot(AddressRange::pageSize() * c_minSlotPages)
+		, m_classes(1)
+		, m_retireBatch(std::max<size_t>(retireBatch_, 1))
+	{
+		while (slotSize(m_classes - 1) < maxPooledBytes_ && m_classes < 32)
+			++m_classes;
+
+		// Enough shards that concurrent threads rarely share one.
+		m_shardCount = std::max(4u, std::thread::hardware_concurrency() * 2);
+		m_shards = allocShards(m_shardCount);
+		for (uint32_t shardNo = 0; shardNo < m_shardCount; ++shardNo)
+		{
+			m_shards[shardNo].clean.resize(m_classes);
+			m_shards[shardNo].stale.resize(m_classes);
+		}
+		m_carvers.resize(m_classes);
+	}
+
+	MappingPool::~MappingPool() noexcept
+	{
+		// Releasing the slabs unmaps everything in them, stale or not.
+	}
+
+
+	MappingPool::Shard& MappingPool::localShard() noexcept
+	{
+		static std::atomic<uint32_t> s_nextThread{ 0 };
+		thread_local const uint32_t t_threadNo = s_nextThread.fetch_add(1, std::memory_order_relaxed);
+		return m_shards[t_threadNo % m_shardCount];
+	}
+
+
+	//////////////////////////////////////////////////////////////////////
+	// Slots.
+
+	bool MappingPool::carveSlots(Shard& shard_, uint32_t sizeClass_) MMAPPER_MAYBE_NOEXCEPT
+	{
+		const size_t slotBytes = slotSize(sizeClass_);
+		Slot carved[c_carveBatch];
+		size_t count = 0;
+		{
+			std::lock_guard<std::mutex> lock(m_slabLock);
+			ClassCarver& carver = m_carvers[sizeClass_];
+			if (carver.next == carver.end)
+			{
+				AddressRange slab;
+				if (!slab.reserve(std::max(c_minSlabBytes, slotBytes * c_carveBatch)))
+					return false;
+#if MMAPPER_API == MMAPPER_POSIX
+				// Reserved space is inaccessible; slots need to read as zeros.
+				if (mprotect(slab.data(), slab.size(), PROT_READ) != 0)
+					return _fail("unable to prepare mapping pool slab");
+#endif
+				carver.next = slab.data();
+				carver.end = slab.data() + slab.size() / slotBytes * slotBytes;
+				m_slabs.emplace_back(std::move(slab));
+			}
+			for ( ; count < c_carveBatch && carver.next != carver.end; ++count, carver.next += slotBytes)
+				carved[count] = Slot{ carver.next, 0 };
+		}
+
+		std::lock_guard<std::mutex> lock(shard_.lock);
+		shard_.clean[sizeClass_].insert(shard_.clean[sizeClass_].end(), carved, carved + count);
+		return true;
+	}
+
+	bool MappingPool::takeSlot(Shard& shard_, uint32_t sizeClass_, Slot& slot_) MMAPPER_MAYBE_NOEXCEPT
+	{
+		auto pop = [&](std::vector<Slot>& list_) {
+			std::lock_guard<std::mutex> lock(shard_.lock);
+			if (list_.empty())
+				return false;
+			slot_ = list_.back();
+			list_.pop_back();
+			return true;
+		};
+
+		// Clean slots first: mapping over a placeholder has nothing to
+		// flush from the TLBs. Then fresh address space, and only when
+		// that's exhausted, a stale slot.
+		if (pop(shard_.clean[sizeClass_]))
+			return true;
+		if (carveSlots(shard_, sizeClass_) && pop(shard_.clean[sizeClass_]))
+			return true;
+		if (!pop(shard_.stale[sizeClass_]))
+			return false;
+		std::lock_guard<std::mutex> lock(shard_.lock);
+		--shard_.staleCount;
+		return true;
+	}
+
+	void MappingPool::giveBack(PooledMapping& mapping_) noexcept
+	{
+		char* const base = const_cast<char*>(mapping_.m_basePtr);
+		if (mapping_.m_sizeClass == PooledMapping::c_unpooled)
+		{
+#if MMAPPER_API == MMAPPER_WIN32
+			UnmapViewOfFile(base);
+#else
+			munmap(base, mapping_.m_mappedBytes);
+#endif
+			return;
+		}
+
+		Shard& shard = localShard();
+		std::lock_guard<std::mutex> lock(shard.lock);
+		shard.stale[mapping_.m_sizeClass].push_back(Slot{ base, mapping_.m_mappedBytes });
+		if (++shard.staleCount >= m_retireBatch)
+			retire(shard);
+	}
+
+
+	//////////////////////////////////////////////////////////////////////
+	// Tear down a shard's stale slots in as few calls as possible.
+	// Caller holds the shard lock.
+
+	void MappingPool::retire(Shard& shard_) noexcept
+	{
+#if MMAPPER_API == MMAPPER_POSIX
+		// (base, slot size, class)
+		std::vector<std::tuple<char*, size_t, uint32_t>> slots;
+		slots.reserve(shard_.staleCount);
+		for (uint32_t sizeClass = 0; sizeClass < m_classes; ++sizeClass)
+		{
+			for (const Slot& slot : shard_.stale[sizeClass])
+				slots.emplace_back(slot.base, slotSize(sizeClass), sizeClass);
+			shard_.stale[sizeClass].clear();
+		}
+		std::sort(slots.begin(), slots.end());
+
+		// Neighbouring slots are replaced in one call: one syscall and one
+		// TLB flush per run rather than per slot.
+		for (size_t first = 0; first < slots.size(); )
+		{
+			size_t last = first;
+			while (last + 1 < slots.size() && std::get<0>(slots[last]) + std::get<1>(slots[last]) == std::get<0>(slots[last + 1]))
+				++last;
+			char* const runStart = std::get<0>(slots[first]);
+			_placeholder(runStart, static_cast<size_t>(std::get<0>(slots[last]) + std::get<1>(slots[last]) - runStart));
+			for ( ; first <= last; ++first)
+				shard_.clean[std::get<2>(slots[first])].push_back(Slot{ std::get<0>(slots[first]), 0 });
+		}
+#endif
+		shard_.staleCount = 0;
+	}
+
+	void MappingPool::flush() noexcept
+	{
+		for (uint32_t shardNo = 0; shardNo < m_shardCount; ++shardNo)
+		{
+			std::lock_guard<std::mutex> lock(m_shards[shardNo].lock);
+			if (m_shards[shardNo].staleCount)
+				retire(m_shards[shardNo]);
+		}
+	}
+
+
+	//////////////////////////////////////////////////////////////////////
+	// Map a file.
+
+	bool MappingPool::map(const filename_str_t& filename_, PooledMapping& into_) MMAPPER_MAYBE_NOEXCEPT
+	{
+		into_.release();
+
+		FileHandle fh{ filename_ };
+		if (!fh.isValid())
+			return false;
+		const size_t size = fh.uncachedFileSize();
+		if (!size)
+			return _fail("trying to map zero-sized file");
+
+#if MMAPPER_API == MMAPPER_WIN32
+		// Windows: no pooling (placeholders need MapViewOfFile3, Windows 10+).
+		FileHandle mapFh{ CreateFileMapping(fh, NULL, PAGE_READONLY, 0, 0, NULL) };
+		if (!mapFh.isValid())
+			return _fail("Failed to create file mapping");
+		LPVOID const ptr = MapViewOfFileEx(mapFh, FILE_MAP_READ, 0, 0, 0, NULL);
+		if (!ptr)
+			return _fail("Mapping failed");
+		into_.m_pool = this;
+		into_.m_basePtr = static_cast<const char*>(ptr);
+		into_.m_size = size;
+		into_.m_mappedBytes = size;
+		into_.m_sizeClass = PooledMapping::c_unpooled;
+		return true;
+#else
+		// A file that ends exactly on a page boundary needs another page
+		// (of placeholder) for its terminating '\0'.
+		const size_t page = AddressRange::pageSize();
+		const size_t fileBytes = (size + page - 1) & ~(page - 1);
+		const size_t needed = (size % page) ? fileBytes : fileBytes + page;
+
+		if (needed > largestSlot())
+		{
+			// Too big to pool. Map it normally, over a zero page when the
+			// last page of the file has no room for the '\0'.
+			void* ptr = MAP_FAILED;
+			if (needed == fileBytes)
+				ptr = mmap(NULL, fileBytes, PROT_READ, MAP_SHARED, fh, 0);
+			else
+			{
+				ptr = mmap(NULL, needed, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+				if (ptr != MAP_FAILED && mmap(ptr, fileBytes, PROT_READ, MAP_SHARED | MAP_FIXED, fh, 0) == MAP_FAILED)
+				{
+					munmap(ptr, needed);
+					ptr = MAP_FAILED;
+				}
+			}
+			if (ptr == MAP_FAILED)
+				return _fail("Mapping failed");
+			into_.m_pool = this;
+			into_.m_basePtr = static_cast<const char*>(ptr);
+			into_.m_size = size;
+			into_.m_mappedBytes = needed;
+			into_.m_sizeClass = PooledMapping::c_unpooled;
+			return true;
+		}
+
+		uint32_t sizeClass = 0;
+		while (slotSize(sizeClass) < needed)
+			++sizeClass;
+
+		Shard& shard = localShard();
+		Slot slot;
+		if (!takeSlot(shard, sizeClass, slot))
+			return _fail("unable to reserve a mapping pool slot");
+
+		if (mmap(slot.base, fileBytes, PROT_READ, MAP_SHARED | MAP_FIXED, fh, 0) == MAP_FAILED)
+		{
+			// A failed MAP_FIXED may have removed part of the old mapping;
+			// reset the whole slot.
+			_placeholder(slot.base, slotSize(sizeClass));
+			std::lock_guard<std::mutex> lock(shard.lock);
+			shard.clean[sizeClass].push_back(Slot{ slot.base, 0 });
+			return _fail("Mapping into pool slot failed");
+		}
+
+		// Don't leave a previous, longer file visible past our end.
+		if (slot.mappedBytes > fileBytes)
+			_placeholder(slot.base + fileBytes, slot.mappedBytes - fileBytes);
+
+		into_.m_pool = this;
+		into_.m_basePtr = slot.base;
+		into_.m_size = size;
+		into_.m_mappedBytes = fileBytes;
+		into_.m_sizeClass = sizeClass;
+		return true;
+#endif
+	}
+
+}
@@ -0,0 +1,170 @@
+#pragma once
+
+// MMapper -> MappingPool -- Reuse reserved address ranges for short-lived file mappings.
+// Author: Oliver "kfsone" Smith 2018 <oliver@kfs.org>
+// Redistribution and re-use fully permitted contingent on inclusion of these 3 lines in copied- or derived- works.
+
+#include "mmapper_platform.h"
+#include "addressspace.h"
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+
+namespace KFS
+{
+
+	class MappingPool;
+
+
+	//////////////////////////////////////////////////////////////////////
+	//! @class PooledMapping
+	//! @brief A read-only file mapping that lives in a MappingPool slot.
+	//! Same accessors as MMappedFile; hands the slot back when destroyed.
+	//
+	class PooledMapping
+	{
+		friend class MappingPool;
+
+		MappingPool*	m_pool{ nullptr };
+		const char*		m_basePtr{ nullptr };
+		size_t			m_size{ 0 };
+		size_t			m_mappedBytes{ 0 };		// slot bytes currently mapped
+		uint32_t		m_sizeClass{ 0 };			// or c_unpooled
+
+	public:
+		static constexpr uint32_t c_unpooled{ ~uint32_t(0) };
+
+		PooledMapping() noexcept = default;
+		~PooledMapping() noexcept { release(); }
+
+		// Copying not allowed.
+		PooledMapping(const PooledMapping&) = delete;
+		PooledMapping& operator=(const PooledMapping&) = delete;
+
+		// Move allowed; the source is left unmapped.
+		PooledMapping(PooledMapping&& rhs_) noexcept;
+		PooledMapping& operator=(PooledMapping&& rhs_) noexcept;
+
+		//! Give the slot back to the pool.
+		void release() noexcept;
+
+		bool isMapped() const noexcept { return m_basePtr != nullptr; }
+
+		//! The contents, followed by a '\0' byte (as with MMappedFile).
+		template<typename T=char>
+		const T* begin() const noexcept { return reinterpret_cast<const T*>(m_basePtr); }
+
+		template<typename T=char>
+		const T* end() const noexcept { return reinterpret_cast<const T*>(m_basePtr + m_size); }
+
+		size_t size() const noexcept { return m_size; }
+	};
+
+
+	//////////////////////////////////////////////////////////////////////
+	//! @class MappingPool
+	//! @brief Maps many short-lived files without an mmap/munmap pair each.
+	//!
+	//! @detail Every MMappedFile creates and destroys a mapping; with many
+	//! threads doing that, they serialize on the process's mmap lock and
+	//! every munmap sends TLB shootdowns to the other cores.
+	//!
+	//! The pool reserves address space in slabs, cut into power-of-two
+	//! size-class slots that hold a read-only, unbacked placeholder. A
+	//! file is mapped into a clean slot with MAP_FIXED, which atomically
+	//! replaces the placeholder and, with nothing to unmap, needs no TLB
+	//! flush. Released slots go onto the releasing thread's stale list
+	//! still holding the file; once there are retireBatch_ of them they
+	//! are put back to placeholders together, adjacent slots coalesced
+	//! into one call. So a map/release pair costs one mmap plus a share
+	//! of a batched teardown, rather than an mmap, a munmap and a
+	//! shootdown each.
+	//!
+	//! The byte after the contents always reads as '\0': the kernel zero
+	//! fills the tail of the last page, and files that end exactly on a
+	//! page boundary are followed by the placeholder's zeros.
+	//!
+	//! Files larger than the biggest size class are mapped normally.
+	//! On Windows every file is mapped normally.
+	//!
+	//! Free lists are sharded per thread; the pool must outlive the
+	//! PooledMappings it hands out.
+	//
+	class MappingPool
+	{
+		friend class PooledMapping;
+
+		struct Slot
+		{
+			char*		base;
+			size_t		mappedBytes;
+		};
+
+		struct alignas(64) Shard
+		{
+			std::mutex						lock;
+			std::vector<std::vector<Slot>>	clean;		// per class: placeholder only
+			std::vector<std::vector<Slot>>	stale;		// per class: still holds an old mapping
+			size_t							staleCount{ 0 };
+		};
+
+		// new[] only honours alignas(64) from C++17, so the shards are
+		// allocated aligned by hand and this destroys and frees them.
+		struct ShardsDeleter
+		{
+			uint32_t	count;
+			void operator()(Shard* shards_) const noexcept;
+		};
+
+		struct ClassCarver
+		{
+			char*	next{ nullptr };
+			char*	end{ nullptr };
+		};
+
+		size_t							m_minSlot;
+		uint32_t						m_classes;
+		size_t							m_retireBatch;
+		std::unique_ptr<Shard[], ShardsDeleter>	m_shards;
+		uint32_t						m_shardCount;
+
+		std::mutex						m_slabLock;
+		std::vector<AddressRange>		m_slabs;
+		std::vector<ClassCarver>		m_carvers;
+
+	public:
+		//! @param[in] maxPooledBytes_ largest file kept in the pool (rounded up to a power of two).
+		//! @param[in] retireBatch_ stale slots a thread accumulates before tearing them down.
+		explicit MappingPool(size_t maxPooledBytes_ = 16 * 1024 * 1024, size_t retireBatch_ = 32);
+		~MappingPool() noexcept;
+
+		MappingPool(const MappingPool&) = delete;
+		MappingPool& operator=(const MappingPool&) = delete;
+
+		//! Map a file read-only.
+		//! @return true on success.
+		bool map(const filename_str_t& filename_, PooledMapping& into_) MMAPPER_MAYBE_NOEXCEPT;
+
+		//! Tear down every stale slot now (e.g. before deleting files that
+		//! were mapped).
+		void flush() noexcept;
+
+		//! Size of the largest slot; files (plus their terminating page)
+		//! bigger than this are mapped normally.
+		size_t largestSlot() const noexcept { return slotSize(m_classes - 1); }
+
+	private:
+		size_t slotSize(uint32_t sizeClass_) const noexcept { return m_minSlot << sizeClass_; }
+		static std::unique_ptr<Shard[], ShardsDeleter> allocShards(uint32_t count_);
+		Shard& localShard() noexcept;
+		bool takeSlot(Shard& shard_, uint32_t sizeClass_, Slot& slot_) MMAPPER_MAYBE_NOEXCEPT;
+		bool carveSlots(Shard& shard_, uint32_t sizeClass_) MMAPPER_MAYBE_NOEXCEPT;
+		void giveBack(PooledMapping& mapping_) noexcept;
+		void retire(Shard& shard_) noexcept;
+	};
+
+}
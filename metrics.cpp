@@ -0,0 +1,334 @@
+// MMapper -> Metrics -- Library-wide counters and latency histograms.
+// Author: Oliver "kfsone" Smith 2018 <oliver@kfs.org>
+// Redistribution and re-use fully permitted contingent on inclusion of these 3 lines in copied- or derived- works.
+
+#include "metrics.h"
+
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+
+namespace KFS
+{
+
+	constexpr unsigned LatencyHistogram::c_subBits;
+	constexpr unsigned LatencyHistogram::c_subBuckets;
+	constexpr size_t LatencyHistogram::c_buckets;
+	constexpr size_t MetricsSnapshot::c_errorBuckets;
+
+
+	//////////////////////////////////////////////////////////////////////
+	// Histogram helpers.
+
+	uint64_t LatencyHistogram::bucketLimit(size_t bucket_) noexcept
+	{
+		if (bucket_ < c_subBuckets)
+			return bucket_;
+		const size_t shift = (bucket_ - c_subBuckets) / c_subBuckets;
+		const uint64_t lower = (c_subBuckets + (bucket_ - c_subBuckets) % c_subBuckets) << shift;
+		return lower + ((uint64_t(1) << shift) - 1);
+	}
+
+	uint64_t LatencyHistogram::percentile(double fraction_) const noexcept
+	{
+		if (!count)
+			return 0;
+		const uint64_t rank = std::max<uint64_t>(1, static_cast<uint64_t>(fraction_ * static_cast<double>(count) + 0.5));
+		uint64_t seen = 0;
+		for (size_t bucket = 0; bucket < c_buckets; ++bucket)
+		{
+			seen += counts[bucket];
+			if (seen >= rank)
+				return std::min(bucketLimit(bucket), maxNs);
+		}
+		return maxNs;
+	}
+
+
+	//////////////////////////////////////////////////////////////////////
+	// JSON.
+
+	static void _appendField(std::string& json_, const char* name_, uint64_t value_, bool comma_ = true)
+	{
+		json_ += '"';
+		json_ += name_;
+		json_ += "\":";
+		json_ += std::to_string(value_);
+		if (comma_)
+			json_ += ',';
+	}
+
+	static void _appendHistogram(std::string& json_, const char* name_, const LatencyHistogram& histogram_)
+	{
+		json_ += '"';
+		json_ += name_;
+		json_ += "\":{";
+		_appendField(json_, "count", histogram_.count);
+		_appendField(json_, "mean_ns", histogram_.meanNs());
+		_appendField(json_, "p50_ns", histogram_.percentile(0.50));
+		_appendField(json_, "p90_ns", histogram_.percentile(0.90));
+		_appendField(json_, "p99_ns", histogram_.percentile(0.99));
+		_appendField(json_, "p999_ns", histogram_.percentile(0.999));
+		_appendField(json_, "max_ns", histogram_.maxNs);
+		json_ += "\"buckets\":[";
+		bool first = true;
+		for (size_t bucket = 0; bucket < LatencyHistogram::c_buckets; ++bucket)
+		{
+			if (!histogram_.counts[bucket])
+				continue;
+			if (!first)
+				json_ += ',';
+			first = false;
+			json_ += '[' + std::to_string(LatencyHistogram::bucketLimit(bucket)) + ',' + std::to_string(histogram_.counts[bucket]) + ']';
+		}
+		json_ += "]}";
+	}
+
+	std::string MetricsSnapshot::toJson() const
+	{
+		std::string json = "{";
+		json += enabled ? "\"enabled\":true," : "\"enabled\":false,";
+		_appendField(json, "maps", maps);
+		_appendField(json, "unmaps", unmaps);
+		_appendField(json, "failures", failures);
+		json += "\"failures_by_error\":{";
+		bool first = true;
+		for (size_t error = 0; error < c_errorBuckets; ++error)
+		{
+			if (!failuresByError[error])
+				continue;
+			if (!first)
+				json += ',';
+			first = false;
+			json += '"' + (error + 1 < c_errorBuckets ? std::to_string(error) : std::string("other")) + "\":" + std::to_string(failuresByError[error]);
+		}
+		json += "},";
+		_appendField(json, "bytes_mapped", bytesMapped);
+		_appendField(json, "peak_bytes_mapped", peakBytesMapped);
+		_appendField(json, "total_bytes_mapped", totalBytesMapped);
+		json += "\"latency\":{";
+		_appendHistogram(json, "open", (*this)[MetricsOp::Open]);
+		json += ',';
+		_appendHistogram(json, "stat", (*this)[MetricsOp::Stat]);
+		json += ',';
+		_appendHistogram(json, "map", (*this)[MetricsOp::Map]);
+		json += ',';
+		_appendHistogram(json, "unmap", (*this)[MetricsOp::Unmap]);
+		json += "}}";
+		return json;
+	}
+
+
+#if defined(MMAPPER_ENABLE_METRICS)
+
+	//////////////////////////////////////////////////////////////////////
+	// Per-thread counts. Only the owning thread writes, so a relaxed load
+	// and store is enough; readers may see a count a moment stale.
+
+	namespace
+	{
+		using Counter = std::atomic<uint64_t>;
+
+		inline void _bump(Counter& counter_, uint64_t by_ = 1) noexcept
+		{
+			counter_.store(counter_.load(std::memory_order_relaxed) + by_, std::memory_order_relaxed);
+		}
+
+		inline uint64_t _read(const Counter& counter_) noexcept
+		{
+			return counter_.load(std::memory_order_relaxed);
+		}
+
+		constexpr size_t c_ops = static_cast<size_t>(MetricsOp::c_count);
+
+		struct ThreadHistogram
+		{
+			Counter		counts[LatencyHistogram::c_buckets]{};
+			Counter		count{ 0 };
+			Counter		totalNs{ 0 };
+			Counter		maxNs{ 0 };
+		};
+
+		struct ThreadBlock
+		{
+			Counter			maps{ 0 };
+			Counter			unmaps{ 0 };
+			Counter			failures{ 0 };
+			Counter			failuresByError[MetricsSnapshot::c_errorBuckets]{};
+			Counter			totalBytesMapped{ 0 };
+			ThreadHistogram	latency[c_ops]{};
+
+			ThreadBlock() noexcept;
+			~ThreadBlock() noexcept;
+
+			void addTo(MetricsSnapshot& into_) const noexcept
+			{
+				into_.maps += _read(maps);
+				into_.unmaps += _read(unmaps);
+				into_.failures += _read(failures);
+				for (size_t error = 0; error < MetricsSnapshot::c_errorBuckets; ++error)
+					into_.failuresByError[error] += _read(failuresByError[error]);
+				into_.totalBytesMapped += _read(totalBytesMapped);
+				for (size_t op = 0; op < c_ops; ++op)
+				{
+					LatencyHistogram& histogram = into_.latency[op];
+					const ThreadHistogram& mine = latency[op];
+					for (size_t bucket = 0; bucket < LatencyHistogram::c_buckets; ++bucket)
+						histogram.counts[bucket] += _read(mine.counts[bucket]);
+					histogram.count += _read(mine.count);
+					histogram.totalNs += _read(mine.totalNs);
+					histogram.maxNs = std::max(histogram.maxNs, _read(mine.maxNs));
+				}
+			}
+		};
+
+		// Live blocks, plus what exited threads left behind.
+		struct Registry
+		{
+			std::mutex					lock;
+			std::vector<ThreadBlock*>	live;
+			MetricsSnapshot				retired;
+			MetricsSnapshot				baseline;	// subtracted by snapshot(), set by reset()
+		};
+
+		Registry& _registry() noexcept
+		{
+			// Leaked: threads may exit after static destruction starts.
+			static Registry* registry = new Registry;
+			return *registry;
+		}
+
+		std::atomic<uint64_t> s_bytesMapped{ 0 };
+		std::atomic<uint64_t> s_peakBytesMapped{ 0 };
+
+		ThreadBlock::ThreadBlock() noexcept
+		{
+			Registry& registry = _registry();
+			std::lock_guard<std::mutex> guard(registry.lock);
+			registry.live.push_back(this);
+		}
+
+		ThreadBlock::~ThreadBlock() noexcept
+		{
+			Registry& registry = _registry();
+			std::lock_guard<std::mutex> guard(registry.lock);
+			addTo(registry.retired);
+			registry.live.erase(std::find(registry.live.begin(), registry.live.end(), this));
+		}
+
+		ThreadBlock& _mine() noexcept
+		{
+			static thread_local ThreadBlock block;
+			return block;
+		}
+	}
+
+
+	//////////////////////////////////////////////////////////////////////
+	// Recording.
+
+	void Metrics::recordMap(size_t bytes_) noexcept
+	{
+		ThreadBlock& block = _mine();
+		_bump(block.maps);
+		_bump(block.totalBytesMapped, bytes_);
+
+		const uint64_t now = s_bytesMapped.fetch_add(bytes_, std::memory_order_relaxed) + bytes_;
+		uint64_t peak = s_peakBytesMapped.load(std::memory_order_relaxed);
+		while (now > peak && !s_peakBytesMapped.compare_exchange_weak(peak, now, std::memory_order_relaxed))
+			;
+	}
+
+	void Metrics::recordUnmap(size_t bytes_) noexcept
+	{
+		_bump(_mine().unmaps);
+		s_bytesMapped.fetch_sub(bytes_, std::memory_order_relaxed);
+	}
+
+	void Metrics::recordFailure(long error_) noexcept
+	{
+		ThreadBlock& block = _mine();
+		_bump(block.failures);
+		const size_t bucket = error_ >= 0 && static_cast<size_t>(error_) < MetricsSnapshot::c_errorBuckets - 1
+							? static_cast<size_t>(error_) : MetricsSnapshot::c_errorBuckets - 1;
+		_bump(block.failuresByError[bucket]);
+	}
+
+	void Metrics::recordLatency(MetricsOp op_, uint64_t ns_) noexcept
+	{
+		ThreadHistogram& histogram = _mine().latency[static_cast<size_t>(op_)];
+		_bump(histogram.counts[LatencyHistogram::bucketFor(ns_)]);
+		_bump(histogram.count);
+		_bump(histogram.totalNs, ns_);
+		if (ns_ > _read(histogram.maxNs))
+			histogram.maxNs.store(ns_, std::memory_order_relaxed);
+	}
+
+
+	//////////////////////////////////////////////////////////////////////
+	// Reading.
+
+	static MetricsSnapshot _sum(Registry& registry_)
+	{
+		MetricsSnapshot total = registry_.retired;
+		for (const ThreadBlock* block : registry_.live)
+			block->addTo(total);
+		return total;
+	}
+
+	MetricsSnapshot Metrics::snapshot()
+	{
+		Registry& registry = _registry();
+		std::lock_guard<std::mutex> guard(registry.lock);
+		MetricsSnapshot snap = _sum(registry);
+		const MetricsSnapshot& base = registry.baseline;
+
+		snap.enabled = true;
+		snap.maps -= base.maps;
+		snap.unmaps -= base.unmaps;
+		snap.failures -= base.failures;
+		for (size_t error = 0; error < MetricsSnapshot::c_errorBuckets; ++error)
+			snap.failuresByError[error] -= base.failuresByError[error];
+		snap.totalBytesMapped -= base.totalBytesMapped;
+		for (size_t op = 0; op < c_ops; ++op)
+		{
+			LatencyHistogram& histogram = snap.latency[op];
+			for (size_t bucket = 0; bucket < LatencyHistogram::c_buckets; ++bucket)
+				histogram.counts[bucket] -= base.latency[op].counts[bucket];
+			histogram.count -= base.latency[op].count;
+			histogram.totalNs -= base.latency[op].totalNs;
+			// The maximum can't be un-merged; drop it if it's from before reset().
+			if (!histogram.count)
+				histogram.maxNs = 0;
+		}
+		snap.bytesMapped = s_bytesMapped.load(std::memory_order_relaxed);
+		snap.peakBytesMapped = s_peakBytesMapped.load(std::memory_order_relaxed);
+		return snap;
+	}
+
+	void Metrics::reset() noexcept
+	{
+		// Other threads own their blocks, so rather than zero them we
+		// remember where they were.
+		Registry& registry = _registry();
+		std::lock_guard<std::mutex> guard(registry.lock);
+		registry.baseline = _sum(registry);
+		s_peakBytesMapped.store(s_bytesMapped.load(std::memory_order_relaxed), std::memory_order_relaxed);
+	}
+
+#else
+
+	MetricsSnapshot Metrics::snapshot()
+	{
+		return MetricsSnapshot{};
+	}
+
+	void Metrics::reset() noexcept
+	{
+	}
+
+#endif
+
+}
@@ -0,0 +1,171 @@
+#pragma once
+
+// MMapper -> Metrics -- Library-wide counters and latency histograms.
+// Author: Oliver "kfsone" Smith 2018 <oliver@kfs.org>
+// Redistribution and re-use fully permitted contingent on inclusion of these 3 lines in copied- or derived- works.
+
+#include "mmapper_platform.h"
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+
+namespace KFS
+{
+
+	//////////////////////////////////////////////////////////////////////
+	//! @class LatencyHistogram
+	//! @brief Log-linear histogram of durations in nanoseconds.
+	//!
+	//! @detail Like HDR histograms: each power of two is split into
+	//! c_subBuckets linear buckets, so any value is recorded to within
+	//! 1/c_subBuckets (12.5%) from 1ns to centuries in a fixed 4KB.
+	//
+	struct LatencyHistogram
+	{
+		static constexpr unsigned c_subBits{ 3 };
+		static constexpr unsigned c_subBuckets{ 1u << c_subBits };
+		static constexpr size_t c_buckets{ c_subBuckets + (64 - c_subBits) * c_subBuckets };
+
+		uint64_t	counts[c_buckets]{};
+		uint64_t	count{ 0 };
+		uint64_t	totalNs{ 0 };
+		uint64_t	maxNs{ 0 };
+
+		static size_t bucketFor(uint64_t ns_) noexcept
+		{
+			if (ns_ < c_subBuckets)
+				return static_cast<size_t>(ns_);
+			unsigned exponent = 63;
+			while (!(ns_ >> exponent))
+				--exponent;
+			const unsigned shift = exponent - c_subBits;
+			return c_subBuckets + shift * c_subBuckets + static_cast<size_t>((ns_ >> shift) & (c_subBuckets - 1));
+		}
+
+		//! Largest value that lands in 'bucket_'.
+		static uint64_t bucketLimit(size_t bucket_) noexcept;
+
+		//! Upper bound of the bucket holding the 'fraction_' (0..1)
+		//! quantile, e.g. 0.99 for p99; 0 if empty.
+		uint64_t percentile(double fraction_) const noexcept;
+
+		uint64_t meanNs() const noexcept { return count ? totalNs / count : 0; }
+	};
+
+
+	//! Which latency histogram a measurement goes in.
+	enum class MetricsOp
+	{
+		Open,		//!< opening the file
+		Stat,		//!< fetching its size
+		Map,		//!< mmap / MapViewOfFile
+		Unmap,		//!< munmap / UnmapViewOfFile (or handing it to a Reclaimer)
+		c_count
+	};
+
+
+	//! A point-in-time copy of all the library's metrics.
+	struct MetricsSnapshot
+	{
+		//! Failure codes below this get their own bucket; the rest share
+		//! the last one.
+		static constexpr size_t c_errorBuckets{ 64 };
+
+		bool				enabled{ false };
+		uint64_t			maps{ 0 };
+		uint64_t			unmaps{ 0 };
+		uint64_t			failures{ 0 };
+		//! Failures by errno (GetLastError() on Windows); 0 is for
+		//! failures without a system error, e.g. an empty file.
+		uint64_t			failuresByError[c_errorBuckets]{};
+		uint64_t			bytesMapped{ 0 };		//!< currently
+		uint64_t			peakBytesMapped{ 0 };
+		uint64_t			totalBytesMapped{ 0 };	//!< ever
+		LatencyHistogram	latency[static_cast<size_t>(MetricsOp::c_count)]{};
+
+		const LatencyHistogram& operator[](MetricsOp op_) const noexcept { return latency[static_cast<size_t>(op_)]; }
+
+		//! The snapshot as a JSON object; histograms are summarized as
+		//! count, mean, p50/p90/p99/p999 and max, plus their non-empty
+		//! buckets as [limit_ns, count] pairs.
+		std::string toJson() const;
+	};
+
+
+	//////////////////////////////////////////////////////////////////////
+	//! @class Metrics
+	//! @brief What the library has been doing: maps, unmaps, failures,
+	//! bytes mapped, and how long the system calls behind them took.
+	//!
+	//! @detail Built with MMAPPER_ENABLE_METRICS (CMake option of the same
+	//! name), each thread counts into its own block - plain loads and
+	//! stores, no locked instructions - and snapshot() adds the blocks up.
+	//! Only bytes-mapped and its peak are shared atomics, since a mapping
+	//! may be released by a different thread than mapped it.
+	//!
+	//! Without it, the recording calls are empty inline functions,
+	//! Timer is an empty object, and snapshot() returns zeros with
+	//! enabled == false: nothing is left in the generated code.
+	//
+	class Metrics
+	{
+	public:
+#if defined(MMAPPER_ENABLE_METRICS)
+		static constexpr bool c_enabled{ true };
+
+		static void recordMap(size_t bytes_) noexcept;
+		static void recordUnmap(size_t bytes_) noexcept;
+		static void recordFailure(long error_) noexcept;
+		static void recordLatency(MetricsOp op_, uint64_t ns_) noexcept;
+
+		//! Times from construction to stop() (or destruction) into one of
+		//! the latency histograms.
+		class Timer
+		{
+			MetricsOp								m_op;
+			bool									m_running{ true };
+			std::chrono::steady_clock::time_point	m_start;
+
+		public:
+			explicit Timer(MetricsOp op_) noexcept : m_op(op_), m_start(std::chrono::steady_clock::now()) {}
+			~Timer() noexcept { stop(); }
+			Timer(const Timer&) = delete;
+			Timer& operator=(const Timer&) = delete;
+
+			void stop() noexcept
+			{
+				if (!m_running)
+					return;
+				m_running = false;
+				recordLatency(m_op, static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - m_start).count()));
+			}
+		};
+#else
+		static constexpr bool c_enabled{ false };
+
+		static void recordMap(size_t) noexcept {}
+		static void recordUnmap(size_t) noexcept {}
+		static void recordFailure(long) noexcept {}
+		static void recordLatency(MetricsOp, uint64_t) noexcept {}
+
+		class Timer
+		{
+		public:
+			explicit Timer(MetricsOp) noexcept {}
+			void stop() noexcept {}
+		};
+#endif
+
+		//! Add up every thread's counts.
+		static MetricsSnapshot snapshot();
+
+		//! Start counting afresh. bytesMapped still tracks live mappings,
+		//! and a histogram's maxNs only clears once nothing recorded
+		//! before the reset remains.
+		static void reset() noexcept;
+	};
+
+}
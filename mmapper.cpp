@@ -6,9 +6,12 @@
 
 #include <stdexcept>
 #include <cstring>
+#include <utility>
 
 #include "mmapper.h"
 #include "filehandle.h"
+#include "metrics.h"
+#include "reclaimer.h"
 #include "internal_includes.h"
 
 
@@ -29,6 +32,20 @@ namespace KFS
 	}
 
 
+	//////////////////////////////////////////////////////////////////////
+	// The error code behind a failed system call, for the metrics.
+
+	static inline long
+	_lastError() noexcept
+	{
+	#if MMAPPER_API == MMAPPER_WIN32
+		return static_cast<long>(GetLastError());
+	#else
+		return errno;
+	#endif
+	}
+
+
 	//////////////////////////////////////////////////////////////////////
 	// Constructor (POSIX + Windows versions combined)
 	// Note: POSIX doesn't support wchar_t filenames.
@@ -60,6 +77,33 @@ namespace KFS
 	}
 
 
+	//////////////////////////////////////////////////////////////////////
+	// Move: take ownership of the mapping, leaving the source unmapped so
+	// that only one of us releases it.
+
+	MMappedFile::MMappedFile(MMappedFile&& rhs_) noexcept
+		: m_filename(std::move(rhs_.m_filename))
+		, m_basePtr(std::exchange(rhs_.m_basePtr, nullptr))
+		, m_endPtr(std::exchange(rhs_.m_endPtr, nullptr))
+		, m_reclaimer(rhs_.m_reclaimer)
+	{
+	}
+
+	MMappedFile& MMappedFile::operator = (MMappedFile&& rhs_) noexcept
+	{
+		if (this != &rhs_)
+		{
+			if (isMapped())
+				unmapFile();
+			m_filename = std::move(rhs_.m_filename);
+			m_basePtr = std::exchange(rhs_.m_basePtr, nullptr);
+			m_endPtr = std::exchange(rhs_.m_endPtr, nullptr);
+			m_reclaimer = rhs_.m_reclaimer;
+		}
+		return *this;
+	}
+
+
 	//////////////////////////////////////////////////////////////////////
 	// Attempt to open a file. Returns false on error.
 
@@ -72,13 +116,21 @@ namespace KFS
 		// New filename.	
 		m_filename = _populateFilename(dirname_, filename_);
 
+		Metrics::Timer openTimer{ MetricsOp::Open };
 		FileHandle fh{ m_filename };
+		openTimer.stop();
 		if (!fh.isValid())
+		{
+			Metrics::recordFailure(_lastError());
 			return false;
+		}
 
+		Metrics::Timer statTimer{ MetricsOp::Stat };
 		auto size = fh.uncachedFileSize();
+		statTimer.stop();
 		if (!size)
 		{
+			Metrics::recordFailure(0);
 	#ifndef MMAPPER_NO_THROW
 			throw std::runtime_error("trying to map zero-sized file");
 	#endif
@@ -90,9 +142,11 @@ namespace KFS
 		// but then give us direct access to the buffer memory".
 	#if MMAPPER_API == MMAPPER_WIN32
 		// Windows implementation.
+		Metrics::Timer mapTimer{ MetricsOp::Map };
 		FileHandle mapFh{ CreateFileMapping(fh, NULL, PAGE_READONLY, 0, 0, NULL) };
 		if (!mapFh.isValid())
 		{
+			Metrics::recordFailure(_lastError());
 	#ifndef MMAPPER_NO_THROW
 			throw std::runtime_error("Failed to create file mapping");
 	#endif
@@ -105,6 +159,7 @@ namespace KFS
 		fh.close();
 
 		LPVOID const ptr = MapViewOfFileEx(mapFh, FILE_MAP_READ, 0, 0, 0, NULL);
+		mapTimer.stop();
 		constexpr LPVOID MapFailure = nullptr;
 	#else
 		// POSIX implementation.
@@ -115,12 +170,15 @@ namespace KFS
 
 		// We ask the OS to give us a byte more than the file requires so that
 		// we can be sure we have a null-byte after the real data.
+		Metrics::Timer mapTimer{ MetricsOp::Map };
 		void* const ptr = mmap(NULL, size + 1, PROT_READ, flags, fh, 0);
+		mapTimer.stop();
 		static const void* MapFailure = MAP_FAILED;
 	#endif
 
 		if (ptr == MapFailure)
 		{
+			Metrics::recordFailure(_lastError());
 	#ifndef MMAPPER_NO_THROW
 			throw std::runtime_error("Mapping failed");
 	#endif
@@ -135,6 +193,7 @@ namespace KFS
 
 		// For convenience, pre-calculate where the end of the data is.
 		m_endPtr = begin() + size;
+		Metrics::recordMap(size);
 
 		// All the file handles we have open at this point are now safe to close.
 
@@ -155,13 +214,22 @@ namespace KFS
 			return false;
 		}
 
+		Metrics::Timer unmapTimer{ MetricsOp::Unmap };
 	#if MMAPPER_API == MMAPPER_WIN32
-		UnmapViewOfFile(m_basePtr);
+		if (m_reclaimer)
+			m_reclaimer->retire(const_cast<void*>(m_basePtr), size());
+		else
+			UnmapViewOfFile(m_basePtr);
 	#else
 		// We asked for an extra byte when we mmap()d, so we have to
 		// include it when we unmap.
-		munmap(const_cast<void*>(m_basePtr), size() + 1);
+		if (m_reclaimer)
+			m_reclaimer->retire(const_cast<void*>(m_basePtr), size() + 1);
+		else
+			munmap(const_cast<void*>(m_basePtr), size() + 1);
 	#endif
+		unmapTimer.stop();
+		Metrics::recordUnmap(size());
 
 		m_filename.clear();
 		m_basePtr = nullptr;
@@ -9,6 +9,8 @@
 namespace KFS
 {
 
+	class Reclaimer;
+
 	//////////////////////////////////////////////////////////////////////
 	//! @class MMapper
 	//! @brief Provides an interface for basic memory-mapped file access
@@ -44,6 +46,9 @@ namespace KFS
 		//! For convenience, where the file would end.
 		const char*		m_endPtr{ nullptr };
 
+		//! If set, unmapping is handed to this instead of done inline.
+		Reclaimer*		m_reclaimer{ nullptr };
+
 	public:
 		//! Simple default CTor.
 		MMappedFile() noexcept = default;
@@ -62,9 +67,9 @@ namespace KFS
 		MMappedFile(const MMappedFile& rhs) = delete;
 		MMappedFile& operator = (const MMappedFile& rhs_) = delete;
 
-		// Move allowed.
-		MMappedFile(MMappedFile&& rhs_) noexcept = default;
-		MMappedFile& operator = (MMappedFile&& rhs_) noexcept = default;
+		// Move allowed; the source is left unmapped.
+		MMappedFile(MMappedFile&& rhs_) noexcept;
+		MMappedFile& operator = (MMappedFile&& rhs_) noexcept;
 
 	public:
 		//! Open a new file (closes any currently open file first).
@@ -79,6 +84,13 @@ namespace KFS
 		//! @return true on success, or false/throw if the file is already unmapped.
 		bool unmapFile() MMAPPER_MAYBE_NOEXCEPT;
 
+		//! Opt in to deferred release: from now on, unmapFile() and the
+		//! destructor hand the mapping to 'reclaimer_' (e.g.
+		//! &Reclaimer::global()) rather than unmapping it inline. Pass
+		//! nullptr to go back to unmapping inline. The reclaimer must
+		//! outlive this object's mappings.
+		void deferRelease(Reclaimer* reclaimer_) noexcept { m_reclaimer = reclaimer_; }
+
 		//////////////////////////////////////////////////////////////////////
 		// Accessors.
 
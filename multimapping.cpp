@@ -0,0 +1,144 @@
+// MMapper -> MultiMappedFile -- Several files mapped back to back as one address range.
+// Author: Oliver "kfsone" Smith 2018 <oliver@kfs.org>
+// Redistribution and re-use fully permitted contingent on inclusion of these 3 lines in copied- or derived- works.
+
+#include "multimapping.h"
+#include "filehandle.h"
+#include "internal_includes.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+
+namespace KFS
+{
+
+	static inline bool _fail(const char* reason_) MMAPPER_MAYBE_NOEXCEPT
+	{
+#ifndef MMAPPER_NO_THROW
+		throw std::runtime_error(reason_);
+#endif
+		(void)reason_;
+		return false;
+	}
+
+
+	MultiMappedFile::MultiMappedFile(const std::vector<filename_str_t>& filenames_, PaddingPolicy padding_) MMAPPER_MAYBE_NOEXCEPT
+	{
+		map(filenames_, padding_);
+	}
+
+	void MultiMappedFile::unmap() noexcept
+	{
+		// The reservation spans every shard mapping: one call drops them all.
+		m_range.release();
+		m_shards.clear();
+		m_size = 0;
+	}
+
+
+	//////////////////////////////////////////////////////////////////////
+	// Map the shards.
+
+	bool MultiMappedFile::map(const std::vector<filename_str_t>& filenames_, PaddingPolicy padding_) MMAPPER_MAYBE_NOEXCEPT
+	{
+		unmap();
+		if (filenames_.empty())
+			return _fail("no files to map");
+
+#if MMAPPER_API == MMAPPER_WIN32
+		(void)padding_;
+		return _fail("multi-file mappings are not supported on Windows");
+#else
+		const size_t page = AddressRange::pageSize();
+		auto roundUp = [page](size_t value_) { return (value_ + page - 1) & ~(page - 1); };
+
+		// Open everything and lay the shards out first, so we can reserve
+		// the whole range in one go.
+		std::vector<FileHandle> handles;
+		std::vector<Shard> shards;
+		handles.reserve(filenames_.size());
+		shards.reserve(filenames_.size());
+		size_t offset = 0;
+		for (size_t shardNo = 0; shardNo < filenames_.size(); ++shardNo)
+		{
+			handles.emplace_back(filenames_[shardNo]);
+			if (!handles.back().isValid())
+				return _fail("unable to open shard file");
+			const size_t size = handles.back().uncachedFileSize();
+			shards.push_back(Shard{ filenames_[shardNo], offset, size });
+
+			offset += roundUp(size);
+			// The last shard needs room for the '\0', the others for a separator.
+			const bool isLast = shardNo + 1 == filenames_.size();
+			if (size % page == 0 && (isLast || padding_.alwaysSeparate))
+				offset += page;
+		}
+
+		AddressRange range;
+		if (!range.reserve(offset))
+			return false;
+		char* const base = range.data();
+
+		for (size_t shardNo = 0; shardNo < shards.size(); ++shardNo)
+		{
+			const Shard& shard = shards[shardNo];
+			const size_t fileBytes = roundUp(shard.size);
+			const size_t slotEnd = shardNo + 1 < shards.size() ? shards[shardNo + 1].offset : offset;
+			const bool isLast = shardNo + 1 == shards.size();
+			const char fill = isLast ? '\0' : padding_.fill;
+
+			if (fileBytes && mmap(base + shard.offset, fileBytes, PROT_READ, MAP_SHARED | MAP_FIXED, handles[shardNo], 0) == MAP_FAILED)
+				return _fail("unable to map shard file");
+
+			// Fill the tail of the last page with a private copy of it.
+			const size_t tail = fileBytes - shard.size;
+			if (tail && fill != '\0')
+			{
+				char* const lastPage = base + shard.offset + fileBytes - page;
+				if (mmap(lastPage, page, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, handles[shardNo], static_cast<off_t>(fileBytes - page)) == MAP_FAILED)
+					return _fail("unable to map shard padding");
+				std::memset(lastPage + page - tail, fill, tail);
+				mprotect(lastPage, page, PROT_READ);
+			}
+
+			// A whole page of separator/terminator.
+			if (slotEnd > shard.offset + fileBytes)
+			{
+				char* const extra = base + shard.offset + fileBytes;
+				const size_t length = slotEnd - (shard.offset + fileBytes);
+				if (mmap(extra, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0) == MAP_FAILED)
+					return _fail("unable to map shard padding");
+				if (fill != '\0')
+					std::memset(extra, fill, length);
+				mprotect(extra, length, PROT_READ);
+			}
+		}
+
+		m_range = std::move(range);
+		m_shards = std::move(shards);
+		m_size = m_shards.back().offset + m_shards.back().size;
+		return true;
+#endif
+	}
+
+
+	//////////////////////////////////////////////////////////////////////
+	// View position -> shard.
+
+	MultiMappedFile::Location MultiMappedFile::locate(size_t offset_) const noexcept
+	{
+		if (m_shards.empty())
+			return Location{ 0, 0, true };
+
+		// The last shard starting at or before offset_.
+		auto it = std::upper_bound(m_shards.begin(), m_shards.end(), offset_,
+								   [](size_t offset, const Shard& shard) { return offset < shard.offset; });
+		const size_t shardNo = it == m_shards.begin() ? 0 : static_cast<size_t>(it - m_shards.begin()) - 1;
+		const Shard& shard = m_shards[shardNo];
+		const size_t local = offset_ - shard.offset;
+		return Location{ shardNo, local, local >= shard.size };
+	}
+
+}
@@ -0,0 +1,135 @@
+#pragma once
+
+// MMapper -> MultiMappedFile -- Several files mapped back to back as one address range.
+// Author: Oliver "kfsone" Smith 2018 <oliver@kfs.org>
+// Redistribution and re-use fully permitted contingent on inclusion of these 3 lines in copied- or derived- works.
+
+#include "mmapper_platform.h"
+#include "addressspace.h"
+
+#include <utility>
+#include <vector>
+
+
+namespace KFS
+{
+
+	//! What the gaps between shards of a MultiMappedFile hold.
+	struct MultiMappingPadding
+	{
+		//! Byte the gap between shards reads as.
+		char	fill{ '\0' };
+		//! Insert a page of fill after shards that end on a page boundary.
+		bool	alwaysSeparate{ false };
+	};
+
+
+	//////////////////////////////////////////////////////////////////////
+	//! @class MultiMappedFile
+	//! @brief One contiguous, read-only view over a list of shard files.
+	//!
+	//! @detail Reserves a single address range and maps each file into it
+	//! with MAP_FIXED, starting on the page after the previous one ends,
+	//! so a scan of begin()..end() crosses shard boundaries without
+	//! copies or special cases.
+	//!
+	//! Between shards there is a gap: the rest of the shard's last page.
+	//! The PaddingPolicy decides what it holds - zeros (free: the kernel
+	//! provides them), or a fill byte such as '\n' so that records can't
+	//! run from one shard into the next (costs one private copy-on-write
+	//! page per shard). With alwaysSeparate, a shard that ends exactly on
+	//! a page boundary is followed by a page of fill, so there is always
+	//! at least one separator byte. As with MMappedFile, the byte at end()
+	//! reads as '\0'.
+	//!
+	//! locate() maps a position in the view back to (shard, offset in the
+	//! shard's file).
+	//!
+	//! POSIX only: Windows would need placeholder views (MapViewOfFile3).
+	//
+	class MultiMappedFile
+	{
+	public:
+		using PaddingPolicy = MultiMappingPadding;
+
+		struct Shard
+		{
+			filename_str_t	filename;
+			size_t			offset;		// in the view
+			size_t			size;		// of the file
+		};
+
+		struct Location
+		{
+			size_t	shard;
+			size_t	offset;			// within the shard's file
+			bool	inPadding;		// in the gap after the shard's data
+		};
+
+	private:
+		AddressRange		m_range;
+		std::vector<Shard>	m_shards;
+		size_t				m_size{ 0 };
+
+	public:
+		MultiMappedFile() noexcept = default;
+
+		//! Map 'filenames_' (in order); see map().
+		explicit MultiMappedFile(const std::vector<filename_str_t>& filenames_, PaddingPolicy padding_ = PaddingPolicy{}) MMAPPER_MAYBE_NOEXCEPT;
+
+		// Copying not allowed.
+		MultiMappedFile(const MultiMappedFile&) = delete;
+		MultiMappedFile& operator=(const MultiMappedFile&) = delete;
+
+		// Move allowed; the source is left unmapped.
+		MultiMappedFile(MultiMappedFile&& rhs_) noexcept
+			: m_range(std::move(rhs_.m_range))
+			, m_shards(std::move(rhs_.m_shards))
+			, m_size(std::exchange(rhs_.m_size, 0))
+		{
+			rhs_.m_shards.clear();
+		}
+
+		MultiMappedFile& operator=(MultiMappedFile&& rhs_) noexcept
+		{
+			if (this != &rhs_)
+			{
+				unmap();
+				m_range = std::move(rhs_.m_range);
+				m_shards = std::move(rhs_.m_shards);
+				rhs_.m_shards.clear();
+				m_size = std::exchange(rhs_.m_size, 0);
+			}
+			return *this;
+		}
+
+		//! Map the files back to back, replacing any current mapping.
+		//! @return true on success.
+		bool map(const std::vector<filename_str_t>& filenames_, PaddingPolicy padding_ = PaddingPolicy{}) MMAPPER_MAYBE_NOEXCEPT;
+
+		//! Release all the mappings.
+		void unmap() noexcept;
+
+		//////////////////////////////////////////////////////////////////////
+		// Accessors.
+
+		bool isMapped() const noexcept { return m_range.isReserved(); }
+
+		template<typename T=char>
+		const T* begin() const noexcept { return reinterpret_cast<const T*>(m_range.data()); }
+
+		//! End of the last shard's data.
+		template<typename T=char>
+		const T* end() const noexcept { return reinterpret_cast<const T*>(m_range.data() + m_size); }
+
+		//! Bytes from begin() to end(), gaps included.
+		size_t size() const noexcept { return m_size; }
+
+		const std::vector<Shard>& shards() const noexcept { return m_shards; }
+
+		//! Translate a position in the view (0 <= offset_ < size()).
+		Location locate(size_t offset_) const noexcept;
+		Location locate(const char* ptr_) const noexcept { return locate(static_cast<size_t>(ptr_ - begin())); }
+	};
+
+}
@@ -0,0 +1,184 @@
+// MMapper -> ParallelChunks -- Split a mapping between threads without cutting records.
+// Author: Oliver "kfsone" Smith 2018 <oliver@kfs.org>
+// Redistribution and re-use fully permitted contingent on inclusion of these 3 lines in copied- or derived- works.
+
+#include "parallelchunks.h"
+#include "addressspace.h"
+
+#include <algorithm>
+
+
+namespace KFS
+{
+
+	// Set on pool threads, and on a caller while its loop runs.
+	static thread_local bool t_inPool = false;
+
+
+	//////////////////////////////////////////////////////////////////////
+	// Lifetime.
+
+	WorkStealingPool::WorkStealingPool(size_t threads_) noexcept
+	{
+		m_queues.reset(new (std::nothrow) Queue[threads_ + 1]);
+		if (!m_queues)
+			return;
+		m_queueCount = 1;
+		try
+		{
+			for (size_t threadNo = 0; threadNo < threads_; ++threadNo)
+			{
+				m_threads.emplace_back(&WorkStealingPool::_worker, this, threadNo);
+				m_queueCount = m_threads.size() + 1;
+			}
+		}
+		catch (...)
+		{
+			// Make do with the threads we got; the caller takes the queue
+			// after the last of them.
+		}
+	}
+
+	WorkStealingPool::~WorkStealingPool() noexcept
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_lock);
+			m_stopping = true;
+		}
+		m_wake.notify_all();
+		for (std::thread& thread : m_threads)
+			thread.join();
+	}
+
+	size_t WorkStealingPool::defaultThreads() noexcept
+	{
+		const unsigned cores = std::thread::hardware_concurrency();
+		return cores > 1 ? cores - 1 : 0;
+	}
+
+	WorkStealingPool& WorkStealingPool::global() noexcept
+	{
+		static WorkStealingPool s_pool;
+		return s_pool;
+	}
+
+
+	//////////////////////////////////////////////////////////////////////
+	// Running.
+
+	void WorkStealingPool::_run(size_t count_, Thunk thunk_, void* context_) noexcept
+	{
+		if (count_ == 0)
+			return;
+		if (t_inPool || m_queueCount <= 1 || count_ == 1)
+		{
+			for (size_t taskNo = 0; taskNo < count_; ++taskNo)
+				thunk_(context_, taskNo);
+			return;
+		}
+
+		std::lock_guard<std::mutex> runLock(m_runLock);
+		{
+			std::lock_guard<std::mutex> lock(m_lock);
+			m_thunk = thunk_;
+			m_context = context_;
+			m_remaining = count_;
+		}
+		// Deal out contiguous runs, so neighbouring chunks tend to go to
+		// the same thread until stealing kicks in.
+		for (size_t queueNo = 0; queueNo < m_queueCount; ++queueNo)
+		{
+			Queue& queue = m_queues[queueNo];
+			std::lock_guard<std::mutex> lock(queue.lock);
+			const size_t first = count_ * queueNo / m_queueCount, last = count_ * (queueNo + 1) / m_queueCount;
+			// Popped from the back: push in reverse so each thread works
+			// forwards.
+			for (size_t taskNo = last; taskNo > first; --taskNo)
+				queue.tasks.push_back(taskNo - 1);
+		}
+		{
+			std::lock_guard<std::mutex> lock(m_lock);
+			++m_generation;
+		}
+		m_wake.notify_all();
+
+		t_inPool = true;
+		_work(m_queueCount - 1);
+		t_inPool = false;
+
+		std::unique_lock<std::mutex> lock(m_lock);
+		m_done.wait(lock, [this] { return m_remaining == 0; });
+	}
+
+	void WorkStealingPool::_work(size_t queueNo_) noexcept
+	{
+		for ( ; ; )
+		{
+			size_t taskNo = 0;
+			bool found = false;
+			{
+				Queue& own = m_queues[queueNo_];
+				std::lock_guard<std::mutex> lock(own.lock);
+				if (!own.tasks.empty())
+				{
+					taskNo = own.tasks.back();
+					own.tasks.pop_back();
+					found = true;
+				}
+			}
+			for (size_t offset = 1; !found && offset < m_queueCount; ++offset)
+			{
+				Queue& victim = m_queues[(queueNo_ + offset) % m_queueCount];
+				std::lock_guard<std::mutex> lock(victim.lock);
+				if (!victim.tasks.empty())
+				{
+					taskNo = victim.tasks.front();
+					victim.tasks.pop_front();
+					found = true;
+				}
+			}
+			if (!found)
+				return;
+
+			// Tasks are only queued after the job is set up, and the queue
+			// lock orders that for us.
+			m_thunk(m_context, taskNo);
+
+			std::lock_guard<std::mutex> lock(m_lock);
+			if (--m_remaining == 0)
+				m_done.notify_all();
+		}
+	}
+
+	void WorkStealingPool::_worker(size_t queueNo_) noexcept
+	{
+		t_inPool = true;
+		uint64_t seen = 0;
+		std::unique_lock<std::mutex> lock(m_lock);
+		for ( ; ; )
+		{
+			m_wake.wait(lock, [&] { return m_stopping || m_generation != seen; });
+			if (m_stopping)
+				return;
+			seen = m_generation;
+			lock.unlock();
+			_work(queueNo_);
+			lock.lock();
+		}
+	}
+
+
+	//////////////////////////////////////////////////////////////////////
+	// Chunking.
+
+	size_t Chunking::chunkSize(size_t size_, const ChunkOptions& options_, const WorkStealingPool& pool_) noexcept
+	{
+		if (options_.chunkSize)
+			return options_.chunkSize;
+		const size_t page = AddressRange::pageSize();
+		const size_t chunks = std::max<size_t>(pool_.concurrency() * std::max<size_t>(options_.chunksPerThread, 1), 1);
+		const size_t chunkSize = std::max(size_ / chunks, std::max<size_t>(options_.minChunk, 1));
+		return (chunkSize + page - 1) & ~(page - 1);
+	}
+
+}
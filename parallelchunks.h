@@ -0,0 +1,272 @@
+#pragma once
+
+// MMapper -> ParallelChunks -- Split a mapping between threads without cutting records.
+// Author: Oliver "kfsone" Smith 2018 <oliver@kfs.org>
+// Redistribution and re-use fully permitted contingent on inclusion of these 3 lines in copied- or derived- works.
+
+#include "mmapper_platform.h"
+#include "mmapper.h"
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+
+namespace KFS
+{
+
+	//////////////////////////////////////////////////////////////////////
+	//! @class WorkStealingPool
+	//! @brief A fixed set of threads that run the tasks of one parallel
+	//! loop at a time, stealing from each other when they run dry.
+	//!
+	//! @detail run() deals the task numbers out in contiguous runs, one
+	//! deque per thread (the calling thread included, so it works rather
+	//! than waits). Each thread pops from the back of its own deque and,
+	//! once that's empty, steals from the front of the others', so a
+	//! thread that drew slow chunks - cold pages, long records - gets
+	//! help instead of holding everyone up.
+	//!
+	//! One loop runs at a time; run() from inside a task runs the inner
+	//! loop inline on that thread. Tasks mustn't throw.
+	//
+	class WorkStealingPool
+	{
+		using Thunk = void (*)(void*, size_t);
+
+		struct Queue
+		{
+			std::mutex			lock;
+			std::deque<size_t>	tasks;
+		};
+
+		std::vector<std::thread>	m_threads;
+		std::unique_ptr<Queue[]>	m_queues;		// one per thread, then the caller's
+		size_t						m_queueCount{ 0 };
+
+		std::mutex					m_runLock;		// one loop at a time
+		std::mutex					m_lock;
+		std::condition_variable		m_wake;
+		std::condition_variable		m_done;
+		uint64_t					m_generation{ 0 };
+		size_t						m_remaining{ 0 };
+		bool						m_stopping{ false };
+		Thunk						m_thunk{ nullptr };
+		void*						m_context{ nullptr };
+
+		void _worker(size_t queueNo_) noexcept;
+		void _work(size_t queueNo_) noexcept;
+		void _run(size_t count_, Thunk thunk_, void* context_) noexcept;
+
+	public:
+		//! 'threads_' helpers besides the caller; by default, one fewer
+		//! than the number of cores.
+		explicit WorkStealingPool(size_t threads_ = defaultThreads()) noexcept;
+		~WorkStealingPool() noexcept;
+
+		WorkStealingPool(const WorkStealingPool&) = delete;
+		WorkStealingPool& operator=(const WorkStealingPool&) = delete;
+
+		static size_t defaultThreads() noexcept;
+
+		//! A process-wide pool.
+		static WorkStealingPool& global() noexcept;
+
+		//! Threads that take part in run(), the caller included.
+		size_t concurrency() const noexcept { return m_queueCount; }
+
+		//! Call 'fn_(size_t taskNo)' for every taskNo in [0, count_),
+		//! returning once they have all finished.
+		template<typename Fn>
+		void run(size_t count_, Fn&& fn_)
+		{
+			using FnType = typename std::remove_reference<Fn>::type;
+			_run(count_, [](void* context_, size_t taskNo_) { (*static_cast<FnType*>(context_))(taskNo_); },
+				 const_cast<void*>(static_cast<const void*>(&fn_)));
+		}
+	};
+
+
+	//! A piece of the input handed to a parallelForChunks() callback.
+	struct Chunk
+	{
+		size_t		index;
+		const char*	begin;
+		const char*	end;
+
+		size_t size() const noexcept { return static_cast<size_t>(end - begin); }
+	};
+
+	//! How parallelForChunks() cuts up its input.
+	struct ChunkOptions
+	{
+		//! Bytes per chunk before boundaries move; 0 picks a size giving
+		//! each thread about chunksPerThread chunks, in whole pages and at
+		//! least minChunk.
+		size_t				chunkSize{ 0 };
+		size_t				chunksPerThread{ 4 };
+		size_t				minChunk{ 256 * 1024 };
+		//! Defaults to WorkStealingPool::global().
+		WorkStealingPool*	pool{ nullptr };
+	};
+
+	namespace Chunking
+	{
+		//! Where chunks start before moving to a boundary: every
+		//! 'chunkSize' bytes of [0, size_).
+		size_t chunkSize(size_t size_, const ChunkOptions& options_, const WorkStealingPool& pool_) noexcept;
+
+		//! The first position in [from_, end_) just past a byte matching
+		//! 'isDelimiter_', or end_.
+		template<typename Pred>
+		const char* nextBoundary(const char* from_, const char* end_, Pred& isDelimiter_)
+		{
+			for ( ; from_ < end_; ++from_)
+			{
+				if (isDelimiter_(*from_))
+					return from_ + 1;
+			}
+			return end_;
+		}
+
+		template<typename Fn, typename Pred>
+		void forChunks(const char* begin_, const char* end_, Pred& isDelimiter_, Fn& fn_, const ChunkOptions& options_)
+		{
+			WorkStealingPool& pool = options_.pool ? *options_.pool : WorkStealingPool::global();
+			const size_t size = static_cast<size_t>(end_ - begin_);
+			if (size == 0)
+				return;
+			const size_t chunkSize = Chunking::chunkSize(size, options_, pool);
+			const size_t count = (size + chunkSize - 1) / chunkSize;
+			// Each chunk runs from just past the first delimiter at or after
+			// its nominal start to the same point for the next chunk, so
+			// neighbours agree on the boundary without talking to each other.
+			auto start = [&](size_t chunkNo_) {
+				if (chunkNo_ == 0)
+					return begin_;
+				if (chunkNo_ >= count)
+					return end_;
+				return nextBoundary(begin_ + chunkNo_ * chunkSize - 1, end_, isDelimiter_);
+			};
+			pool.run(count, [&](size_t chunkNo_) {
+				const Chunk chunk{ chunkNo_, start(chunkNo_), start(chunkNo_ + 1) };
+				fn_(chunk);
+			});
+		}
+
+		struct AnyByte
+		{
+			bool operator()(char) const noexcept { return true; }
+		};
+
+		struct ByteIs
+		{
+			char	delimiter;
+			bool operator()(char c_) const noexcept { return c_ == delimiter; }
+		};
+	}
+
+
+	//////////////////////////////////////////////////////////////////////
+	// parallelForChunks: call 'fn_(const Chunk&)' for pieces of the input
+	// on the pool's threads. Chunk boundaries fall just after a
+	// delimiter (or a byte the predicate accepts), so no record is cut;
+	// one longer than a chunk just makes its chunk bigger, and chunks can
+	// come out empty. Chunks run concurrently and in no particular order.
+
+	//! Split anywhere.
+	template<typename Fn>
+	void parallelForChunks(const char* begin_, const char* end_, Fn&& fn_, const ChunkOptions& options_ = ChunkOptions{})
+	{
+		Chunking::AnyByte any;
+		Chunking::forChunks(begin_, end_, any, fn_, options_);
+	}
+
+	//! Split after 'delimiter_'.
+	template<typename Fn>
+	void parallelForChunks(const char* begin_, const char* end_, char delimiter_, Fn&& fn_, const ChunkOptions& options_ = ChunkOptions{})
+	{
+		Chunking::ByteIs byteIs{ delimiter_ };
+		Chunking::forChunks(begin_, end_, byteIs, fn_, options_);
+	}
+
+	//! Split after a byte for which 'isDelimiter_(char)' is true.
+	template<typename Pred, typename Fn, typename = decltype(std::declval<Pred&>()('\0'))>
+	void parallelForChunks(const char* begin_, const char* end_, Pred&& isDelimiter_, Fn&& fn_, const ChunkOptions& options_ = ChunkOptions{})
+	{
+		Chunking::forChunks(begin_, end_, isDelimiter_, fn_, options_);
+	}
+
+	template<typename... Args>
+	void parallelForChunks(const MMappedFile& file_, Args&&... args_)
+	{
+		parallelForChunks(file_.begin(), file_.end(), std::forward<Args>(args_)...);
+	}
+
+
+	//////////////////////////////////////////////////////////////////////
+	//! parallelReduceChunks: as parallelForChunks(), but each chunk
+	//! produces 'map_(const Chunk&)' and the results are folded in file
+	//! order on the calling thread:
+	//!   reduce_(reduce_(reduce_(init_, r0), r1), r2)...
+	//! so 'reduce_' needn't be commutative - "first match", "line number
+	//! of", concatenation all work. What 'map_' returns must be
+	//! default-constructible.
+
+	namespace Chunking
+	{
+		template<typename Result, typename Pred, typename Map, typename Reduce>
+		Result reduceChunks(const char* begin_, const char* end_, Pred& isDelimiter_, Map& map_, Result init_, Reduce& reduce_, const ChunkOptions& options_)
+		{
+			const size_t size = static_cast<size_t>(end_ - begin_);
+			if (size == 0)
+				return init_;
+			// Fix the chunking now, to know how many results there'll be.
+			ChunkOptions options = options_;
+			options.pool = options_.pool ? options_.pool : &WorkStealingPool::global();
+			options.chunkSize = chunkSize(size, options_, *options.pool);
+			using ChunkResult = typename std::decay<decltype(map_(std::declval<const Chunk&>()))>::type;
+			std::vector<ChunkResult> results((size + options.chunkSize - 1) / options.chunkSize);
+			auto mapOne = [&](const Chunk& chunk_) { results[chunk_.index] = map_(chunk_); };
+			forChunks(begin_, end_, isDelimiter_, mapOne, options);
+
+			Result result = std::move(init_);
+			for (ChunkResult& chunkResult : results)
+				result = reduce_(std::move(result), std::move(chunkResult));
+			return result;
+		}
+	}
+
+	//! Split anywhere.
+	template<typename Result, typename Map, typename Reduce>
+	Result parallelReduceChunks(const char* begin_, const char* end_, Map&& map_, Result init_, Reduce&& reduce_,
+								const ChunkOptions& options_ = ChunkOptions{})
+	{
+		Chunking::AnyByte any;
+		return Chunking::reduceChunks(begin_, end_, any, map_, std::move(init_), reduce_, options_);
+	}
+
+	//! Split after 'delimiter_'.
+	template<typename Result, typename Map, typename Reduce>
+	Result parallelReduceChunks(const char* begin_, const char* end_, char delimiter_, Map&& map_, Result init_, Reduce&& reduce_,
+								const ChunkOptions& options_ = ChunkOptions{})
+	{
+		Chunking::ByteIs byteIs{ delimiter_ };
+		return Chunking::reduceChunks(begin_, end_, byteIs, map_, std::move(init_), reduce_, options_);
+	}
+
+	template<typename... Args>
+	auto parallelReduceChunks(const MMappedFile& file_, Args&&... args_)
+		-> decltype(parallelReduceChunks(file_.begin(), file_.end(), std::forward<Args>(args_)...))
+	{
+		return parallelReduceChunks(file_.begin(), file_.end(), std::forward<Args>(args_)...);
+	}
+
+}
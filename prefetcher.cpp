@@ -0,0 +1,118 @@
+// MMapper -> Prefetcher -- Keep the pages ahead of a sequential scan resident from a helper thread.
+// Author: Oliver "kfsone" Smith 2018 <oliver@kfs.org>
+// Redistribution and re-use fully permitted contingent on inclusion of these 3 lines in copied- or derived- works.
+
+#include "prefetcher.h"
+#include "addressspace.h"
+#include "mmapper.h"
+#include "internal_includes.h"
+
+#include <algorithm>
+#include <chrono>
+
+
+namespace KFS
+{
+
+	// The most lead the window grows to when the consumer keeps catching up.
+	static constexpr double c_maxLead = 2.0;
+
+	Prefetcher::Prefetcher(const char* begin_, size_t size_, PrefetcherOptions options_)
+		: m_begin(begin_)
+		, m_size(size_)
+		, m_options(options_)
+	{
+		const size_t page = AddressRange::pageSize();
+		m_options.step = std::max<size_t>((m_options.step + page - 1) & ~(page - 1), page);
+		m_options.minWindow = std::max(m_options.minWindow, m_options.step);
+		m_options.maxWindow = std::max(m_options.maxWindow, m_options.minWindow);
+		m_window.store(std::min(std::max(m_options.window, m_options.minWindow), m_options.maxWindow), std::memory_order_relaxed);
+		if (m_size > 0)
+			m_thread = std::thread([this] { _run(); });
+	}
+
+	Prefetcher::Prefetcher(const MMappedFile& file_, PrefetcherOptions options_)
+		: Prefetcher(file_.begin(), file_.size(), options_)
+	{
+	}
+
+	void Prefetcher::stop() noexcept
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_lock);
+			m_stopping.store(true, std::memory_order_relaxed);
+		}
+		m_wake.notify_all();
+		if (m_thread.joinable())
+			m_thread.join();
+	}
+
+
+	//////////////////////////////////////////////////////////////////////
+	// The helper: fault in a step at a time until the window ahead of the
+	// cursor is full, then wait for the consumer to use some of it.
+
+	void Prefetcher::_run() noexcept
+	{
+		using Clock = std::chrono::steady_clock;
+		const bool adaptive = m_options.leadMs != 0;
+		double lead = m_options.leadMs / 1000.0;
+		double speed = 0;					// bytes/second, smoothed
+		size_t ahead = 0;					// faulted in up to here
+		size_t lastCursor = 0;
+		Clock::time_point lastSample = Clock::now();
+
+		while (!m_stopping.load(std::memory_order_relaxed) && ahead < m_size)
+		{
+			const size_t cursor = std::min(m_cursor.load(std::memory_order_relaxed), m_size);
+			size_t window = m_window.load(std::memory_order_relaxed);
+
+			const Clock::time_point now = Clock::now();
+			const double elapsed = std::chrono::duration<double>(now - lastSample).count();
+			if (adaptive && elapsed >= 0.005 && cursor > lastCursor)
+			{
+				const double sample = (cursor - lastCursor) / elapsed;
+				speed = speed == 0 ? sample : speed * 0.75 + sample * 0.25;
+				lastCursor = cursor;
+				lastSample = now;
+				window = static_cast<size_t>(speed * lead);
+			}
+
+			if (cursor > ahead)
+			{
+				// The consumer is faulting pages in itself: skip to it,
+				// and stay further ahead from now on.
+				if (ahead != 0)
+				{
+					m_catchUps.fetch_add(1, std::memory_order_relaxed);
+					if (adaptive)
+					{
+						lead = std::min(lead * 2, c_maxLead);
+						window = std::max(window, m_window.load(std::memory_order_relaxed) * 2);
+					}
+				}
+				ahead = cursor;
+			}
+
+			window = std::min(std::max(window, m_options.minWindow), m_options.maxWindow);
+			m_window.store(window, std::memory_order_relaxed);
+
+			const size_t target = std::min(m_size, cursor + window);
+			if (ahead < target)
+			{
+				const size_t to = std::min(target, ahead + m_options.step);
+				AddressRange::populate(m_begin + ahead, to - ahead);
+				ahead = to;
+				continue;
+			}
+
+			// Window full: wait about as long as the consumer takes to
+			// get through a step.
+			const double stepTime = speed > 0 ? m_options.step / speed : 0.001;
+			const auto nap = std::chrono::microseconds(static_cast<long long>(std::min(std::max(stepTime, 0.0001), 0.01) * 1e6));
+			std::unique_lock<std::mutex> lock(m_lock);
+			m_wake.wait_for(lock, nap, [this] { return m_stopping.load(std::memory_order_relaxed); });
+		}
+	}
+
+}
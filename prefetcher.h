@@ -0,0 +1,107 @@
+#pragma once
+
+// MMapper -> Prefetcher -- Keep the pages ahead of a sequential scan resident from a helper thread.
+// Author: Oliver "kfsone" Smith 2018 <oliver@kfs.org>
+// Redistribution and re-use fully permitted contingent on inclusion of these 3 lines in copied- or derived- works.
+
+#include "mmapper_platform.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+
+
+namespace KFS
+{
+
+	class MMappedFile;
+
+	//! How far ahead a Prefetcher stays, and how it adapts.
+	struct PrefetcherOptions
+	{
+		//! Bytes to keep resident ahead of the cursor to begin with.
+		size_t	window{ 16 * 1024 * 1024 };
+		//! Limits for the adapted window.
+		size_t	minWindow{ 2 * 1024 * 1024 };
+		size_t	maxWindow{ 256 * 1024 * 1024 };
+		//! Bytes faulted in per step; rounded up to whole pages.
+		size_t	step{ 1024 * 1024 };
+		//! Size the window to cover this many milliseconds of the
+		//! consumer's measured speed; doubled each time the consumer
+		//! catches up. 0 keeps the window fixed.
+		unsigned	leadMs{ 50 };
+	};
+
+
+	//////////////////////////////////////////////////////////////////////
+	//! @class Prefetcher
+	//! @brief A helper thread that walks ahead of a sequential scan of a
+	//! mapping, faulting pages in so the scan doesn't have to.
+	//!
+	//! @detail Kernel readahead on a mapping grows slowly and is
+	//! triggered by the faults it's meant to avoid; a consumer hashing or
+	//! parsing at GB/s outruns it and spends its time in page faults. The
+	//! consumer publishes how far it's got (one relaxed atomic store), and
+	//! the helper keeps [cursor, cursor + window) resident, a step at a
+	//! time: MADV_POPULATE_READ where available, else MADV_WILLNEED and a
+	//! read of every page. On Windows, just the reads.
+	//!
+	//! The window follows the consumer: it covers 'leadMs' of the speed
+	//! the consumer has been publishing at, and the lead doubles each time
+	//! the consumer overtakes the helper.
+	//!
+	//! @code
+	//!   KFS::Prefetcher prefetcher(file);
+	//!   for (size_t offset = 0; offset < file.size(); offset += step) {
+	//!       process(file.begin() + offset, ...);
+	//!       prefetcher.publish(offset + step);
+	//!   }
+	//! @endcode
+	//!
+	//! Prefetching is advisory: the mapping reads the same with or without
+	//! it. The mapping must outlive the prefetcher.
+	//
+	class Prefetcher
+	{
+		const char*				m_begin{ nullptr };
+		size_t					m_size{ 0 };
+		PrefetcherOptions		m_options{};
+
+		std::atomic<size_t>		m_cursor{ 0 };
+		std::atomic<size_t>		m_window{ 0 };
+		std::atomic<size_t>		m_catchUps{ 0 };
+		std::atomic<bool>		m_stopping{ false };
+		std::mutex				m_lock;
+		std::condition_variable	m_wake;
+		std::thread				m_thread;
+
+		void _run() noexcept;
+
+	public:
+		//! Prefetch ahead of a scan of [begin_, begin_ + size_).
+		Prefetcher(const char* begin_, size_t size_, PrefetcherOptions options_ = PrefetcherOptions{});
+		explicit Prefetcher(const MMappedFile& file_, PrefetcherOptions options_ = PrefetcherOptions{});
+
+		Prefetcher(const Prefetcher&) = delete;
+		Prefetcher& operator=(const Prefetcher&) = delete;
+
+		//! Stops the helper.
+		~Prefetcher() noexcept { stop(); }
+
+		//! The consumer has finished with everything before 'offset_'.
+		void publish(size_t offset_) noexcept { m_cursor.store(offset_, std::memory_order_relaxed); }
+		void publish(const char* position_) noexcept { publish(static_cast<size_t>(position_ - m_begin)); }
+
+		//! Stop prefetching (e.g. the scan ended early).
+		void stop() noexcept;
+
+		//! The current window, in bytes.
+		size_t window() const noexcept { return m_window.load(std::memory_order_relaxed); }
+		//! Times the consumer got ahead of the prefetched pages.
+		size_t catchUps() const noexcept { return m_catchUps.load(std::memory_order_relaxed); }
+	};
+
+}
@@ -0,0 +1,150 @@
+// MMapper -> Reclaimer -- Unmap retired mappings on a background thread.
+// Author: Oliver "kfsone" Smith 2018 <oliver@kfs.org>
+// Redistribution and re-use fully permitted contingent on inclusion of these 3 lines in copied- or derived- works.
+
+#include "reclaimer.h"
+#include "internal_includes.h"
+
+#include <algorithm>
+#include <cstdint>
+
+
+namespace KFS
+{
+
+	//////////////////////////////////////////////////////////////////////
+	// Lifetime.
+
+	Reclaimer::Reclaimer(size_t maxBacklog_) noexcept
+		: m_maxBacklog(std::max<size_t>(maxBacklog_, 1))
+	{
+	}
+
+	Reclaimer::~Reclaimer() noexcept
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_lock);
+			m_stopping = true;
+		}
+		m_wake.notify_one();
+		if (m_thread.joinable())
+			m_thread.join();
+
+		// Anything the thread didn't get to.
+		for (const Range& range : m_pending)
+			unmap(range.base, range.length);
+	}
+
+	Reclaimer& Reclaimer::global() noexcept
+	{
+		static Reclaimer s_reclaimer;
+		return s_reclaimer;
+	}
+
+
+	//////////////////////////////////////////////////////////////////////
+	// Producer side.
+
+	void Reclaimer::unmap(void* base_, size_t length_) noexcept
+	{
+#if MMAPPER_API == MMAPPER_WIN32
+		(void)length_;
+		UnmapViewOfFile(base_);
+#else
+		munmap(base_, length_);
+#endif
+	}
+
+	void Reclaimer::retire(void* base_, size_t length_) noexcept
+	{
+		{
+			std::unique_lock<std::mutex> lock(m_lock);
+			if (m_pending.size() < m_maxBacklog && !m_stopping)
+			{
+				if (!m_thread.joinable())
+				{
+					try
+					{
+						m_thread = std::thread(&Reclaimer::run, this);
+					}
+					catch (...)
+					{
+						// No thread: fall through to unmapping here.
+					}
+				}
+				if (m_thread.joinable())
+				{
+					m_pending.push_back(Range{ base_, length_ });
+					++m_deferred;
+					lock.unlock();
+					m_wake.notify_one();
+					return;
+				}
+			}
+			++m_synchronous;
+		}
+
+		unmap(base_, length_);
+	}
+
+	void Reclaimer::drain() noexcept
+	{
+		std::unique_lock<std::mutex> lock(m_lock);
+		m_idle.wait(lock, [this] { return m_pending.empty() && m_inFlight == 0; });
+	}
+
+	Reclaimer::Stats Reclaimer::stats() noexcept
+	{
+		std::lock_guard<std::mutex> lock(m_lock);
+		return Stats{ m_deferred, m_synchronous, m_unmapCalls };
+	}
+
+
+	//////////////////////////////////////////////////////////////////////
+	// The reclaimer thread.
+
+	void Reclaimer::run() noexcept
+	{
+		std::vector<Range> batch;
+		std::unique_lock<std::mutex> lock(m_lock);
+		for ( ; ; )
+		{
+			m_wake.wait(lock, [this] { return !m_pending.empty() || m_stopping; });
+			if (m_pending.empty())
+				return;
+
+			batch.swap(m_pending);
+			m_inFlight = batch.size();
+			lock.unlock();
+
+			size_t calls = 0;
+#if MMAPPER_API == MMAPPER_WIN32
+			// Views can only be unmapped one at a time, by base address.
+			for (const Range& range : batch)
+				unmap(range.base, range.length);
+			calls = batch.size();
+#else
+			// Ranges that abut - consecutive mmaps usually do - go in one call.
+			const uintptr_t pageMask = static_cast<uintptr_t>(sysconf(_SC_PAGESIZE)) - 1;
+			std::sort(batch.begin(), batch.end(), [](const Range& lhs_, const Range& rhs_) { return lhs_.base < rhs_.base; });
+			for (size_t first = 0; first < batch.size(); ++calls)
+			{
+				const uintptr_t start = reinterpret_cast<uintptr_t>(batch[first].base);
+				uintptr_t end = (start + batch[first].length + pageMask) & ~pageMask;
+				size_t next = first + 1;
+				for ( ; next < batch.size() && reinterpret_cast<uintptr_t>(batch[next].base) == end; ++next)
+					end = (end + batch[next].length + pageMask) & ~pageMask;
+				unmap(reinterpret_cast<void*>(start), static_cast<size_t>(end - start));
+				first = next;
+			}
+#endif
+			batch.clear();
+
+			lock.lock();
+			m_unmapCalls += calls;
+			m_inFlight = 0;
+			m_idle.notify_all();
+		}
+	}
+
+}
@@ -0,0 +1,92 @@
+#pragma once
+
+// MMapper -> Reclaimer -- Unmap retired mappings on a background thread.
+// Author: Oliver "kfsone" Smith 2018 <oliver@kfs.org>
+// Redistribution and re-use fully permitted contingent on inclusion of these 3 lines in copied- or derived- works.
+
+#include "mmapper_platform.h"
+
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+namespace KFS
+{
+
+	//////////////////////////////////////////////////////////////////////
+	//! @class Reclaimer
+	//! @brief Takes the cost of unmapping off the threads that release
+	//! mappings.
+	//!
+	//! @detail Tearing down the page tables of a multi-GB mapping takes
+	//! milliseconds. A thread that retire()s a range instead hands it to
+	//! the reclaimer's thread, which collects whatever has queued up,
+	//! merges ranges that sit next to each other and unmaps each run with
+	//! a single call.
+	//!
+	//! The backlog is bounded: when maxBacklog_ ranges are already
+	//! waiting, retire() unmaps synchronously rather than letting
+	//! unreleased address space pile up. drain() waits for everything
+	//! queued so far to be unmapped; the destructor drains and stops the
+	//! thread, which is only started on first use.
+	//!
+	//! Opt an MMappedFile in with mf.deferRelease(&reclaimer) - or
+	//! Reclaimer::global().
+	//
+	class Reclaimer
+	{
+		struct Range
+		{
+			void*	base;
+			size_t	length;
+		};
+
+		std::mutex				m_lock;
+		std::condition_variable	m_wake;		// work arrived / stopping
+		std::condition_variable	m_idle;		// a batch finished
+		std::vector<Range>		m_pending;
+		std::thread				m_thread;
+		size_t					m_maxBacklog;
+		size_t					m_inFlight{ 0 };
+		bool					m_stopping{ false };
+
+		// Statistics (under m_lock).
+		size_t					m_deferred{ 0 };
+		size_t					m_synchronous{ 0 };
+		size_t					m_unmapCalls{ 0 };
+
+	public:
+		explicit Reclaimer(size_t maxBacklog_ = 1024) noexcept;
+		~Reclaimer() noexcept;
+
+		Reclaimer(const Reclaimer&) = delete;
+		Reclaimer& operator=(const Reclaimer&) = delete;
+
+		//! Unmap [base_, base_ + length_) soon. The range must be a whole
+		//! mapping (or mappings) owned by the caller, which mustn't touch
+		//! it again.
+		void retire(void* base_, size_t length_) noexcept;
+
+		//! Block until everything retired so far has been unmapped.
+		void drain() noexcept;
+
+		//! A process-wide reclaimer, drained at exit.
+		static Reclaimer& global() noexcept;
+
+		struct Stats
+		{
+			size_t	deferred;		// ranges handed to the thread
+			size_t	synchronous;	// ranges unmapped by retire() because the backlog was full
+			size_t	unmapCalls;		// calls the thread made for the deferred ranges
+		};
+		Stats stats() noexcept;
+
+	private:
+		void run() noexcept;
+		static void unmap(void* base_, size_t length_) noexcept;
+	};
+
+}
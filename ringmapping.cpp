@@ -0,0 +1,278 @@
+// MMapper -> RingMappedFile -- Circular journal file mapped twice, back to back.
+// Author: Oliver "kfsone" Smith 2018 <oliver@kfs.org>
+// Redistribution and re-use fully permitted contingent on inclusion of these 3 lines in copied- or derived- works.
+
+#include "ringmapping.h"
+#include "internal_includes.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <utility>
+
+
+namespace KFS
+{
+
+	constexpr uint64_t RingFileHeader::c_magic;
+	constexpr size_t RingFileHeader::c_regionAlign;
+	constexpr size_t RingMappedFile::c_recordHeader;
+
+	static_assert(sizeof(RingFileHeader) == 4 * sizeof(uint64_t), "RingFileHeader must be four plain 64-bit words on disk");
+
+
+	static inline bool _fail(const char* reason_) MMAPPER_MAYBE_NOEXCEPT
+	{
+#ifndef MMAPPER_NO_THROW
+		throw std::runtime_error(reason_);
+#endif
+		(void)reason_;
+		return false;
+	}
+
+
+	//////////////////////////////////////////////////////////////////////
+	// Create a journal file: header plus zeroed ring.
+
+	bool RingMappedFile::create(const filename_str_t& filename_, size_t capacity_) MMAPPER_MAYBE_NOEXCEPT
+	{
+		const size_t align = RingFileHeader::c_regionAlign;
+		const uint64_t capacity = (std::max<size_t>(capacity_, 1) + align - 1) / align * align;
+		const uint64_t total = align + capacity;
+		const uint64_t header[4] = { RingFileHeader::c_magic, capacity, 0, 0 };
+
+		FileHandle fh{ filename_, FileAccess::CreateReadWrite };
+		if (!fh.isValid())
+			return _fail("unable to create ring file");
+
+#if MMAPPER_API == MMAPPER_WIN32
+		// Truncate, then extend: the ring starts zeroed.
+		LARGE_INTEGER position;
+		position.QuadPart = 0;
+		if (!SetFilePointerEx(fh, position, NULL, FILE_BEGIN) || !SetEndOfFile(fh))
+			return _fail("unable to truncate ring file");
+		position.QuadPart = static_cast<LONGLONG>(total);
+		if (!SetFilePointerEx(fh, position, NULL, FILE_BEGIN) || !SetEndOfFile(fh))
+			return _fail("unable to size ring file");
+		position.QuadPart = 0;
+		DWORD written = 0;
+		if (!SetFilePointerEx(fh, position, NULL, FILE_BEGIN) || !WriteFile(fh, header, sizeof(header), &written, NULL) || written != sizeof(header))
+			return _fail("unable to write ring file header");
+#else
+		if (ftruncate(fh, 0) != 0 || ftruncate(fh, static_cast<off_t>(total)) != 0)
+			return _fail("unable to size ring file");
+		if (pwrite(fh, header, sizeof(header), 0) != static_cast<ssize_t>(sizeof(header)))
+			return _fail("unable to write ring file header");
+#endif
+		return true;
+	}
+
+
+	//////////////////////////////////////////////////////////////////////
+	// Lifetime.
+
+	RingMappedFile::RingMappedFile(const filename_str_t& filename_, FileAccess access_) MMAPPER_MAYBE_NOEXCEPT
+	{
+		mapFile(filename_, access_);
+	}
+
+	RingMappedFile::RingMappedFile(RingMappedFile&& rhs_) noexcept
+		: m_base(std::exchange(rhs_.m_base, nullptr))
+		, m_header(std::exchange(rhs_.m_header, nullptr))
+		, m_data(std::exchange(rhs_.m_data, nullptr))
+		, m_capacity(std::exchange(rhs_.m_capacity, 0))
+		, m_writable(std::exchange(rhs_.m_writable, false))
+	{
+	}
+
+	RingMappedFile& RingMappedFile::operator=(RingMappedFile&& rhs_) noexcept
+	{
+		if (this != &rhs_)
+		{
+			unmapFile();
+			m_base = std::exchange(rhs_.m_base, nullptr);
+			m_header = std::exchange(rhs_.m_header, nullptr);
+			m_data = std::exchange(rhs_.m_data, nullptr);
+			m_capacity = std::exchange(rhs_.m_capacity, 0);
+			m_writable = std::exchange(rhs_.m_writable, false);
+		}
+		return *this;
+	}
+
+	void RingMappedFile::unmapFile() noexcept
+	{
+		if (!m_base)
+			return;
+#if MMAPPER_API == MMAPPER_WIN32
+		UnmapViewOfFile(m_base);
+		UnmapViewOfFile(m_data + m_capacity);
+#else
+		munmap(m_base, RingFileHeader::c_regionAlign + 2 * m_capacity);
+#endif
+		m_base = nullptr;
+		m_header = nullptr;
+		m_data = nullptr;
+		m_capacity = 0;
+		m_writable = false;
+	}
+
+
+	//////////////////////////////////////////////////////////////////////
+	// Map: [header region + data] then [data] again right after it.
+
+	bool RingMappedFile::mapFile(const filename_str_t& filename_, FileAccess access_) MMAPPER_MAYBE_NOEXCEPT
+	{
+		unmapFile();
+
+		const bool writable = access_ != FileAccess::ReadOnly;
+		FileHandle fh{ filename_, writable ? FileAccess::ReadWrite : FileAccess::ReadOnly };
+		if (!fh.isValid())
+			return _fail("unable to open ring file");
+
+		const size_t align = RingFileHeader::c_regionAlign;
+		uint64_t header[4] = {};
+#if MMAPPER_API == MMAPPER_WIN32
+		DWORD got = 0;
+		if (!ReadFile(fh, header, sizeof(header), &got, NULL) || got != sizeof(header))
+			return _fail("unable to read ring file header");
+#else
+		if (pread(fh, header, sizeof(header), 0) != static_cast<ssize_t>(sizeof(header)))
+			return _fail("unable to read ring file header");
+#endif
+		const uint64_t capacity = header[1];
+		if (header[0] != RingFileHeader::c_magic || capacity == 0 || capacity % align != 0
+			|| fh.uncachedFileSize() != align + capacity)
+		{
+			return _fail("not a ring file");
+		}
+		const size_t cap = static_cast<size_t>(capacity);
+		const size_t total = align + 2 * cap;
+
+#if MMAPPER_API == MMAPPER_WIN32
+		FileHandle mapFh{ CreateFileMapping(fh, NULL, writable ? PAGE_READWRITE : PAGE_READONLY, 0, 0, NULL) };
+		if (!mapFh.isValid())
+			return _fail("Failed to create file mapping");
+		const DWORD viewAccess = writable ? FILE_MAP_WRITE : FILE_MAP_READ;
+
+		// Find a hole big enough for both views, give it back and map
+		// into it; another thread can take the addresses in between, so
+		// retry a few times.
+		char* base = nullptr;
+		for (int attempt = 0; attempt < 16 && !base; ++attempt)
+		{
+			void* const probe = VirtualAlloc(NULL, total, MEM_RESERVE, PAGE_NOACCESS);
+			if (!probe)
+				break;
+			VirtualFree(probe, 0, MEM_RELEASE);
+
+			char* const first = static_cast<char*>(MapViewOfFileEx(mapFh, viewAccess, 0, 0, align + cap, probe));
+			if (!first)
+				continue;
+			const uint64_t offset = align;
+			if (!MapViewOfFileEx(mapFh, viewAccess, static_cast<DWORD>(offset >> 32), static_cast<DWORD>(offset), cap, first + align + cap))
+			{
+				UnmapViewOfFile(first);
+				continue;
+			}
+			base = first;
+		}
+		if (!base)
+			return _fail("unable to map ring views");
+#else
+		char* const base = static_cast<char*>(mmap(NULL, total, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0));
+		if (base == MAP_FAILED)
+			return _fail("unable to reserve ring address space");
+		const int prot = writable ? (PROT_READ | PROT_WRITE) : PROT_READ;
+		if (mmap(base, align + cap, prot, MAP_SHARED | MAP_FIXED, fh, 0) == MAP_FAILED
+			|| mmap(base + align + cap, cap, prot, MAP_SHARED | MAP_FIXED, fh, static_cast<off_t>(align)) == MAP_FAILED)
+		{
+			munmap(base, total);
+			return _fail("unable to map ring views");
+		}
+#endif
+
+		m_base = base;
+		m_header = reinterpret_cast<RingFileHeader*>(base);
+		m_data = base + align;
+		m_capacity = cap;
+		m_writable = writable;
+		return true;
+	}
+
+
+	//////////////////////////////////////////////////////////////////////
+	// Writer.
+
+	bool RingMappedFile::append(const void* data_, size_t size_) noexcept
+	{
+		if (!m_writable || size_ > maxRecordSize())
+			return false;
+
+		const size_t need = recordSpan(size_);
+		const uint64_t head = m_header->head.load(std::memory_order_relaxed);
+		uint64_t tail = m_header->tail.load(std::memory_order_relaxed);
+		if (head + need - tail > m_capacity)
+		{
+			// Drop the oldest records until this one fits.
+			while (head + need - tail > m_capacity)
+			{
+				uint32_t oldSize;
+				std::memcpy(&oldSize, span(tail), sizeof(oldSize));
+				tail += recordSpan(oldSize);
+			}
+			// Readers must see the new tail before we overwrite anything
+			// they might be looking at.
+			m_header->tail.store(tail, std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_release);
+		}
+
+		char* const out = m_data + (head % m_capacity);
+		const uint32_t size32 = static_cast<uint32_t>(size_);
+		std::memcpy(out, &size32, sizeof(size32));
+		std::memcpy(out + c_recordHeader, data_, size_);
+		m_header->head.store(head + need, std::memory_order_release);
+		return true;
+	}
+
+
+	//////////////////////////////////////////////////////////////////////
+	// Readers.
+
+	bool RingMappedFile::Cursor::next(const char*& data_, size_t& size_) noexcept
+	{
+		for ( ; ; )
+		{
+			const uint64_t tail = m_ring->tail();
+			if (m_position < tail)
+			{
+				m_lostBytes += tail - m_position;
+				m_position = tail;
+			}
+			const uint64_t head = m_ring->head();
+			if (m_position >= head)
+				return false;
+
+			uint32_t size;
+			std::memcpy(&size, m_ring->span(m_position), sizeof(size));
+			// If the writer lapped us while we read the size, start over.
+			std::atomic_thread_fence(std::memory_order_acquire);
+			if (m_ring->m_header->tail.load(std::memory_order_relaxed) > m_position)
+				continue;
+			if (size > m_ring->maxRecordSize() || m_position + recordSpan(size) > head)
+			{
+				// Not a record boundary (e.g. a corrupt file): give up on
+				// the backlog.
+				m_lostBytes += head - m_position;
+				m_position = head;
+				return false;
+			}
+
+			m_current = m_position;
+			data_ = m_ring->span(m_position) + c_recordHeader;
+			size_ = size;
+			m_position += recordSpan(size);
+			return true;
+		}
+	}
+
+}
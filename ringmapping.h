@@ -0,0 +1,166 @@
+#pragma once
+
+// MMapper -> RingMappedFile -- Circular journal file mapped twice, back to back.
+// Author: Oliver "kfsone" Smith 2018 <oliver@kfs.org>
+// Redistribution and re-use fully permitted contingent on inclusion of these 3 lines in copied- or derived- works.
+
+#include "mmapper_platform.h"
+#include "filehandle.h"
+
+#include <atomic>
+#include <cstdint>
+
+
+namespace KFS
+{
+
+	//////////////////////////////////////////////////////////////////////
+	// Journal file layout.
+	//
+	// [RingFileHeader, padded to c_regionAlign][data: capacity bytes]
+	//
+	// Positions are absolute byte counts; the data offset is position %
+	// capacity. Records are [uint32 size][payload] padded to 8 bytes, and
+	// may wrap past the end of the data area.
+
+	struct RingFileHeader
+	{
+		static constexpr uint64_t c_magic{ 0x31474e49524b464bull };	// "KFKRING1"
+
+		//! Header size and capacity granularity: 64KB, the coarsest
+		//! mapping granularity we support (Windows), so files are portable.
+		static constexpr size_t c_regionAlign{ 64 * 1024 };
+
+		uint64_t				magic;
+		uint64_t				capacity;
+		//! Where the next record will be written.
+		std::atomic<uint64_t>	head;
+		//! The oldest record still in the ring.
+		std::atomic<uint64_t>	tail;
+	};
+
+
+	//////////////////////////////////////////////////////////////////////
+	//! @class RingMappedFile
+	//! @brief A fixed-size circular journal whose data area is mapped
+	//! twice in adjacent address ranges (a "magic ring").
+	//!
+	//! @detail span(position) returns a pointer from which up to
+	//! capacity() bytes can be read - or written - contiguously: bytes
+	//! that run off the end of the first mapping land in the second, which
+	//! is the same file data. Records that wrap never need copying or
+	//! splitting.
+	//!
+	//! A single writer append()s records, dropping the oldest ones when
+	//! the ring is full. Any number of readers, in this or other
+	//! processes, walk the records with a Cursor. head and tail live in
+	//! the file, so a journal resumes where it left off when reopened.
+	//!
+	//! RAII like MMappedFile: mapFile()/unmapFile(), and the destructor
+	//! unmaps.
+	//
+	class RingMappedFile
+	{
+		char*				m_base{ nullptr };		// start of the whole view
+		RingFileHeader*		m_header{ nullptr };
+		char*				m_data{ nullptr };
+		size_t				m_capacity{ 0 };
+		bool				m_writable{ false };
+
+	public:
+		static constexpr size_t c_recordHeader{ sizeof(uint32_t) };
+
+		//! Create (or reset) a journal file with 'capacity_' bytes of ring,
+		//! rounded up to a multiple of RingFileHeader::c_regionAlign.
+		//! @return true on success.
+		static bool create(const filename_str_t& filename_, size_t capacity_) MMAPPER_MAYBE_NOEXCEPT;
+
+		RingMappedFile() noexcept = default;
+
+		//! Map an existing journal; check isMapped() in no-throw builds.
+		explicit RingMappedFile(const filename_str_t& filename_, FileAccess access_ = FileAccess::ReadOnly) MMAPPER_MAYBE_NOEXCEPT;
+
+		~RingMappedFile() noexcept { unmapFile(); }
+
+		// Copying not allowed.
+		RingMappedFile(const RingMappedFile&) = delete;
+		RingMappedFile& operator=(const RingMappedFile&) = delete;
+
+		// Move allowed; the source is left unmapped.
+		RingMappedFile(RingMappedFile&& rhs_) noexcept;
+		RingMappedFile& operator=(RingMappedFile&& rhs_) noexcept;
+
+		//! Map a journal created with create(). ReadWrite for the writer.
+		//! @return true on success.
+		bool mapFile(const filename_str_t& filename_, FileAccess access_ = FileAccess::ReadOnly) MMAPPER_MAYBE_NOEXCEPT;
+
+		void unmapFile() noexcept;
+
+		//////////////////////////////////////////////////////////////////////
+		// Accessors.
+
+		bool isMapped() const noexcept { return m_base != nullptr; }
+		bool isWritable() const noexcept { return m_writable; }
+		size_t capacity() const noexcept { return m_capacity; }
+
+		uint64_t head() const noexcept { return m_header->head.load(std::memory_order_acquire); }
+		uint64_t tail() const noexcept { return m_header->tail.load(std::memory_order_acquire); }
+
+		//! Contiguous view of up to capacity() bytes starting at 'position_'.
+		const char* span(uint64_t position_) const noexcept { return m_data + (position_ % m_capacity); }
+		char* writableSpan(uint64_t position_) noexcept { return m_writable ? m_data + (position_ % m_capacity) : nullptr; }
+
+		//! Largest payload append() accepts.
+		size_t maxRecordSize() const noexcept { return m_capacity - 8; }
+
+		static size_t recordSpan(size_t size_) noexcept { return (c_recordHeader + size_ + 7) & ~size_t(7); }
+
+		//////////////////////////////////////////////////////////////////////
+		// Writer.
+
+		//! Append a record, discarding the oldest records to make room.
+		//! @return false if the record is too large or the view read-only.
+		bool append(const void* data_, size_t size_) noexcept;
+
+		//////////////////////////////////////////////////////////////////////
+		// Readers.
+
+		class Cursor
+		{
+			const RingMappedFile*	m_ring{ nullptr };
+			uint64_t				m_position{ 0 };
+			uint64_t				m_current{ 0 };		// start of the record last returned
+			uint64_t				m_lostBytes{ 0 };
+
+		public:
+			Cursor() noexcept = default;
+			Cursor(const RingMappedFile& ring_, uint64_t position_) noexcept : m_ring(&ring_), m_position(position_), m_current(position_) {}
+
+			//! Step to the next record. 'data_' points into the mapping and
+			//! is contiguous even if the record wraps.
+			//! @return false when there's nothing more (yet).
+			bool next(const char*& data_, size_t& size_) noexcept;
+
+			//! True if the writer hasn't overwritten the record last
+			//! returned by next(). Check after using it if a writer may
+			//! be running concurrently.
+			bool stillValid() const noexcept
+			{
+				std::atomic_thread_fence(std::memory_order_acquire);
+				return m_ring->m_header->tail.load(std::memory_order_relaxed) <= m_current;
+			}
+
+			uint64_t position() const noexcept { return m_position; }
+
+			//! Bytes of records the writer overwrote before we read them.
+			uint64_t lostBytes() const noexcept { return m_lostBytes; }
+		};
+
+		//! A cursor at the oldest record.
+		Cursor oldest() const noexcept { return Cursor(*this, tail()); }
+
+		//! A cursor that will only see records appended from now on.
+		Cursor latest() const noexcept { return Cursor(*this, head()); }
+	};
+
+}
@@ -0,0 +1,390 @@
+// MMapper -> SharedMemory -- Anonymous shareable mappings for zero-copy IPC.
+// Author: Oliver "kfsone" Smith 2018 <oliver@kfs.org>
+// Redistribution and re-use fully permitted contingent on inclusion of these 3 lines in copied- or derived- works.
+
+#include "sharedmemory.h"
+#include "internal_includes.h"
+
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <utility>
+
+#if MMAPPER_API == MMAPPER_POSIX
+# include <sys/socket.h>
+# include <sys/uio.h>
+#endif
+
+// memfd + sealing is Linux-only; everything else uses shm_open().
+#if MMAPPER_API == MMAPPER_POSIX && defined(__linux__) && defined(MFD_ALLOW_SEALING) && defined(F_ADD_SEALS)
+# define MMAPPER_HAVE_MEMFD 1
+#else
+# define MMAPPER_HAVE_MEMFD 0
+#endif
+
+
+namespace KFS
+{
+
+	static inline bool _fail(const char* reason_) MMAPPER_MAYBE_NOEXCEPT
+	{
+#ifndef MMAPPER_NO_THROW
+		throw std::runtime_error(reason_);
+#endif
+		(void)reason_;
+		return false;
+	}
+
+	static inline void _closeHandle(file_handle_t& handle_) noexcept
+	{
+		if (handle_ == INVALID_HANDLE_VALUE)
+			return;
+#if MMAPPER_API == MMAPPER_WIN32
+		CloseHandle(handle_);
+#else
+		::close(handle_);
+#endif
+		handle_ = INVALID_HANDLE_VALUE;
+	}
+
+
+	//////////////////////////////////////////////////////////////////////
+	// Lifetime.
+
+	SharedMemory::~SharedMemory() noexcept
+	{
+		close();
+	}
+
+	SharedMemory::SharedMemory(SharedMemory&& rhs_) noexcept
+		: m_handle(std::exchange(rhs_.m_handle, INVALID_HANDLE_VALUE))
+		, m_readOnlyHandle(std::exchange(rhs_.m_readOnlyHandle, INVALID_HANDLE_VALUE))
+		, m_basePtr(std::exchange(rhs_.m_basePtr, nullptr))
+		, m_size(std::exchange(rhs_.m_size, 0))
+		, m_writable(std::exchange(rhs_.m_writable, false))
+		, m_sealed(std::exchange(rhs_.m_sealed, false))
+	{
+	}
+
+	SharedMemory& SharedMemory::operator=(SharedMemory&& rhs_) noexcept
+	{
+		if (this != &rhs_)
+		{
+			close();
+			m_handle = std::exchange(rhs_.m_handle, INVALID_HANDLE_VALUE);
+			m_readOnlyHandle = std::exchange(rhs_.m_readOnlyHandle, INVALID_HANDLE_VALUE);
+			m_basePtr = std::exchange(rhs_.m_basePtr, nullptr);
+			m_size = std::exchange(rhs_.m_size, 0);
+			m_writable = std::exchange(rhs_.m_writable, false);
+			m_sealed = std::exchange(rhs_.m_sealed, false);
+		}
+		return *this;
+	}
+
+
+	void SharedMemory::close() noexcept
+	{
+		if (m_basePtr)
+		{
+#if MMAPPER_API == MMAPPER_WIN32
+			UnmapViewOfFile(m_basePtr);
+#else
+			munmap(m_basePtr, m_size);
+#endif
+		}
+		_closeHandle(m_handle);
+		_closeHandle(m_readOnlyHandle);
+		m_basePtr = nullptr;
+		m_size = 0;
+		m_writable = false;
+		m_sealed = false;
+	}
+
+
+	//////////////////////////////////////////////////////////////////////
+	// Create a new region.
+
+	bool SharedMemory::create(size_t size_, const char* name_) MMAPPER_MAYBE_NOEXCEPT
+	{
+		close();
+
+		if (size_ == 0)
+			return _fail("trying to create a zero-sized shared region");
+
+#if MMAPPER_API == MMAPPER_WIN32
+		(void)name_;
+		const uint64_t size = size_;
+		m_handle = CreateFileMapping(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE,
+									 static_cast<DWORD>(size >> 32), static_cast<DWORD>(size), NULL);
+		if (m_handle == NULL)
+		{
+			m_handle = INVALID_HANDLE_VALUE;
+			return _fail("CreateFileMapping failed");
+		}
+
+		m_basePtr = MapViewOfFile(m_handle, FILE_MAP_ALL_ACCESS, 0, 0, size_);
+		if (!m_basePtr)
+		{
+			close();
+			return _fail("MapViewOfFile failed");
+		}
+#else
+	#if MMAPPER_HAVE_MEMFD
+		m_handle = memfd_create(name_ ? name_ : "mmapper", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+		if (m_handle < 0)
+		{
+			m_handle = INVALID_HANDLE_VALUE;
+			return _fail("memfd_create failed");
+		}
+	#else
+		// shm_open wants a name; make one nobody else will guess, and
+		// remove it as soon as both our descriptors are open. macOS caps
+		// names at 31 characters, so the prefix is short and the pid and
+		// counter are hex: at most 1 + 8 + 1 + 8 + 1 + 8.
+		static std::atomic<unsigned> s_counter{ 0 };
+		char shmName[64];
+		int fd = -1;
+		for (int attempt = 0; attempt < 16; ++attempt)
+		{
+			snprintf(shmName, sizeof(shmName), "/%.8s-%lx-%x", name_ ? name_ : "mmapper",
+					 static_cast<unsigned long>(getpid()) & 0xffffffffUL, s_counter.fetch_add(1));
+			fd = shm_open(shmName, O_RDWR | O_CREAT | O_EXCL, 0600);
+			if (fd >= 0 || errno != EEXIST)
+				break;
+		}
+		if (fd < 0)
+			return _fail("shm_open failed");
+		m_handle = fd;
+		m_readOnlyHandle = shm_open(shmName, O_RDONLY, 0);
+		shm_unlink(shmName);
+		if (m_readOnlyHandle < 0)
+		{
+			m_readOnlyHandle = INVALID_HANDLE_VALUE;
+			close();
+			return _fail("shm_open (read-only) failed");
+		}
+		fcntl(m_handle, F_SETFD, FD_CLOEXEC);
+		fcntl(m_readOnlyHandle, F_SETFD, FD_CLOEXEC);
+	#endif
+
+		if (ftruncate(m_handle, static_cast<off_t>(size_)) != 0)
+		{
+			close();
+			return _fail("unable to size shared region");
+		}
+
+		void* const ptr = mmap(NULL, size_, PROT_READ | PROT_WRITE, MAP_SHARED, m_handle, 0);
+		if (ptr == MAP_FAILED)
+		{
+			close();
+			return _fail("mapping shared region failed");
+		}
+		m_basePtr = ptr;
+#endif
+
+		m_size = size_;
+		m_writable = true;
+		return true;
+	}
+
+
+	//////////////////////////////////////////////////////////////////////
+	// Map a region someone else created.
+
+	bool SharedMemory::attach(file_handle_t handle_, Access access_) MMAPPER_MAYBE_NOEXCEPT
+	{
+		close();
+		m_handle = handle_;
+		if (m_handle == INVALID_HANDLE_VALUE)
+			return _fail("attach given an invalid handle");
+
+		const bool writable = (access_ == Access::ReadWrite);
+
+#if MMAPPER_API == MMAPPER_WIN32
+		m_basePtr = MapViewOfFile(m_handle, writable ? FILE_MAP_WRITE : FILE_MAP_READ, 0, 0, 0);
+		if (!m_basePtr)
+		{
+			close();
+			return _fail("MapViewOfFile failed");
+		}
+		// Sections don't report their size; the view covers all of it.
+		MEMORY_BASIC_INFORMATION info;
+		VirtualQuery(m_basePtr, &info, sizeof(info));
+		m_size = info.RegionSize;
+#else
+		struct stat stats;
+		if (fstat(m_handle, &stats) != 0 || stats.st_size <= 0)
+		{
+			close();
+			return _fail("unable to size shared region");
+		}
+		const size_t size = static_cast<size_t>(stats.st_size);
+
+		void* const ptr = mmap(NULL, size, writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, m_handle, 0);
+		if (ptr == MAP_FAILED)
+		{
+			// EPERM/EACCES here usually means the region is sealed or the
+			// descriptor is read-only.
+			close();
+			return _fail("mapping shared region failed");
+		}
+		m_basePtr = ptr;
+		m_size = size;
+
+	#if MMAPPER_HAVE_MEMFD
+		const int seals = fcntl(m_handle, F_GET_SEALS);
+		m_sealed = seals > 0 && (seals & F_SEAL_WRITE) != 0;
+	#endif
+#endif
+
+		m_writable = writable;
+		return true;
+	}
+
+
+	//////////////////////////////////////////////////////////////////////
+	// Make the contents immutable.
+
+	bool SharedMemory::seal() MMAPPER_MAYBE_NOEXCEPT
+	{
+		if (!isMapped())
+			return _fail("sealing an unmapped shared region");
+		if (m_sealed)
+			return true;
+
+#if MMAPPER_API == MMAPPER_WIN32
+		DWORD oldProtect;
+		if (!VirtualProtect(m_basePtr, m_size, PAGE_READONLY, &oldProtect))
+			return _fail("VirtualProtect failed");
+#elif MMAPPER_HAVE_MEMFD
+		// F_SEAL_WRITE is refused while any shared writable mapping exists,
+		// including ours, and mprotect() doesn't count. Swap our view for an
+		// inaccessible placeholder (keeping the address), seal, then map the
+		// region back read-only in the same place.
+		if (mmap(m_basePtr, m_size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0) == MAP_FAILED)
+			return _fail("unable to drop writable view");
+
+		const int sealed = fcntl(m_handle, F_ADD_SEALS, F_SEAL_WRITE | F_SEAL_GROW | F_SEAL_SHRINK | F_SEAL_SEAL);
+		void* const ptr = mmap(m_basePtr, m_size, PROT_READ, MAP_SHARED | MAP_FIXED, m_handle, 0);
+		if (ptr == MAP_FAILED)
+		{
+			// We can't leave the placeholder behind pretending to be the data.
+			munmap(m_basePtr, m_size);
+			m_basePtr = nullptr;
+			close();
+			return _fail("unable to remap sealed region");
+		}
+		if (sealed != 0)
+		{
+			// Someone else still has it mapped writable (EBUSY).
+			m_writable = false;
+			return _fail("unable to seal shared region");
+		}
+#else
+		// Receivers get the read-only descriptor; all we can do beyond
+		// that is stop writing ourselves.
+		if (mprotect(m_basePtr, m_size, PROT_READ) != 0)
+			return _fail("mprotect failed");
+#endif
+
+		m_writable = false;
+		m_sealed = true;
+		return true;
+	}
+
+
+	//////////////////////////////////////////////////////////////////////
+	// Handle passing.
+
+#if MMAPPER_API == MMAPPER_WIN32
+
+	HANDLE SharedMemory::duplicateHandleFor(HANDLE targetProcess_) const noexcept
+	{
+		HANDLE duplicate = NULL;
+		if (!DuplicateHandle(GetCurrentProcess(), m_handle, targetProcess_, &duplicate, FILE_MAP_READ, FALSE, 0))
+			return NULL;
+		return duplicate;
+	}
+
+#else
+
+	bool SharedMemory::sendHandle(int socket_, file_handle_t handle_) noexcept
+	{
+		// SCM_RIGHTS needs at least one byte of real payload to ride along.
+		char payload = 'F';
+		struct iovec iov;
+		iov.iov_base = &payload;
+		iov.iov_len = 1;
+
+		union
+		{
+			char			buffer[CMSG_SPACE(sizeof(int))];
+			struct cmsghdr	align;
+		} control;
+		std::memset(&control, 0, sizeof(control));
+
+		struct msghdr msg;
+		std::memset(&msg, 0, sizeof(msg));
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+		msg.msg_control = control.buffer;
+		msg.msg_controllen = sizeof(control.buffer);
+
+		struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_RIGHTS;
+		cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+		std::memcpy(CMSG_DATA(cmsg), &handle_, sizeof(int));
+
+		ssize_t sent;
+		do
+			sent = sendmsg(socket_, &msg, 0);
+		while (sent < 0 && errno == EINTR);
+		return sent == 1;
+	}
+
+
+	file_handle_t SharedMemory::receiveHandle(int socket_) noexcept
+	{
+		char payload;
+		struct iovec iov;
+		iov.iov_base = &payload;
+		iov.iov_len = 1;
+
+		union
+		{
+			char			buffer[CMSG_SPACE(sizeof(int))];
+			struct cmsghdr	align;
+		} control;
+
+		struct msghdr msg;
+		std::memset(&msg, 0, sizeof(msg));
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+		msg.msg_control = control.buffer;
+		msg.msg_controllen = sizeof(control.buffer);
+
+		ssize_t received;
+		do
+			received = recvmsg(socket_, &msg, 0);
+		while (received < 0 && errno == EINTR);
+		if (received != 1)
+			return INVALID_HANDLE_VALUE;
+
+		for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg))
+		{
+			if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS && cmsg->cmsg_len == CMSG_LEN(sizeof(int)))
+			{
+				int fd;
+				std::memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+				fcntl(fd, F_SETFD, FD_CLOEXEC);
+				return fd;
+			}
+		}
+		return INVALID_HANDLE_VALUE;
+	}
+
+#endif
+
+}
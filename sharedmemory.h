@@ -0,0 +1,133 @@
+#pragma once
+
+// MMapper -> SharedMemory -- Anonymous shareable mappings for zero-copy IPC.
+// Author: Oliver "kfsone" Smith 2018 <oliver@kfs.org>
+// Redistribution and re-use fully permitted contingent on inclusion of these 3 lines in copied- or derived- works.
+
+#include "mmapper_platform.h"
+
+
+namespace KFS
+{
+
+	//////////////////////////////////////////////////////////////////////
+	//! @class SharedMemory
+	//! @brief RAII anonymous memory region that can be handed to other
+	//! processes by handle.
+	//!
+	//! @detail The producer create()s a region, fills it in, optionally
+	//! seal()s it and passes handle() to a consumer process, which
+	//! attach()es to it. Both sides then see the same physical pages: no
+	//! data crosses a pipe.
+	//!
+	//! Backing per platform:
+	//!  - Linux: memfd_create(). seal() applies F_SEAL_WRITE/GROW/SHRINK,
+	//!    after which nobody can change the contents or size - receivers
+	//!    can trust what they map without copying it first.
+	//!  - Other POSIX: shm_open() with a unique name that is unlinked
+	//!    immediately; handle() is a read-only descriptor opened before
+	//!    the unlink.
+	//!  - Windows: a pagefile-backed CreateFileMapping() section;
+	//!    duplicateHandleFor() produces a FILE_MAP_READ handle for the
+	//!    target process.
+	//!
+	//! Handles travel between processes with sendHandle()/receiveHandle()
+	//! (SCM_RIGHTS over a UNIX domain socket) on POSIX, or by passing the
+	//! duplicated handle's value on Windows.
+	//
+	class SharedMemory
+	{
+		//! The handle we map from.
+		file_handle_t	m_handle{ INVALID_HANDLE_VALUE };
+
+		//! Read-only handle for sharing, where the platform needs one.
+		file_handle_t	m_readOnlyHandle{ INVALID_HANDLE_VALUE };
+
+		void*			m_basePtr{ nullptr };
+		size_t			m_size{ 0 };
+		bool			m_writable{ false };
+		bool			m_sealed{ false };
+
+	public:
+		enum class Access { ReadOnly, ReadWrite };
+
+		//! Simple default CTor.
+		SharedMemory() noexcept = default;
+
+		// DTor: unmaps and closes the handles.
+		~SharedMemory() noexcept;
+
+		// Copying not allowed.
+		SharedMemory(const SharedMemory&) = delete;
+		SharedMemory& operator=(const SharedMemory&) = delete;
+
+		// Move allowed; the source is left empty.
+		SharedMemory(SharedMemory&& rhs_) noexcept;
+		SharedMemory& operator=(SharedMemory&& rhs_) noexcept;
+
+	public:
+		//! Create a new zero-filled, writable region.
+		//!
+		//! @param[in] size_ size in bytes.
+		//! @param[in] name_ [optional] debugging name (shows in /proc/pid/maps on Linux).
+		//! @return true on success.
+		bool create(size_t size_, const char* name_ = "mmapper") MMAPPER_MAYBE_NOEXCEPT;
+
+		//! Map a region received from another process. Takes ownership of
+		//! the handle, even on failure.
+		//!
+		//! @param[in] handle_ the received handle.
+		//! @param[in] access_ how to map it; sealed regions only allow ReadOnly.
+		//! @return true on success.
+		bool attach(file_handle_t handle_, Access access_ = Access::ReadOnly) MMAPPER_MAYBE_NOEXCEPT;
+
+		//! Freeze the contents: the local view becomes read-only, and where
+		//! the platform supports it, nobody can write or resize the region.
+		//! @return true on success.
+		bool seal() MMAPPER_MAYBE_NOEXCEPT;
+
+		//! Unmap the region and close the handles.
+		void close() noexcept;
+
+		//////////////////////////////////////////////////////////////////////
+		// Accessors.
+
+		bool isMapped() const noexcept { return m_basePtr != nullptr; }
+		bool isWritable() const noexcept { return m_writable; }
+		bool isSealed() const noexcept { return m_sealed; }
+		size_t size() const noexcept { return m_size; }
+
+		//! The handle to give to other processes. Still owned by us.
+		file_handle_t handle() const noexcept
+		{
+			return m_readOnlyHandle != INVALID_HANDLE_VALUE ? m_readOnlyHandle : m_handle;
+		}
+
+		//! Writable pointer to the region, or nullptr if it isn't writable.
+		void* data() noexcept { return m_writable ? m_basePtr : nullptr; }
+
+		template<typename T=char>
+		const T* begin() const noexcept { return static_cast<const T*>(m_basePtr); }
+
+		template<typename T=char>
+		const T* end() const noexcept { return reinterpret_cast<const T*>(static_cast<const char*>(m_basePtr) + m_size); }
+
+		//////////////////////////////////////////////////////////////////////
+		// Passing handles between processes.
+
+#if MMAPPER_API == MMAPPER_WIN32
+		//! Duplicate our handle into another process with read-only access.
+		//! @return the handle value, valid in the target process, to send by any IPC.
+		HANDLE duplicateHandleFor(HANDLE targetProcess_) const noexcept;
+#else
+		//! Send a descriptor over a connected UNIX domain socket.
+		//! @return true if it was sent.
+		static bool sendHandle(int socket_, file_handle_t handle_) noexcept;
+
+		//! Receive a descriptor sent with sendHandle().
+		//! @return the descriptor (now owned by the caller) or INVALID_HANDLE_VALUE.
+		static file_handle_t receiveHandle(int socket_) noexcept;
+#endif
+	};
+
+}
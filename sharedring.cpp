@@ -0,0 +1,312 @@
+// MMapper -> SharedRing -- Lock-free SPSC/MPSC record ring living in a shared mapping.
+// Author: Oliver "kfsone" Smith 2018 <oliver@kfs.org>
+// Redistribution and re-use fully permitted contingent on inclusion of these 3 lines in copied- or derived- works.
+
+#include "sharedring.h"
+
+#include <algorithm>
+#include <chrono>
+#include <new>
+#include <stdexcept>
+#include <thread>
+
+#if defined(__linux__)
+# include <linux/futex.h>
+# include <sys/syscall.h>
+# include <time.h>
+# include <unistd.h>
+# define MMAPPER_HAVE_FUTEX 1
+#else
+# define MMAPPER_HAVE_FUTEX 0
+#endif
+
+#if defined(_MSC_VER)
+# include <intrin.h>
+#endif
+
+
+namespace KFS
+{
+
+	constexpr uint32_t SharedRingRecord::c_padding;
+	constexpr uint64_t SharedRingHeader::c_magic;
+
+
+	static inline bool _fail(const char* reason_) MMAPPER_MAYBE_NOEXCEPT
+	{
+#ifndef MMAPPER_NO_THROW
+		throw std::runtime_error(reason_);
+#endif
+		(void)reason_;
+		return false;
+	}
+
+	// Polite busy-wait hint.
+	static inline void _cpuRelax() noexcept
+	{
+#if defined(_MSC_VER)
+		_mm_pause();
+#elif defined(__x86_64__) || defined(__i386__)
+		__builtin_ia32_pause();
+#elif defined(__aarch64__)
+		__asm__ __volatile__("yield");
+#endif
+	}
+
+
+	//////////////////////////////////////////////////////////////////////
+	// Setup.
+
+	bool SharedRing::initialize(void* region_, size_t regionSize_, Producers producers_) MMAPPER_MAYBE_NOEXCEPT
+	{
+		m_header = nullptr;
+		if (!region_ || regionSize_ < sizeof(SharedRingHeader) + 4096)
+			return _fail("shared ring region too small");
+
+		// Use the largest power of two that fits.
+		size_t capacity = 4096;
+		while (capacity * 2 <= regionSize_ - sizeof(SharedRingHeader))
+			capacity *= 2;
+
+		std::memset(region_, 0, sizeof(SharedRingHeader) + capacity);
+		SharedRingHeader* header = new (region_) SharedRingHeader();
+		header->capacity = capacity;
+		header->multiProducer = (producers_ == Producers::Multiple) ? 1 : 0;
+		header->reserveHead.store(0, std::memory_order_relaxed);
+		header->tail.store(0, std::memory_order_relaxed);
+		header->consumerWaiting.store(0, std::memory_order_relaxed);
+		header->wakeSequence.store(0, std::memory_order_relaxed);
+
+		// Publish the magic last: attach() in another process keys off it.
+		std::atomic_thread_fence(std::memory_order_release);
+		header->magic = SharedRingHeader::c_magic;
+
+		return attach(region_, regionSize_);
+	}
+
+
+	bool SharedRing::attach(void* region_, size_t regionSize_) MMAPPER_MAYBE_NOEXCEPT
+	{
+		m_header = nullptr;
+		if (!region_ || regionSize_ < sizeof(SharedRingHeader))
+			return _fail("shared ring region too small");
+
+		SharedRingHeader* header = static_cast<SharedRingHeader*>(region_);
+		const uint64_t capacity = header->capacity;
+		if (header->magic != SharedRingHeader::c_magic || capacity < 4096 || (capacity & (capacity - 1)) != 0
+			|| capacity > regionSize_ - sizeof(SharedRingHeader))
+		{
+			return _fail("region does not hold a shared ring");
+		}
+		std::atomic_thread_fence(std::memory_order_acquire);
+
+		m_header = header;
+		m_data = static_cast<char*>(region_) + sizeof(SharedRingHeader);
+		m_mask = capacity - 1;
+		m_multiProducer = header->multiProducer != 0;
+		m_cachedTail = header->tail.load(std::memory_order_acquire);
+		return true;
+	}
+
+
+	//////////////////////////////////////////////////////////////////////
+	// Producers.
+
+	uint64_t SharedRing::claim(size_t bytes_) noexcept
+	{
+		const uint64_t capacity = m_mask + 1;
+		uint64_t head = m_header->reserveHead.load(std::memory_order_relaxed);
+		for ( ; ; )
+		{
+			// Records must be contiguous: if this one would run off the end
+			// of the data area, the gap becomes a padding record.
+			const uint64_t toEnd = capacity - (head & m_mask);
+			const uint64_t padding = bytes_ > toEnd ? toEnd : 0;
+			const uint64_t end = head + padding + bytes_;
+
+			if (end - m_cachedTail > capacity)
+			{
+				m_cachedTail = m_header->tail.load(std::memory_order_acquire);
+				if (end - m_cachedTail > capacity)
+					return ~uint64_t(0);
+			}
+
+			if (!m_multiProducer)
+				m_header->reserveHead.store(end, std::memory_order_relaxed);
+			else if (!m_header->reserveHead.compare_exchange_weak(head, end, std::memory_order_relaxed))
+				continue;	// 'head' was reloaded by the failed exchange.
+
+			if (padding)
+			{
+				const uint32_t padSize = static_cast<uint32_t>(padding - sizeof(SharedRingRecord));
+				recordAt(head)->committed.store((padSize + 1) | SharedRingRecord::c_padding, std::memory_order_release);
+			}
+			return head + padding;
+		}
+	}
+
+
+	bool SharedRing::tryReserve(size_t size_, Reservation& reservation_) noexcept
+	{
+		if (size_ > maxRecordSize())
+			return false;
+		const uint64_t position = claim(recordSpan(size_));
+		if (position == ~uint64_t(0))
+			return false;
+
+		reservation_.data = payloadAt(position);
+		reservation_.position = position;
+		reservation_.size = size_;
+		return true;
+	}
+
+
+	bool SharedRing::tryPublish(const void* data_, size_t size_) noexcept
+	{
+		Reservation reservation;
+		if (!tryReserve(size_, reservation))
+			return false;
+		std::memcpy(reservation.data, data_, size_);
+		commit(reservation);
+		return true;
+	}
+
+
+	bool SharedRing::publish(const void* data_, size_t size_) noexcept
+	{
+		if (size_ > maxRecordSize())
+			return false;
+		for (unsigned attempt = 0; !tryPublish(data_, size_); ++attempt)
+		{
+			if (attempt < 64)
+				_cpuRelax();
+			else
+				std::this_thread::yield();
+		}
+		return true;
+	}
+
+
+	bool SharedRing::tryPublishBatch(const Buffer* records_, size_t count_) noexcept
+	{
+		size_t total = 0;
+		for (size_t i = 0; i < count_; ++i)
+			total += recordSpan(records_[i].size);
+		if (count_ == 0 || total > capacity() / 2)
+			return false;
+
+		// One claim for the whole batch; records are laid out back to back.
+		const uint64_t start = claim(total);
+		if (start == ~uint64_t(0))
+			return false;
+
+		uint64_t position = start;
+		for (size_t i = 0; i < count_; ++i)
+		{
+			std::memcpy(payloadAt(position), records_[i].data, records_[i].size);
+			position += recordSpan(records_[i].size);
+		}
+
+		// Publish back to front: the consumer can't get past the first
+		// record until it's committed, so it sees the batch in one go.
+		size_t index = count_;
+		while (index-- > 0)
+		{
+			position -= recordSpan(records_[index].size);
+			publishRecord(position, records_[index].size);
+		}
+
+		wakeConsumer();
+		return true;
+	}
+
+
+	//////////////////////////////////////////////////////////////////////
+	// Sleeping and waking.
+
+#if MMAPPER_HAVE_FUTEX
+	static inline void _futexWait(std::atomic<uint32_t>* word_, uint32_t expected_, uint32_t timeoutMs_) noexcept
+	{
+		struct timespec timeout;
+		timeout.tv_sec = timeoutMs_ / 1000;
+		timeout.tv_nsec = static_cast<long>(timeoutMs_ % 1000) * 1000000L;
+		// Not FUTEX_PRIVATE_FLAG: the word is shared with other processes.
+		syscall(SYS_futex, reinterpret_cast<uint32_t*>(word_), FUTEX_WAIT, expected_, &timeout, nullptr, 0);
+	}
+
+	static inline void _futexWake(std::atomic<uint32_t>* word_) noexcept
+	{
+		syscall(SYS_futex, reinterpret_cast<uint32_t*>(word_), FUTEX_WAKE, 1, nullptr, nullptr, 0);
+	}
+#endif
+
+
+	void SharedRing::wakeConsumer() noexcept
+	{
+		// Pairs with the fence in waitForData(): either the consumer sees
+		// our record, or we see that it is going to sleep.
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if (m_header->consumerWaiting.load(std::memory_order_relaxed) == 0)
+			return;
+
+		m_header->wakeSequence.fetch_add(1, std::memory_order_release);
+#if MMAPPER_HAVE_FUTEX
+		_futexWake(&m_header->wakeSequence);
+#endif
+	}
+
+
+	bool SharedRing::waitForData(uint32_t timeoutMs_) noexcept
+	{
+		// A short spin catches producers that are mid-publish.
+		for (int spin = 0; spin < 128; ++spin)
+		{
+			if (hasData())
+				return true;
+			_cpuRelax();
+		}
+
+		m_header->consumerWaiting.store(1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		const uint32_t sequence = m_header->wakeSequence.load(std::memory_order_acquire);
+		if (!hasData())
+		{
+#if MMAPPER_HAVE_FUTEX
+			_futexWait(&m_header->wakeSequence, sequence, timeoutMs_);
+#else
+			// No cross-process wait primitive: back off from 50us to 1ms.
+			(void)sequence;
+			const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs_);
+			auto backoff = std::chrono::microseconds(50);
+			while (!hasData() && std::chrono::steady_clock::now() < deadline)
+			{
+				std::this_thread::sleep_for(backoff);
+				backoff = std::min(backoff * 2, std::chrono::microseconds(1000));
+			}
+#endif
+		}
+		m_header->consumerWaiting.store(0, std::memory_order_relaxed);
+
+		return hasData();
+	}
+
+
+	//////////////////////////////////////////////////////////////////////
+	// Consumer.
+
+	void SharedRing::release(uint64_t from_, uint64_t to_) noexcept
+	{
+		// Zero what we consumed so that every header a producer hasn't
+		// committed yet reads as 0, then hand the space back.
+		const uint64_t capacity = m_mask + 1;
+		const uint64_t offset = from_ & m_mask;
+		const uint64_t length = to_ - from_;
+		const uint64_t first = std::min(length, capacity - offset);
+		std::memset(m_data + offset, 0, static_cast<size_t>(first));
+		if (length > first)
+			std::memset(m_data, 0, static_cast<size_t>(length - first));
+
+		m_header->tail.store(to_, std::memory_order_release);
+	}
+
+}
@@ -0,0 +1,242 @@
+#pragma once
+
+// MMapper -> SharedRing -- Lock-free SPSC/MPSC record ring living in a shared mapping.
+// Author: Oliver "kfsone" Smith 2018 <oliver@kfs.org>
+// Redistribution and re-use fully permitted contingent on inclusion of these 3 lines in copied- or derived- works.
+
+#include "mmapper_platform.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+
+
+namespace KFS
+{
+
+	// The ring is shared between processes, so its atomics must not fall
+	// back to (process-local) locks.
+	static_assert(ATOMIC_LLONG_LOCK_FREE == 2 && ATOMIC_INT_LOCK_FREE == 2,
+				  "SharedRing requires lock-free 32 and 64 bit atomics");
+
+
+	//////////////////////////////////////////////////////////////////////
+	// Shared layout.
+	//
+	// [SharedRingHeader][data area of 'capacity' bytes]
+	//
+	// Every counter is an absolute byte position; the data offset is the
+	// position masked by capacity - 1. Each group of fields that a
+	// different party writes sits on its own cache line.
+	//
+	// Records are [SharedRingRecord][payload] padded to 8 bytes. A record
+	// is published by the release-store of its 'committed' word, so the
+	// consumer never sees a half-written payload. A record that wouldn't
+	// fit before the end of the data area is preceded by a padding record
+	// that fills the gap. The consumer zeroes what it has consumed before
+	// handing the space back, so an uncommitted header always reads zero.
+
+	struct SharedRingRecord
+	{
+		static constexpr uint32_t c_padding{ 0x80000000u };
+
+		//! payload size + 1, with c_padding set for padding records; 0 until published.
+		std::atomic<uint32_t>	committed;
+		uint32_t				reserved;
+	};
+
+	struct SharedRingHeader
+	{
+		static constexpr uint64_t c_magic{ 0x31474e4952534b46ull };	// "FKSRING1"
+
+		alignas(64) uint64_t		magic;
+		uint64_t					capacity;
+		uint32_t					multiProducer;
+
+		//! Producers claim space by advancing this.
+		alignas(64) std::atomic<uint64_t>	reserveHead;
+
+		//! The consumer hands space back by advancing this.
+		alignas(64) std::atomic<uint64_t>	tail;
+
+		//! Consumer sleep/wake: set while the consumer is (about to be) asleep,
+		//! and the futex word producers bump to wake it.
+		alignas(64) std::atomic<uint32_t>	consumerWaiting;
+		std::atomic<uint32_t>				wakeSequence;
+	};
+
+
+	//////////////////////////////////////////////////////////////////////
+	//! @class SharedRing
+	//! @brief Variable-length record channel between processes that only
+	//! enters the kernel when the consumer has run out of work.
+	//!
+	//! @detail The ring lives entirely inside a caller-provided region -
+	//! normally a SharedMemory mapping - which one process initialize()s
+	//! and the others attach() to. Each process, and each producer thread
+	//! within a process, uses its own SharedRing object over the region.
+	//!
+	//! Producers: any number (Producers::Multiple) or exactly one
+	//! (Producers::Single, which replaces a CAS with a store). Publishing
+	//! never blocks in the kernel; a full ring makes tryPublish() fail and
+	//! publish() spin/yield.
+	//!
+	//! Consumer: exactly one. consume() drains whatever is available in a
+	//! batch and releases the space with a single store; waitForData()
+	//! sleeps on a futex (Linux) or backs off (elsewhere) when idle, and
+	//! producers only issue a wake syscall when it's actually asleep.
+	//
+	class SharedRing
+	{
+		SharedRingHeader*	m_header{ nullptr };
+		char*				m_data{ nullptr };
+		uint64_t			m_mask{ 0 };
+		bool				m_multiProducer{ false };
+
+		//! Producer-side cache of the consumer's tail, so producers only
+		//! touch the consumer's cache line when the ring looks full.
+		uint64_t			m_cachedTail{ 0 };
+
+	public:
+		enum class Producers { Single, Multiple };
+
+		//! One record for tryPublishBatch().
+		struct Buffer
+		{
+			const void*	data;
+			size_t		size;
+		};
+
+		//! A claimed-but-unpublished record from reserve().
+		struct Reservation
+		{
+			void*		data{ nullptr };
+			uint64_t	position{ 0 };
+			size_t		size{ 0 };
+		};
+
+		SharedRing() noexcept = default;
+
+		//! Bytes of region required for a ring with 'capacity_' bytes of data.
+		//! capacity_ must be a power of two, at least 4KB.
+		static size_t regionSize(size_t capacity_) noexcept { return sizeof(SharedRingHeader) + capacity_; }
+
+		//! Format a zero-filled region as an empty ring (creator side).
+		//! @return true on success.
+		bool initialize(void* region_, size_t regionSize_, Producers producers_) MMAPPER_MAYBE_NOEXCEPT;
+
+		//! Join a ring another process initialized.
+		//! @return true if the region holds a valid ring.
+		bool attach(void* region_, size_t regionSize_) MMAPPER_MAYBE_NOEXCEPT;
+
+		bool isValid() const noexcept { return m_header != nullptr; }
+		size_t capacity() const noexcept { return static_cast<size_t>(m_mask + 1); }
+
+		//! Largest payload a single record can carry: half the ring, and
+		//! small enough for its size + 1 to stay clear of c_padding.
+		size_t maxRecordSize() const noexcept
+		{
+			return std::min<size_t>(capacity() / 2 - sizeof(SharedRingRecord), SharedRingRecord::c_padding - 2);
+		}
+
+		//////////////////////////////////////////////////////////////////////
+		// Producer API.
+
+		//! Claim space for a record and get a pointer to write it in place.
+		//! @return false if the ring is full or the record too large.
+		bool tryReserve(size_t size_, Reservation& reservation_) noexcept;
+
+		//! Publish a reserved record and wake the consumer if it sleeps.
+		void commit(const Reservation& reservation_) noexcept
+		{
+			publishRecord(reservation_.position, reservation_.size);
+			wakeConsumer();
+		}
+
+		//! Copy one record in.
+		//! @return false if the ring is full or the record too large.
+		bool tryPublish(const void* data_, size_t size_) noexcept;
+
+		//! Copy one record in, waiting (spin, then yield) for space.
+		//! @return false only if the record can never fit.
+		bool publish(const void* data_, size_t size_) noexcept;
+
+		//! Copy several records in with one space claim and one wake check.
+		//! All or nothing.
+		//! @return false if the batch doesn't fit right now.
+		bool tryPublishBatch(const Buffer* records_, size_t count_) noexcept;
+
+		//////////////////////////////////////////////////////////////////////
+		// Consumer API.
+
+		//! Deliver available records to fn(const char* data, size_t size), in
+		//! order, then release their space in one step. Record pointers are
+		//! only valid during the callback.
+		//! @return number of records delivered.
+		template<typename Fn>
+		size_t consume(Fn&& fn_, size_t maxRecords_ = std::numeric_limits<size_t>::max())
+		{
+			const uint64_t start = m_header->tail.load(std::memory_order_relaxed);
+			uint64_t position = start;
+			size_t delivered = 0;
+			// Space isn't zeroed until release(), so stop short of a full lap.
+			while (delivered < maxRecords_ && position - start < m_mask)
+			{
+				SharedRingRecord* const record = recordAt(position);
+				const uint32_t committed = record->committed.load(std::memory_order_acquire);
+				if (committed == 0)
+					break;
+
+				const size_t size = (committed & ~SharedRingRecord::c_padding) - 1;
+				if (!(committed & SharedRingRecord::c_padding))
+				{
+					fn_(static_cast<const char*>(payloadAt(position)), size);
+					++delivered;
+				}
+				position += recordSpan(size);
+			}
+			if (position != start)
+				release(start, position);
+			return delivered;
+		}
+
+		//! True if consume() would deliver something right now.
+		bool hasData() const noexcept
+		{
+			return recordAt(m_header->tail.load(std::memory_order_relaxed))->committed.load(std::memory_order_acquire) != 0;
+		}
+
+		//! Sleep until a record is available or the timeout passes.
+		//! @return true if there is data.
+		bool waitForData(uint32_t timeoutMs_) noexcept;
+
+	private:
+		static size_t recordSpan(size_t size_) noexcept { return (sizeof(SharedRingRecord) + size_ + 7) & ~size_t(7); }
+
+		SharedRingRecord* recordAt(uint64_t position_) const noexcept
+		{
+			return reinterpret_cast<SharedRingRecord*>(m_data + (position_ & m_mask));
+		}
+
+		//! The payload that follows the record header at 'position_'.
+		char* payloadAt(uint64_t position_) const noexcept
+		{
+			return m_data + (position_ & m_mask) + sizeof(SharedRingRecord);
+		}
+
+		//! Claim 'bytes_' of contiguous space (plus leading padding if needed).
+		//! @return the position of the contiguous space, or ~0 if full.
+		uint64_t claim(size_t bytes_) noexcept;
+
+		void publishRecord(uint64_t position_, size_t size_) noexcept
+		{
+			recordAt(position_)->committed.store(static_cast<uint32_t>(size_ + 1), std::memory_order_release);
+		}
+
+		void wakeConsumer() noexcept;
+		void release(uint64_t from_, uint64_t to_) noexcept;
+	};
+
+}
@@ -0,0 +1,110 @@
+// MMapper -> StreamScan -- Walk a mapping in windows without flooding the page cache.
+// Author: Oliver "kfsone" Smith 2018 <oliver@kfs.org>
+// Redistribution and re-use fully permitted contingent on inclusion of these 3 lines in copied- or derived- works.
+
+#include "streamscan.h"
+#include "addressspace.h"
+#include "mmapper.h"
+#include "internal_includes.h"
+
+#include <algorithm>
+#include <cstdint>
+
+
+namespace KFS
+{
+
+	StreamScan::StreamScan(const char* begin_, size_t size_, const filename_str_t& filename_, StreamScanOptions options_) noexcept
+		: m_begin(begin_)
+		, m_size(size_)
+		, m_options(options_)
+		, m_file(filename_)
+	{
+		const size_t page = AddressRange::pageSize();
+		m_options.window = std::max<size_t>((m_options.window + page - 1) & ~(page - 1), page);
+	}
+
+	StreamScan::StreamScan(const MMappedFile& file_, StreamScanOptions options_) noexcept
+		: StreamScan(file_.begin(), file_.size(), file_.filename(), options_)
+	{
+	}
+
+
+	//////////////////////////////////////////////////////////////////////
+	// Advance.
+
+	bool StreamScan::next(const char*& from_, const char*& to_) noexcept
+	{
+		if (m_position >= m_size)
+			return false;
+
+		const size_t window = m_options.window;
+		const size_t keep = m_options.keepBehind * window;
+		if (m_position > keep)
+			_release(m_position - keep);
+
+		const size_t ahead = std::min(m_size, m_position + (m_options.readAhead + 1) * window);
+		if (ahead > m_advised)
+		{
+#if MMAPPER_API != MMAPPER_WIN32
+			const size_t page = AddressRange::pageSize();
+			const uintptr_t start = reinterpret_cast<uintptr_t>(m_begin + m_advised) & ~uintptr_t(page - 1);
+			madvise(reinterpret_cast<void*>(start), reinterpret_cast<uintptr_t>(m_begin + ahead) - start, MADV_WILLNEED);
+#endif
+			m_advised = ahead;
+		}
+
+		from_ = m_begin + m_position;
+		m_position = std::min(m_position + window, m_size);
+		to_ = m_begin + m_position;
+		return true;
+	}
+
+	void StreamScan::finish() noexcept
+	{
+		// Include anything read ahead that we never got to.
+		_release(std::max(m_position, m_advised));
+		m_position = m_size;
+	}
+
+
+	//////////////////////////////////////////////////////////////////////
+	// Let go of [m_released, upTo_).
+
+	void StreamScan::_release(size_t upTo_) noexcept
+	{
+		if (upTo_ <= m_released)
+			return;
+
+		// Only whole pages inside the range.
+		const size_t page = AddressRange::pageSize();
+		const uintptr_t start = (reinterpret_cast<uintptr_t>(m_begin + m_released) + page - 1) & ~uintptr_t(page - 1);
+		const uintptr_t end = upTo_ >= m_size
+							? (reinterpret_cast<uintptr_t>(m_begin + m_size) + page - 1) & ~uintptr_t(page - 1)
+							: reinterpret_cast<uintptr_t>(m_begin + upTo_) & ~uintptr_t(page - 1);
+		if (end > start)
+		{
+			void* const addr = reinterpret_cast<void*>(start);
+			const size_t length = end - start;
+#if MMAPPER_API == MMAPPER_WIN32
+			// Unlocking pages that aren't locked trims them from the working set.
+			VirtualUnlock(addr, length);
+#else
+# if defined(MADV_COLD)
+			madvise(addr, length, MADV_COLD);
+# endif
+			madvise(addr, length, MADV_DONTNEED);
+# if defined(POSIX_FADV_DONTNEED)
+			// Now that we no longer map them, the cache can let them go.
+			if (m_options.dropFromCache && m_file.isValid())
+			{
+				const off_t offset = static_cast<off_t>(start - reinterpret_cast<uintptr_t>(m_begin));
+				posix_fadvise(m_file, offset, static_cast<off_t>(length), POSIX_FADV_DONTNEED);
+			}
+# endif
+#endif
+		}
+		m_released = upTo_;
+	}
+
+}
@@ -0,0 +1,111 @@
+#pragma once
+
+// MMapper -> StreamScan -- Walk a mapping in windows without flooding the page cache.
+// Author: Oliver "kfsone" Smith 2018 <oliver@kfs.org>
+// Redistribution and re-use fully permitted contingent on inclusion of these 3 lines in copied- or derived- works.
+
+#include "mmapper_platform.h"
+#include "filehandle.h"
+
+#include <cstddef>
+
+
+namespace KFS
+{
+
+	class MMappedFile;
+
+	//! How StreamScan paces its advice.
+	struct StreamScanOptions
+	{
+		//! Bytes per window; rounded up to whole pages.
+		size_t	window{ 8 * 1024 * 1024 };
+		//! Windows to ask the OS to read ahead of the current one.
+		size_t	readAhead{ 2 };
+		//! Windows to keep behind the current one before releasing them,
+		//! so a record that straddles a boundary can still be looked at.
+		size_t	keepBehind{ 1 };
+		//! Also drop released pages from the page cache, not just from
+		//! our mapping.
+		bool	dropFromCache{ true };
+	};
+
+
+	//////////////////////////////////////////////////////////////////////
+	//! @class StreamScan
+	//! @brief One sequential pass over a mapping that leaves memory (and
+	//! the page cache) roughly as it found it.
+	//!
+	//! @detail Scanning a huge file through a mapping pulls every page
+	//! into our resident set and into the page cache, evicting whatever
+	//! else was hot. StreamScan hands the mapping out a window at a time,
+	//! asking for WILLNEED readahead in front and, behind:
+	//!  - MADV_COLD, so pages other processes also map go to the back of
+	//!    the LRU,
+	//!  - MADV_DONTNEED, dropping them from our resident set,
+	//!  - posix_fadvise(DONTNEED), dropping them from the page cache.
+	//! Resident memory stays around (readAhead + keepBehind + 1) windows,
+	//! whatever the file size.
+	//!
+	//! Released pages are still mapped: touching them again just faults
+	//! them back in, so correctness never depends on the advice.
+	//!
+	//! On Windows, released windows are trimmed from the working set with
+	//! VirtualUnlock; there is no readahead advice.
+	//
+	class StreamScan
+	{
+		const char*			m_begin{ nullptr };
+		size_t				m_size{ 0 };
+		StreamScanOptions	m_options{};
+		FileHandle			m_file;				// for fadvise; may be invalid
+		size_t				m_position{ 0 };	// start of the next window
+		size_t				m_advised{ 0 };		// readahead requested up to here
+		size_t				m_released{ 0 };	// released up to here
+
+		void _release(size_t upTo_) noexcept;
+
+	public:
+		//! Scan [begin_, begin_ + size_), which must be a mapping of
+		//! 'filename_' starting at offset 0. Without a filename, pages are
+		//! only released from the mapping, not from the page cache.
+		StreamScan(const char* begin_, size_t size_, const filename_str_t& filename_ = filename_str_t{}, StreamScanOptions options_ = StreamScanOptions{}) noexcept;
+
+		//! Scan all of 'file_'.
+		explicit StreamScan(const MMappedFile& file_, StreamScanOptions options_ = StreamScanOptions{}) noexcept;
+
+		StreamScan(const StreamScan&) = delete;
+		StreamScan& operator=(const StreamScan&) = delete;
+
+		//! Releases the last windows.
+		~StreamScan() noexcept { finish(); }
+
+		//! Step to the next window, releasing the ones that have fallen
+		//! behind and advising the ones ahead.
+		//! @return false at the end of the mapping.
+		bool next(const char*& from_, const char*& to_) noexcept;
+
+		//! Release everything scanned so far (no more calls to next()).
+		void finish() noexcept;
+
+		//! Call 'consumer_(from, to)' for each window until it returns
+		//! false or the mapping ends.
+		//! @return true if the whole mapping was scanned.
+		template<typename Consumer>
+		bool scan(Consumer&& consumer_)
+		{
+			const char* from;
+			const char* to;
+			while (next(from, to))
+			{
+				if (!consumer_(from, to))
+					return false;
+			}
+			return true;
+		}
+
+		size_t position() const noexcept { return m_position; }
+		size_t window() const noexcept { return m_options.window; }
+	};
+
+}